@@ -4,7 +4,10 @@
 uniform sampler2D DiffuseMap, NormalMap, SpecularMap, ShininessMap;
 uniform sampler2D AmbientMap, EmissiveMap, ReflectionMap;
 uniform sampler2D LightParameterMap;  // (r0: col+type, r1: pos+att1, r2: dir+att0, r3: spotProp)
-uniform vec2 LightNumber;  // (num, max_num)
+uniform sampler2D LightClusterMap, LightIndexMap;  // cluster: (offset, count), index: 4 ids per texel
+uniform vec3 LightClusterGrid;  // (tiles_x, tiles_y, depth_slices)
+uniform vec2 InvScreenResolution, LightNumber;  // (num, max_num)
+uniform vec2 LightTableSize, LightClusterDepth;  // (param_rows, index_rows), (near, far)
 VERSE_FS_IN vec4 texCoord0, texCoord1, color, eyeVertex;
 VERSE_FS_IN vec3 eyeNormal, eyeTangent, eyeBinormal;
 VERSE_FS_OUT vec4 fragData;
@@ -34,14 +37,34 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 int getLightAttributes(in float id, out vec3 color, out vec3 pos, out vec3 dir,
                        out float range, out float spotCutoff)
 {
-    const vec2 halfP = vec2(0.5 / 1024.0, 0.5 / 4.0), step = vec2(1.0 / 1024.0, 1.0 / 4.0);
-    vec4 attr0 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 0.0 * step.y)); // color, type
-    vec4 attr1 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 1.0 * step.y)); // pos, att
-    vec4 attr2 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 2.0 * step.y)); // dir, spot
+    float column = mod(id, 1024.0), row = floor(id / 1024.0) * 4.0;
+    vec2 uv = vec2((column + 0.5) / 1024.0, (row + 0.5) / LightTableSize.x), step = vec2(0.0, 1.0 / LightTableSize.x);
+    vec4 attr0 = VERSE_TEX2D(LightParameterMap, uv); // color, type
+    vec4 attr1 = VERSE_TEX2D(LightParameterMap, uv + step); // pos, att
+    vec4 attr2 = VERSE_TEX2D(LightParameterMap, uv + step * 2.0); // dir, spot
     color = attr0.xyz; pos = attr1.xyz; dir = attr2.xyz; range = attr1.w;
     spotCutoff = attr2.w; return int(attr0.w);
 }
 
+vec2 getLightCluster(in vec2 uv, in float depth)
+{
+    vec2 tile = clamp(floor(uv * LightClusterGrid.xy), vec2(0.0), LightClusterGrid.xy - vec2(1.0));
+    float slice = (depth > LightClusterDepth.x) ? floor(log(depth / LightClusterDepth.x) * LightClusterGrid.z
+                / log(LightClusterDepth.y / LightClusterDepth.x)) : 0.0;
+    slice = clamp(slice, 0.0, LightClusterGrid.z - 1.0);
+
+    float numTiles = LightClusterGrid.x * LightClusterGrid.y, cluster = tile.x + tile.y * LightClusterGrid.x;
+    return VERSE_TEX2D(LightClusterMap, vec2((cluster + 0.5) / numTiles, (slice + 0.5) / LightClusterGrid.z)).xy;
+}
+
+float getClusterLightIndex(in float index)
+{
+    float texel = floor(index / 4.0), channel = index - texel * 4.0;
+    vec2 uv = vec2((mod(texel, 1024.0) + 0.5) / 1024.0, (floor(texel / 1024.0) + 0.5) / LightTableSize.y);
+    vec4 ids = VERSE_TEX2D(LightIndexMap, uv);
+    return dot(ids, vec4(equal(vec4(channel), vec4(0.0, 1.0, 2.0, 3.0))));
+}
+
 void main()
 {
     vec2 uv0 = texCoord0.xy, uv1 = texCoord1.xy;
@@ -55,7 +78,11 @@ void main()
     vec3 eyeNormal2 = eyeNormal;
     if (normalValue.a > 0.1)
     {
-        vec3 tsNormal = normalize(2.0 * normalValue.rgb - vec3(1.0));
+        // Two-channel (RG/BC5) normal maps read blue as 0, which never happens for tangent-space
+        // normals (z >= 0), so reconstruct Z from XY then
+        vec3 tsNormal = 2.0 * normalValue.rgb - vec3(1.0);
+        if (normalValue.b < 0.01) tsNormal.z = sqrt(max(1.0 - dot(tsNormal.xy, tsNormal.xy), 0.0));
+        tsNormal = normalize(tsNormal);
         eyeNormal2 = normalize(mat3(eyeTangent, eyeBinormal, eyeNormal) * tsNormal);
     }
 
@@ -69,13 +96,15 @@ void main()
     // if it's a metal, use the albedo color as F0 (metallic workflow)
     vec3 F0 = mix(vec3(0.04), albedo, metallic), radianceOut = vec3(0.0);
 
-    // Compute direcional lights
+    // Compute direcional/point/spot lights of current cluster (tile from window coordinates)
     vec3 lightColor, lightPos, lightDir; float lightRange = 0.0, lightSpot = 0.0;
-    int numLights = int(min(LightNumber.x, LightNumber.y));
+    vec2 cluster = getLightCluster(gl_FragCoord.xy * InvScreenResolution, -eyeVertex.z / eyeVertex.w);
+    int numLights = int(min(cluster.y, LightNumber.y));
     for (int i = 0; i < maxLights; ++i)
     {
         if (numLights <= i) break;  // to avoid 'WebGL: Loop index cannot be compared with non-constant expression'
-        int type = getLightAttributes(float(i), lightColor, lightPos, lightDir, lightRange, lightSpot);
+        float lightID = getClusterLightIndex(cluster.x + float(i));
+        int type = getLightAttributes(lightID, lightColor, lightPos, lightDir, lightRange, lightSpot);
         if (type == 1)
         {
             //radianceOut += computeDirectionalLight(
@@ -27,7 +27,11 @@ void main()
     vec3 eyeNormal2 = eyeNormal;
     if (normalValue.a > 0.1)
     {
-        vec3 tsNormal = normalize(2.0 * normalValue.rgb - vec3(1.0));
+        // Two-channel (RG/BC5) normal maps read blue as 0, which never happens for tangent-space
+        // normals (z >= 0), so reconstruct Z from XY then
+        vec3 tsNormal = 2.0 * normalValue.rgb - vec3(1.0);
+        if (normalValue.b < 0.01) tsNormal.z = sqrt(max(1.0 - dot(tsNormal.xy, tsNormal.xy), 0.0));
+        tsNormal = normalize(tsNormal);
         eyeNormal2 = normalize(mat3(eyeTangent, eyeBinormal, eyeNormal) * tsNormal);
     }
 
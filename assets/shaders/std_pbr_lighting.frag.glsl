@@ -3,8 +3,11 @@
 uniform sampler2D BrdfLutBuffer, PrefilterBuffer, IrradianceBuffer;
 uniform sampler2D NormalBuffer, DepthBuffer, DiffuseMetallicBuffer, SpecularRoughnessBuffer;
 uniform sampler2D LightParameterMap;  // (r0: col+type, r1: pos+att1, r2: dir+att0, r3: spotProp)
+uniform sampler2D LightClusterMap, LightIndexMap;  // cluster: (offset, count), index: 4 ids per texel
 uniform mat4 GBufferMatrices[4];  // w2v, v2w, v2p, p2v
+uniform vec3 LightClusterGrid;  // (tiles_x, tiles_y, depth_slices)
 uniform vec2 InvScreenResolution, LightNumber;  // (num, max_num)
+uniform vec2 LightTableSize, LightClusterDepth;  // (param_rows, index_rows), (near, far)
 VERSE_FS_IN vec4 texCoord0;
 
 #ifdef VERSE_GLES3
@@ -37,14 +40,34 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 int getLightAttributes(in float id, out vec3 color, out vec3 pos, out vec3 dir,
                        out float range, out float spotCutoff)
 {
-    const vec2 halfP = vec2(0.5 / 1024.0, 0.5 / 4.0), step = vec2(1.0 / 1024.0, 1.0 / 4.0);
-    vec4 attr0 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 0.0 * step.y)); // color, type
-    vec4 attr1 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 1.0 * step.y)); // pos, att
-    vec4 attr2 = VERSE_TEX2D(LightParameterMap, halfP + vec2(id * step.x, 2.0 * step.y)); // dir, spot
+    float column = mod(id, 1024.0), row = floor(id / 1024.0) * 4.0;
+    vec2 uv = vec2((column + 0.5) / 1024.0, (row + 0.5) / LightTableSize.x), step = vec2(0.0, 1.0 / LightTableSize.x);
+    vec4 attr0 = VERSE_TEX2D(LightParameterMap, uv); // color, type
+    vec4 attr1 = VERSE_TEX2D(LightParameterMap, uv + step); // pos, att
+    vec4 attr2 = VERSE_TEX2D(LightParameterMap, uv + step * 2.0); // dir, spot
     color = attr0.xyz; pos = attr1.xyz; dir = attr2.xyz; range = attr1.w;
     spotCutoff = attr2.w; return int(attr0.w);
 }
 
+vec2 getLightCluster(in vec2 uv, in float depth)
+{
+    vec2 tile = clamp(floor(uv * LightClusterGrid.xy), vec2(0.0), LightClusterGrid.xy - vec2(1.0));
+    float slice = (depth > LightClusterDepth.x) ? floor(log(depth / LightClusterDepth.x) * LightClusterGrid.z
+                / log(LightClusterDepth.y / LightClusterDepth.x)) : 0.0;
+    slice = clamp(slice, 0.0, LightClusterGrid.z - 1.0);
+
+    float numTiles = LightClusterGrid.x * LightClusterGrid.y, cluster = tile.x + tile.y * LightClusterGrid.x;
+    return VERSE_TEX2D(LightClusterMap, vec2((cluster + 0.5) / numTiles, (slice + 0.5) / LightClusterGrid.z)).xy;
+}
+
+float getClusterLightIndex(in float index)
+{
+    float texel = floor(index / 4.0), channel = index - texel * 4.0;
+    vec2 uv = vec2((mod(texel, 1024.0) + 0.5) / 1024.0, (floor(texel / 1024.0) + 0.5) / LightTableSize.y);
+    vec4 ids = VERSE_TEX2D(LightIndexMap, uv);
+    return dot(ids, vec4(equal(vec4(channel), vec4(0.0, 1.0, 2.0, 3.0))));
+}
+
 void main()
 {
     vec2 uv0 = texCoord0.xy;
@@ -69,13 +92,15 @@ void main()
     // if it's a metal, use the albedo color as F0 (metallic workflow)
     vec3 F0 = mix(vec3(0.04), albedo, metallic), radianceOut = vec3(0.0);
 
-    // Compute direcional lights
+    // Compute direcional/point/spot lights of current cluster
     vec3 lightColor, lightPos, lightDir; float lightRange = 0.0, lightSpot = 0.0;
-    int numLights = int(min(LightNumber.x, LightNumber.y));
+    vec2 cluster = getLightCluster(uv0, -eyeVertex.z / eyeVertex.w);  // (offset, count)
+    int numLights = int(min(cluster.y, LightNumber.y));
     for (int i = 0; i < maxLights; ++i)
     {
         if (numLights <= i) break;  // to avoid 'WebGL: Loop index cannot be compared with non-constant expression'
-        int type = getLightAttributes(float(i), lightColor, lightPos, lightDir, lightRange, lightSpot);
+        float lightID = getClusterLightIndex(cluster.x + float(i));
+        int type = getLightAttributes(lightID, lightColor, lightPos, lightDir, lightRange, lightSpot);
         if (type == 1)
         {
             //radianceOut += computeDirectionalLight(
@@ -4,11 +4,12 @@ uniform sampler2D NormalBuffer, DepthBuffer, RandomTexture;
 uniform mat4 GBufferMatrices[4];  // w2v, v2w, v2p, p2v
 uniform vec2 NearFarPlanes, InvScreenResolution;
 uniform float AORadius, AOBias, AOPowExponent;
+uniform float AONumDirections, AONumSteps;  // 0 to use maximum values below
 VERSE_FS_IN vec4 texCoord0;
 VERSE_FS_OUT vec4 fragData;
 
-const float NUM_STEPS = 4.0;
-const float NUM_DIRECTIONS = 8.0;
+const float NUM_STEPS = 4.0;       // maximum steps
+const float NUM_DIRECTIONS = 8.0;  // maximum directions
 float projScale = 1.0 / (tan((M_PI * 0.25) * 0.5) * 2.0);
 float negInvR2 = 0.0, radiusToScreen = 0.0, AOMultiplier = 0.0;
 
@@ -70,11 +71,16 @@ float computeAO(vec3 P, vec3 N, vec3 S)
 
 float computeCoarseAO(vec2 fullResUV, float radiusPixels, vec4 rand, vec3 viewPosition, vec3 viewNormal)
 {
-    // Divide by NUM_STEPS+1 so that the farthest samples are not fully attenuated
-    float stepSizePixels = radiusPixels / (NUM_STEPS + 1.0), AO = 0.0;
-    const float alpha = 2.0 * M_PI / NUM_DIRECTIONS;
+    // Sample counts may be lowered at runtime, but loops must keep constant bounds for GLES2
+    float numDirections = (AONumDirections > 0.0) ? min(AONumDirections, NUM_DIRECTIONS) : NUM_DIRECTIONS;
+    float numSteps = (AONumSteps > 0.0) ? min(AONumSteps, NUM_STEPS) : NUM_STEPS;
+
+    // Divide by numSteps+1 so that the farthest samples are not fully attenuated
+    float stepSizePixels = radiusPixels / (numSteps + 1.0), AO = 0.0;
+    float alpha = 2.0 * M_PI / numDirections;
     for (float directionIndex = 0.0; directionIndex < NUM_DIRECTIONS; ++directionIndex)
     {
+        if (directionIndex >= numDirections) break;
         // Compute normalized 2D direction
         float angle = alpha * directionIndex;
         vec2 direction = rotateDirection(vec2(cos(angle), sin(angle)), rand.xy);
@@ -83,12 +89,13 @@ float computeCoarseAO(vec2 fullResUV, float radiusPixels, vec4 rand, vec3 viewPo
         float rayPixels = (rand.z * stepSizePixels + 1.0);
         for (float stepIndex = 0.0; stepIndex < NUM_STEPS; ++stepIndex)
         {
+            if (stepIndex >= numSteps) break;
             vec2 snappedUV = round(vec2(rayPixels) * direction) * InvScreenResolution + fullResUV;
             vec3 S = fetchViewPos(snappedUV); rayPixels += stepSizePixels;
             AO += computeAO(viewPosition, viewNormal, S);
         }
     }
-    AO *= AOMultiplier / (NUM_DIRECTIONS * NUM_STEPS);
+    AO *= AOMultiplier / (numDirections * numSteps);
     return clamp(1.0 - AO * 2.0, 0.0, 1.0);
 }
 
@@ -6,6 +6,7 @@
 #include <osgUtil/CullVisitor>
 #include <parallel_radix_sort.h>
 #include "Math.h"
+#include "Profiler.h"
 #include "GaussianGeometry.h"
 using namespace osgVerse;
 
@@ -848,6 +849,7 @@ public:
             {
                 Task& task = it->second; size_t numCulled = 0;
                 if (task.indices.empty()) continue;
+                VERSE_PROFILE_ZONE_CATEGORY("GaussianSorter::sort", "gaussian");
 
                 std::vector<GLuint> keys(task.indices.size());
                 if (task.positions3)
@@ -961,6 +963,7 @@ void GaussianSorter::removeGeometry(GaussianGeometry* geom)
 
 void GaussianSorter::cull(osg::RenderInfo& renderInfo)
 {
+    VERSE_PROFILE_ZONE_CATEGORY("GaussianSorter::cull", "gaussian");
     if (!renderInfo.getCurrentCamera() || _geometries.empty()) return;
     const osg::Matrix& view = renderInfo.getCurrentCamera()->getViewMatrix();
 
@@ -0,0 +1,98 @@
+#include <osg/Notify>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include "Profiler.h"
+using namespace osgVerse;
+
+static unsigned int getProfileThreadID()
+{
+    // Small sequential IDs read better than system thread handles in trace viewers
+    static std::atomic<unsigned int> s_threadCounter(0);
+    thread_local unsigned int threadID = ++s_threadCounter;
+    return threadID;
+}
+
+Profiler* Profiler::instance()
+{
+    static osg::ref_ptr<Profiler> s_instance = new Profiler;
+    return s_instance.get();
+}
+
+Profiler::Profiler()
+:   _head(0), _size(0), _frameNumber(0), _enabled(true)
+{ _zones.resize(65536); }
+
+void Profiler::setCapacity(unsigned int n)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _zones.clear(); _zones.resize(osg::maximum(n, 1u)); _head = 0; _size = 0;
+}
+
+void Profiler::record(const char* name, const char* category, double start, double duration)
+{
+    if (!_enabled) return;
+    Zone zone; zone.name = name; zone.category = category;
+    zone.start = start; zone.duration = duration;
+    zone.threadID = getProfileThreadID(); zone.frameNumber = _frameNumber;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _zones[_head] = zone; _head = (_head + 1) % _zones.size();
+    if (_size < _zones.size()) _size++;
+}
+
+void Profiler::getZones(std::vector<Zone>& zones, double lastMilliseconds) const
+{
+    double since = (lastMilliseconds > 0.0) ? (osg::Timer::instance()->time_u() - lastMilliseconds * 1000.0) : 0.0;
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t capacity = _zones.size(), first = (_head + capacity - _size) % capacity;
+    zones.clear(); zones.reserve(_size);
+    for (size_t i = 0; i < _size; ++i)
+    {
+        const Zone& zone = _zones[(first + i) % capacity];
+        if (zone.start + zone.duration >= since) zones.push_back(zone);
+    }
+}
+
+void Profiler::getStatistics(std::map<std::string, ZoneStatistics>& stats, double lastMilliseconds) const
+{
+    std::vector<Zone> zones; getZones(zones, lastMilliseconds); stats.clear();
+    for (size_t i = 0; i < zones.size(); ++i)
+    {
+        ZoneStatistics& st = stats[zones[i].name]; double t = zones[i].duration * 0.001;
+        st.totalTime += t; st.maxTime = osg::maximum(st.maxTime, t); st.count++;
+    }
+}
+
+bool Profiler::writeChromeTrace(std::ostream& out) const
+{
+    std::vector<Zone> zones; getZones(zones);
+    out << "{\"traceEvents\":[\n" << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < zones.size(); ++i)
+    {
+        const Zone& z = zones[i];
+        out << "{\"name\":\"" << (z.name ? z.name : "") << "\",\"cat\":\"" << (z.category ? z.category : "")
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << z.threadID << ",\"ts\":" << z.start
+            << ",\"dur\":" << z.duration << ",\"args\":{\"frame\":" << z.frameNumber << "}}"
+            << (i < zones.size() - 1 ? ",\n" : "\n");
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return out.good();
+}
+
+bool Profiler::dumpChromeTrace(const std::string& fileName) const
+{
+    std::ofstream out(fileName.c_str());
+    if (!out)
+    {
+        OSG_WARN << "[Profiler] Failed to write trace file " << fileName << std::endl;
+        return false;
+    }
+    return writeChromeTrace(out);
+}
+
+void Profiler::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _head = 0; _size = 0;
+}
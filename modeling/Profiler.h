@@ -0,0 +1,122 @@
+#ifndef MANA_MODELING_PROFILER_HPP
+#define MANA_MODELING_PROFILER_HPP
+
+#include <osg/Referenced>
+#include <osg/Timer>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#if defined(VERSE_STATIC_BUILD)
+#  define OSGVERSE_PROFILER_EXPORT
+#elif defined(VERSE_WINDOWS)
+#  if defined(VERSE_PROFILER_LIBRARY)
+#    define OSGVERSE_PROFILER_EXPORT __declspec(dllexport)
+#  else
+#    define OSGVERSE_PROFILER_EXPORT __declspec(dllimport)
+#  endif
+#else
+#  define OSGVERSE_PROFILER_EXPORT __attribute__((visibility("default")))
+#endif
+
+namespace osgVerse
+{
+    /** Lightweight CPU profiler. Scoped zones are recorded into an in-process ring buffer, which can be
+        read every frame (e.g., by an ImGui panel) or dumped as a Chrome trace file (chrome://tracing or
+        ui.perfetto.dev). Zone macros are compiled only when VERSE_ENABLE_PROFILING is defined.
+        It is built as the shared osgVerseProfiler library (static only with VERSE_STATIC_BUILD), so that
+        libraries and dynamic plugins all record into the same instance */
+    class OSGVERSE_PROFILER_EXPORT Profiler : public osg::Referenced
+    {
+    public:
+        static Profiler* instance();
+
+        struct Zone
+        {
+            const char *name, *category;  // must be string literals or other persistent strings
+            double start, duration;       // in microseconds since timer start
+            unsigned int threadID, frameNumber;
+        };
+
+        struct ZoneStatistics
+        {
+            double totalTime, maxTime;    // in milliseconds
+            unsigned int count;
+            ZoneStatistics() : totalTime(0.0), maxTime(0.0), count(0) {}
+        };
+
+        /** Enable or disable recording at runtime (enabled by default) */
+        void setEnabled(bool b) { _enabled = b; }
+        bool isEnabled() const { return _enabled; }
+
+        /** Set ring buffer size, which also clears recorded zones (default: 65536) */
+        void setCapacity(unsigned int n);
+        unsigned int getCapacity() const { return (unsigned int)_zones.size(); }
+
+        /** Set current frame number, which will be attached to following zones */
+        void setFrameNumber(unsigned int f) { _frameNumber = f; }
+        unsigned int getFrameNumber() const { return _frameNumber; }
+
+        /** Record a zone, mainly called by ProfileScope */
+        void record(const char* name, const char* category, double start, double duration);
+
+        /** Copy recorded zones (oldest first), optionally only those of last few milliseconds */
+        void getZones(std::vector<Zone>& zones, double lastMilliseconds = 0.0) const;
+
+        /** Aggregate recorded zones by name, optionally only those of last few milliseconds */
+        void getStatistics(std::map<std::string, ZoneStatistics>& stats, double lastMilliseconds = 0.0) const;
+
+        /** Write zones in Chrome trace event format */
+        bool writeChromeTrace(std::ostream& out) const;
+        bool dumpChromeTrace(const std::string& fileName) const;
+
+        void clear();
+
+    protected:
+        Profiler();
+        virtual ~Profiler() {}
+
+        std::vector<Zone> _zones;
+        mutable std::mutex _mutex;
+        size_t _head, _size;
+        std::atomic<unsigned int> _frameNumber;
+        std::atomic<bool> _enabled;
+    };
+
+    /** Records a zone from its construction to destruction */
+    class ProfileScope
+    {
+    public:
+        ProfileScope(const char* name, const char* category = "osgVerse")
+        :   _name(name), _category(category), _start(osg::Timer::instance()->time_u()) {}
+
+        ~ProfileScope()
+        {
+            double end = osg::Timer::instance()->time_u();
+            Profiler::instance()->record(_name, _category, _start, end - _start);
+        }
+
+    protected:
+        const char *_name, *_category;
+        double _start;
+    };
+}
+
+#define VERSE_PROFILE_CONCAT_IMPL(a, b) a##b
+#define VERSE_PROFILE_CONCAT(a, b) VERSE_PROFILE_CONCAT_IMPL(a, b)
+#ifdef VERSE_ENABLE_PROFILING
+#   define VERSE_PROFILE_ZONE(name) \
+        osgVerse::ProfileScope VERSE_PROFILE_CONCAT(verseProfileZone, __LINE__)(name)
+#   define VERSE_PROFILE_ZONE_CATEGORY(name, category) \
+        osgVerse::ProfileScope VERSE_PROFILE_CONCAT(verseProfileZone, __LINE__)(name, category)
+#   define VERSE_PROFILE_FRAME(frameNumber) osgVerse::Profiler::instance()->setFrameNumber(frameNumber)
+#else
+#   define VERSE_PROFILE_ZONE(name)
+#   define VERSE_PROFILE_ZONE_CATEGORY(name, category)
+#   define VERSE_PROFILE_FRAME(frameNumber)
+#endif
+
+#endif
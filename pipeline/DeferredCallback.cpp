@@ -151,6 +151,7 @@ namespace osgVerse
             // Apply FBO buffer for drawing and clear the viewport
             if (r->created)
             {
+                if (r->preDrawCallback.valid()) (*r->preDrawCallback)(renderInfo);
                 r->start(cb, renderInfo);
                 if (r->viewport.valid())
                 {
@@ -189,6 +190,7 @@ namespace osgVerse
                 // Draw user-defined geometry and finish the FBO rendering
                 r->draw(cb, renderInfo);
                 r->finish(cb, renderInfo);
+                if (r->postDrawCallback.valid()) (*r->postDrawCallback)(renderInfo);
             }
         }
 
@@ -70,6 +70,8 @@ namespace osgVerse
             RttRunner(const std::string& n = "") : name(n), created(false), active(true), runOnce(false) {}
             void detach(osg::Camera::BufferComponent buffer) { attachments.erase(buffer); }
 
+            /** Optional callbacks called before/after each run, e.g., for timing */
+            osg::ref_ptr<osg::Camera::DrawCallback> preDrawCallback, postDrawCallback;
             osg::Camera::BufferAttachmentMap attachments;
             osg::ref_ptr<osg::FrameBufferObject> fbo;
             osg::ref_ptr<osg::Viewport> viewport;
@@ -0,0 +1,257 @@
+#include <osg/io_utils>
+#include <osg/State>
+#include <iostream>
+#include <cmath>
+#include "DynamicResolution.h"
+#include "NISUpscaler.h"
+#include "Utilities.h"
+
+namespace osgVerse
+{
+    class DynamicResolutionDrawCallback : public CameraDrawCallback
+    {
+    public:
+        enum Type { BEGIN_FRAME, UPSCALE, END_FRAME };
+        DynamicResolutionDrawCallback(DynamicResolutionModule* m, Type t) : _module(m), _type(t) {}
+
+        virtual void operator()(osg::RenderInfo& renderInfo) const
+        {
+            DynamicResolutionModule* module = _module.get();
+            if (module != NULL && renderInfo.getState() != NULL)
+            {
+                switch (_type)
+                {
+                case BEGIN_FRAME: module->beginFrame(renderInfo); break;
+                case UPSCALE: module->upscale(renderInfo); break;
+                default: module->endFrame(renderInfo); break;
+                }
+            }
+            if (_subCallback.valid()) _subCallback.get()->run(renderInfo);
+        }
+
+    protected:
+        osg::observer_ptr<DynamicResolutionModule> _module;
+        Type _type;
+    };
+
+    DynamicResolutionController::DynamicResolutionController()
+    :   _targetFrameTime(1000.0 / 60.0), _lowerThreshold(0.8), _upperThreshold(1.05), _averageFrameTime(0.0),
+        _scale(1.0f), _minScale(0.5f), _maxScale(1.0f), _scaleStep(0.05f), _sampleWindow(30),
+        _cooldownFrames(10), _framesToSkip(0), _probeWait(0), _probeBackoff(1), _usingGpuTiming(false),
+        _cpuBound(false), _probing(false) {}
+
+    void DynamicResolutionController::setScaleRange(float minScale, float maxScale)
+    {
+        _minScale = osg::clampBetween(minScale, 0.1f, 1.0f);
+        _maxScale = osg::clampBetween(maxScale, _minScale, 1.0f);
+        setScale(_scale);
+    }
+
+    void DynamicResolutionController::setScale(float s)
+    {
+        _scale = osg::clampBetween(s, _minScale, _maxScale);
+        _cpuSamples.clear(); _gpuSamples.clear(); _intervalSamples.clear();
+    }
+
+    void DynamicResolutionController::reset()
+    {
+        _cpuSamples.clear(); _gpuSamples.clear(); _intervalSamples.clear(); _scale = _maxScale;
+        _averageFrameTime = 0.0; _framesToSkip = 0; _usingGpuTiming = false; _cpuBound = false;
+        _probeWait = 0; _probeBackoff = 1; _probing = false;
+    }
+
+    float DynamicResolutionController::quantize(float s) const
+    {
+        float q = floorf(s / _scaleStep + 0.001f) * _scaleStep;
+        return osg::clampBetween(q, _minScale, _maxScale);
+    }
+
+    bool DynamicResolutionController::update(double cpuTime, double gpuTime, double frameInterval)
+    {
+        if (_framesToSkip > 0) { _framesToSkip--; return false; }
+        _cpuSamples.push_back(cpuTime); _gpuSamples.push_back(gpuTime); _intervalSamples.push_back(frameInterval);
+        while (_cpuSamples.size() > _sampleWindow)
+        { _cpuSamples.pop_front(); _gpuSamples.pop_front(); _intervalSamples.pop_front(); }
+        if (_cpuSamples.size() < _sampleWindow) return false;
+
+        double cpuAverage = 0.0, gpuAverage = 0.0, intervalAverage = 0.0;
+        unsigned int numGpuSamples = 0, numIntervalSamples = 0;
+        for (size_t i = 0; i < _cpuSamples.size(); ++i)
+        {
+            cpuAverage += _cpuSamples[i];
+            if (_gpuSamples[i] >= 0.0) { gpuAverage += _gpuSamples[i]; numGpuSamples++; }
+            if (_intervalSamples[i] >= 0.0) { intervalAverage += _intervalSamples[i]; numIntervalSamples++; }
+        }
+        cpuAverage /= (double)_cpuSamples.size();
+        _usingGpuTiming = numGpuSamples > _sampleWindow / 2;
+        bool usingInterval = !_usingGpuTiming && numIntervalSamples > _sampleWindow / 2;
+        if (_usingGpuTiming) gpuAverage /= (double)numGpuSamples;
+        if (usingInterval) intervalAverage /= (double)numIntervalSamples;
+        _averageFrameTime = _usingGpuTiming ? gpuAverage : (usingInterval ? intervalAverage : cpuAverage);
+
+        double upperTime = _targetFrameTime * _upperThreshold, lowerTime = _targetFrameTime * _lowerThreshold;
+        _cpuBound = _usingGpuTiming && cpuAverage > upperTime && gpuAverage <= upperTime;
+
+        // First decision after a probe: if it failed, step back and wait longer before next probe
+        bool probeFailed = _probing && _averageFrameTime > upperTime;
+        if (_probing)
+        {
+            if (probeFailed)
+            { _probeWait = _probeBackoff * _sampleWindow; _probeBackoff = osg::minimum(_probeBackoff * 2, 16u); }
+            else _probeBackoff = 1;
+            _probing = false;
+        }
+
+        float newScale = _scale;
+        if (probeFailed) newScale = quantize(_scale - _scaleStep);
+        else if (_averageFrameTime > upperTime)
+        {
+            // Pixel cost is proportional to the square of render scale; drop at least one step
+            float s = _scale * (float)sqrt(_targetFrameTime / _averageFrameTime);
+            newScale = osg::minimum(quantize(s), quantize(_scale - _scaleStep));
+        }
+        else if (_averageFrameTime < lowerTime && _scale < _maxScale)
+        {
+            // Raise one step only if the predicted cost is still in budget, to avoid oscillating
+            float s = quantize(_scale + _scaleStep);
+            double predicted = _averageFrameTime * (s * s) / (_scale * _scale);
+            if (predicted <= _targetFrameTime) newScale = s;
+        }
+        else if (usingInterval && cpuAverage < lowerTime && _scale < _maxScale)
+        {
+            // Frame interval in the band may be capped by VSync, which hides spare GPU time.
+            // CPU work is in budget, so probe one step up when not waiting after failed probes
+            if (_probeWait > 0) _probeWait--;
+            else { newScale = quantize(_scale + _scaleStep); _probing = true; }
+        }
+
+        if (fabs(newScale - _scale) < 1e-4f) return false;
+        _scale = newScale; _cpuSamples.clear(); _gpuSamples.clear(); _intervalSamples.clear();
+        _framesToSkip = _cooldownFrames; return true;
+    }
+
+    DynamicResolutionModule::DynamicResolutionModule(const std::string& name, Pipeline* pipeline)
+        : _pipeline(pipeline), _lastFrameTick(0), _updateTick(0), _lastCpuTime(0.0),
+          _enabled(true), _upscaling(false)
+    {
+        _controller = new DynamicResolutionController;
+        _gpuTimer = new GpuTimer;
+        if (pipeline) pipeline->addModule(name, this);
+    }
+
+    DynamicResolutionModule::~DynamicResolutionModule()
+    {
+        if (_pipeline.valid()) _pipeline->removeModule(this);
+    }
+
+    bool DynamicResolutionModule::applyStages(Pipeline::Stage* firstStage, Pipeline::Stage* displayStage,
+                                              bool withUpscaler)
+    {
+        if (!_pipeline || !firstStage || !displayStage || !firstStage->camera || !displayStage->camera)
+        {
+            OSG_WARN << "[DynamicResolutionModule] Invalid pipeline or stages" << std::endl;
+            return false;
+        }
+
+        osg::ref_ptr<DynamicResolutionDrawCallback> beginCallback =
+            new DynamicResolutionDrawCallback(this, DynamicResolutionDrawCallback::BEGIN_FRAME);
+        osg::ref_ptr<DynamicResolutionDrawCallback> upscaleCallback =
+            new DynamicResolutionDrawCallback(this, DynamicResolutionDrawCallback::UPSCALE);
+        osg::ref_ptr<DynamicResolutionDrawCallback> endCallback =
+            new DynamicResolutionDrawCallback(this, DynamicResolutionDrawCallback::END_FRAME);
+        beginCallback->setup(firstStage->camera.get(), INITIAL_DRAW);
+        upscaleCallback->setup(displayStage->camera.get(), PRE_DRAW);
+        endCallback->setup(displayStage->camera.get(), FINAL_DRAW);
+
+        _displayStage = displayStage;
+        _sourceColor = dynamic_cast<osg::Texture*>(displayStage->getOrCreateStateSet()
+                     ->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+        if (!withUpscaler || !_sourceColor) return true;
+
+#if OSG_VERSION_GREATER_THAN(3, 5, 0) && !defined(OSG_GLES2_AVAILABLE) && !defined(OSG_GLES3_AVAILABLE)
+        GLVersionData* data = _pipeline->getVersionData();
+        osg::Texture2D* source = dynamic_cast<osg::Texture2D*>(_sourceColor.get());
+        if (!source || (data && data->glVersion < 430))
+        {
+            OSG_NOTICE << "[DynamicResolutionModule] NIS upscaler requires OpenGL 4.3, "
+                       << "scaled results will be displayed with bilinear filtering" << std::endl;
+            return true;
+        }
+
+        osg::Vec2s size = _pipeline->getStageSize();
+        osg::ref_ptr<osg::Texture2D> upscaled = static_cast<osg::Texture2D*>(
+            Pipeline::createTexture(Pipeline::RGBA_INT8, size[0], size[1], _pipeline->getGlCurrentVersion()));
+        _upscaler = new NISUpscaler(NISUpscaler::SCALER);
+        if (!_upscaler->initialize(size[0], size[1], size[0], size[1])) { _upscaler = NULL; return true; }
+        _upscaler->setInputTexture(source); _upscaler->setOutputTexture(upscaled.get());
+        _upscaledColor = upscaled;
+#else
+        OSG_NOTICE << "[DynamicResolutionModule] NIS upscaler not supported, "
+                   << "scaled results will be displayed with bilinear filtering" << std::endl;
+#endif
+        return true;
+    }
+
+    double DynamicResolutionModule::getLastGpuTime() const
+    { return _gpuTimer->getLastTime(); }
+
+    void DynamicResolutionModule::operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        osg::Timer_t tick = osg::Timer::instance()->tick();
+        double frameTime = (_lastFrameTick > 0) ? osg::Timer::instance()->delta_m(_lastFrameTick, tick) : 0.0;
+        _lastFrameTick = tick; _updateTick = tick;
+
+        if (_pipeline.valid())
+        {
+            if (_enabled && frameTime > 0.0)
+            {
+                // Without GPU timings, frame interval is used as it includes waiting for the GPU
+                _controller->update(_lastCpuTime, _gpuTimer->getLastTime(), frameTime);
+            }
+
+            // Also re-apply after window resizing, which restores unscaled buffers
+            float scale = _enabled ? _controller->getScale() : 1.0f;
+            if (scale != _pipeline->getRenderScale()) applyScale(scale);
+        }
+        traverse(node, nv);
+    }
+
+    void DynamicResolutionModule::applyScale(float scale)
+    {
+        _pipeline->setRenderScale(scale);
+        osg::Texture2D* source = dynamic_cast<osg::Texture2D*>(_sourceColor.get());
+
+        bool upscaling = false;
+        if (_upscaler.valid() && source != NULL && scale < 1.0f)
+            upscaling = _upscaler->setInputSize(source->getTextureWidth(), source->getTextureHeight());
+        if (_displayStage.valid() && upscaling != _upscaling)
+            _displayStage->applyTexture(upscaling ? _upscaledColor.get() : _sourceColor.get(), "ColorBuffer", 0);
+        _upscaling = upscaling;
+
+        OSG_INFO << "[DynamicResolutionModule] Render scale: " << _pipeline->getRenderScale()
+                 << (upscaling ? " (NIS)" : "") << ", averaged frame time: "
+                 << _controller->getAverageFrameTime() << "ms" << std::endl;
+    }
+
+    void DynamicResolutionModule::beginFrame(osg::RenderInfo& renderInfo)
+    { _gpuTimer->begin(*renderInfo.getState()); }
+
+    void DynamicResolutionModule::upscale(osg::RenderInfo& renderInfo)
+    {
+        if (!_upscaling || !_upscaler) return;
+        osg::State* state = renderInfo.getState();
+        _upscaler->dispatch(state);
+
+        // Program and textures are applied by the upscaler outside of OSG state tracking
+        state->haveAppliedAttribute(osg::StateAttribute::PROGRAM);
+        for (unsigned int u = 0; u < 5; ++u)
+            state->haveAppliedTextureAttribute(u, osg::StateAttribute::TEXTURE);
+    }
+
+    void DynamicResolutionModule::endFrame(osg::RenderInfo& renderInfo)
+    {
+        _gpuTimer->end(*renderInfo.getState());
+        if (_updateTick > 0)
+            _lastCpuTime = osg::Timer::instance()->delta_m(_updateTick, osg::Timer::instance()->tick());
+    }
+}
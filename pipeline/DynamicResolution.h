@@ -0,0 +1,133 @@
+#ifndef MANA_PP_DYNAMIC_RESOLUTION_HPP
+#define MANA_PP_DYNAMIC_RESOLUTION_HPP
+
+#include <osg/Timer>
+#include <deque>
+#include "Pipeline.h"
+
+namespace osgVerse
+{
+    class GpuTimer;
+    class NISUpscaler;
+
+    /** Frame-time driven render scale controller. It contains no OpenGL calls, so it can be fed with
+        synthetic timings for testing. Average timing of a sliding window is compared with the target:
+        - Above (target * upperThreshold): scale down, proportional to the square root of over-budget ratio
+        - Below (target * lowerThreshold): scale up by one step, if the predicted cost is still in budget
+        - Otherwise: keep current scale (the hysteresis band)
+        Samples are dropped for a few frames after each change, as reallocating buffers may cause spikes.
+        GPU timings are preferred; if they are in budget but CPU ones are not, the frame is CPU-bound
+        and lowering resolution will not help, which is reported by isCpuBound().
+        Without GPU timings, frame intervals are used instead. They may be capped by VSync and then never
+        fall below the target, so if CPU time is in budget, scaling up is probed one step at a time; each
+        failed probe doubles the waiting time (in sample windows, at most 16) before the next one */
+    class DynamicResolutionController : public osg::Referenced
+    {
+    public:
+        DynamicResolutionController();
+
+        /** Set target frame time in milliseconds (default: 16.67ms for 60 FPS) */
+        void setTargetFrameTime(double ms) { _targetFrameTime = ms; }
+        double getTargetFrameTime() const { return _targetFrameTime; }
+
+        /** Set render scale range (default: 0.5 - 1.0, as NIS upscaler supports at most 2x) */
+        void setScaleRange(float minScale, float maxScale);
+        float getMinScale() const { return _minScale; }
+        float getMaxScale() const { return _maxScale; }
+
+        /** Set quantization step of render scale, to avoid reallocating buffers too often (default: 0.05) */
+        void setScaleStep(float step) { _scaleStep = osg::maximum(step, 0.001f); }
+        float getScaleStep() const { return _scaleStep; }
+
+        /** Set hysteresis band as ratios of target frame time (default: 0.8 - 1.05) */
+        void setHysteresis(double lower, double upper) { _lowerThreshold = lower; _upperThreshold = upper; }
+        double getLowerThreshold() const { return _lowerThreshold; }
+        double getUpperThreshold() const { return _upperThreshold; }
+
+        /** Set number of frames to average before making decisions (default: 30) */
+        void setSampleWindow(unsigned int frames) { _sampleWindow = osg::maximum(frames, 1u); }
+        unsigned int getSampleWindow() const { return _sampleWindow; }
+
+        /** Set number of frames to ignore after each scale change (default: 10) */
+        void setCooldownFrames(unsigned int frames) { _cooldownFrames = frames; }
+        unsigned int getCooldownFrames() const { return _cooldownFrames; }
+
+        /** Feed timings of a frame in milliseconds (gpuTime / frameInterval < 0 if not available).
+            Return true if render scale is changed */
+        bool update(double cpuTime, double gpuTime, double frameInterval = -1.0);
+
+        void setScale(float s);
+        float getScale() const { return _scale; }
+
+        /** Averaged timing which decisions are made from (GPU timing if available) */
+        double getAverageFrameTime() const { return _averageFrameTime; }
+        bool isUsingGpuTiming() const { return _usingGpuTiming; }
+        bool isCpuBound() const { return _cpuBound; }
+
+        /** Clear all samples and restore maximum scale */
+        void reset();
+
+    protected:
+        float quantize(float s) const;
+
+        std::deque<double> _cpuSamples, _gpuSamples, _intervalSamples;
+        double _targetFrameTime, _lowerThreshold, _upperThreshold, _averageFrameTime;
+        float _scale, _minScale, _maxScale, _scaleStep;
+        unsigned int _sampleWindow, _cooldownFrames, _framesToSkip, _probeWait, _probeBackoff;
+        bool _usingGpuTiming, _cpuBound, _probing;
+    };
+
+    /** Pipeline module applying a DynamicResolutionController. It measures CPU and GPU frame times, changes
+        render scale of the pipeline, and upscales the scaled result with NIS before the display stage if
+        compute shaders are supported (otherwise the display stage samples it bilinearly).
+        - GPU time: from the beginning of the first stage to the end of the display stage (timer queries)
+        - CPU time: from the update traversal to the end of the display stage
+        - Frame interval: used instead of GPU time if timer queries are not available (see the controller)
+        It should be added as update callback of the main camera and works in SingleThreaded mode */
+    class DynamicResolutionModule : public RenderingModuleBase
+    {
+    public:
+        DynamicResolutionModule(const std::string& name, Pipeline* pipeline);
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        /** Apply timer callbacks to the first and display stages. The texture that display stage reads
+            as "ColorBuffer" (unit 0) will be replaced by NIS result when scaled, if withUpscaler is set */
+        bool applyStages(Pipeline::Stage* firstStage, Pipeline::Stage* displayStage, bool withUpscaler);
+
+        DynamicResolutionController* getController() { return _controller.get(); }
+        const DynamicResolutionController* getController() const { return _controller.get(); }
+
+        NISUpscaler* getUpscaler() { return _upscaler.get(); }
+        const NISUpscaler* getUpscaler() const { return _upscaler.get(); }
+        bool isUpscaling() const { return _upscaling; }
+
+        /** Disabling will restore full resolution at once */
+        void setEnabled(bool b) { _enabled = b; }
+        bool getEnabled() const { return _enabled; }
+
+        /** Timings (in ms) of latest measured frame; GPU time is -1 if not available */
+        double getLastCpuTime() const { return _lastCpuTime; }
+        double getLastGpuTime() const;
+
+        /** Called by internal draw callbacks */
+        void beginFrame(osg::RenderInfo& renderInfo);
+        void upscale(osg::RenderInfo& renderInfo);
+        void endFrame(osg::RenderInfo& renderInfo);
+
+    protected:
+        virtual ~DynamicResolutionModule();
+        void applyScale(float scale);
+
+        osg::observer_ptr<Pipeline> _pipeline;
+        osg::observer_ptr<Pipeline::Stage> _displayStage;
+        osg::ref_ptr<DynamicResolutionController> _controller;
+        osg::ref_ptr<GpuTimer> _gpuTimer;
+        osg::ref_ptr<NISUpscaler> _upscaler;
+        osg::ref_ptr<osg::Texture> _sourceColor, _upscaledColor;
+        osg::Timer_t _lastFrameTick, _updateTick;
+        double _lastCpuTime;
+        bool _enabled, _upscaling;
+    };
+}
+
+#endif
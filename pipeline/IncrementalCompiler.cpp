@@ -1,10 +1,17 @@
 #include "IncrementalCompiler.h"
+#include "Utilities.h"
 #include <osg/GLObjects>
+#include <osg/Timer>
 #include <iostream>
 #include <algorithm>
 #include <iterator>
 using namespace osgVerse;
 
+#ifndef GL_TEXTURE_BASE_LEVEL
+#   define GL_TEXTURE_BASE_LEVEL 0x813C
+#   define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
 bool IncrementalCompileCallback::compile(ICO::CompileDrawableOp* op, ICO::CompileInfo& compileInfo)
 { op->_drawable->compileGLObjects(compileInfo); return true; }
 
@@ -26,8 +33,125 @@ bool IncrementalCompileCallback::compile(ICO::CompileTextureOp* op, ICO::Compile
 bool IncrementalCompileCallback::compile(ICO::CompileProgramOp* op, ICO::CompileInfo& compileInfo)
 { op->_program->compileGLObjects(*compileInfo.getState()); return true; }
 
+/// MipmapSubloadCallback: upload mipmap levels of a large texture from the coarsest one across frames,
+///                        restricting GL_TEXTURE_BASE_LEVEL to uploaded levels so it is always complete
+class MipmapSubloadCallback : public osg::Texture2D::SubloadCallback
+{
+public:
+    MipmapSubloadCallback(osg::Image* image, GLenum internalFormat)
+        : _image(image), _internalFormat(internalFormat), _budget(0), _uploadedBytes(0)
+    { _nextLevel = (int)image->getNumMipmapLevels() - 1; }
+
+    void setByteBudget(unsigned long long b) { _budget = b; }
+    bool isComplete() const { return _nextLevel < 0; }
+    unsigned long long takeUploadedBytes() const
+    { unsigned long long b = _uploadedBytes; _uploadedBytes = 0; return b; }
+
+    virtual void load(const osg::Texture2D& texture, osg::State& state) const
+    {
+#if !defined(OSG_GLES1_AVAILABLE) && !defined(OSG_GLES2_AVAILABLE)
+        int numLevels = (int)_image->getNumMipmapLevels();
+        osg::Texture2D& tex = const_cast<osg::Texture2D&>(texture);
+        tex.setTextureSize(_image->s(), _image->t()); tex.setNumMipmapLevels(numLevels);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, _image->getPacking());
+        for (int level = 0; level < numLevels; ++level)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, _internalFormat, getLevelWidth(level), getLevelHeight(level),
+                         0, _image->getPixelFormat(), _image->getDataType(), NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+        subload(texture, state);
+#endif
+    }
+
+    virtual void subload(const osg::Texture2D& texture, osg::State& state) const
+    {
+#if !defined(OSG_GLES1_AVAILABLE) && !defined(OSG_GLES2_AVAILABLE)
+        if (_nextLevel < 0) return;
+        unsigned long long bytes = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, _image->getPacking());
+        while (_nextLevel >= 0)
+        {
+            unsigned long long levelBytes = getLevelBytes(_nextLevel);
+            if (bytes > 0 && bytes + levelBytes > _budget) break;  // at least one level each time
+            glTexSubImage2D(GL_TEXTURE_2D, _nextLevel, 0, 0, getLevelWidth(_nextLevel), getLevelHeight(_nextLevel),
+                            _image->getPixelFormat(), _image->getDataType(), _image->getMipmapData(_nextLevel));
+            bytes += levelBytes; _nextLevel--;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, _nextLevel + 1);
+        _uploadedBytes += bytes;
+#endif
+    }
+
+protected:
+    int getLevelWidth(int level) const { return osg::maximum(_image->s() >> level, 1); }
+    int getLevelHeight(int level) const { return osg::maximum(_image->t() >> level, 1); }
+
+    unsigned long long getLevelBytes(int level) const
+    {
+        unsigned int numLevels = _image->getNumMipmapLevels();
+        unsigned int end = (level + 1 < (int)numLevels) ? _image->getMipmapOffset(level + 1)
+                         : _image->getTotalDataSize();
+        return end - _image->getMipmapOffset(level);
+    }
+
+    osg::ref_ptr<osg::Image> _image;
+    GLenum _internalFormat;
+    unsigned long long _budget;
+    mutable unsigned long long _uploadedBytes;
+    mutable int _nextLevel;
+};
+
+static unsigned long long getDrawableBytes(osg::Drawable* drawable)
+{
+    osg::Geometry* geom = drawable ? drawable->asGeometry() : NULL;
+    if (!geom) return 1024;
+
+    unsigned long long bytes = 0;
+    osg::Geometry::ArrayList arrays; geom->getArrayList(arrays);
+    for (size_t i = 0; i < arrays.size(); ++i)
+    { if (arrays[i].valid()) bytes += arrays[i]->getTotalDataSize(); }
+    for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); ++i)
+    {
+        osg::DrawElements* de = geom->getPrimitiveSet(i)->getDrawElements();
+        if (de) bytes += de->getTotalDataSize();
+    }
+    return bytes;
+}
+
+static unsigned long long getTextureBytes(osg::Texture* texture)
+{
+    unsigned long long bytes = 0;
+    for (unsigned int i = 0; i < texture->getNumImages(); ++i)
+    {
+        osg::Image* image = texture->getImage(i);
+        if (image) bytes += image->getTotalDataSize();
+    }
+
+    if (bytes == 0)
+    {
+        bytes = (unsigned long long)osg::maximum(texture->getTextureWidth(), 1) * 4 *
+                osg::maximum(texture->getTextureHeight(), 1) * osg::maximum(texture->getTextureDepth(), 1);
+    }
+    return bytes;
+}
+
+static unsigned long long getProgramKey(osg::Program* program)
+{
+    unsigned long long key = 0;
+    for (unsigned int i = 0; i < program->getNumShaders(); ++i)
+    {
+        osg::Shader* shader = program->getShader(i);
+        if (shader) key = key * 31 + Hash::getShader(*shader);
+    }
+    return key;
+}
+
 IncrementalCompiler::IncrementalCompiler()
-    : osgUtil::IncrementalCompileOperation()
+    : osgUtil::IncrementalCompileOperation(), _frameStartTick(0), _splitThreshold(16 * 1024 * 1024),
+      _bytesInFrame(0), _numCompiledInFrame(0), _uploadRate(500.0 * 1024.0), _defaultLinkTime(5.0),
+      _splitAllowed(false)
 {}
 
 IncrementalCompiler::~IncrementalCompiler()
@@ -58,6 +182,40 @@ void IncrementalCompiler::operator()(osg::GraphicsContext* context)
         std::copy(_toCompile.begin(), _toCompile.end(), std::back_inserter<CompileSets>(toCompileCopy));
     }
 
+    // Sort compile sets by priority, and collect queued bytes
+    _eye = context->getState()->getInitialInverseViewMatrix().getTrans();
+    _frameStartTick = osg::Timer::instance()->tick();
+    _bytesInFrame = 0; _numCompiledInFrame = 0;
+    if (!toCompileCopy.empty())
+    {
+        std::map<CompileSet*, float> priorities; unsigned long long queuedBytes = 0, bytes = 0;
+        unsigned int numQueued = 0;
+        for (CompileSets::iterator itr = toCompileCopy.begin(); itr != toCompileCopy.end(); ++itr)
+        {
+            CompileList& compileList = (*itr)->_compileMap[context];
+            for (CompileList::CompileOps::iterator itr2 = compileList._compileOps.begin();
+                 itr2 != compileList._compileOps.end(); ++itr2)
+            { estimateCompileTime(itr2->get(), bytes); queuedBytes += bytes; numQueued++; }
+            priorities[itr->get()] = computePriority(itr->get());
+        }
+
+        for (std::map<CompileSet*, osg::BoundingSphere>::iterator itr = _compileSetBounds.begin();
+             itr != _compileSetBounds.end();)
+        {   // remove finished compile sets
+            if (priorities.find(itr->first) == priorities.end()) _compileSetBounds.erase(itr++);
+            else ++itr;
+        }
+
+        toCompileCopy.sort([&priorities](const osg::ref_ptr<CompileSet>& a, const osg::ref_ptr<CompileSet>& b)
+                           { return priorities[a.get()] > priorities[b.get()]; });
+        _statistics.queuedBytes = queuedBytes; _statistics.numQueuedObjects = numQueued;
+    }
+    else
+    {
+        _compileSetBounds.clear(); _statistics.queuedBytes = 0;
+        _statistics.numQueuedObjects = 0;
+    }
+
     if (!toCompileCopy.empty()) compileGLDataSets(toCompileCopy, compileInfo);
     osg::flushDeletedGLObjects(context->getState()->getContextID(), currentTime, flushTime);
     if (!toCompileCopy.empty() && compileInfo.maxNumObjectsToCompile > 0)
@@ -66,6 +224,116 @@ void IncrementalCompiler::operator()(osg::GraphicsContext* context)
         compileInfo.allocatedTime += flushTime;
         if (compileInfo.okToCompile()) compileGLDataSets(toCompileCopy, compileInfo);
     }
+
+    double timeUsed = osg::Timer::instance()->delta_m(_frameStartTick, osg::Timer::instance()->tick());
+    if (_numCompiledInFrame > 0 && !compileInfo.compileAll && timeUsed > availableTime * 1000.0)
+        _statistics.numOverruns++;
+    _statistics.budgetLastFrame = availableTime * 1000.0;
+    _statistics.compileTimeLastFrame = timeUsed;
+    _statistics.compiledBytesLastFrame = _bytesInFrame;
+    _statistics.totalCompiledBytes += _bytesInFrame;
+    _statistics.uploadRate = _uploadRate;
+}
+
+double IncrementalCompiler::estimateCompileTime(CompileOp* op, unsigned long long& bytes) const
+{
+    CompileDrawableOp* d = dynamic_cast<CompileDrawableOp*>(op); bytes = 0;
+    if (d) bytes = getDrawableBytes(d->_drawable.get());
+    else
+    {
+        CompileTextureOp* t = dynamic_cast<CompileTextureOp*>(op);
+        if (t) bytes = getTextureBytes(t->_texture.get());
+        else
+        {
+            CompileProgramOp* p = dynamic_cast<CompileProgramOp*>(op);
+            if (p)
+            {
+                std::map<unsigned long long, double>::const_iterator itr =
+                    _linkTimes.find(getProgramKey(p->_program.get()));
+                return (itr != _linkTimes.end() ? itr->second : _defaultLinkTime) * 0.001;
+            }
+        }
+    }
+    return ((double)bytes / _uploadRate + 0.01) * 0.001;  // with a small fixed cost per object
+}
+
+float IncrementalCompiler::computePriority(CompileSet* cs)
+{
+    if (_priorityCallback) return _priorityCallback(cs);
+    std::map<CompileSet*, osg::BoundingSphere>::iterator itr = _compileSetBounds.find(cs);
+    if (itr == _compileSetBounds.end())
+    {
+        osg::BoundingSphere bs;
+        if (cs->_subgraphToCompile.valid()) bs = cs->_subgraphToCompile->getBound();
+
+        osg::ref_ptr<osg::Group> attachment;
+        if (cs->_attachmentPoint.lock(attachment) && bs.valid())
+        {
+            osg::MatrixList matrices = attachment->getWorldMatrices();
+            if (!matrices.empty()) bs = osg::BoundingSphere(bs.center() * matrices[0], bs.radius());
+        }
+        itr = _compileSetBounds.insert(std::make_pair(cs, bs)).first;
+    }
+
+    const osg::BoundingSphere& bs = itr->second; if (!bs.valid()) return 0.0f;
+    return -(float)osg::maximum((bs.center() - _eye).length() - (double)bs.radius(), 0.0);
+}
+
+osg::Texture2D* IncrementalCompiler::getSplittableTexture(osg::Texture* texture, unsigned long long bytes) const
+{
+#if defined(OSG_GLES1_AVAILABLE) || defined(OSG_GLES2_AVAILABLE)
+    return NULL;
+#else
+    if (!_splitAllowed || _splitThreshold == 0 || bytes < _splitThreshold) return NULL;
+    osg::Texture2D* tex2D = dynamic_cast<osg::Texture2D*>(texture);
+    osg::Image* image = tex2D ? tex2D->getImage() : NULL;
+    if (!image || image->getNumMipmapLevels() < 2 || image->isCompressed()) return NULL;
+    if (image->getRowLength() != 0 && image->getRowLength() != image->s()) return NULL;
+    if (tex2D->getInternalFormatMode() != osg::Texture::USE_IMAGE_DATA_FORMAT &&
+        tex2D->getInternalFormatMode() != osg::Texture::USE_USER_DEFINED_FORMAT) return NULL;
+
+    osg::Texture2D::SubloadCallback* cb = tex2D->getSubloadCallback();
+    if (cb != NULL && dynamic_cast<MipmapSubloadCallback*>(cb) == NULL) return NULL;
+    return tex2D;
+#endif
+}
+
+bool IncrementalCompiler::compileTextureLevels(osg::Texture2D* texture, CompileInfo& compileInfo,
+                                               unsigned long long budget, unsigned long long& uploaded)
+{
+    MipmapSubloadCallback* cb = dynamic_cast<MipmapSubloadCallback*>(texture->getSubloadCallback());
+    if (!cb)
+    {
+        osg::Image* image = texture->getImage();
+        GLenum internalFormat = (texture->getInternalFormatMode() == osg::Texture::USE_USER_DEFINED_FORMAT)
+                              ? texture->getInternalFormat() : image->getInternalTextureFormat();
+        cb = new MipmapSubloadCallback(image, internalFormat);
+        texture->setSubloadCallback(cb); _statistics.numSplitTextures++;
+    }
+
+    cb->setByteBudget(budget);
+    texture->apply(*compileInfo.getState());
+    uploaded = cb->takeUploadedBytes();
+    if (!cb->isComplete()) return false;
+
+    // All levels uploaded: let the texture work as usual without re-uploading the image
+    unsigned int contextID = compileInfo.getState()->getContextID();
+    texture->getModifiedCount(contextID) = texture->getImage()->getModifiedCount();
+    texture->setSubloadCallback(NULL); return true;
+}
+
+void IncrementalCompiler::recordCompileTime(CompileOp* op, unsigned long long bytes, double ms)
+{
+    CompileProgramOp* p = dynamic_cast<CompileProgramOp*>(op);
+    if (p)
+    {
+        _linkTimes[getProgramKey(p->_program.get())] = ms;
+        _defaultLinkTime = _defaultLinkTime * 0.9 + ms * 0.1;
+    }
+    else if (bytes > 64 * 1024 && ms > 0.01)
+    {   // learn upload throughput from large uploads only
+        _uploadRate = _uploadRate * 0.9 + ((double)bytes / ms) * 0.1;
+    }
 }
 
 void IncrementalCompiler::compileGLDataSets(CompileSets& toCompile, CompileInfo& compileInfo)
@@ -78,6 +346,8 @@ void IncrementalCompiler::compileGLDataSets(CompileSets& toCompile, CompileInfo&
         CompileList& compileList = cs->_compileMap[gc];
         if (!compileList.empty())
         {
+            // Level-by-level uploading keeps state in the texture, so only do it for one context
+            _splitAllowed = (cs->_compileMap.size() == 1);
             if (compileGLDataSubList(compileList, compileInfo))
             {
                 --cs->_numberCompileListsToCompile;
@@ -118,25 +388,42 @@ bool IncrementalCompiler::compileGLDataSubList(CompileList& toCompile, CompileIn
          itr != toCompile._compileOps.end() && compileInfo.okToCompile();)
     {
         CompileList::CompileOps::iterator saved_itr(itr); ++itr;
-        bool compiled = false; compileInfo.maxNumObjectsToCompile--;
-
         IncrementalCompiler::CompileOp* op = (*saved_itr).get();
-        if (_callback.valid())
+        unsigned long long bytes = 0; double estimated = estimateCompileTime(op, bytes);
+
+        // Skip ops that don't fit the rest of this frame (always compile at least one op per frame),
+        // except large textures which are then uploaded partially
+        IncrementalCompiler::CompileTextureOp* t = dynamic_cast<IncrementalCompiler::CompileTextureOp*>(op);
+        osg::Texture2D* splitTexture = t ? getSplittableTexture(t->_texture.get(), bytes) : NULL;
+        if (!splitTexture && _numCompiledInFrame > 0 && !compileInfo.okToCompile(estimated)) continue;
+
+        bool compiled = false; compileInfo.maxNumObjectsToCompile--;
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        if (splitTexture)
         {
-            IncrementalCompiler::CompileDrawableOp* d = dynamic_cast<IncrementalCompiler::CompileDrawableOp*>(op);
-            if (d) compiled = _callback->compile(d, compileInfo);
-            else
+            double elapsed = osg::Timer::instance()->delta_s(_frameStartTick, t0);
+            double remaining = osg::maximum(compileInfo.allocatedTime - elapsed, 0.0) * 1000.0;
+            compiled = compileTextureLevels(splitTexture, compileInfo,
+                                            (unsigned long long)(remaining * _uploadRate), bytes);
+        }
+        else
+        {
+            if (_callback.valid())
             {
-                IncrementalCompiler::CompileTextureOp* t = dynamic_cast<IncrementalCompiler::CompileTextureOp*>(op);
-                if (t) compiled = _callback->compile(t, compileInfo);
+                IncrementalCompiler::CompileDrawableOp* d = dynamic_cast<IncrementalCompiler::CompileDrawableOp*>(op);
+                if (d) compiled = _callback->compile(d, compileInfo);
+                else if (t) compiled = _callback->compile(t, compileInfo);
                 else
                 {
                     IncrementalCompiler::CompileProgramOp* p = dynamic_cast<IncrementalCompiler::CompileProgramOp*>(op);
                     if (p) compiled = _callback->compile(p, compileInfo);
                 }
             }
+            if (!compiled) compiled = op->compile(compileInfo);
         }
-        if (!compiled) compiled = op->compile(compileInfo);
+
+        recordCompileTime(op, bytes, osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick()));
+        _bytesInFrame += bytes; _numCompiledInFrame++;
         if (compiled) toCompile._compileOps.erase(saved_itr);
     }
     return toCompile.empty();
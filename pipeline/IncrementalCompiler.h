@@ -5,6 +5,8 @@
 #include <osg/Geometry>
 #include <osg/Texture2D>
 #include <osgUtil/IncrementalCompileOperation>
+#include <functional>
+#include <map>
 
 namespace osgVerse
 {
@@ -18,6 +20,9 @@ namespace osgVerse
         virtual bool compile(ICO::CompileProgramOp*, ICO::CompileInfo&);
     };
 
+    /** Incremental compiler which estimates cost of each compile op (bytes of texture levels and vertex/index
+        arrays, program link history) and schedules ops by priority so that each frame stays in budget.
+        Large mipmapped textures may be uploaded level by level (coarsest first) across frames */
     class IncrementalCompiler : public osgUtil::IncrementalCompileOperation
     {
     public:
@@ -27,11 +32,51 @@ namespace osgVerse
         void setCompileCallback(IncrementalCompileCallback* cb) { _callback = cb; }
         IncrementalCompileCallback* getCompileCallback() { return _callback.get(); }
 
+        /** Priority of a compile set (larger ones compile first). By default, sets nearer to the eye
+            have higher priorities, similar to the priorities of database pager requests */
+        typedef std::function<float (CompileSet*)> PriorityCallback;
+        void setPriorityCallback(PriorityCallback cb) { _priorityCallback = cb; }
+
+        /** Mipmapped 2D textures larger than this are uploaded level by level across frames (0 = disabled) */
+        void setTextureSplitThreshold(unsigned long long bytes) { _splitThreshold = bytes; }
+        unsigned long long getTextureSplitThreshold() const { return _splitThreshold; }
+
+        struct Statistics
+        {
+            unsigned long long queuedBytes, compiledBytesLastFrame, totalCompiledBytes;
+            unsigned int numQueuedObjects, numOverruns, numSplitTextures;
+            double budgetLastFrame, compileTimeLastFrame, uploadRate;  // ms, ms, bytes per ms
+            Statistics() : queuedBytes(0), compiledBytesLastFrame(0), totalCompiledBytes(0),
+                           numQueuedObjects(0), numOverruns(0), numSplitTextures(0),
+                           budgetLastFrame(0.0), compileTimeLastFrame(0.0), uploadRate(0.0) {}
+        };
+        const Statistics& getStatistics() const { return _statistics; }
+
+        /** Estimated time (in seconds) and bytes to upload of the compile op */
+        double estimateCompileTime(CompileOp* op, unsigned long long& bytes) const;
+
     protected:
         virtual ~IncrementalCompiler();
         void compileGLDataSets(CompileSets& toCompile, CompileInfo& compileInfo);
         virtual bool compileGLDataSubList(CompileList& toCompile, CompileInfo& compileInfo);
+
+        float computePriority(CompileSet* cs);
+        osg::Texture2D* getSplittableTexture(osg::Texture* texture, unsigned long long bytes) const;
+        bool compileTextureLevels(osg::Texture2D* texture, CompileInfo& compileInfo,
+                                  unsigned long long budget, unsigned long long& uploaded);
+        void recordCompileTime(CompileOp* op, unsigned long long bytes, double ms);
+
         osg::ref_ptr<IncrementalCompileCallback> _callback;
+        PriorityCallback _priorityCallback;
+        std::map<CompileSet*, osg::BoundingSphere> _compileSetBounds;
+        std::map<unsigned long long, double> _linkTimes;  // ms
+        Statistics _statistics;
+        osg::Vec3d _eye;
+        osg::Timer_t _frameStartTick;
+        unsigned long long _splitThreshold, _bytesInFrame;
+        unsigned int _numCompiledInFrame;
+        double _uploadRate, _defaultLinkTime;
+        bool _splitAllowed;
     };
 
 }
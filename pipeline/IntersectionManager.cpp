@@ -8,6 +8,12 @@
 #include <osg/Texture>
 #include <osg/TexMat>
 #include <osg/TriangleIndexFunctor>
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Condition>
+#include <atomic>
+#include <cfloat>
+#include <list>
 using namespace osgVerse;
 
 static osg::Texture* getTextureLookUp(const osgUtil::LineSegmentIntersector::Intersection& it, osg::Vec3& tc)
@@ -123,17 +129,549 @@ osg::Node* IntersectionResult::findNode(IntersectionResult::FindNodeFunc func)
     { if (func(*itr)) return *itr; } return NULL;
 }
 
+/// TriangleBVH: binned-SAH bounding volume hierarchy of a single geometry, built once in background
+///              and shared by all line / polytope queries until the geometry is modified
+class TriangleBVH : public osg::Referenced
+{
+public:
+    struct Node
+    {
+        osg::BoundingBoxf box;
+        unsigned int first, count, right;  // leaf if count > 0; otherwise left child = this + 1
+        Node() : first(0), count(0), right(0) {}
+    };
+
+    struct LineHit
+    {
+        double ratio, u, v; unsigned int triangle;
+        LineHit(double r = 0.0, double uu = 0.0, double vv = 0.0, unsigned int t = 0)
+            : ratio(r), u(uu), v(vv), triangle(t) {}
+    };
+
+    enum LineQuery { ALL_HITS = 0, ANY_HIT, NEAREST_HIT };
+    typedef std::function<void (unsigned int, const std::vector<osg::Vec3d>&)> PolytopeHitCallback;
+
+    TriangleBVH(osg::Geometry* g, unsigned long long key)
+        : _geometry(g), _key(key), _ready(false), _usable(false) {}
+
+    static unsigned long long computeKey(const osg::Geometry* geom)
+    {
+        const osg::Array* va = geom->getVertexArray();
+        unsigned long long key = (unsigned long long)(size_t)va;
+        if (va) key = key * 31 + va->getModifiedCount() * 7919ull + va->getNumElements();
+        for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); ++i)
+        {
+            const osg::PrimitiveSet* p = geom->getPrimitiveSet(i);
+            key = key * 31 + (unsigned long long)(size_t)p;
+            if (p) key = key * 31 + p->getModifiedCount() * 7919ull + p->getNumIndices();
+        }
+        return key;
+    }
+
+    static unsigned int estimateNumTriangles(const osg::Geometry* geom)
+    {
+        unsigned int num = 0;
+        for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); ++i)
+        { const osg::PrimitiveSet* p = geom->getPrimitiveSet(i); if (p) num += p->getNumIndices() / 3; }
+        return num;
+    }
+
+    osg::Geometry* getGeometry() { return _geometry.get(); }
+    unsigned long long getKey() const { return _key; }
+    // Published by build threads with release stores, so BVH data is visible once these are read as true
+    bool isReady() const { return _ready.load(std::memory_order_acquire); }
+    bool isUsable() const
+    { return _ready.load(std::memory_order_acquire) && _usable.load(std::memory_order_acquire); }
+
+    unsigned int getVertexIndex(unsigned int t, int i) const { return _indices[t * 3 + i]; }
+    unsigned int getPrimitiveIndex(unsigned int t) const { return _primitiveIndices[t]; }
+    const osg::Vec3f& getVertex(unsigned int t, int i) const { return _vertices[_indices[t * 3 + i]]; }
+
+    void build()
+    {
+        osg::ref_ptr<osg::Geometry> geom;
+        if (_geometry.lock(geom)) buildFrom(geom.get());
+        _ready.store(true, std::memory_order_release);
+    }
+
+    bool intersect(const osg::Vec3d& s, const osg::Vec3d& e, LineQuery query, std::vector<LineHit>& hits) const
+    {
+        if (_nodes.empty()) return false;
+        osg::Vec3d dir = e - s, invDir;
+        for (int i = 0; i < 3; ++i) invDir[i] = (dir[i] != 0.0) ? (1.0 / dir[i]) : DBL_MAX;
+
+        double tMax = 1.0; bool found = false;
+        unsigned int stack[64]; int stackSize = 0; stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const Node& node = _nodes[stack[--stackSize]];
+            if (!intersectBox(node.box, s, dir, invDir, tMax)) continue;
+            if (node.count == 0)
+            {
+                if (stackSize + 2 > 64) continue;  // should never happen with a balanced build
+                stack[stackSize++] = node.right;
+                stack[stackSize++] = (unsigned int)(&node - &_nodes[0]) + 1;
+                continue;
+            }
+
+            for (unsigned int n = node.first; n < node.first + node.count; ++n)
+            {
+                unsigned int t = _order[n]; double ratio = 0.0, u = 0.0, v = 0.0;
+                if (!intersectTriangle(t, s, dir, tMax, ratio, u, v)) continue;
+                if (query == ANY_HIT) { hits.push_back(LineHit(ratio, u, v, t)); return true; }
+                else if (query == NEAREST_HIT)
+                {
+                    tMax = ratio; hits.clear();
+                    hits.push_back(LineHit(ratio, u, v, t));
+                }
+                else hits.push_back(LineHit(ratio, u, v, t));
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void intersect(const osg::Polytope::PlaneList& planes, PolytopeHitCallback cb) const
+    {
+        if (_nodes.empty()) return;
+        std::vector<osg::Vec3d> polygon, clipped;
+        std::vector<unsigned int> stack; stack.push_back(0);
+        while (!stack.empty())
+        {
+            unsigned int index = stack.back(); stack.pop_back();
+            const Node& node = _nodes[index];
+            if (!intersectBox(node.box, planes)) continue;
+            if (node.count == 0)
+            { stack.push_back(node.right); stack.push_back(index + 1); continue; }
+
+            for (unsigned int n = node.first; n < node.first + node.count; ++n)
+            {
+                unsigned int t = _order[n]; polygon.clear();
+                polygon.push_back(getVertex(t, 0)); polygon.push_back(getVertex(t, 1));
+                polygon.push_back(getVertex(t, 2));
+                for (size_t p = 0; p < planes.size() && !polygon.empty(); ++p)
+                {   // Sutherland-Hodgman clipping against each plane
+                    const osg::Plane& plane = planes[p]; clipped.clear();
+                    for (size_t i = 0; i < polygon.size(); ++i)
+                    {
+                        const osg::Vec3d &a = polygon[i], &b = polygon[(i + 1) % polygon.size()];
+                        double da = plane.distance(a), db = plane.distance(b);
+                        if (da >= 0.0) clipped.push_back(a);
+                        if ((da >= 0.0) != (db >= 0.0)) clipped.push_back(a + (b - a) * (da / (da - db)));
+                    }
+                    polygon.swap(clipped);
+                }
+                if (!polygon.empty()) cb(t, polygon);
+            }
+        }
+    }
+
+protected:
+    void buildFrom(osg::Geometry* geom)
+    {
+        osg::Vec3Array* va = dynamic_cast<osg::Vec3Array*>(geom->getVertexArray());
+        if (!va || va->empty()) return;
+        for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); ++i)
+        {
+            const osg::PrimitiveSet* p = geom->getPrimitiveSet(i);
+            if (!p) continue;
+            switch (p->getMode())
+            {   // points and lines are left to the default intersector
+            case GL_TRIANGLES: case GL_TRIANGLE_STRIP: case GL_TRIANGLE_FAN:
+            case GL_QUADS: case GL_QUAD_STRIP: case GL_POLYGON: break;
+            default: return;
+            }
+        }
+
+        osg::TriangleIndexFunctor<CollectTriangleOperator> functor;
+        functor.indices = &_indices; functor.primitiveIndices = &_primitiveIndices;
+        functor.numVertices = va->size(); geom->accept(functor);
+        _vertices.assign(va->begin(), va->end());
+
+        size_t numTriangles = _primitiveIndices.size();
+        if (numTriangles == 0) return;
+
+        std::vector<osg::BoundingBoxf> boxes(numTriangles);
+        std::vector<osg::Vec3f> centers(numTriangles);
+        _order.resize(numTriangles);
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            osg::BoundingBoxf& bb = boxes[t];
+            bb.expandBy(getVertex(t, 0)); bb.expandBy(getVertex(t, 1)); bb.expandBy(getVertex(t, 2));
+            centers[t] = bb.center(); _order[t] = t;
+        }
+
+        _nodes.reserve(numTriangles / 2 + 1);
+        buildNode(boxes, centers, 0, numTriangles, 0);
+        _usable.store(true, std::memory_order_release);
+    }
+
+    unsigned int buildNode(const std::vector<osg::BoundingBoxf>& boxes, const std::vector<osg::Vec3f>& centers,
+                           unsigned int first, unsigned int count, int depth)
+    {
+        unsigned int index = _nodes.size(); _nodes.push_back(Node());
+        osg::BoundingBoxf box, centerBox;
+        for (unsigned int i = first; i < first + count; ++i)
+        { box.expandBy(boxes[_order[i]]); centerBox.expandBy(centers[_order[i]]); }
+        _nodes[index].box = box; _nodes[index].first = first; _nodes[index].count = count;
+        if (count <= 4 || depth > 48) return index;
+
+        // Find best split plane with binned SAH
+        const int NUM_BINS = 16;
+        float bestCost = FLT_MAX; int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float minValue = centerBox._min[axis], extent = centerBox._max[axis] - minValue;
+            if (extent <= 0.0f) continue;
+
+            osg::BoundingBoxf bins[NUM_BINS]; unsigned int binCounts[NUM_BINS] = { 0 };
+            float scale = (float)NUM_BINS / extent;
+            for (unsigned int i = first; i < first + count; ++i)
+            {
+                unsigned int t = _order[i];
+                int b = osg::minimum(NUM_BINS - 1, (int)((centers[t][axis] - minValue) * scale));
+                binCounts[b]++; bins[b].expandBy(boxes[t]);
+            }
+
+            float leftCost[NUM_BINS]; osg::BoundingBoxf leftBox; unsigned int leftCount = 0;
+            for (int b = 0; b < NUM_BINS - 1; ++b)
+            {
+                leftBox.expandBy(bins[b]); leftCount += binCounts[b];
+                leftCost[b] = computeArea(leftBox) * leftCount;
+            }
+
+            osg::BoundingBoxf rightBox; unsigned int rightCount = 0;
+            for (int b = NUM_BINS - 1; b > 0; --b)
+            {
+                rightBox.expandBy(bins[b]); rightCount += binCounts[b];
+                float cost = leftCost[b - 1] + computeArea(rightBox) * rightCount;
+                if (cost < bestCost) { bestCost = cost; bestAxis = axis; bestBin = b; }
+            }
+        }
+
+        unsigned int mid = first;
+        if (bestAxis >= 0)
+        {
+            if (count <= 16 && bestCost >= computeArea(box) * count) return index;
+            float minValue = centerBox._min[bestAxis];
+            float scale = (float)NUM_BINS / (centerBox._max[bestAxis] - minValue);
+            unsigned int* split = std::partition(&_order[first], &_order[first] + count,
+                [&](unsigned int t)
+                {
+                    int b = osg::minimum(NUM_BINS - 1, (int)((centers[t][bestAxis] - minValue) * scale));
+                    return b < bestBin;
+                });
+            mid = (unsigned int)(split - &_order[0]);
+        }
+
+        if (mid == first || mid == first + count)
+        {   // all centers coincide or the split failed: fall back to a median split
+            osg::Vec3f ext = box._max - box._min;
+            int axis = (ext[0] > ext[1]) ? (ext[0] > ext[2] ? 0 : 2) : (ext[1] > ext[2] ? 1 : 2);
+            mid = first + count / 2;
+            std::nth_element(&_order[first], &_order[mid], &_order[first] + count,
+                             [&](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+        }
+
+        _nodes[index].count = 0;
+        buildNode(boxes, centers, first, mid - first, depth + 1);
+        unsigned int right = buildNode(boxes, centers, mid, first + count - mid, depth + 1);
+        _nodes[index].right = right; return index;
+    }
+
+    bool intersectTriangle(unsigned int t, const osg::Vec3d& s, const osg::Vec3d& dir, double tMax,
+                           double& ratio, double& u, double& v) const
+    {   // Moller-Trumbore test in double precision
+        osg::Vec3d v0 = getVertex(t, 0), e1 = osg::Vec3d(getVertex(t, 1)) - v0,
+                   e2 = osg::Vec3d(getVertex(t, 2)) - v0, p = dir ^ e2;
+        double det = e1 * p; if (fabs(det) < 1e-18) return false;
+        double invDet = 1.0 / det; osg::Vec3d tv = s - v0;
+        u = (tv * p) * invDet; if (u < 0.0 || u > 1.0) return false;
+        osg::Vec3d q = tv ^ e1;
+        v = (dir * q) * invDet; if (v < 0.0 || u + v > 1.0) return false;
+        ratio = (e2 * q) * invDet; return ratio >= 0.0 && ratio <= tMax;
+    }
+
+    static bool intersectBox(const osg::BoundingBoxf& bb, const osg::Vec3d& s, const osg::Vec3d& dir,
+                             const osg::Vec3d& invDir, double tMax)
+    {
+        double t0 = 0.0, t1 = tMax;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (dir[i] == 0.0)
+            { if (s[i] < bb._min[i] || s[i] > bb._max[i]) return false; continue; }
+            double tNear = (bb._min[i] - s[i]) * invDir[i], tFar = (bb._max[i] - s[i]) * invDir[i];
+            if (tNear > tFar) std::swap(tNear, tFar);
+            t0 = osg::maximum(t0, tNear); t1 = osg::minimum(t1, tFar);
+            if (t0 > t1) return false;
+        }
+        return true;
+    }
+
+    static bool intersectBox(const osg::BoundingBoxf& bb, const osg::Polytope::PlaneList& planes)
+    {
+        for (size_t p = 0; p < planes.size(); ++p)
+        {   // reject if the most positive corner is still outside
+            const osg::Vec3d n = planes[p].getNormal();
+            osg::Vec3d corner(n[0] >= 0.0 ? bb._max[0] : bb._min[0], n[1] >= 0.0 ? bb._max[1] : bb._min[1],
+                              n[2] >= 0.0 ? bb._max[2] : bb._min[2]);
+            if (planes[p].distance(corner) < 0.0) return false;
+        }
+        return true;
+    }
+
+    static float computeArea(const osg::BoundingBoxf& bb)
+    {
+        if (!bb.valid()) return 0.0f; osg::Vec3f ext = bb._max - bb._min;
+        return 2.0f * (ext[0] * ext[1] + ext[1] * ext[2] + ext[2] * ext[0]);
+    }
+
+    struct CollectTriangleOperator
+    {
+        std::vector<unsigned int>* indices;
+        std::vector<unsigned int>* primitiveIndices;
+        unsigned int numVertices, primitiveIndex;
+        CollectTriangleOperator() : indices(NULL), primitiveIndices(NULL), numVertices(0), primitiveIndex(0) {}
+
+        void operator()(unsigned int i1, unsigned int i2, unsigned int i3)
+        {   // keep primitive indices in the same order as osgUtil intersectors do
+            unsigned int index = primitiveIndex++;
+            if (i1 == i2 || i2 == i3 || i1 == i3) return;
+            if (i1 >= numVertices || i2 >= numVertices || i3 >= numVertices) return;
+            indices->push_back(i1); indices->push_back(i2); indices->push_back(i3);
+            primitiveIndices->push_back(index);
+        }
+    };
+
+    osg::observer_ptr<osg::Geometry> _geometry;
+    std::vector<osg::Vec3f> _vertices;
+    std::vector<unsigned int> _indices, _primitiveIndices, _order;
+    std::vector<Node> _nodes;
+    unsigned long long _key;
+    std::atomic<bool> _ready, _usable;
+};
+
+/// TriangleBVHManager: the BVH cache, with worker threads building requested BVHs in background
+class TriangleBVHManager : public osg::Referenced
+{
+public:
+    static TriangleBVHManager* instance()
+    {
+        static osg::ref_ptr<TriangleBVHManager> s_instance = new TriangleBVHManager;
+        return s_instance.get();
+    }
+
+    void setEnabled(bool b, unsigned int minTriangles)
+    { _enabled = b; _minTriangles = minTriangles; if (!b) clear(); }
+
+    bool getEnabled() const { return _enabled; }
+    unsigned int getMinTriangles() const { return _minTriangles; }
+
+    /** Return the BVH of the drawable if it is ready, otherwise request it and return NULL */
+    osg::ref_ptr<TriangleBVH> get(osg::Drawable* drawable)
+    {
+        osg::Geometry* geom = getQualifiedGeometry(drawable);
+        if (!geom) return NULL;
+
+        unsigned long long key = TriangleBVH::computeKey(geom);
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        std::map<osg::Geometry*, osg::ref_ptr<TriangleBVH>>::iterator itr = _bvhMap.find(geom);
+        if (itr != _bvhMap.end())
+        {
+            TriangleBVH* bvh = itr->second.get();
+            if (bvh->getGeometry() == geom && bvh->getKey() == key)
+                return bvh->isUsable() ? bvh : NULL;
+            _bvhMap.erase(itr);  // geometry deleted or vertices modified
+        }
+
+        for (itr = _bvhMap.begin(); itr != _bvhMap.end();)
+        {   // remove BVHs of deleted geometries
+            if (!itr->second->getGeometry()) itr = _bvhMap.erase(itr);
+            else ++itr;
+        }
+
+        osg::ref_ptr<TriangleBVH> bvh = new TriangleBVH(geom, key);
+        _bvhMap[geom] = bvh; _tasks.push_back(bvh); _condition.signal();
+        if (_threads.empty())
+        {
+            int numThreads = osg::clampBetween(OpenThreads::GetNumberOfProcessors() / 2, 1, 4);
+            for (int i = 0; i < numThreads; ++i)
+            { _threads.push_back(new BuildThread(this)); _threads.back()->start(); }
+        }
+        return NULL;
+    }
+
+    /** Build the BVH of the drawable in current thread if it is not ready yet */
+    osg::ref_ptr<TriangleBVH> build(osg::Drawable* drawable)
+    {
+        osg::Geometry* geom = getQualifiedGeometry(drawable);
+        if (!geom) return NULL;
+
+        unsigned long long key = TriangleBVH::computeKey(geom);
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            std::map<osg::Geometry*, osg::ref_ptr<TriangleBVH>>::iterator itr = _bvhMap.find(geom);
+            if (itr != _bvhMap.end() && itr->second->getGeometry() == geom &&
+                itr->second->getKey() == key && itr->second->isReady())
+                return itr->second->isUsable() ? itr->second : NULL;
+        }
+
+        // A pending task of the same geometry is skipped by workers once replaced here
+        osg::ref_ptr<TriangleBVH> bvh = new TriangleBVH(geom, key); bvh->build();
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _bvhMap[geom] = bvh; return bvh->isUsable() ? bvh : NULL;
+    }
+
+    void clear()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _bvhMap.clear(); _tasks.clear();
+    }
+
+    /** Wait until a task is requested; return NULL if the manager is quitting */
+    osg::ref_ptr<TriangleBVH> takeTask()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        while (_tasks.empty() && !_quitting) _condition.wait(&_mutex);
+        if (_quitting) return NULL;
+
+        osg::ref_ptr<TriangleBVH> bvh = _tasks.front();
+        _tasks.pop_front(); return bvh;
+    }
+
+protected:
+    TriangleBVHManager() : _minTriangles(10000), _enabled(true), _quitting(false) {}
+
+    osg::Geometry* getQualifiedGeometry(osg::Drawable* drawable) const
+    {
+        osg::Geometry* geom = (_enabled && drawable) ? drawable->asGeometry() : NULL;
+        if (!geom || TriangleBVH::estimateNumTriangles(geom) < _minTriangles) return NULL;
+        return geom;
+    }
+
+    virtual ~TriangleBVHManager()
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _quitting = true; _condition.broadcast();
+        }
+
+        for (size_t i = 0; i < _threads.size(); ++i)
+        { _threads[i]->join(); delete _threads[i]; }
+    }
+
+    class BuildThread : public OpenThreads::Thread
+    {
+    public:
+        BuildThread(TriangleBVHManager* m) : _manager(m) {}
+
+        virtual void run()
+        {
+            osg::ref_ptr<TriangleBVH> bvh;
+            while ((bvh = _manager->takeTask()).valid())
+            { if (bvh->referenceCount() > 1) bvh->build(); bvh = NULL; }
+        }
+
+        TriangleBVHManager* _manager;
+    };
+
+    std::map<osg::Geometry*, osg::ref_ptr<TriangleBVH>> _bvhMap;
+    std::list<osg::ref_ptr<TriangleBVH>> _tasks;
+    std::vector<BuildThread*> _threads;
+    OpenThreads::Mutex _mutex;
+    OpenThreads::Condition _condition;
+    unsigned int _minTriangles;
+    bool _enabled, _quitting;
+};
+
+/// Drawables with ready BVHs found during traversal, processed later (possibly in parallel)
+struct LineBVHTask
+{
+    osg::ref_ptr<TriangleBVH> bvh;
+    osg::ref_ptr<osg::Drawable> drawable;
+    osg::ref_ptr<osg::RefMatrix> matrix;
+    osg::NodePath nodePath;
+    osg::Vec3d start, end;
+};
+
+struct PolytopeBVHTask
+{
+    osg::ref_ptr<TriangleBVH> bvh;
+    osg::ref_ptr<osg::Drawable> drawable;
+    osg::ref_ptr<osg::RefMatrix> matrix;
+    osg::NodePath nodePath;
+    osg::Polytope::PlaneList planes;
+    osg::Plane referencePlane;
+};
+
+static void computeLineBVHIntersections(
+    const LineBVHTask& task, osgUtil::Intersector::IntersectionLimit limit,
+    std::vector<osgUtil::LineSegmentIntersector::Intersection>& intersections)
+{
+    std::vector<TriangleBVH::LineHit> hits;
+    TriangleBVH::LineQuery query = (limit == osgUtil::Intersector::NO_LIMIT) ? TriangleBVH::ALL_HITS
+                                 : (limit == osgUtil::Intersector::LIMIT_ONE) ? TriangleBVH::ANY_HIT
+                                 : TriangleBVH::NEAREST_HIT;
+    if (!task.bvh->intersect(task.start, task.end, query, hits)) return;
+
+    const TriangleBVH* bvh = task.bvh.get();
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+        const TriangleBVH::LineHit& h = hits[i]; unsigned int t = h.triangle;
+        osgUtil::LineSegmentIntersector::Intersection hit;
+        hit.ratio = h.ratio; hit.nodePath = task.nodePath;
+        hit.drawable = task.drawable; hit.matrix = task.matrix;
+        hit.localIntersectionPoint = task.start * (1.0 - h.ratio) + task.end * h.ratio;
+
+        osg::Vec3 normal = (bvh->getVertex(t, 1) - bvh->getVertex(t, 0)) ^
+                           (bvh->getVertex(t, 2) - bvh->getVertex(t, 1));
+        normal.normalize(); hit.localIntersectionNormal = normal;
+        for (int k = 0; k < 3; ++k) hit.indexList.push_back(bvh->getVertexIndex(t, k));
+        hit.ratioList.push_back(1.0 - h.u - h.v);
+        hit.ratioList.push_back(h.u); hit.ratioList.push_back(h.v);
+        hit.primitiveIndex = bvh->getPrimitiveIndex(t);
+        intersections.push_back(hit);
+    }
+}
+
+static void computePolytopeBVHIntersections(
+    const PolytopeBVHTask& task, std::vector<osgUtil::PolytopeIntersector::Intersection>& intersections)
+{
+    typedef osgUtil::PolytopeIntersector::Intersection Intersection;
+    const TriangleBVH* bvh = task.bvh.get();
+    bvh->intersect(task.planes, [&](unsigned int t, const std::vector<osg::Vec3d>& points)
+    {
+        Intersection hit; osg::Vec3d center; double maxDistance = -DBL_MAX;
+        hit.nodePath = task.nodePath; hit.drawable = task.drawable; hit.matrix = task.matrix;
+        hit.numIntersectionPoints = osg::minimum((unsigned int)points.size(),
+                                                 (unsigned int)Intersection::MaxNumIntesectionPoints);
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            double d = task.referencePlane.distance(points[i]);
+            if (d > maxDistance) maxDistance = d; center += points[i];
+            if (i < hit.numIntersectionPoints) hit.intersectionPoints[i] = points[i];
+        }
+
+        center /= (double)points.size();
+        hit.localIntersectionPoint = center;
+        hit.distance = task.referencePlane.distance(center);
+        hit.maxDistance = maxDistance;
+        hit.primitiveIndex = bvh->getPrimitiveIndex(t);
+        intersections.push_back(hit);
+    });
+}
+
 class LineSegmentIntersectorEx : public osgUtil::LineSegmentIntersector
 {
 public:
     LineSegmentIntersectorEx(const osg::Vec3d& s, const osg::Vec3d& e)
-        : osgUtil::LineSegmentIntersector(s, e) {}
+        : osgUtil::LineSegmentIntersector(s, e), _deferredTasks(NULL) {}
 
     LineSegmentIntersectorEx(CoordinateFrame cf, const osg::Vec3d& s, const osg::Vec3d& e)
-        : osgUtil::LineSegmentIntersector(cf, s, e) {}
+        : osgUtil::LineSegmentIntersector(cf, s, e), _deferredTasks(NULL) {}
 
     LineSegmentIntersectorEx(CoordinateFrame cf, double x, double y)
-        : osgUtil::LineSegmentIntersector(cf, x, y) {}
+        : osgUtil::LineSegmentIntersector(cf, x, y), _deferredTasks(NULL) {}
 
     virtual Intersector* clone(osgUtil::IntersectionVisitor& iv)
     {
@@ -143,6 +681,7 @@ public:
             lsi->_parent = this;
             lsi->_nodesToIgnore = _nodesToIgnore;
             lsi->_intersectionLimit = this->_intersectionLimit;
+            lsi->_deferredTasks = _deferredTasks;
             return lsi.release();
         }
 
@@ -178,6 +717,7 @@ public:
         lsi->_parent = this;
         lsi->_nodesToIgnore = _nodesToIgnore;
         lsi->_intersectionLimit = this->_intersectionLimit;
+        lsi->_deferredTasks = _deferredTasks;
         return lsi.release();
     }
 
@@ -187,20 +727,46 @@ public:
         return osgUtil::LineSegmentIntersector::enter(node);
     }
 
+    virtual void intersect(osgUtil::IntersectionVisitor& iv, osg::Drawable* drawable)
+    {
+        osg::ref_ptr<TriangleBVH> bvh = TriangleBVHManager::instance()->get(drawable);
+        if (!bvh) { osgUtil::LineSegmentIntersector::intersect(iv, drawable); return; }
+        if ((_intersectionLimit == LIMIT_ONE && containsIntersections()) || iv.getDoDummyTraversal()) return;
+
+        LineBVHTask task; task.bvh = bvh; task.drawable = drawable;
+        task.matrix = iv.getModelMatrix(); task.nodePath = iv.getNodePath();
+        task.start = _start; task.end = _end;
+        if (_deferredTasks) { _deferredTasks->push_back(task); return; }
+
+        std::vector<Intersection> hits;
+        computeLineBVHIntersections(task, _intersectionLimit, hits);
+        for (size_t i = 0; i < hits.size(); ++i) insertBVHIntersection(hits[i]);
+    }
+
+    void insertBVHIntersection(const Intersection& hit)
+    {
+        Intersections& all = getIntersections();
+        if (_intersectionLimit == LIMIT_ONE && !all.empty()) return;
+        else if (_intersectionLimit == LIMIT_NEAREST && !all.empty())
+        { if (hit.ratio >= all.begin()->ratio) return; all.clear(); }
+        all.insert(hit);
+    }
+
     std::set<osg::Node*> _nodesToIgnore;
+    std::vector<LineBVHTask>* _deferredTasks;  // if set, BVH drawables are recorded and computed later
 };
 
 class PolytopeIntersectorEx : public osgUtil::PolytopeIntersector
 {
 public:
     PolytopeIntersectorEx(const osg::Polytope& polytope)
-        : osgUtil::PolytopeIntersector(polytope) {}
+        : osgUtil::PolytopeIntersector(polytope), _deferredTasks(NULL) {}
 
     PolytopeIntersectorEx(CoordinateFrame cf, const osg::Polytope& polytope)
-        : osgUtil::PolytopeIntersector(cf, polytope) {}
+        : osgUtil::PolytopeIntersector(cf, polytope), _deferredTasks(NULL) {}
 
     PolytopeIntersectorEx(CoordinateFrame cf, double xMin, double yMin, double xMax, double yMax)
-        : osgUtil::PolytopeIntersector(cf, xMin, yMin, xMax, yMax) {}
+        : osgUtil::PolytopeIntersector(cf, xMin, yMin, xMax, yMax), _deferredTasks(NULL) {}
 
     Intersector* clone(osgUtil::IntersectionVisitor& iv)
     {
@@ -211,6 +777,7 @@ public:
             pi->_nodesToIgnore = _nodesToIgnore;
             pi->_intersectionLimit = this->_intersectionLimit;
             pi->_referencePlane = this->_referencePlane;
+            pi->_deferredTasks = _deferredTasks;
             return pi.release();
         }
 
@@ -248,6 +815,7 @@ public:
         pi->_intersectionLimit = this->_intersectionLimit;
         pi->_referencePlane = this->_referencePlane;
         pi->_referencePlane.transformProvidingInverse(matrix);
+        pi->_deferredTasks = _deferredTasks;
         return pi.release();
     }
 
@@ -257,8 +825,33 @@ public:
         return osgUtil::PolytopeIntersector::enter(node);
     }
 
+    virtual void intersect(osgUtil::IntersectionVisitor& iv, osg::Drawable* drawable)
+    {
+        osg::ref_ptr<TriangleBVH> bvh = TriangleBVHManager::instance()->get(drawable);
+        if (!bvh) { osgUtil::PolytopeIntersector::intersect(iv, drawable); return; }
+        if ((_intersectionLimit == LIMIT_ONE && containsIntersections()) || iv.getDoDummyTraversal()) return;
+
+        PolytopeBVHTask task; task.bvh = bvh; task.drawable = drawable;
+        task.matrix = iv.getModelMatrix(); task.nodePath = iv.getNodePath();
+        task.planes = _polytope.getPlaneList(); task.referencePlane = _referencePlane;
+        if (_deferredTasks) { _deferredTasks->push_back(task); return; }
+
+        std::vector<Intersection> hits; computePolytopeBVHIntersections(task, hits);
+        for (size_t i = 0; i < hits.size(); ++i) insertBVHIntersection(hits[i]);
+    }
+
+    void insertBVHIntersection(const Intersection& hit)
+    {
+        Intersections& all = getIntersections();
+        if (_intersectionLimit == LIMIT_ONE && !all.empty()) return;
+        else if (_intersectionLimit == LIMIT_NEAREST && !all.empty())
+        { if (hit.distance >= all.begin()->distance) return; all.clear(); }
+        all.insert(hit);
+    }
+
     const osg::Polytope& getCurrentPolytope() const { return _polytope; }
     std::set<osg::Node*> _nodesToIgnore;
+    std::vector<PolytopeBVHTask>* _deferredTasks;  // if set, BVH drawables are recorded and computed later
 };
 
 static void applyLinesegmentIntersectionCondition(
@@ -356,8 +949,67 @@ static void savePolytopeIntersectionResult(
     result.primitiveIndex = intersection.primitiveIndex;
 }
 
+static void applyDeferredLineTasks(LineSegmentIntersectorEx* intersector, const std::vector<LineBVHTask>& tasks)
+{
+    typedef osgUtil::LineSegmentIntersector::Intersection Intersection;
+    std::vector<std::vector<Intersection>> hits(tasks.size());
+    osgUtil::Intersector::IntersectionLimit limit = intersector->getIntersectionLimit();
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)tasks.size(); ++i)
+        computeLineBVHIntersections(tasks[i], limit, hits[i]);
+
+    for (size_t i = 0; i < hits.size(); ++i)
+    { for (size_t j = 0; j < hits[i].size(); ++j) intersector->insertBVHIntersection(hits[i][j]); }
+}
+
+static void applyDeferredPolytopeTasks(PolytopeIntersectorEx* intersector,
+                                       const std::vector<PolytopeBVHTask>& tasks)
+{
+    typedef osgUtil::PolytopeIntersector::Intersection Intersection;
+    std::vector<std::vector<Intersection>> hits(tasks.size());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)tasks.size(); ++i)
+        computePolytopeBVHIntersections(tasks[i], hits[i]);
+
+    for (size_t i = 0; i < hits.size(); ++i)
+    { for (size_t j = 0; j < hits[i].size(); ++j) intersector->insertBVHIntersection(hits[i][j]); }
+}
+
 namespace osgVerse
 {
+    void setIntersectionBVHEnabled(bool enabled, unsigned int minTriangles)
+    { TriangleBVHManager::instance()->setEnabled(enabled, minTriangles); }
+
+    bool getIntersectionBVHEnabled()
+    { return TriangleBVHManager::instance()->getEnabled(); }
+
+    void clearIntersectionBVHCache()
+    { TriangleBVHManager::instance()->clear(); }
+
+    unsigned int prepareIntersectionBVH(osg::Node* node)
+    {
+        class CollectGeometryVisitor : public osg::NodeVisitor
+        {
+        public:
+            CollectGeometryVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+            virtual void apply(osg::Geode& node)
+            {
+                for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+                    drawables.insert(node.getDrawable(i));
+                traverse(node);
+            }
+            std::set<osg::Drawable*> drawables;
+        };
+
+        CollectGeometryVisitor cgv; if (node) node->accept(cgv);
+        std::vector<osg::Drawable*> drawables(cgv.drawables.begin(), cgv.drawables.end());
+        unsigned int numReady = 0;
+#pragma omp parallel for reduction(+:numReady)
+        for (int i = 0; i < (int)drawables.size(); ++i)
+        { if (TriangleBVHManager::instance()->build(drawables[i]).valid()) numReady++; }
+        return numReady;
+    }
+
     IntersectionResult findNearestIntersection(
         osg::Node* node, double xNorm, double yNorm, IntersectionCondition* condition)
     {
@@ -397,6 +1049,23 @@ namespace osgVerse
         return result;
     }
 
+    std::vector<IntersectionResult> findNearestIntersections(
+        osg::Node* node, const std::vector<std::pair<osg::Vec3d, osg::Vec3d>>& segments,
+        IntersectionCondition* condition)
+    {
+        std::vector<IntersectionResult> results(segments.size());
+        if (!node || segments.empty()) return results;
+        node->getBound();  // make sure all bounds are computed before traversing in parallel
+
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int i = 0; i < (int)segments.size(); ++i)
+        {
+            const std::pair<osg::Vec3d, osg::Vec3d>& seg = segments[i];
+            results[i] = findNearestIntersection(node, seg.first, seg.second, condition);
+        }
+        return results;
+    }
+
     std::vector<IntersectionResult> findAllIntersections(
         osg::Node* node, const osg::Vec3d& s, const osg::Vec3d& e, IntersectionCondition* condition)
     {
@@ -406,7 +1075,10 @@ namespace osgVerse
         osgUtil::IntersectionVisitor iv(intersector.get());
         if (condition)
             applyLinesegmentIntersectionCondition(iv, intersector.get(), condition);
-        node->accept(iv);
+
+        std::vector<LineBVHTask> tasks; intersector->_deferredTasks = &tasks;
+        node->accept(iv); intersector->_deferredTasks = NULL;
+        applyDeferredLineTasks(intersector.get(), tasks);
 
         std::vector<IntersectionResult> results;
         if (intersector->containsIntersections())
@@ -472,7 +1144,10 @@ namespace osgVerse
         osgUtil::IntersectionVisitor iv(intersector.get());
         if (condition)
             applyPolytopeIntersectionCondition(iv, intersector.get(), condition);
-        node->accept(iv);
+
+        std::vector<PolytopeBVHTask> tasks; intersector->_deferredTasks = &tasks;
+        node->accept(iv); intersector->_deferredTasks = NULL;
+        applyDeferredPolytopeTasks(intersector.get(), tasks);
 
         std::vector<IntersectionResult> results;
         if (intersector->containsIntersections())
@@ -51,6 +51,19 @@ namespace osgVerse
         osg::Node* findNode(FindNodeFunc func);
     };
 
+    /** Enable cached BVHs for triangle drawables with at least minTriangles triangles (default: on, 10000).
+        A BVH is built in background threads at the first query of the drawable (which still uses the default
+        intersector), and is rebuilt automatically once its vertex array or primitive sets are modified */
+    extern void setIntersectionBVHEnabled(bool enabled, unsigned int minTriangles = 10000);
+    extern bool getIntersectionBVHEnabled();
+
+    /** Release all cached BVHs */
+    extern void clearIntersectionBVHCache();
+
+    /** Build BVHs of all qualified drawables under the node at once (in current thread, instead of waiting
+        for background threads), e.g., before heavy queries. Returns number of ready BVHs */
+    extern unsigned int prepareIntersectionBVH(osg::Node* node);
+
     /** Find nearest intersection result with projected coordinates to form a linesegment */
     extern IntersectionResult findNearestIntersection(
         osg::Node* node, double xNorm, double yNorm, IntersectionCondition* condition = 0);
@@ -59,6 +72,12 @@ namespace osgVerse
     extern IntersectionResult findNearestIntersection(
         osg::Node* node, const osg::Vec3d&, const osg::Vec3d&, IntersectionCondition* condition = 0);
 
+    /** Find nearest intersection results of many 3D linesegments at once, e.g., for line-of-sight analysis.
+        Segments are tested in parallel and results are returned in the same order */
+    extern std::vector<IntersectionResult> findNearestIntersections(
+        osg::Node* node, const std::vector<std::pair<osg::Vec3d, osg::Vec3d>>& segments,
+        IntersectionCondition* condition = 0);
+
     /** Find all intersection results with a 3D linesegment */
     extern std::vector<IntersectionResult> findAllIntersections(
         osg::Node* node, const osg::Vec3d&, const osg::Vec3d&, IntersectionCondition* condition = 0);
@@ -23,6 +23,7 @@ bool LightCullCallback::cull(osg::NodeVisitor* nv, osg::Drawable* drawable, osg:
         // If not culled, add parameters to global light manager
         LightGlobalManager::LightData lData;
         lData.light = ld; lData.frameNo = cv->getFrameStamp()->getFrameNumber();
+        lData.modifiedCount = ld->getModifiedCount();
         lData.matrix = ld->getEyeSpace() ? osg::Matrix() : (*cv->getModelViewMatrix());
         LightGlobalManager::instance()->add(lData);
         return !ld->getDebugShow();
@@ -31,7 +32,7 @@ bool LightCullCallback::cull(osg::NodeVisitor* nv, osg::Drawable* drawable, osg:
 }
 
 LightDrawable::LightDrawable()
-:   osg::ShapeDrawable(), _eyeSpace(false), _debugShow(false)
+:   osg::ShapeDrawable(), _modifiedCount(0), _eyeSpace(false), _debugShow(false)
 {
     setUseDisplayList(false); setUseVertexBufferObjects(true);
     setCullCallback(LightGlobalManager::instance()->getCallback());
@@ -45,7 +46,7 @@ LightDrawable::LightDrawable()
 LightDrawable::LightDrawable(const LightDrawable& copy, const osg::CopyOp& copyop)
 :   osg::ShapeDrawable(copy, copyop), _lightColor(copy._lightColor),
     _position(copy._position), _direction(copy._direction), _attenuationRange(copy._attenuationRange),
-    _spotCutoff(copy._spotCutoff), _eyeSpace(copy._eyeSpace),
+    _spotCutoff(copy._spotCutoff), _modifiedCount(0), _eyeSpace(copy._eyeSpace),
     _directional(copy._directional), _debugShow(copy._debugShow) {}
 
 LightDrawable::~LightDrawable()
@@ -98,7 +99,7 @@ void LightDrawable::recreate()
         break;
     }
 
-    setShape(shape.get());
+    setShape(shape.get()); _modifiedCount++;
     setComputeBoundingBoxCallback(
         unlimited ? new osgVerse::DisableBoundingBoxCallback : NULL);
     dirtyBound();
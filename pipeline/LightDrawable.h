@@ -23,7 +23,7 @@ namespace osgVerse
         Type getType(bool& unlimited) const;
 
         /** Set the color & power of the light. */
-        inline void setColor(const osg::Vec3& color) { _lightColor = color; }
+        inline void setColor(const osg::Vec3& color) { _lightColor = color; _modifiedCount++; }
 
         /** Get the color & power of the light. */
         inline const osg::Vec3& getColor() const { return _lightColor; }
@@ -70,12 +70,16 @@ namespace osgVerse
         /** Get if show debug wireframe model of the light. */
         bool getDebugShow() const { return _debugShow; }
 
+        /** Get the counter which increases whenever a light parameter is changed. */
+        unsigned int getModifiedCount() const { return _modifiedCount; }
+
     protected:
         virtual ~LightDrawable();
         void recreate();
 
         osg::Vec3 _position, _direction, _lightColor;
         float _attenuationRange, _spotCutoff;
+        unsigned int _modifiedCount;
         bool _eyeSpace, _directional, _debugShow;
     };
 }
@@ -2,32 +2,92 @@
 #include <osgDB/ReadFile>
 #include <osgUtil/UpdateVisitor>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <modeling/Profiler.h>
 #include "LightModule.h"
 #include "ShadowModule.h"
 #include "Utilities.h"
 
 namespace osgVerse
 {
-    LightModule::LightModule(const std::string& name, Pipeline* pipeline, int maxLightsInPass)
-        : _pipeline(pipeline), _maxLightsInPass(maxLightsInPass)
+    struct LightClusterRange
     {
-        _parameterImage = new osg::Image;
-        _parameterImage->allocateImage(1024, 4, 1, GL_RGB, GL_FLOAT);
+        int x0, x1, y0, y1, z0, z1;
+        void setAll(int tx, int ty, int tz) { x0 = y0 = z0 = 0; x1 = tx - 1; y1 = ty - 1; z1 = tz - 1; }
+        void setEmpty() { x0 = y0 = z0 = 0; x1 = y1 = z1 = -1; }
+    };
+
+    static void allocateLightTable(osg::Image* image, int w, int h)
+    {
+        image->allocateImage(w, h, 1, GL_RGBA, GL_FLOAT);
 #if defined(VERSE_EMBEDDED_GLES2)
-        _parameterImage->setInternalTextureFormat(GL_RGB);
+        image->setInternalTextureFormat(GL_RGBA);
 #else
-        _parameterImage->setInternalTextureFormat(GL_RGB32F_ARB);
+        image->setInternalTextureFormat(GL_RGBA32F_ARB);
 #endif
+        memset(image->data(), 0, image->getTotalSizeInBytes());
+    }
+
+    static osg::Texture2D* createLightTableTexture(osg::Image* image)
+    {
+        osg::Texture2D* tex = new osg::Texture2D;
+        tex->setImage(image); tex->setResizeNonPowerOfTwoHint(false);
+        tex->setSubloadCallback(new DirtyRegionSubloadCallback);
+        tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+        tex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER);
+        tex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER);
+        tex->setBorderColor(osg::Vec4(0.0f, 0.0f, 0.0f, 0.0f));
+        return tex;
+    }
+
+    static DirtyRegionSubloadCallback* getSubloader(osg::Texture2D* tex)
+    { return static_cast<DirtyRegionSubloadCallback*>(tex->getSubloadCallback()); }
+
+    static int getPowerOfTwoRows(size_t required, int minimum)
+    {
+        int rows = minimum;
+        while ((size_t)rows < required) rows *= 2;
+        return rows;
+    }
+
+    static bool computeTileRange(float ndcMin, float ndcMax, int tiles, int& t0, int& t1)
+    {
+        if (ndcMin > ndcMax) std::swap(ndcMin, ndcMax);
+        if (ndcMax < -1.0f || ndcMin > 1.0f) return false;
+        t0 = osg::clampBetween((int)floorf((ndcMin * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+        t1 = osg::clampBetween((int)floorf((ndcMax * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+        return true;
+    }
+
+    static int computeDepthSlice(float depth, float zNear, float sliceScale, int slices)
+    {
+        if (depth <= zNear) return 0;
+        return osg::clampBetween((int)(logf(depth / zNear) * sliceScale), 0, slices - 1);
+    }
+
+    LightModule::LightModule(const std::string& name, Pipeline* pipeline, int maxLightsInPass)
+        : _pipeline(pipeline), _clusterNear(1.0f), _numTruncatedClusters(0), _maxLightsInPass(maxLightsInPass),
+          _tilesX(16), _tilesY(9), _depthSlices(24), _clusterDirty(true)
+    {
+        _parameterImage = new osg::Image;
+        allocateLightTable(_parameterImage.get(), 1024, 4);
+        _parameterTex = createLightTableTexture(_parameterImage.get());
+
+        _clusterImage = new osg::Image;
+        allocateLightTable(_clusterImage.get(), _tilesX * _tilesY, _depthSlices);
+        _clusterTex = createLightTableTexture(_clusterImage.get());
 
-        _parameterTex = new osg::Texture2D;
-        _parameterTex->setImage(_parameterImage.get());
-        _parameterTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
-        _parameterTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
-        _parameterTex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER);
-        _parameterTex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER);
-        _parameterTex->setBorderColor(osg::Vec4(0.0f, 0.0f, 0.0f, 0.0f));
+        _indexImage = new osg::Image;
+        allocateLightTable(_indexImage.get(), 1024, 1);
+        _indexTex = createLightTableTexture(_indexImage.get());
 
         _lightNumber = new osg::Uniform("LightNumber", osg::Vec2(0.0f, (float)maxLightsInPass));
+        _lightTableSize = new osg::Uniform("LightTableSize", osg::Vec2(4.0f, 1.0f));
+        _lightClusterGrid = new osg::Uniform(
+            "LightClusterGrid", osg::Vec3((float)_tilesX, (float)_tilesY, (float)_depthSlices));
+        _lightClusterDepth = new osg::Uniform("LightClusterDepth", osg::Vec2(_clusterNear, _clusterNear * 2.0f));
         if (pipeline) pipeline->addModule(name, this);
     }
 
@@ -36,10 +96,20 @@ namespace osgVerse
         if (_pipeline.valid()) _pipeline->removeModule(this);
     }
 
+    void LightModule::setClusterGrid(int tilesX, int tilesY, int depthSlices)
+    {
+        _tilesX = osg::maximum(tilesX, 1); _tilesY = osg::maximum(tilesY, 1);
+        _depthSlices = osg::maximum(depthSlices, 1); _clusterDirty = true;
+        allocateLightTable(_clusterImage.get(), _tilesX * _tilesY, _depthSlices);
+        getSubloader(_clusterTex.get())->dirtyAll();
+        _lightClusterGrid->set(osg::Vec3((float)_tilesX, (float)_tilesY, (float)_depthSlices));
+    }
+
     void LightModule::operator()(osg::Node* node, osg::NodeVisitor* nv)
     {
         osgUtil::UpdateVisitor* uv = static_cast<osgUtil::UpdateVisitor*>(nv);
         if (!uv) { traverse(node, nv); return; }
+        VERSE_PROFILE_ZONE_CATEGORY("LightModule", "pipeline");
 
         // Update shadow module if main-light exists
         const float dirLength = 1000.0f;
@@ -60,35 +130,194 @@ namespace osgVerse
         // Prune global light manager
         if (uv->getFrameStamp() && !(uv->getFrameStamp()->getFrameNumber() % 10))
             LightGlobalManager::instance()->prune(uv->getFrameStamp());
-        if (!LightGlobalManager::instance()->checkDirty())
+
+        // Light clusters are built in the main camera's view space
+        osg::Matrix proj; bool hasProjection = false;
+        if (_pipeline.valid() && _pipeline->getForwardCamera() != NULL)
+        { proj = _pipeline->getForwardCamera()->getProjectionMatrix(); hasProjection = true; }
+
+        bool lightsChanged = LightGlobalManager::instance()->checkDirty();
+        if (!lightsChanged && !_clusterDirty && proj == _clusterProjection)
         { traverse(node, nv); return; }
+        _clusterProjection = proj; _clusterDirty = false;
 
         // Get and sort lights by its importance (e.g., last frame number, distance to eye)
         std::vector<LightGlobalManager::LightData> resultLights;
         size_t numData = LightGlobalManager::instance()->getSortedResult(resultLights);
-        if (numData > 1024) numData = 1024;
+        int parameterRows = getPowerOfTwoRows(((numData + 1023) / 1024) * 4, 4);
+        if (parameterRows != _parameterImage->t())
+        {
+            allocateLightTable(_parameterImage.get(), 1024, parameterRows);
+            getSubloader(_parameterTex.get())->dirtyAll();
+        }
 
         // Save all lights to a parameter texture to use in deferred shader
-        osg::Vec3f* paramPtr = (osg::Vec3f*)_parameterImage->data();
-        for (size_t i = 0; i < numData; ++i)
+        std::vector<osg::Vec4> lightSpheres(numData);
+        std::vector<char> lightChanged(numData, 0);
+        float clusterFar = _clusterNear * 2.0f;
+#pragma omp parallel for
+        for (int i = 0; i < (int)numData; ++i)
         {
             LightGlobalManager::LightData& ld = resultLights[i];
-            if (!ld.light) continue; bool unlimited = false;
-            LightDrawable::Type t = ld.light->getType(unlimited);
+            if (!ld.light) { lightSpheres[i].set(0.0f, 0.0f, 0.0f, 0.0f); continue; }
+
+            bool unlimited = false; LightDrawable::Type t = ld.light->getType(unlimited);
             const osg::Vec3& color = ld.light->getColor();
             osg::Vec3 pos0 = ld.light->getPosition() * ld.matrix;
             osg::Vec3 pos1 = (ld.light->getPosition() +
                               ld.light->getDirection() * dirLength) * ld.matrix;
             osg::Vec3 dir = pos1 - pos0; dir.normalize();
 
-            *(paramPtr + 1024 * 0 + i)/*light color*/ = osg::Vec3(color[0], color[1], color[2]);
-            *(paramPtr + 1024 * 1 + i)/*eye-space position, att*/ = osg::Vec3(pos0[0], pos0[1], pos0[2]);
-            *(paramPtr + 1024 * 2 + i)/*eye-space rotation, spot*/ = osg::Vec3(dir[0], dir[1], dir[2]);
-            *(paramPtr + 1024 * 3 + i)/*type, range, spot-cutoff*/ =
-                osg::Vec3((float)t, ld.light->getRange(), ld.light->getSpotCutoff());
+            float range = ld.light->getRange(), cutoff = ld.light->getSpotCutoff();
+            osg::Vec4f values[4] = {
+                osg::Vec4(color, (float)t)/*light color, type*/, osg::Vec4(pos0, range)/*eye-space position, range*/,
+                osg::Vec4(dir, cutoff)/*eye-space rotation, spot*/,
+                osg::Vec4((float)t, range, cutoff, 0.0f)/*type, range, spot-cutoff*/ };
+
+            int x = i % 1024, y = (i / 1024) * 4;
+            for (int r = 0; r < 4; ++r)
+            {
+                osg::Vec4f* ptr = (osg::Vec4f*)_parameterImage->data(x, y + r);
+                if (*ptr != values[r]) { *ptr = values[r]; lightChanged[i] = 1; }
+            }
+
+            // Negative radius means the light affects all clusters
+            if (unlimited || t == LightDrawable::Directional || !(range > 0.0f))
+                lightSpheres[i].set(pos0[0], pos0[1], pos0[2], -1.0f);
+            else
+                lightSpheres[i].set(pos0[0], pos0[1], pos0[2], range);
+        }
+
+        // Only upload changed lights, one texel run for each parameter row
+        std::vector<DirtyRegionSubloadCallback::TexelRun> paramRuns(
+            4, DirtyRegionSubloadCallback::TexelRun(getSubloader(_parameterTex.get())));
+        for (size_t i = 0; i < numData; ++i)
+        {
+            const osg::Vec4& sphere = lightSpheres[i];
+            if (sphere[3] > 0.0f) clusterFar = osg::maximum(clusterFar, -sphere[2] + sphere[3]);
+            if (!lightChanged[i]) continue;
+
+            unsigned int x = i % 1024, y = (i / 1024) * 4;
+            for (unsigned int r = 0; r < 4; ++r) paramRuns[r].add((y + r) * 1024 + x);
+        }
+        for (int r = 0; r < 4; ++r) paramRuns[r].flush();
+
+        // Compute cluster range of each light from its eye-space bounding sphere
+        bool perspective = hasProjection && proj(3, 3) == 0.0;
+        float sliceScale = (float)_depthSlices / logf(clusterFar / _clusterNear);
+        std::vector<LightClusterRange> lightRanges(numData);
+#pragma omp parallel for
+        for (int i = 0; i < (int)numData; ++i)
+        {
+            const osg::Vec4& sphere = lightSpheres[i];
+            LightClusterRange& lr = lightRanges[i];
+            if (!resultLights[i].light || sphere[3] == 0.0f) { lr.setEmpty(); continue; }
+            else if (sphere[3] < 0.0f) { lr.setAll(_tilesX, _tilesY, _depthSlices); continue; }
+
+            float r = sphere[3], dMin = -sphere[2] - r, dMax = -sphere[2] + r;
+            if (dMax < 0.0f) { lr.setEmpty(); continue; }
+            lr.z0 = computeDepthSlice(dMin, _clusterNear, sliceScale, _depthSlices);
+            lr.z1 = computeDepthSlice(dMax, _clusterNear, sliceScale, _depthSlices);
+            if (!hasProjection || (perspective && dMin < 1e-4f))
+            { lr.x0 = lr.y0 = 0; lr.x1 = _tilesX - 1; lr.y1 = _tilesY - 1; continue; }
+
+            float ndc[4];  // xMin, xMax, yMin, yMax
+            if (perspective)
+            {
+                ndc[0] = osg::minimum((sphere[0] - r) / dMin, (sphere[0] - r) / dMax) * proj(0, 0) - proj(2, 0);
+                ndc[1] = osg::maximum((sphere[0] + r) / dMin, (sphere[0] + r) / dMax) * proj(0, 0) - proj(2, 0);
+                ndc[2] = osg::minimum((sphere[1] - r) / dMin, (sphere[1] - r) / dMax) * proj(1, 1) - proj(2, 1);
+                ndc[3] = osg::maximum((sphere[1] + r) / dMin, (sphere[1] + r) / dMax) * proj(1, 1) - proj(2, 1);
+            }
+            else
+            {
+                ndc[0] = (sphere[0] - r) * proj(0, 0) + proj(3, 0);
+                ndc[1] = (sphere[0] + r) * proj(0, 0) + proj(3, 0);
+                ndc[2] = (sphere[1] - r) * proj(1, 1) + proj(3, 1);
+                ndc[3] = (sphere[1] + r) * proj(1, 1) + proj(3, 1);
+            }
+
+            if (!computeTileRange(ndc[0], ndc[1], _tilesX, lr.x0, lr.x1) ||
+                !computeTileRange(ndc[2], ndc[3], _tilesY, lr.y0, lr.y1)) lr.setEmpty();
         }
+
+        // Assign lights to clusters, each depth slice in its own thread
+        int numTiles = _tilesX * _tilesY, numClusters = numTiles * _depthSlices;
+        _clusterLists.resize(numClusters);
+#pragma omp parallel for
+        for (int z = 0; z < _depthSlices; ++z)
+        {
+            std::vector<unsigned int>* sliceLists = &_clusterLists[z * numTiles];
+            for (int c = 0; c < numTiles; ++c) sliceLists[c].clear();
+            for (size_t i = 0; i < numData; ++i)
+            {
+                const LightClusterRange& lr = lightRanges[i];
+                if (z < lr.z0 || z > lr.z1) continue;
+                for (int y = lr.y0; y <= lr.y1; ++y)
+                    for (int x = lr.x0; x <= lr.x1; ++x)
+                        sliceLists[y * _tilesX + x].push_back((unsigned int)i);
+            }
+        }
+
+        // Shaders iterate at most maxLightsInPass lights of a cluster; lights are sorted by importance,
+        // so only keep the first ones and tell user instead of dropping the others silently
+        unsigned int numTruncated = 0; size_t maxInCluster = 0;
+        for (int c = 0; c < numClusters; ++c)
+        {
+            std::vector<unsigned int>& list = _clusterLists[c];
+            maxInCluster = osg::maximum(maxInCluster, list.size());
+            if ((int)list.size() > _maxLightsInPass) { list.resize(_maxLightsInPass); numTruncated++; }
+        }
+
+        if (numTruncated > 0 && _numTruncatedClusters == 0)
+            OSG_NOTICE << "[LightModule] " << numTruncated << " clusters have more than " << _maxLightsInPass
+                       << " lights (max = " << maxInCluster << "), less important ones are ignored. "
+                       << "Increase maxLightsInPass or cluster grid to avoid this" << std::endl;
+        _numTruncatedClusters = numTruncated;
+
+        // Compact all cluster lists into the index list texture
+        std::vector<size_t> offsets(numClusters); size_t numIndices = 0;
+        osg::Vec4f* clusterPtr = (osg::Vec4f*)_clusterImage->data();
+        DirtyRegionSubloadCallback::TexelRun clusterRun(getSubloader(_clusterTex.get()));
+        for (int c = 0; c < numClusters; ++c)
+        {
+            size_t count = _clusterLists[c].size(); offsets[c] = numIndices;
+            osg::Vec4f value((float)numIndices, (float)count, 0.0f, 0.0f); numIndices += count;
+            if (clusterPtr[c] != value) { clusterPtr[c] = value; clusterRun.add(c); }
+        }
+        clusterRun.flush();
+
+        int indexRows = getPowerOfTwoRows((numIndices + 4095) / 4096, 1);
+        if (indexRows != _indexImage->t())
+        {
+            allocateLightTable(_indexImage.get(), 1024, indexRows);
+            getSubloader(_indexTex.get())->dirtyAll();
+        }
+
+        float* indexPtr = (float*)_indexImage->data();
+        std::vector<char> clusterChanged(numClusters, 0);
+#pragma omp parallel for
+        for (int c = 0; c < numClusters; ++c)
+        {
+            const std::vector<unsigned int>& list = _clusterLists[c];
+            for (size_t j = 0; j < list.size(); ++j)
+            {
+                float& value = indexPtr[offsets[c] + j];
+                if (value != (float)list[j]) { value = (float)list[j]; clusterChanged[c] = 1; }
+            }
+        }
+
+        DirtyRegionSubloadCallback* indexSubloader = getSubloader(_indexTex.get());
+        for (int c = 0; c < numClusters; ++c)
+        {
+            if (!clusterChanged[c]) continue;
+            size_t first = offsets[c] / 4, last = (offsets[c] + _clusterLists[c].size() + 3) / 4;
+            indexSubloader->dirtyTexels((unsigned int)first, (unsigned int)(last - first));
+        }
+
         _lightNumber->set(osg::Vec2((float)numData, (float)_maxLightsInPass));
-        _parameterImage->dirty();
+        _lightTableSize->set(osg::Vec2((float)parameterRows, (float)indexRows));
+        _lightClusterDepth->set(osg::Vec2(_clusterNear, clusterFar));
         traverse(node, nv);
     }
 
@@ -96,8 +325,35 @@ namespace osgVerse
                                              const std::string& prefix, int startU)
     {
         stage->applyTexture(_parameterTex.get(), prefix, startU);
+        stage->applyTexture(_clusterTex.get(), "LightClusterMap", startU + 1);
+        stage->applyTexture(_indexTex.get(), "LightIndexMap", startU + 2);
         stage->applyUniform(getLightNumber());
-        return startU + 1;
+        stage->applyUniform(getLightTableSize());
+        stage->applyUniform(getLightClusterGrid());
+        stage->applyUniform(getLightClusterDepth());
+        return startU + 3;
+    }
+
+    int LightModule::applyTextureAndUniforms(osg::StateSet* ss, const std::string& prefix, int startU)
+    {
+        ss->setTextureAttributeAndModes(startU, _parameterTex.get());
+        ss->setTextureAttributeAndModes(startU + 1, _clusterTex.get());
+        ss->setTextureAttributeAndModes(startU + 2, _indexTex.get());
+        ss->addUniform(new osg::Uniform(prefix.c_str(), startU));
+        ss->addUniform(new osg::Uniform("LightClusterMap", startU + 1));
+        ss->addUniform(new osg::Uniform("LightIndexMap", startU + 2));
+        ss->addUniform(getLightNumber()); ss->addUniform(getLightTableSize());
+        ss->addUniform(getLightClusterGrid()); ss->addUniform(getLightClusterDepth());
+        if (_pipeline.valid()) ss->addUniform(_pipeline->getInvScreenResolution());
+        return startU + 3;
+    }
+
+    unsigned int LightModule::getBytesUploadedInLastFrame() const
+    {
+        osg::Texture2D* textures[3] = { _parameterTex.get(), _clusterTex.get(), _indexTex.get() };
+        unsigned int numBytes = 0;
+        for (int i = 0; i < 3; ++i) numBytes += getSubloader(textures[i])->getBytesUploadedInLastFrame();
+        return numBytes;
     }
 
     LightGlobalManager* LightGlobalManager::instance()
@@ -107,26 +363,46 @@ namespace osgVerse
     }
 
     LightGlobalManager::LightGlobalManager()
-    { _callback = new LightCullCallback; _dirty = false; }
+    { _callback = new LightCullCallback; _dirty = false; _sortDirty = false; }
+
+    void LightGlobalManager::add(const LightData& ld)
+    {
+        std::map<LightDrawable*, LightData>::iterator itr = _lights.find(ld.light);
+        if (itr == _lights.end())
+        { _lights[ld.light] = ld; _dirty = true; _sortDirty = true; return; }
+
+        // Only changed lights should require the light module to update
+        LightData& old = itr->second;
+        if (old.modifiedCount != ld.modifiedCount || old.matrix != ld.matrix) _dirty = true;
+        old = ld;
+    }
 
     size_t LightGlobalManager::getSortedResult(std::vector<LightData>& result)
     {
-        for (std::map<LightDrawable*, LightData>::iterator itr = _lights.begin();
-             itr != _lights.end(); ++itr)
-        { result.push_back(itr->second); }
-
-        std::sort(result.begin(), result.end(),
-                  [](const LightData& l, const LightData& r) {
-            // TODO: more sort comparers, like distance-to-eye?
-            return l.frameNo > r.frameNo;
-        });
+        if (_sortDirty)
+        {
+            _sortedLights.clear();
+            for (std::map<LightDrawable*, LightData>::iterator itr = _lights.begin();
+                 itr != _lights.end(); ++itr)
+            { _sortedLights.push_back(&(itr->second)); }
+
+            std::sort(_sortedLights.begin(), _sortedLights.end(),
+                      [](const LightData* l, const LightData* r) {
+                // TODO: more sort comparers, like distance-to-eye?
+                return l->frameNo > r->frameNo;
+            });
+            _sortDirty = false;
+        }
+
+        for (size_t i = 0; i < _sortedLights.size(); ++i)
+            result.push_back(*_sortedLights[i]);
         return result.size();
     }
 
     void LightGlobalManager::remove(LightDrawable* light)
     {
         if (_lights.find(light) != _lights.end())
-        { _lights.erase(_lights.find(light)); _dirty = true; }
+        { _lights.erase(_lights.find(light)); _dirty = true; _sortDirty = true; }
     }
 
     void LightGlobalManager::prune(const osg::FrameStamp* fs, int outdatedFrames)
@@ -136,7 +412,7 @@ namespace osgVerse
              itr != _lights.end();)
         {
             if ((itr->second.frameNo + outdatedFrames) >= frameNo) itr++;
-            else { itr = _lights.erase(itr); _dirty = true; }
+            else { itr = _lights.erase(itr); _dirty = true; _sortDirty = true; }
         }
     }
 }
@@ -13,13 +13,29 @@ namespace osgVerse
     class LightModule : public RenderingModuleBase
     {
     public:
+        /** maxLightsInPass: maximum lights of each cluster. Clusters with more lights keep the most
+            important ones (in sorted order of LightGlobalManager) and a notice is printed */
         LightModule(const std::string& name, Pipeline* pipeline, int maxLightsInPass = 24);
         virtual LightModule* asLightModule() { return this; }
         virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
-        /** Feed light parameter data & uniforms to certain pipeline stage */
+        /** Feed light parameter data & uniforms to certain pipeline stage.
+            Light cluster table and index list will be applied to unit (startU + 1) and (startU + 2) */
         int applyTextureAndUniforms(Pipeline::Stage* stage, const std::string& prefix, int startU);
 
+        /** Feed light tables & uniforms to a forward state-set, also with InvScreenResolution
+            of the pipeline to find cluster of each fragment */
+        int applyTextureAndUniforms(osg::StateSet* ss, const std::string& prefix, int startU);
+
+        /** Set light cluster grid: screen-space tiles and exponential depth slices */
+        void setClusterGrid(int tilesX, int tilesY, int depthSlices);
+        void getClusterGrid(int& tilesX, int& tilesY, int& depthSlices) const
+        { tilesX = _tilesX; tilesY = _tilesY; depthSlices = _depthSlices; }
+
+        /** Set depth of the first cluster slice. The last one is computed from light ranges */
+        void setClusterNearDepth(float z) { _clusterNear = z; _clusterDirty = true; }
+        float getClusterNearDepth() const { return _clusterNear; }
+
         /** Set main-light which can automatically update shadow as well */
         void setMainLight(LightDrawable* ld, const std::string& shadowModule)
         { _mainLight = ld; _shadowModuleName = shadowModule; }
@@ -27,18 +43,42 @@ namespace osgVerse
         LightDrawable* getMainLight() { return _mainLight.get(); }
         const std::string& getShadowModuleName() const { return _shadowModuleName; }
 
-        /** Get light parameter table data:
+        /** Get light parameter table data (1024 columns, 4 rows for every 1024 lights):
             - row0: light color & power (vec3), type (float)
-            - row1: eye-space position (vec3), attenuationMax
-            - row2: eye-space rotation (vec3), attenuationMin
-            - row3: spotExponent, spotCutoff
+            - row1: eye-space position (vec3), range
+            - row2: eye-space direction (vec3), spotCutoff
+            - row3: type, range, spotCutoff
         */
         osg::Texture2D* getParameterTable() { return _parameterTex.get(); }
         const osg::Texture2D* getParameterTable() const { return _parameterTex.get(); }
 
+        /** Get light cluster table: (offset, count) of light indices of each cluster,
+            with (tilesX * tilesY) columns and depthSlices rows */
+        osg::Texture2D* getClusterTable() { return _clusterTex.get(); }
+        const osg::Texture2D* getClusterTable() const { return _clusterTex.get(); }
+
+        /** Get light index list of all clusters: 4 indices per texel, 1024 texels per row */
+        osg::Texture2D* getIndexList() { return _indexTex.get(); }
+        const osg::Texture2D* getIndexList() const { return _indexTex.get(); }
+
+        /** Get number of clusters truncated to maxLightsInPass in last update */
+        unsigned int getNumTruncatedClusters() const { return _numTruncatedClusters; }
+
+        /** Get bytes of light tables uploaded to GPU in last frame; only changed texels are uploaded */
+        unsigned int getBytesUploadedInLastFrame() const;
+
         osg::Uniform* getLightNumber() { return _lightNumber.get(); }
         const osg::Uniform* getLightNumber() const { return _lightNumber.get(); }
 
+        osg::Uniform* getLightTableSize() { return _lightTableSize.get(); }
+        const osg::Uniform* getLightTableSize() const { return _lightTableSize.get(); }
+
+        osg::Uniform* getLightClusterGrid() { return _lightClusterGrid.get(); }
+        const osg::Uniform* getLightClusterGrid() const { return _lightClusterGrid.get(); }
+
+        osg::Uniform* getLightClusterDepth() { return _lightClusterDepth.get(); }
+        const osg::Uniform* getLightClusterDepth() const { return _lightClusterDepth.get(); }
+
     protected:
         virtual ~LightModule();
 
@@ -46,9 +86,19 @@ namespace osgVerse
         osg::ref_ptr<LightDrawable> _mainLight;
         osg::ref_ptr<osg::Texture2D> _parameterTex;
         osg::ref_ptr<osg::Image> _parameterImage;
+        osg::ref_ptr<osg::Texture2D> _clusterTex, _indexTex;
+        osg::ref_ptr<osg::Image> _clusterImage, _indexImage;
         osg::ref_ptr<osg::Uniform> _lightNumber;  // vec2
+        osg::ref_ptr<osg::Uniform> _lightTableSize;  // vec2
+        osg::ref_ptr<osg::Uniform> _lightClusterGrid;  // vec3
+        osg::ref_ptr<osg::Uniform> _lightClusterDepth;  // vec2
+        std::vector<std::vector<unsigned int>> _clusterLists;
+        osg::Matrix _clusterProjection;
         std::string _shadowModuleName;
-        int _maxLightsInPass;
+        float _clusterNear;
+        unsigned int _numTruncatedClusters;
+        int _maxLightsInPass, _tilesX, _tilesY, _depthSlices;
+        bool _clusterDirty;
     };
 
     class LightGlobalManager : public osg::Referenced
@@ -62,19 +112,22 @@ namespace osgVerse
         {
             LightDrawable* light;
             osg::Matrix matrix;
-            unsigned int frameNo;
+            unsigned int frameNo, modifiedCount;
         };
+
+        /** Get lights sorted by importance. The order is only recomputed when lights are added or removed */
         size_t getSortedResult(std::vector<LightData>& result);
 
-        void add(const LightData& ld) { _lights[ld.light] = ld; _dirty = true; }
+        void add(const LightData& ld);
         void remove(LightDrawable* light);
         void prune(const osg::FrameStamp* fs, int outdatedFrames = 5);
 
     protected:
         LightGlobalManager();
         std::map<LightDrawable*, LightData> _lights;
+        std::vector<LightData*> _sortedLights;
         osg::ref_ptr<LightCullCallback> _callback;
-        bool _dirty;
+        bool _dirty, _sortDirty;
     };
 }
 
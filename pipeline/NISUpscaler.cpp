@@ -231,6 +231,25 @@ void main()
         return ok;
     }
 
+    bool NISUpscaler::setInputSize(int inputWidth, int inputHeight)
+    {
+        if (inputWidth == _inputWidth && inputHeight == _inputHeight) return true;
+        if (inputWidth <= 0 || inputHeight <= 0) return false;
+        if (_mode == SCALER)
+        {
+            float sx = float(inputWidth) / float(_outputWidth);
+            float sy = float(inputHeight) / float(_outputHeight);
+            if (sx < 0.5f || sx > 1.0f || sy < 0.5f || sy > 1.0f) return false;
+        }
+        else if (inputWidth != _outputWidth || inputHeight != _outputHeight)
+            return false;
+
+        int lastWidth = _inputWidth, lastHeight = _inputHeight;
+        _inputWidth = inputWidth; _inputHeight = inputHeight;
+        if (updateConfig(_sharpness, _hdrMode)) return true;
+        _inputWidth = lastWidth; _inputHeight = lastHeight; return false;
+    }
+
     bool NISUpscaler::createCoefficientTextures()
     {
         // NIS uses 64 phases x 8 taps (scaler uses first 6, sharpen uses all 8)
@@ -344,12 +363,12 @@ void main()
             ext->glGenBuffers(1, &_uboId);
             if (_uboId == 0) { OSG_WARN << "[NISUpscaler] Failed to generate UBO" << std::endl; return; }
             ext->glBindBuffer(GL_UNIFORM_BUFFER, _uboId);
-            ext->glBufferData(GL_UNIFORM_BUFFER, sizeof(NISConfig), &_config, GL_DYNAMIC_DRAW);
+            ext->glBufferData(GL_UNIFORM_BUFFER, sizeof(NISConfig), _config, GL_DYNAMIC_DRAW);
         }
         else
         {   // Update existing UBO
             ext->glBindBuffer(GL_UNIFORM_BUFFER, _uboId);
-            ext->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(NISConfig), &_config);
+            ext->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(NISConfig), _config);
         }
         ext->glBindBufferBase(GL_UNIFORM_BUFFER, 0, _uboId);
 
@@ -85,6 +85,13 @@ namespace osgVerse
          */
         bool updateConfig(float sharpness, HDRMode hdr = HDR_NONE);
 
+        /**
+         * Change source render resolution without recompiling shaders or
+         * recreating coefficient textures, e.g. for dynamic resolution.
+         * @return false if the new scale is not supported by current mode
+         */
+        bool setInputSize(int inputWidth, int inputHeight);
+
         /**
          * Dispatch compute shader. Binds textures/UBO and calls glDispatchCompute.
          *
@@ -18,22 +18,85 @@ bool NodeSelector::BoundUpdater::removeTarget(osg::Node* t)
     osg::NodePath::iterator itr = std::find(_targets.begin(), _targets.end(), t);
     if (itr != _targets.end())
     {
-        _targets.erase(itr);
+        _targets.erase(itr); _cachedBounds.erase(t);
         if (!_targets.size()) return false;
     }
     return true;
 }
 
+bool NodeSelector::BoundUpdater::computeTargetBound(osg::Node* target, const osg::Matrix& matrix,
+                                                    const osg::Matrix* viewProj, ComputationMethod method,
+                                                    osg::BoundingBox& bb)
+{
+    // Only recompute when the target's bound is dirtied or its world matrix changes;
+    // camera changes only re-project the cached box
+    CachedBound& cache = _cachedBounds[target];
+    const osg::BoundingSphere& sphere = target->getBound();
+    if (cache.sphere != sphere) { cache.sphere = sphere; cache.dirty = true; }
+
+    switch (method)
+    {
+    case USE_NODE_BBOX:
+        if (cache.dirty || cache.matrix != matrix)
+        {
+            osg::ComputeBoundsVisitor cbbv;
+            cbbv.pushMatrix(matrix); target->accept(cbbv);
+            cache.worldBox = cbbv.getBoundingBox(); cache.matrix = matrix;
+            cache.localBox.init(); cache.dirty = false;
+        }
+
+        if (viewProj && cache.worldBox.valid())
+        { bb.init(); for (int i = 0; i < 8; ++i) bb.expandBy(cache.worldBox.corner(i) * (*viewProj)); }
+        else bb = cache.worldBox;
+        break;
+    case USE_NODE_OBB:
+        if (cache.dirty || !cache.localBox.valid())
+        {
+            osg::ComputeBoundsVisitor cbbv; target->accept(cbbv);
+            cache.localBox = cbbv.getBoundingBox();
+            cache.worldBox.init(); cache.dirty = false;
+        }
+
+        bb.init();
+        if (cache.localBox.valid())
+        {
+            osg::Matrix fullMatrix = viewProj ? matrix * (*viewProj) : matrix;
+            for (int i = 0; i < 8; ++i) bb.expandBy(cache.localBox.corner(i) * fullMatrix);
+        }
+        break;
+    case USE_NODE_BSPHERE:
+        if (sphere.valid())
+        {
+            osg::Matrix fullMatrix = viewProj ? matrix * (*viewProj) : matrix;
+            osg::Vec3 pt = sphere.center();
+            osg::BoundingSphere bs(pt * fullMatrix, 0.0f);
+
+            pt = pt + osg::X_AXIS * sphere.radius();
+            bs.expandRadiusBy(pt * fullMatrix);
+            bb.init(); if (bs.valid()) bb.expandBy(bs);
+        }
+        break;
+    default: return false;
+    }
+    return bb.valid();
+}
+
 void NodeSelector::BoundUpdater::operator()(osg::Node* node, osg::NodeVisitor* nv)
 {
     osg::BoundingBox totalBound;
     osg::Camera* mainCamera = _picker->getMainCamera();
+    ComputationMethod method = _picker->getComputationMethod();
+    unsigned int maxExactTargets = _picker->getMaxExactBoundTargets();
+    if (method == USE_NODE_BBOX && maxExactTargets > 0 && _targets.size() > maxExactTargets)
+        method = USE_NODE_OBB;  // too many targets to compute exact bounds
+    if (method != _lastMethod) { _cachedBounds.clear(); _lastMethod = method; }
+
     for (unsigned int i = 0; i < _targets.size(); ++i)
     {
         osg::Node* target = _targets[i];
         if (target && target->referenceCount() > 0)
         {
-            osg::Matrix worldMatrix;
+            osg::Matrix worldMatrix, viewProj; bool toClipSpace = false;
             if (target->getNumParents() > 0)
                 worldMatrix = target->getParent(0)->getWorldMatrices().front();
 
@@ -42,47 +105,21 @@ void NodeSelector::BoundUpdater::operator()(osg::Node* node, osg::NodeVisitor* n
             case NodeSelector::BOUND_RECTANGLE: case NodeSelector::BOUND_SQUARE:
                 if (mainCamera)
                 {
-                    // Set the matrix to [-1, 1] for HUD billboards
-                    worldMatrix = worldMatrix * mainCamera->getViewMatrix() *
-                                  mainCamera->getProjectionMatrix();
+                    // Project to [-1, 1] for HUD billboards
+                    viewProj = mainCamera->getViewMatrix() * mainCamera->getProjectionMatrix();
+                    toClipSpace = true;
                 }
                 break;
             default: break;
             }
 
-            switch (_picker->getComputationMethod())
+            osg::BoundingBox bb;
+            if (computeTargetBound(target, worldMatrix, toClipSpace ? &viewProj : NULL, method, bb))
+                totalBound.expandBy(bb);
+            else
             {
-            case USE_NODE_BBOX:
-                {
-                    osg::ComputeBoundsVisitor cbbv;
-                    cbbv.pushMatrix(worldMatrix);
-                    target->accept(cbbv);
-
-                    osg::BoundingBox bb = cbbv.getBoundingBox();
-                    if (bb.valid()) totalBound.expandBy(bb);
-                    else
-                    {
-                        OSG_INFO << "[NodeSelector::BoundUpdater] cannot compute bound of target "
-                            << target->getName() << std::endl;
-                    }
-                }
-                break;
-            case USE_NODE_BSPHERE:
-                {
-                    osg::Vec3 pt = target->getBound().center();
-                    osg::BoundingSphere bs(pt * worldMatrix, 0.0f);
-
-                    pt = pt + osg::X_AXIS * target->getBound().radius();
-                    bs.expandRadiusBy(pt * worldMatrix);
-                    if (bs.valid()) totalBound.expandBy(bs);
-                    else
-                    {
-                        OSG_INFO << "[NodeSelector::BoundUpdater] cannot compute bound of target "
-                                 << target->getName() << std::endl;
-                    }
-                }
-                break;
-            default: break;
+                OSG_INFO << "[NodeSelector::BoundUpdater] cannot compute bound of target "
+                         << target->getName() << std::endl;
             }
         }
         else
@@ -121,7 +158,7 @@ void NodeSelector::BoundUpdater::operator()(osg::Node* node, osg::NodeVisitor* n
 
 NodeSelector::NodeSelector()
     : _selectorColor(1.0f, 1.0f, 1.0f, 1.0f), _boundColor(1.0f, 1.0f, 0.0f, 1.0f),
-    _boundDeltaLength(0.2f), _computationMethod(USE_NODE_BBOX),
+    _boundDeltaLength(0.2f), _maxExactBoundTargets(0), _computationMethod(USE_NODE_BBOX),
     _selectorType(SINGLE_SELECTOR), _boundType(BOUND_BOX)
 {
     _hudRoot = new osg::Group;
@@ -11,7 +11,7 @@ namespace osgVerse
     class NodeSelector : public osg::Referenced
     {
     public:
-        enum ComputationMethod { USE_NODE_BBOX, USE_NODE_BSPHERE };
+        enum ComputationMethod { USE_NODE_BBOX, USE_NODE_BSPHERE, USE_NODE_OBB };
         enum SelectorType { SINGLE_SELECTOR, RECTANGLE_SELECTOR, CIRCLE_SELECTOR, POLYGON_SELECTOR };
         enum BoundType { BOUND_BOX, BOUND_RECTANGLE, BOUND_SQUARE };
         NodeSelector();
@@ -24,10 +24,16 @@ namespace osgVerse
         osg::Group* getHeadUpDisplayRoot() { return _hudRoot.get(); }
         osg::Group* getAuxiliaryRoot() { return _auxiliaryRoot.get(); }
 
-        /** Set selector line display type */
+        /** Set how to compute selection bounds: exact world AABB (cached until the target's bound
+            or world matrix changes), bounding sphere, or local AABB transformed to world (OBB) */
         void setComputationMethod(ComputationMethod m) { _computationMethod = m; }
         ComputationMethod getComputationMethod() const { return _computationMethod; }
 
+        /** Set max number of targets in one bound to use exact AABBs; larger selections will
+            use OBBs instead when computation method is USE_NODE_BBOX. 0 means no limit */
+        void setMaxExactBoundTargets(unsigned int n) { _maxExactBoundTargets = n; }
+        unsigned int getMaxExactBoundTargets() const { return _maxExactBoundTargets; }
+
         /** Set selector line display type */
         void setSelectorType(SelectorType t) { _selectorType = t; rebuildSelectorGeometry(); }
         SelectorType getSelectorType() const { return _selectorType; }
@@ -103,14 +109,29 @@ namespace osgVerse
         class BoundUpdater : public osg::NodeCallback
         {
         public:
-            BoundUpdater(osg::Node* t, NodeSelector* p) : _picker(p) { _targets.push_back(t); }
-            BoundUpdater(const osg::NodePath& t, NodeSelector* p) : _targets(t), _picker(p) {}
+            BoundUpdater(osg::Node* t, NodeSelector* p)
+                : _picker(p), _lastMethod(p->getComputationMethod()) { _targets.push_back(t); }
+            BoundUpdater(const osg::NodePath& t, NodeSelector* p)
+                : _targets(t), _picker(p), _lastMethod(p->getComputationMethod()) {}
             bool removeTarget(osg::Node* t);
             virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
         protected:
+            struct CachedBound
+            {
+                osg::BoundingSphere sphere; osg::Matrix matrix;
+                osg::BoundingBox localBox, worldBox;
+                CachedBound() : dirty(true) {}
+                bool dirty;
+            };
+
+            /** Compute bound of target in world space (matrix), or in clip space if viewProj is set */
+            bool computeTargetBound(osg::Node* target, const osg::Matrix& matrix, const osg::Matrix* viewProj,
+                                    ComputationMethod method, osg::BoundingBox& bb);
+            std::map<osg::Node*, CachedBound> _cachedBounds;
             osg::NodePath _targets;
             NodeSelector* _picker;
+            ComputationMethod _lastMethod;
         };
 
         void updateSelectionGeometry(bool rebuilding = false);
@@ -126,6 +147,7 @@ namespace osgVerse
         osg::ref_ptr<osg::Drawable> _boundMaskBox;
         osg::Vec4 _selectorColor, _boundColor;
         float _boundDeltaLength;
+        unsigned int _maxExactBoundTargets;
         ComputationMethod _computationMethod;
         SelectorType _selectorType;
         BoundType _boundType;
@@ -111,13 +111,13 @@ class MyCullVisitor : public osgUtil::CullVisitor
 {
 public:
     MyCullVisitor()
-    :   osgUtil::CullVisitor(), _cullMask(0xffffffff), _defaultMask(0xffffffff), _valid(0) {}
+    :   osgUtil::CullVisitor(), _cullMask(0xffffffff), _cullExcludeMask(0), _defaultMask(0xffffffff), _valid(0) {}
     MyCullVisitor(const MyCullVisitor& v)
     :   osgUtil::CullVisitor(v), _callback(v._callback), _shadowData(v._shadowData),
         _shadowViewport(v._shadowViewport), _pipelineMaskPath(v._pipelineMaskPath),
         _shadowModelViews(v._shadowModelViews), _shadowProjections(v._shadowProjections),
         _pixelSizeVectorList(v._pixelSizeVectorList), _cullMask(v._cullMask),
-        _defaultMask(v._defaultMask), _valid(v._valid) {}
+        _cullExcludeMask(v._cullExcludeMask), _defaultMask(v._defaultMask), _valid(v._valid) {}
 
     virtual CullVisitor* clone() const { return new MyCullVisitor(*this); }
     void setDeferredCallback(osgVerse::DeferredRenderCallback* cb) { _callback = cb; }
@@ -132,12 +132,15 @@ public:
 
     virtual void reset()
     {
-        _cullMask = 0xffffffff; _pipelineMaskPath.clear(); _shadowData = NULL;
+        _cullMask = 0xffffffff; _cullExcludeMask = 0; _pipelineMaskPath.clear(); _shadowData = NULL;
         if (_callback.valid()) _defaultMask = _callback->getForwardMask();
 
         osg::Camera* cam = this->getCurrentCamera();
         if (cam && cam->getUserDataContainer() != NULL)
+        {
             cam->getUserValue("PipelineCullMask", _cullMask);
+            cam->getUserValue("PipelineCullExcludeMask", _cullExcludeMask);
+        }
         if (cam && cam->getUserData() != NULL)
         {
             osgVerse::ShadowModule::ShadowData* sd =
@@ -164,6 +167,11 @@ public:
         osgUtil::CullVisitor::reset();
     }
 
+    /** Check pipeline mask of a node: it must intersect cull mask and never intersect exclude mask
+        (e.g., to reject dynamic casters which also have the common caster bit in static shadow pass) */
+    bool checkMask(unsigned int mask) const
+    { return (_cullMask & mask) != 0 && (_cullExcludeMask & mask) == 0; }
+
     bool passable(osg::Node& node, PassableData& pdata)
     {
         pdata.maskSet = 0; pushM(node, pdata);
@@ -189,7 +197,7 @@ public:
                 if (flags & osg::StateAttribute::ON)
                 {
                     pushMaskPath(nodePipMask, flags); pdata.maskSet |= 1;
-                    if ((_cullMask & nodePipMask) != 0)
+                    if (checkMask(nodePipMask))
                         return !checkSmallPixelSizeCulling(node.getBound());
                     return false;
                 }  // otherwise, treat the mask as not set
@@ -200,7 +208,7 @@ public:
         if (!_pipelineMaskPath.empty())
         {
             std::pair<unsigned int, unsigned int> maskAndFlags = _pipelineMaskPath.back();
-            return (_cullMask & maskAndFlags.first) != 0;
+            return checkMask(maskAndFlags.first);
         }
         return true;
     }
@@ -226,7 +234,7 @@ public:
 
             if (flags & osg::StateAttribute::ON)
             {
-                if ((_cullMask & nodePipMask) != 0)
+                if (checkMask(nodePipMask))
                     return !checkSmallPixelSizeCulling(node.getBound());
                 return false;
             }
@@ -238,9 +246,9 @@ public:
             // Handle drawables which is never been set pipeline masks:
             // if pipeline mask is never set, we will treat current node as forward one
             // to avoid it being rendered multiple times.
-            return (_cullMask & _defaultMask) != 0;
+            return checkMask(_defaultMask);
         }
-        return (_cullMask & _pipelineMaskPath.back().first) != 0;
+        return checkMask(_pipelineMaskPath.back().first);
     }
 
     virtual void apply(osg::Node& node)
@@ -492,7 +500,7 @@ protected:
     typedef std::vector<osg::Matrix> MatrixValueStack;
     MatrixValueStack _shadowModelViews, _shadowProjections;
     std::vector<osg::Vec4> _pixelSizeVectorList;
-    unsigned int _cullMask, _defaultMask, _valid;
+    unsigned int _cullMask, _cullExcludeMask, _defaultMask, _valid;
 };
 
 class MySceneView : public osgUtil::SceneView
@@ -641,7 +649,11 @@ struct MyResizedCallback : public osg::GraphicsContext::ResizedCallback
         double heightChangeRatio = double(h) / double(traits->height);
         double aspectRatioChange = widthChangeRatio / heightChangeRatio;
         if (_pipeline.valid())
+        {
+            // Restore unscaled buffers first; dynamic resolution module may scale them again later
+            _pipeline->setRenderScale(1.0f);
             _pipeline->getInvScreenResolution()->set(osg::Vec2(1.0f / (float)w, 1.0f / (float)h));
+        }
 
         osg::GraphicsContext::Cameras cameras = gc->getCameras();
         for (osg::GraphicsContext::Cameras::iterator itr = cameras.begin(); itr != cameras.end(); ++itr)
@@ -833,7 +845,7 @@ namespace osgVerse
         _invScreenResolution = new osg::Uniform(
             "InvScreenResolution", osg::Vec2(1.0f / 1920.0f, 1.0f / 1080.0f));
         _glContextVersion = glContextVer; _glVersion = 0;
-        _glslTargetVersion = glslVer;
+        _glslTargetVersion = glslVer; _renderScale = 1.0f;
     }
 
     osg::GraphicsContext* Pipeline::createGraphicsContext(int w, int h, const std::string& glContext,
@@ -1388,6 +1400,55 @@ namespace osgVerse
         return s;
     }
 
+    void Pipeline::setRenderScale(float scale)
+    {
+        scale = osg::clampBetween(scale, 0.1f, 1.0f);
+        if (scale == _renderScale) return;
+        for (size_t i = 0; i < _stages.size(); ++i)
+        {
+            Stage* s = _stages[i].get();
+            if (s->deferred && (!s->runner || s->runner->runOnce)) continue;
+            if (!s->deferred && (!s->camera || s->camera->getRenderTargetImplementation()
+                                 != osg::Camera::FRAME_BUFFER_OBJECT)) continue;
+            if (s->parentModule.valid() && s->parentModule->asShadowModule()) continue;
+
+            // Unscaled sizes are recorded when scaling at the first time
+            int width = 0, height = 0;
+            for (std::map<std::string, osg::observer_ptr<osg::Texture>>::iterator itr = s->outputs.begin();
+                 itr != s->outputs.end(); ++itr)
+            {
+                osg::Texture2D* tex = dynamic_cast<osg::Texture2D*>(itr->second.get());
+                if (!tex) continue;
+
+                std::map<osg::Texture2D*, osg::Vec2s>::iterator sizeItr = _unscaledBufferSizes.find(tex);
+                if (sizeItr == _unscaledBufferSizes.end())
+                {
+                    sizeItr = _unscaledBufferSizes.insert(std::make_pair(tex,
+                        osg::Vec2s(tex->getTextureWidth(), tex->getTextureHeight()))).first;
+                }
+                width = osg::maximum((int)(sizeItr->second[0] * scale), 1);
+                height = osg::maximum((int)(sizeItr->second[1] * scale), 1);
+                if (tex->getTextureWidth() != width || tex->getTextureHeight() != height)
+                { tex->setTextureSize(width, height); tex->dirtyTextureObject(); }
+            }
+            if (width == 0 || height == 0) continue;
+
+            if (s->deferred)
+            { s->runner->viewport = new osg::Viewport(0, 0, width, height); s->runner->created = false; }
+            else
+            {
+                s->camera->setViewport(0, 0, width, height);
+#if OSG_VERSION_GREATER_THAN(3, 3, 6)
+                s->camera->dirtyAttachmentMap();
+#endif
+            }
+        }
+
+        osg::Vec2 invRes; _invScreenResolution->get(invRes);
+        _invScreenResolution->set(invRes * (_renderScale / scale));
+        _renderScale = scale; if (scale == 1.0f) _unscaledBufferSizes.clear();
+    }
+
     void Pipeline::removeModule(RenderingModuleBase* cb)
     {
         for (std::map<std::string, osg::ref_ptr<RenderingModuleBase>>::iterator
@@ -21,6 +21,7 @@
 #define DEFERRED_SCENE_MASK   0xff000000
 #define FORWARD_SCENE_MASK    0x000000ff
 #define SHADOW_CASTER_MASK    0x00100000
+#define DYNAMIC_CASTER_MASK   0x00200000  // moving casters, excluded from cached static shadows
 #define CUSTOM_INPUT_MASK     0x00010000
 
 #ifndef GL_HALF_FLOAT
@@ -289,6 +290,11 @@ namespace osgVerse
         osg::Uniform* getInvScreenResolution() { return _invScreenResolution.get(); }
         osg::Vec2s getStageSize() const { return _stageSize; }
 
+        /** Scale internal buffers of screen-sized stages (input, work and per-frame deferred ones),
+            e.g., for dynamic resolution. Shadow, run-once and display stages are not affected */
+        void setRenderScale(float scale);
+        float getRenderScale() const { return _renderScale; }
+
         void setVersionData(GLVersionData* d);
         GLVersionData* getVersionData() { return _glVersionData.get(); }
         int getContextTargetVersion() const { return _glContextVersion; }
@@ -325,7 +331,9 @@ namespace osgVerse
         osg::ref_ptr<osg::Uniform> _invScreenResolution;
         osg::ref_ptr<GLVersionData> _glVersionData;
         osg::observer_ptr<osg::Camera> _forwardCamera;
+        std::map<osg::Texture2D*, osg::Vec2s> _unscaledBufferSizes;
         osg::Vec2s _stageSize;
+        float _renderScale;
         int _glContextVersion, _glVersion, _glslTargetVersion;
     };
 
@@ -378,9 +386,11 @@ namespace osgVerse
         osg::ref_ptr<osg::Texture2D> skyboxMap;
         unsigned int originWidth, originHeight, deferredMask, forwardMask;
         unsigned int shadowCastMask, shadowNumber, shadowResolution, shadowTechnique, coverageSamples;
-        double depthPartitionNearValue;
+        unsigned int dynamicCastMask;  // casters re-rendered every frame if enableCachedShadows is set
+        double depthPartitionNearValue, targetFrameTime;  // targetFrameTime (ms) for dynamic resolution & budget
         bool withEmbeddedViewer, debugShadowModule, debugShadowCombination, enableVSync, enableMRT;
         bool enableAO, enablePostEffects, enableUserInput, enableDepthPartition, enableVR, enable3DGS;
+        bool enableDynamicResolution, enableStageStatistics, enableCachedShadows;
 
         StandardPipelineParameters();
         StandardPipelineParameters(const std::string& shaderDir, const std::string& skyboxFile);
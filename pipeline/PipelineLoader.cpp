@@ -352,7 +352,8 @@ namespace osgVerse
 
             unsigned int deferredMask = DEFERRED_SCENE_MASK,
                          forwardMask = FORWARD_SCENE_MASK,
-                         shadowCastMask = SHADOW_CASTER_MASK;
+                         shadowCastMask = SHADOW_CASTER_MASK,
+                         dynamicCastMask = DYNAMIC_CASTER_MASK;
             if (props.contains("masks"))
             {
                 picojson::value& masks = props.get("masks");
@@ -364,16 +365,20 @@ namespace osgVerse
                         forwardMask = std::stoul(masks.get("forward").to_str(), 0, 16);
                     if (masks.contains("shadow_caster"))
                         shadowCastMask = std::stoul(masks.get("shadow_caster").to_str(), 0, 16);
+                    if (masks.contains("dynamic_caster"))
+                        dynamicCastMask = std::stoul(masks.get("dynamic_caster").to_str(), 0, 16);
                 }
                 catch (std::exception& e)
                 { OSG_WARN << "[Pipeline] " << e.what() << " while reading masks" << std::endl; }
             }
 
-            unsigned int shadowNumber = 0, shadowRes = 1024;
+            unsigned int shadowNumber = 0, shadowRes = 1024; bool cachedShadows = false;
             if (props.contains("shadow_number"))
                 shadowNumber = props.get("shadow_number").get<double>();
             if (props.contains("shadow_resolution"))
                 shadowRes = props.get("shadow_resolution").get<double>();
+            if (props.contains("cached_shadows"))
+                cachedShadows = props.get("cached_shadows").get<bool>();
 
             std::map<std::string, osg::ref_ptr<osg::Shader>> sharedShaders;
             std::map<std::string, osg::ref_ptr<osg::Texture>> sharedTextures;
@@ -469,6 +474,7 @@ namespace osgVerse
                                 {
                                     osg::ref_ptr<osgVerse::ShadowModule> shadowModule =
                                         new osgVerse::ShadowModule(name, this, false);
+                                    if (cachedShadows) shadowModule->setCachedShadows(true, dynamicCastMask);
                                     shadowModule->createStages(shadowRes, shadowNumber,
                                         inShaders[vIdx], inShaders[fIdx], shadowCastMask);
 
@@ -5,6 +5,8 @@
 #include "UserInputModule.h"
 #include "ShadowModule.h"
 #include "LightModule.h"
+#include "DynamicResolution.h"
+#include "StageStatistics.h"
 #include "IntersectionManager.h"
 #include "NodeSelector.h"
 #include "Utilities.h"
@@ -343,10 +345,13 @@ namespace osgVerse
     StandardPipelineParameters::StandardPipelineParameters()
     :   deferredMask(DEFERRED_SCENE_MASK), forwardMask(FORWARD_SCENE_MASK),
         shadowCastMask(SHADOW_CASTER_MASK), shadowNumber(0), shadowResolution(4096),
-        shadowTechnique(ShadowModule::PossionPCF), coverageSamples(0), depthPartitionNearValue(0.1),
+        shadowTechnique(ShadowModule::PossionPCF), coverageSamples(0), dynamicCastMask(DYNAMIC_CASTER_MASK),
+        depthPartitionNearValue(0.1),
+        targetFrameTime(1000.0 / 60.0),
         withEmbeddedViewer(false), debugShadowModule(false), debugShadowCombination(false),
         enableVSync(true), enableMRT(true), enableAO(true), enablePostEffects(true),
-        enableUserInput(false), enableDepthPartition(false), enableVR(false), enable3DGS(true)
+        enableUserInput(false), enableDepthPartition(false), enableVR(false), enable3DGS(true),
+        enableDynamicResolution(false), enableStageStatistics(false), enableCachedShadows(false)
     {
         obtainScreenResolution(originWidth, originHeight);
         if (!originWidth) originWidth = 1920; if (!originHeight) originHeight = 1080;
@@ -355,10 +360,13 @@ namespace osgVerse
     StandardPipelineParameters::StandardPipelineParameters(const std::string& dir, const std::string& sky)
     :   deferredMask(DEFERRED_SCENE_MASK), forwardMask(FORWARD_SCENE_MASK),
         shadowCastMask(SHADOW_CASTER_MASK), shadowNumber(3), shadowResolution(4096),
-        shadowTechnique(ShadowModule::PossionPCF), coverageSamples(0), depthPartitionNearValue(0.1),
+        shadowTechnique(ShadowModule::PossionPCF), coverageSamples(0), dynamicCastMask(DYNAMIC_CASTER_MASK),
+        depthPartitionNearValue(0.1),
+        targetFrameTime(1000.0 / 60.0),
         withEmbeddedViewer(false), debugShadowModule(false), debugShadowCombination(false),
         enableVSync(true), enableMRT(true), enableAO(true), enablePostEffects(true),
-        enableUserInput(false), enableDepthPartition(false), enableVR(false), enable3DGS(true)
+        enableUserInput(false), enableDepthPartition(false), enableVR(false), enable3DGS(true),
+        enableDynamicResolution(false), enableStageStatistics(false), enableCachedShadows(false)
     {
         obtainScreenResolution(originWidth, originHeight);
         if (!originWidth) originWidth = 1920; if (!originHeight) originHeight = 1080;
@@ -599,6 +607,7 @@ namespace osgVerse
         osg::ref_ptr<osgVerse::ShadowModule> shadowModule =
             new osgVerse::ShadowModule("Shadow", p, spp.debugShadowModule);
         shadowModule->setTechnique((osgVerse::ShadowModule::Technique)spp.shadowTechnique);
+        if (spp.enableCachedShadows) shadowModule->setCachedShadows(true, spp.dynamicCastMask);
         std::vector<Pipeline::Stage*> shadowStages = shadowModule->createStages(
             spp.shadowResolution, spp.shadowNumber,
             spp.shaders.shadowCastVS, spp.shaders.shadowCastFS, spp.shadowCastMask);
@@ -918,14 +927,34 @@ namespace osgVerse
         p->applyStagesToView(view, mainCam, spp.forwardMask);
         p->requireDepthBlit(gbuffer, true);
 
+        if (spp.enableDynamicResolution)
+        {
+            osg::ref_ptr<osgVerse::DynamicResolutionModule> dynamicResolution =
+                new osgVerse::DynamicResolutionModule("DynamicResolution", p);
+            dynamicResolution->getController()->setTargetFrameTime(spp.targetFrameTime);
+            if (dynamicResolution->applyStages(gbuffer, output, true))
+                mainCam->addUpdateCallback(dynamicResolution.get());
+        }
+
+        if (spp.enableStageStatistics)
+        {
+            // Per-stage timings, and lower SSAO quality when total GPU time is over target
+            osg::ref_ptr<osgVerse::StageStatisticsModule> stageStatistics =
+                new osgVerse::StageStatisticsModule("StageStatistics", p);
+            stageStatistics->applyStages(true);
+            if (view->getViewerBase()) stageStatistics->setStats(view->getViewerBase()->getViewerStats());
+            if (spp.enableAO)
+            {
+                stageStatistics->setFrameBudget(spp.targetFrameTime);
+                stageStatistics->addBudgetCallback(new osgVerse::SsaoBudgetCallback);
+            }
+            mainCam->addUpdateCallback(stageStatistics.get());
+        }
+
         /*osg::StateSet* forwardSS = p->createForwardStateSet(
             spp.shaders.forwardVS.get(), spp.shaders.forwardFS.get());
         if (forwardSS && lightModule)
-        {
-            forwardSS->setTextureAttributeAndModes(7, lightModule->getParameterTable());
-            forwardSS->addUniform(new osg::Uniform("LightParameterMap", 7));
-            forwardSS->addUniform(lightModule->getLightNumber());
-        }*/
+            lightModule->applyTextureAndUniforms(forwardSS, "LightParameterMap", 7);*/
         return true;
     }
 
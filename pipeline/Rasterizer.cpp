@@ -5,9 +5,14 @@
 #   include <rasterizer/Occluder.h>
 #   include <rasterizer/Rasterizer.h>
 #endif
+#include <osg/Timer>
+#include <osgDB/FileUtils>
 #include <osgDB/WriteFile>
+#include <osgUtil/CullVisitor>
+#include <fstream>
 #include <algorithm>
 #include "modeling/Utilities.h"
+#include "modeling/Profiler.h"
 #include "Rasterizer.h"
 
 namespace osgVerse
@@ -26,7 +31,12 @@ namespace osgVerse
     { osg::Vec4 v = convertToVec4(vec); return osg::Vec3(v[0], v[1], v[2]); }
 
     struct BatchOccluderData { std::unique_ptr<Occluder> data; };
-    struct UserRasterizerData { std::unique_ptr<Rasterizer> data; };
+    struct UserRasterizerData
+    {
+        std::unique_ptr<Rasterizer> data;
+        std::vector<std::unique_ptr<Rasterizer>> tiles;  // each covers owned block rows + 1 guard row
+        std::vector<unsigned int> tileRowStart, tileRowCount;
+    };
 
     BatchOccluder::BatchOccluder(UserOccluder* u, const std::vector<osg::Vec3> vertices,
                                  const osg::BoundingBoxf& refBound) : _owner(u)
@@ -172,12 +182,47 @@ namespace osgVerse
     }
 
     UserRasterizer::UserRasterizer(unsigned int w, unsigned int h)
+    :   _zNear(0.25), _zFar(1000.0), _numThreads(0)
     {
         UserRasterizerData* rd = new UserRasterizerData;
         rd->data = std::make_unique<Rasterizer>(w, h);
         _privateData = rd; _blockNumX = w / 8; _blockNumY = h / 8;
     }
 
+    void UserRasterizer::setNumThreads(int n)
+    {
+        UserRasterizerData* rd = (UserRasterizerData*)_privateData;
+        rd->tiles.clear(); rd->tileRowStart.clear(); rd->tileRowCount.clear();
+        _numThreads = osg::maximum(n, 0); if (_numThreads < 1 || _blockNumY < 2) return;
+
+        // Use more tiles than threads for balancing, but at most 64 (bin masks are 64-bit)
+        unsigned int numTiles = osg::minimum(osg::minimum((unsigned int)_numThreads * 2, _blockNumY / 2), 64u);
+        unsigned int rowsPerTile = (_blockNumY + numTiles - 1) / numTiles;
+        for (unsigned int r = 0; r < _blockNumY; r += rowsPerTile)
+        {
+            unsigned int rows = osg::minimum(rowsPerTile, _blockNumY - r);
+            rd->tiles.push_back(std::make_unique<Rasterizer>(_blockNumX * 8, (rows + 1) * 8));
+            rd->tileRowStart.push_back(r); rd->tileRowCount.push_back(rows);
+        }
+        applyTileMatrices();
+    }
+
+    void UserRasterizer::applyTileMatrices()
+    {
+        // The rasterizer maps NDC y in [-1, 1] to pixel (y + 1) * (height / 2 - 4), so remap NDC y of
+        // each tile to make its local pixel rows match global rows starting from tileRowStart * 8
+        UserRasterizerData* rd = (UserRasterizerData*)_privateData;
+        float halfH = _blockNumY * 4.0f - 4.0f;
+        for (size_t i = 0; i < rd->tiles.size(); ++i)
+        {
+            float halfTileH = (rd->tileRowCount[i] + 1) * 4.0f - 4.0f;
+            osg::Matrixf remap;
+            remap(1, 1) = halfH / halfTileH;
+            remap(3, 1) = (halfH - rd->tileRowStart[i] * 8.0f) / halfTileH - 1.0f;
+            rd->tiles[i]->setModelViewProjection(osg::Matrixf(_viewProjection * remap).ptr());
+        }
+    }
+
     UserRasterizer::~UserRasterizer()
     { UserRasterizerData* rd = (UserRasterizerData*)_privateData; delete rd; }
 
@@ -190,13 +235,96 @@ namespace osgVerse
         osg::Matrix view = view0 * convV, proj = proj0 * convP;  // FIXME: not consider non-perspective matrix
         proj(2, 3) = -proj(2, 3); proj(3, 2) = -proj(3, 2);      // http://perry.cz/articles/ProjectionMatrix.xhtml
 
+        double fovy = 0.0, aspect = 0.0, l, r, b, t;
+        if (!proj0.getPerspective(fovy, aspect, _zNear, _zFar))
+            proj0.getOrtho(l, r, b, t, _zNear, _zFar);
+        _frustum.setToUnitFrustum(true, true);
+        _frustum.transformProvidingInverse(view0 * proj0);
+
         UserRasterizerData* rd = (UserRasterizerData*)_privateData;
-        rd->data->setModelViewProjection(osg::Matrixf(view * proj).ptr());
+        _viewProjection = view * proj; rd->data->setModelViewProjection(_viewProjection.ptr());
+        if (!rd->tiles.empty()) applyTileMatrices();
+    }
+
+    static void renderTiles(UserRasterizerData* rd, std::vector<BatchOccluder*>& occluders,
+                            const osg::Vec3& cameraPos, size_t blocksX, int numThreads,
+                            UserRasterizer::Statistics& st)
+    {
+        // Sort front to back, with distances computed concurrently
+        osg::Timer_t t0 = osg::Timer::instance()->tick(), t1 = t0;
+        typedef std::pair<float, BatchOccluder*> DistanceAndOccluder;
+        int numOccluders = (int)occluders.size(), numTiles = (int)rd->tiles.size();
+        std::vector<DistanceAndOccluder> sorted(numOccluders);
+#pragma omp parallel for num_threads(numThreads)
+        for (int i = 0; i < numOccluders; ++i)
+            sorted[i] = DistanceAndOccluder((occluders[i]->getCenter() - cameraPos).length2(), occluders[i]);
+        std::sort(sorted.begin(), sorted.end(), [](const DistanceAndOccluder& o1, const DistanceAndOccluder& o2)
+                  { return o1.first < o2.first; });
+        t1 = osg::Timer::instance()->tick(); st.sortTime = osg::Timer::instance()->delta_m(t0, t1);
+
+        // Transform / clip bounds of every occluder against each tile frustum and bin them
+        std::vector<uint64_t> tileMasks(numOccluders, 0);
+        for (int t = 0; t < numTiles; ++t) rd->tiles[t]->clear();
+#pragma omp parallel for num_threads(numThreads)
+        for (int i = 0; i < numOccluders; ++i)
+        {
+            BatchOccluderData* od = (BatchOccluderData*)sorted[i].second->getOccluder();
+            for (int t = 0; t < numTiles; ++t)
+            {
+                bool needsClipping = false;
+                if (rd->tiles[t]->queryVisibility(od->data->m_boundsMin, od->data->m_boundsMax, needsClipping))
+                    tileMasks[i] |= (uint64_t)1 << t;
+            }
+        }
+
+        std::vector<std::vector<int>> bins(numTiles);
+#pragma omp parallel for num_threads(numThreads)
+        for (int t = 0; t < numTiles; ++t)
+        {
+            for (int i = 0; i < numOccluders; ++i)
+            { if (tileMasks[i] & ((uint64_t)1 << t)) bins[t].push_back(i); }
+        }
+        t0 = t1; t1 = osg::Timer::instance()->tick(); st.binTime = osg::Timer::instance()->delta_m(t0, t1);
+
+        // Rasterize tiles concurrently, each tile still culls occluders hidden by previous ones
+        int numRasterized = 0;
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic) reduction(+:numRasterized)
+        for (int t = 0; t < numTiles; ++t)
+        {
+            Rasterizer* tile = rd->tiles[t].get(); std::vector<int>& bin = bins[t];
+            for (size_t j = 0; j < bin.size(); ++j)
+            {
+                BatchOccluderData* od = (BatchOccluderData*)sorted[bin[j]].second->getOccluder();
+                bool needsClipping = false;
+                if (tile->queryVisibility(od->data->m_boundsMin, od->data->m_boundsMax, needsClipping))
+                {
+                    if (needsClipping) tile->rasterize<true>(*od->data);
+                    else tile->rasterize<false>(*od->data); numRasterized++;
+                }
+            }
+        }
+        st.numRasterized = numRasterized;
+        t0 = t1; t1 = osg::Timer::instance()->tick(); st.rasterTime = osg::Timer::instance()->delta_m(t0, t1);
+
+        // Merge owned block rows to the global depth buffer and HiZ
+        std::vector<__m128i>& depthBuffer = rd->data->getDepthBuffer();
+        std::vector<uint16_t>& hizBuffer = rd->data->getHiZ();
+#pragma omp parallel for num_threads(numThreads)
+        for (int t = 0; t < numTiles; ++t)
+        {
+            size_t row0 = rd->tileRowStart[t], rows = rd->tileRowCount[t];
+            std::vector<__m128i>& tileDepth = rd->tiles[t]->getDepthBuffer();
+            std::vector<uint16_t>& tileHiZ = rd->tiles[t]->getHiZ();
+            memcpy(&depthBuffer[8 * row0 * blocksX], tileDepth.data(), 8 * rows * blocksX * sizeof(__m128i));
+            memcpy(&hizBuffer[row0 * blocksX], tileHiZ.data(), rows * blocksX * sizeof(uint16_t));
+        }
+        t0 = t1; t1 = osg::Timer::instance()->tick(); st.resolveTime = osg::Timer::instance()->delta_m(t0, t1);
     }
 
     void UserRasterizer::render(const osg::Vec3& cameraPos, std::vector<float>* depthData,
                                 std::vector<unsigned short>* hizData)
     {
+        VERSE_PROFILE_ZONE_CATEGORY("UserRasterizer::render", "pipeline");
         std::vector<BatchOccluder*> globalOccluders;
         for (std::set<osg::ref_ptr<UserOccluder>>::iterator it = _occluders.begin();
              it != _occluders.end(); ++it)
@@ -206,27 +334,42 @@ namespace osgVerse
         }
 
         UserRasterizerData* rd = (UserRasterizerData*)_privateData;
-        rd->data->clear();
+        rd->data->clear(); _statistics = Statistics();
+        _statistics.numOccluders = globalOccluders.size();
+        _statistics.numTiles = rd->tiles.size();
 
-        // Sort front to back
-        __m128 camPos = convertFromVec3(cameraPos);
-        std::sort(globalOccluders.begin(), globalOccluders.end(), [&](const BatchOccluder* o1, const BatchOccluder* o2)
-            {
-                __m128 dist1 = _mm_sub_ps(((BatchOccluderData*)o1->getOccluder())->data->m_center, camPos);
-                __m128 dist2 = _mm_sub_ps(((BatchOccluderData*)o2->getOccluder())->data->m_center, camPos);
-                return _mm_comilt_ss(_mm_dp_ps(dist1, dist1, 0x7f), _mm_dp_ps(dist2, dist2, 0x7f));
-            });
-
-        // Rasterize all occluders
-        for (size_t i = 0; i < globalOccluders.size(); ++i)
+        osg::Timer_t t0 = osg::Timer::instance()->tick(), t1 = t0;
+        if (!rd->tiles.empty())
         {
-            BatchOccluder* bo = globalOccluders[i]; bool needsClipping = false;
-            BatchOccluderData* od = (BatchOccluderData*)bo->getOccluder();
-            if (rd->data->queryVisibility(od->data->m_boundsMin, od->data->m_boundsMax, needsClipping))
+            renderTiles(rd, globalOccluders, cameraPos, _blockNumX, _numThreads, _statistics);
+            t1 = osg::Timer::instance()->tick();
+        }
+        else
+        {
+            // Sort front to back
+            __m128 camPos = convertFromVec3(cameraPos);
+            std::sort(globalOccluders.begin(), globalOccluders.end(), [&](const BatchOccluder* o1, const BatchOccluder* o2)
+                {
+                    __m128 dist1 = _mm_sub_ps(((BatchOccluderData*)o1->getOccluder())->data->m_center, camPos);
+                    __m128 dist2 = _mm_sub_ps(((BatchOccluderData*)o2->getOccluder())->data->m_center, camPos);
+                    return _mm_comilt_ss(_mm_dp_ps(dist1, dist1, 0x7f), _mm_dp_ps(dist2, dist2, 0x7f));
+                });
+            t1 = osg::Timer::instance()->tick(); _statistics.sortTime = osg::Timer::instance()->delta_m(t0, t1);
+
+            // Rasterize all occluders
+            for (size_t i = 0; i < globalOccluders.size(); ++i)
             {
-                if (needsClipping) rd->data->rasterize<true>(*od->data);
-                else rd->data->rasterize<false>(*od->data);
-            }   
+                BatchOccluder* bo = globalOccluders[i]; bool needsClipping = false;
+                BatchOccluderData* od = (BatchOccluderData*)bo->getOccluder();
+                if (rd->data->queryVisibility(od->data->m_boundsMin, od->data->m_boundsMax, needsClipping))
+                {
+                    if (needsClipping) rd->data->rasterize<true>(*od->data);
+                    else rd->data->rasterize<false>(*od->data);
+                    _statistics.numRasterized++;
+                }   
+            }
+            t0 = t1; t1 = osg::Timer::instance()->tick();
+            _statistics.rasterTime = osg::Timer::instance()->delta_m(t0, t1);
         }
 
         // Get result depth image
@@ -235,6 +378,7 @@ namespace osgVerse
         if (depthData)
         {
             const float bias = 3.9623753e+28f; // 1.0f / floatCompressionBias
+            const float zNear = (float)_zNear, zFar = (float)_zFar;
             depthData->resize(_blockNumX * _blockNumY * 64);
             for (uint32_t y = 0; y < _blockNumY; ++y)
             {
@@ -257,10 +401,10 @@ namespace osgVerse
                         __m128i depthI = _mm_load_si128(source++);
                         __m256i depthI256 = _mm256_slli_epi32(_mm256_cvtepu16_epi32(depthI), 12);
                         __m256 depth = _mm256_mul_ps(_mm256_castsi256_ps(depthI256), _mm256_set1_ps(bias));
-                        __m256 linDepth = _mm256_div_ps(_mm256_set1_ps(2 * 0.25f),
-                                                        _mm256_sub_ps(_mm256_set1_ps(0.25f + 1000.0f),
+                        __m256 linDepth = _mm256_div_ps(_mm256_set1_ps(2 * zNear),
+                                                        _mm256_sub_ps(_mm256_set1_ps(zNear + zFar),
                                                                       _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), depth),
-                                                                                    _mm256_set1_ps(1000.0f - 0.25f))));
+                                                                                    _mm256_set1_ps(zFar - zNear))));
                         float linDepthA[16]; _mm256_storeu_ps(linDepthA, linDepth);
 
                         std::vector<float>::iterator it = depthData->begin() + ((8 * _blockNumX) * (8 * y + subY) + 8 * x);
@@ -270,6 +414,8 @@ namespace osgVerse
             }
         }
         if (hizData) hizData->assign(hizBuffer.begin(), hizBuffer.end());
+        t0 = t1; t1 = osg::Timer::instance()->tick();
+        _statistics.resolveTime += osg::Timer::instance()->delta_m(t0, t1);
 
 #   if false
         std::vector<char> rawData(_blockNumX * _blockNumY * 256);
@@ -302,6 +448,46 @@ namespace osgVerse
         if (numVisible) *numVisible = occCount;
         return (float)count / (float)maxCount;
     }
+
+    bool UserRasterizer::isInsideFrustum(const osg::BoundingBoxf& box) const
+    {
+        osg::BoundingBox bb(box._min, box._max);
+        const osg::Polytope::PlaneList& planes = _frustum.getPlaneList();
+        for (size_t i = 0; i < planes.size(); ++i)
+        { if (planes[i].intersect(bb) < 1) return false; }
+        return true;
+    }
+
+    bool UserRasterizer::isVisible(const osg::BoundingBoxf& box, bool conservative)
+    {
+        if (!box.valid()) return true;
+        else if (conservative && !isInsideFrustum(box)) return true;
+
+        UserRasterizerData* rd = (UserRasterizerData*)_privateData; bool needsClipping = false;
+        return rd->data->queryVisibility(convertFromVec3(box._min), convertFromVec3(box._max), needsClipping);
+    }
+
+    unsigned int UserRasterizer::queryVisibility(const std::vector<osg::BoundingBoxf>& boxes,
+                                                 std::vector<unsigned char>& results, bool conservative)
+    {
+        int numBoxes = (int)boxes.size(), numRejected = 0; results.resize(numBoxes);
+#pragma omp parallel for reduction(+:numRejected)
+        for (int i = 0; i < numBoxes; ++i)
+        {
+            results[i] = isVisible(boxes[i], conservative) ? 1 : 0;
+            if (!results[i]) numRejected++;
+        }
+        return numRejected;
+    }
+
+    unsigned int UserRasterizer::queryVisibility(const std::vector<osg::BoundingSphere>& spheres,
+                                                 std::vector<unsigned char>& results, bool conservative)
+    {
+        std::vector<osg::BoundingBoxf> boxes(spheres.size());
+        for (size_t i = 0; i < spheres.size(); ++i)
+        { if (spheres[i].valid()) boxes[i].expandBy(spheres[i]); }
+        return queryVisibility(boxes, results, conservative);
+    }
 #else
     UserOccluder::UserOccluder(const std::string& name, const std::vector<osg::Vec3> vertices,
                                const std::vector<unsigned int>& indices) : _name(name) {}
@@ -317,8 +503,21 @@ namespace osgVerse
     osg::BoundingBoxf BatchOccluder::getBound() const { osg::BoundingBoxf bb; return bb; }
     osg::Vec3 BatchOccluder::getCenter() const { osg::Vec3 vv; return vv; }
 
-    UserRasterizer::UserRasterizer(unsigned int, unsigned int) {}
+    UserRasterizer::UserRasterizer(unsigned int, unsigned int)
+    :   _zNear(0.25), _zFar(1000.0), _privateData(NULL), _numThreads(0) {}
+    bool UserRasterizer::isInsideFrustum(const osg::BoundingBoxf&) const { return false; }
+    bool UserRasterizer::isVisible(const osg::BoundingBoxf&, bool) { return true; }
+
+    unsigned int UserRasterizer::queryVisibility(const std::vector<osg::BoundingBoxf>& boxes,
+                                                 std::vector<unsigned char>& results, bool)
+    { results.assign(boxes.size(), 1); return 0; }
+
+    unsigned int UserRasterizer::queryVisibility(const std::vector<osg::BoundingSphere>& spheres,
+                                                 std::vector<unsigned char>& results, bool)
+    { results.assign(spheres.size(), 1); return 0; }
     UserRasterizer::~UserRasterizer() {}
+    void UserRasterizer::setNumThreads(int n) { _numThreads = n; }
+    void UserRasterizer::applyTileMatrices() {}
     float UserRasterizer::queryVisibility(UserOccluder*, int*) { return 0.0f; }
     void UserRasterizer::setModelViewProjection(const osg::Matrix&, const osg::Matrix&) {}
     void UserRasterizer::render(const osg::Vec3&, std::vector<float>*, std::vector<unsigned short>*)
@@ -330,4 +529,293 @@ namespace osgVerse
         std::set<osg::ref_ptr<UserOccluder>>::iterator it = _occluders.find(o);
         if (it != _occluders.end()) _occluders.erase(it);
     }
+
+    void OcclusionCullCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        osg::ref_ptr<UserRasterizer> rasterizer;
+        osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+        if (cv && _rasterizer.lock(rasterizer) && node->getBound().valid())
+        {
+            // Node bound is in parent coordinates, so exclude the node itself from the path
+            osg::NodePath path = nv->getNodePath(); if (!path.empty()) path.pop_back();
+            osg::Matrix localToWorld = osg::computeLocalToWorld(path);
+
+            osg::BoundingBoxf localBox, worldBox; localBox.expandBy(node->getBound());
+            for (int i = 0; i < 8; ++i) worldBox.expandBy(localBox.corner(i) * localToWorld);
+            ++_numTested; if (!rasterizer->isVisible(worldBox, true)) { ++_numRejected; return; }
+        }
+        traverse(node, nv);
+    }
+
+    /// OccluderBuilder ///
+    static const unsigned int s_boxIndices[36] = {
+        0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+        1, 2, 6, 1, 6, 5,  2, 3, 7, 2, 7, 6,  3, 0, 4, 3, 4, 7 };
+
+    static void hashData(uint64_t& hash, const void* data, size_t size)
+    {
+        const unsigned char* ptr = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i) { hash ^= ptr[i]; hash *= 1099511628211ull; }  // FNV-1a
+    }
+
+    static void hashGeometry(uint64_t& hash, const osg::Geometry& geom, const osg::Matrix& matrix)
+    {
+        hashData(hash, matrix.ptr(), sizeof(osg::Matrix::value_type) * 16);
+        const osg::Array* va = geom.getVertexArray();
+        if (va && va->getTotalDataSize() > 0) hashData(hash, va->getDataPointer(), va->getTotalDataSize());
+        for (unsigned int i = 0; i < geom.getNumPrimitiveSets(); ++i)
+        {
+            const osg::PrimitiveSet* p = geom.getPrimitiveSet(i);
+            GLenum mode = p->getMode(); unsigned int num = p->getNumIndices(), first = num ? p->index(0) : 0;
+            hashData(hash, &mode, sizeof(GLenum)); hashData(hash, &num, sizeof(unsigned int));
+            hashData(hash, &first, sizeof(unsigned int));
+            if (p->getTotalDataSize() > 0) hashData(hash, p->getDataPointer(), p->getTotalDataSize());
+        }
+    }
+
+    /** Edge function of point (px, py) against edge (a, b) in XY plane. Endpoints are ordered canonically,
+        so a shared edge gives exactly negated values in both adjacent triangles */
+    static double edgeFunction(const osg::Vec3& a, const osg::Vec3& b, double px, double py)
+    {
+        bool swapped = (b[0] < a[0]) || (b[0] == a[0] && b[1] < a[1]);
+        const osg::Vec3 &p0 = swapped ? b : a, &p1 = swapped ? a : b;
+        double e = ((double)p1[0] - p0[0]) * (py - p0[1]) - ((double)p1[1] - p0[1]) * (px - p0[0]);
+        return swapped ? -e : e;
+    }
+
+    /** Top-left rule of a counter-clockwise triangle: points exactly on a shared edge or vertex
+        are covered by only one of the triangles, so ray hits are never counted twice */
+    static bool isInsideEdge(double e, const osg::Vec3& a, const osg::Vec3& b)
+    {
+        if (e != 0.0) return e > 0.0;
+        return (a[1] > b[1]) || (a[1] == b[1] && b[0] < a[0]);  // left or top edge
+    }
+
+    OccluderBuilder::OccluderBuilder()
+    :   _minimumSize(10.0f), _voxelResolution(16), _maxBoxesPerMesh(16),
+        _maxBoxesPerOccluder(128), _requireClosedMeshes(true) {}
+
+    void OccluderBuilder::createInnerBoxes(const MeshData& mesh, std::vector<osg::BoundingBoxf>& boxes) const
+    {
+        const std::vector<osg::Vec3>& va = mesh.first; const std::vector<unsigned int>& ia = mesh.second;
+        osg::BoundingBoxf bb; for (size_t i = 0; i < va.size(); ++i) bb.expandBy(va[i]);
+        osg::Vec3 extent = bb._max - bb._min;
+        float cell = osg::maximum(extent[0], osg::maximum(extent[1], extent[2])) / osg::maximum(_voxelResolution, 2);
+        if (cell <= 0.0f) return;
+
+        int nx = osg::maximum((int)ceil(extent[0] / cell), 1), ny = osg::maximum((int)ceil(extent[1] / cell), 1),
+            nz = osg::maximum((int)ceil(extent[2] / cell), 1);
+        std::vector<unsigned char> grid(nx * ny * nz, 0);  // 0: outside, 1: inside, 2: surface
+        std::vector<std::vector<float>> columnHits(nx * ny);
+#define VOXEL(x, y, z) grid[((z) * ny + (y)) * nx + (x)]
+
+        for (size_t i = 0; i + 2 < ia.size(); i += 3)
+        {
+            const osg::Vec3 &v0 = va[ia[i]], &v1 = va[ia[i + 1]], &v2 = va[ia[i + 2]];
+            osg::BoundingBoxf tb; tb.expandBy(v0); tb.expandBy(v1); tb.expandBy(v2);
+            osg::Vec3 t0 = (tb._min - bb._min) / cell, t1 = (tb._max - bb._min) / cell;
+            int x0 = osg::clampBetween((int)floor(t0[0]), 0, nx - 1), x1 = osg::clampBetween((int)floor(t1[0]), 0, nx - 1);
+            int y0 = osg::clampBetween((int)floor(t0[1]), 0, ny - 1), y1 = osg::clampBetween((int)floor(t1[1]), 0, ny - 1);
+            int z0 = osg::clampBetween((int)floor(t0[2]), 0, nz - 1), z1 = osg::clampBetween((int)floor(t1[2]), 0, nz - 1);
+
+            // Mark voxels touched by triangle bound as surface (over-estimated, so inner ones are conservative)
+            for (int z = z0; z <= z1; ++z) for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x) VOXEL(x, y, z) = 2;
+
+            // Record hits of vertical rays through column centers for inside / outside parity
+            double area = edgeFunction(v0, v1, v2[0], v2[1]);
+            if (area == 0.0) continue;
+            const osg::Vec3 &a = v0, &b = (area > 0.0) ? v1 : v2, &c = (area > 0.0) ? v2 : v1;
+            area = fabs(area);
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                {
+                    double px = bb._min[0] + (x + 0.5) * cell, py = bb._min[1] + (y + 0.5) * cell;
+                    double wa = edgeFunction(b, c, px, py), wb = edgeFunction(c, a, px, py),
+                           wc = edgeFunction(a, b, px, py);
+                    if (!isInsideEdge(wa, b, c) || !isInsideEdge(wb, c, a) || !isInsideEdge(wc, a, b)) continue;
+                    columnHits[y * nx + x].push_back((float)((wa * a[2] + wb * b[2] + wc * c[2]) / area));
+                }
+        }
+
+        for (int y = 0; y < ny; ++y)
+            for (int x = 0; x < nx; ++x)
+            {
+                std::vector<float>& hits = columnHits[y * nx + x];
+                std::sort(hits.begin(), hits.end());
+                for (size_t h = 0; h + 1 < hits.size(); h += 2)
+                {
+                    for (int z = 0; z < nz; ++z)
+                    {
+                        float pz = bb._min[2] + (z + 0.5f) * cell;
+                        if (pz > hits[h] && pz < hits[h + 1] && VOXEL(x, y, z) == 0) VOXEL(x, y, z) = 1;
+                    }
+                }
+            }
+
+        // Greedy merging of inner voxels into boxes
+        std::vector<osg::BoundingBoxf> merged;
+        for (int z = 0; z < nz; ++z) for (int y = 0; y < ny; ++y) for (int x = 0; x < nx; ++x)
+        {
+            if (VOXEL(x, y, z) != 1) continue;
+            int ex = x + 1, ey = y + 1, ez = z + 1; bool canGrow = true;
+            while (ex < nx && VOXEL(ex, y, z) == 1) ex++;
+            for (; ey < ny && canGrow; ey += canGrow ? 1 : 0)
+            { for (int i = x; i < ex; ++i) { if (VOXEL(i, ey, z) != 1) { canGrow = false; break; } } }
+            for (canGrow = true; ez < nz && canGrow; ez += canGrow ? 1 : 0)
+            {
+                for (int j = y; j < ey && canGrow; ++j)
+                    for (int i = x; i < ex; ++i) { if (VOXEL(i, j, ez) != 1) { canGrow = false; break; } }
+            }
+
+            for (int k = z; k < ez; ++k) for (int j = y; j < ey; ++j)
+                for (int i = x; i < ex; ++i) VOXEL(i, j, k) = 3;  // used
+            merged.push_back(osg::BoundingBoxf(bb._min + osg::Vec3(x, y, z) * cell,
+                                               bb._min + osg::Vec3(ex, ey, ez) * cell));
+        }
+#undef VOXEL
+
+        std::stable_sort(merged.begin(), merged.end(), [](const osg::BoundingBoxf& b1, const osg::BoundingBoxf& b2)
+            {
+                osg::Vec3 e1 = b1._max - b1._min, e2 = b2._max - b2._min;
+                return e1[0] * e1[1] * e1[2] > e2[0] * e2[1] * e2[2];
+            });
+        if ((int)merged.size() > _maxBoxesPerMesh) merged.resize(_maxBoxesPerMesh);
+        boxes.insert(boxes.end(), merged.begin(), merged.end());
+    }
+
+    bool OccluderBuilder::readCache(uint64_t key, std::vector<MeshData>& occluders) const
+    {
+        std::ifstream in(_cacheFile.c_str(), std::ios::in | std::ios::binary);
+        if (!in) return false;
+
+        char magic[4] = { 0 }; uint64_t key0 = 0; uint32_t num = 0;
+        in.read(magic, 4); in.read((char*)&key0, sizeof(uint64_t));
+        if (strncmp(magic, "VOCC", 4) != 0 || key0 != key) return false;
+
+        in.read((char*)&num, sizeof(uint32_t)); occluders.resize(num);
+        for (uint32_t i = 0; i < num && in.good(); ++i)
+        {
+            uint32_t numV = 0, numI = 0; MeshData& md = occluders[i];
+            in.read((char*)&numV, sizeof(uint32_t)); md.first.resize(numV);
+            if (numV > 0) in.read((char*)&md.first[0], numV * sizeof(osg::Vec3));
+            in.read((char*)&numI, sizeof(uint32_t)); md.second.resize(numI);
+            if (numI > 0) in.read((char*)&md.second[0], numI * sizeof(unsigned int));
+        }
+        if (!in.good()) { occluders.clear(); return false; }
+        return true;
+    }
+
+    bool OccluderBuilder::writeCache(uint64_t key, const std::vector<MeshData>& occluders) const
+    {
+        std::ofstream out(_cacheFile.c_str(), std::ios::out | std::ios::binary);
+        if (!out) return false;
+
+        uint32_t num = occluders.size(); out.write("VOCC", 4);
+        out.write((char*)&key, sizeof(uint64_t)); out.write((char*)&num, sizeof(uint32_t));
+        for (uint32_t i = 0; i < num; ++i)
+        {
+            const MeshData& md = occluders[i];
+            uint32_t numV = md.first.size(), numI = md.second.size();
+            out.write((char*)&numV, sizeof(uint32_t));
+            if (numV > 0) out.write((char*)&md.first[0], numV * sizeof(osg::Vec3));
+            out.write((char*)&numI, sizeof(uint32_t));
+            if (numI > 0) out.write((char*)&md.second[0], numI * sizeof(unsigned int));
+        }
+        return out.good();
+    }
+
+    std::vector<osg::ref_ptr<UserOccluder>> OccluderBuilder::build(osg::Node& node)
+    {
+        // Cache key of input geometries and parameters, computed before any (costly) mesh processing
+        FindGeometryVisitor fgv(true); node.accept(fgv);
+        std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList = fgv.getGeometries();
+        uint64_t key = 14695981039346656037ull;
+        hashData(key, &_voxelResolution, sizeof(int)); hashData(key, &_maxBoxesPerMesh, sizeof(int));
+        hashData(key, &_maxBoxesPerOccluder, sizeof(int)); hashData(key, &_minimumSize, sizeof(float));
+        hashData(key, &_requireClosedMeshes, sizeof(bool));
+        for (size_t i = 0; i < geomList.size(); ++i)
+            hashGeometry(key, *geomList[i].first, geomList[i].second);
+
+        std::vector<MeshData> occluderData;
+        if (_cacheFile.empty() || !readCache(key, occluderData))
+        {
+            occluderData = buildOccluderData(geomList);
+            if (!_cacheFile.empty() && !writeCache(key, occluderData))
+                OSG_WARN << "[OccluderBuilder] Failed to write cache file " << _cacheFile << std::endl;
+        }
+        else
+            OSG_NOTICE << "[OccluderBuilder] Read " << occluderData.size() << " occluders from cache "
+                       << _cacheFile << std::endl;
+
+        std::vector<osg::ref_ptr<UserOccluder>> occluders;
+        for (size_t i = 0; i < occluderData.size(); ++i)
+        {
+            occluders.push_back(new UserOccluder(
+                node.getName() + "_Occluder" + std::to_string(i), occluderData[i].first, occluderData[i].second));
+        }
+        return occluders;
+    }
+
+    std::vector<OccluderBuilder::MeshData> OccluderBuilder::buildOccluderData(
+            const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList) const
+    {
+        // Collect large (closed) meshes in world space, in traversal order
+        std::vector<MeshData> meshes;
+        for (size_t i = 0; i < geomList.size(); ++i)
+        {
+            MeshCollector collector; collector.setWeldingVertices(true);
+            collector.setOnlyVertexAndIndices(true); collector.apply(*geomList[i].first);
+
+            unsigned int problemID = 0;
+            const std::vector<osg::Vec3>& va = collector.getVertices();
+            const std::vector<unsigned int>& ia = collector.getTriangles();
+            if (va.empty() || ia.size() < 12) continue;
+            if (_requireClosedMeshes && collector.isManifold(problemID) != MeshCollector::IS_MANIFOLD) continue;
+
+            MeshData md; md.first.resize(va.size()); md.second = ia;
+            osg::BoundingBoxf bb; const osg::Matrix& matrix = geomList[i].second;
+            for (size_t v = 0; v < va.size(); ++v) { md.first[v] = va[v] * matrix; bb.expandBy(md.first[v]); }
+            if ((bb._max - bb._min).length() < _minimumSize) continue;
+            meshes.push_back(md);
+        }
+
+        // Voxelize meshes concurrently, then combine boxes in original order for batching
+        std::vector<std::vector<osg::BoundingBoxf>> boxesOfMeshes(meshes.size());
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)meshes.size(); ++i) createInnerBoxes(meshes[i], boxesOfMeshes[i]);
+
+        std::vector<MeshData> occluderData; MeshData current; int numBoxes = 0;
+        for (size_t i = 0; i < boxesOfMeshes.size(); ++i)
+        {
+            std::vector<osg::BoundingBoxf>& boxes = boxesOfMeshes[i];
+            for (size_t j = 0; j < boxes.size(); ++j)
+            {
+                unsigned int start = current.first.size();
+                for (int c = 0; c < 8; ++c)
+                {
+                    const osg::BoundingBoxf& b = boxes[j];
+                    current.first.push_back(osg::Vec3((c == 1 || c == 2 || c == 5 || c == 6) ? b._max[0] : b._min[0],
+                                                      (c == 2 || c == 3 || c == 6 || c == 7) ? b._max[1] : b._min[1],
+                                                      (c < 4) ? b._min[2] : b._max[2]));
+                }
+                for (int k = 0; k < 36; ++k) current.second.push_back(start + s_boxIndices[k]);
+                if (++numBoxes >= _maxBoxesPerOccluder)
+                { occluderData.push_back(current); current = MeshData(); numBoxes = 0; }
+            }
+        }
+        if (numBoxes > 0) occluderData.push_back(current);
+        return occluderData;
+    }
+
+    unsigned int OccluderBuilder::buildAndRegister(osg::Node& node, UserRasterizer* rasterizer)
+    {
+        std::vector<osg::ref_ptr<UserOccluder>> occluders = build(node);
+        if (rasterizer != NULL)
+        {
+            for (size_t i = 0; i < occluders.size(); ++i)
+                rasterizer->addOccluder(occluders[i].get());
+        }
+        return occluders.size();
+    }
 }
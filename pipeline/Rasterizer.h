@@ -3,6 +3,8 @@
 
 #include <osg/Texture2D>
 #include <osg/Geometry>
+#include <osg/Polytope>
+#include <OpenThreads/Atomic>
 #include <memory>
 #include <set>
 
@@ -66,6 +68,34 @@ namespace osgVerse
                     std::vector<unsigned short>* hizData = NULL);
         float queryVisibility(UserOccluder* occluder, int* numVisible = NULL);
 
+        /** Test world-space boxes against the HiZ buffer of the last render() in one batch.
+            Each result is 1 if visible and 0 if rejected. With 'conservative' set, boxes not fully inside
+            the rendered frustum are always regarded as visible. Returns the number of rejected boxes */
+        unsigned int queryVisibility(const std::vector<osg::BoundingBoxf>& boxes,
+                                     std::vector<unsigned char>& results, bool conservative = true);
+        unsigned int queryVisibility(const std::vector<osg::BoundingSphere>& spheres,
+                                     std::vector<unsigned char>& results, bool conservative = true);
+        bool isVisible(const osg::BoundingBoxf& box, bool conservative = true);
+
+        /** Near/far planes of last projection matrix, used for linear depth output */
+        double getNear() const { return _zNear; }
+        double getFar() const { return _zFar; }
+
+        /** Set number of worker threads: 0 to rasterize all occluders on the calling thread (default);
+            otherwise occluders are binned to screen tiles (block rows) which are rasterized concurrently
+            and merged into the final depth buffer and HiZ */
+        void setNumThreads(int n);
+        int getNumThreads() const { return _numThreads; }
+
+        struct Statistics
+        {
+            double sortTime, binTime, rasterTime, resolveTime;  // in milliseconds
+            unsigned int numOccluders, numRasterized, numTiles;
+            Statistics() : sortTime(0.0), binTime(0.0), rasterTime(0.0), resolveTime(0.0),
+                           numOccluders(0), numRasterized(0), numTiles(0) {}
+        };
+        const Statistics& getStatistics() const { return _statistics; }
+
         void addOccluder(UserOccluder* o) { _occluders.insert(o); }
         void removeOccluder(UserOccluder* o);
         void removeAllOccluders() { _occluders.clear(); }
@@ -76,9 +106,89 @@ namespace osgVerse
 
     protected:
         virtual ~UserRasterizer();
+        void applyTileMatrices();
+        bool isInsideFrustum(const osg::BoundingBoxf& box) const;
+
         std::set<osg::ref_ptr<UserOccluder>> _occluders;
+        osg::Matrixf _viewProjection;
+        osg::Polytope _frustum;
+        double _zNear, _zFar;
+        Statistics _statistics;
         unsigned int _blockNumX, _blockNumY;
         void* _privateData;
+        int _numThreads;
+    };
+
+    /** Generate conservative low-poly occluders from scene geometry: large closed meshes are voxelized,
+        and inner voxels (not touching the surface) are merged into boxes. Results are deterministic and
+        can be cached to disk, keyed by a hash of input meshes and parameters */
+    class OccluderBuilder : public osg::Referenced
+    {
+    public:
+        OccluderBuilder();
+
+        /** Voxel count along the longest axis of each mesh (default: 16) */
+        void setVoxelResolution(int r) { _voxelResolution = r; }
+        int getVoxelResolution() const { return _voxelResolution; }
+
+        /** Meshes with smaller bound diagonal will be ignored (default: 10) */
+        void setMinimumSize(float s) { _minimumSize = s; }
+        float getMinimumSize() const { return _minimumSize; }
+
+        /** Maximum merged boxes kept for each mesh, the largest ones first (default: 16) */
+        void setMaxBoxesPerMesh(int n) { _maxBoxesPerMesh = n; }
+        int getMaxBoxesPerMesh() const { return _maxBoxesPerMesh; }
+
+        /** Maximum boxes combined into one UserOccluder for batching (default: 128) */
+        void setMaxBoxesPerOccluder(int n) { _maxBoxesPerOccluder = n; }
+        int getMaxBoxesPerOccluder() const { return _maxBoxesPerOccluder; }
+
+        /** Only use closed (manifold) meshes, which makes inner voxels meaningful (default: true) */
+        void setRequireClosedMeshes(bool b) { _requireClosedMeshes = b; }
+        bool getRequireClosedMeshes() const { return _requireClosedMeshes; }
+
+        /** Cache file to read/write generated occluders; empty to disable caching */
+        void setCacheFile(const std::string& f) { _cacheFile = f; }
+        const std::string& getCacheFile() const { return _cacheFile; }
+
+        /** Build occluders from the scene, or read from cache file if input meshes are unchanged */
+        std::vector<osg::ref_ptr<UserOccluder>> build(osg::Node& node);
+
+        /** Build occluders and add them to the rasterizer. Returns number of added occluders */
+        unsigned int buildAndRegister(osg::Node& node, UserRasterizer* rasterizer);
+
+    protected:
+        typedef std::pair<std::vector<osg::Vec3>, std::vector<unsigned int>> MeshData;
+        bool readCache(uint64_t key, std::vector<MeshData>& occluders) const;
+        bool writeCache(uint64_t key, const std::vector<MeshData>& occluders) const;
+        std::vector<MeshData> buildOccluderData(
+            const std::vector<std::pair<osg::Geometry*, osg::Matrix>>& geomList) const;
+        void createInnerBoxes(const MeshData& mesh, std::vector<osg::BoundingBoxf>& boxes) const;
+
+        std::string _cacheFile;
+        float _minimumSize;
+        int _voxelResolution, _maxBoxesPerMesh, _maxBoxesPerOccluder;
+        bool _requireClosedMeshes;
+    };
+
+    /** Cull callback skipping subgraphs which are hidden in the software depth buffer. The depth buffer
+        is from the last UserRasterizer::render(), usually called once per frame with previous camera */
+    class OcclusionCullCallback : public osg::NodeCallback
+    {
+    public:
+        OcclusionCullCallback(UserRasterizer* r = NULL) : _rasterizer(r) {}
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        void setRasterizer(UserRasterizer* r) { _rasterizer = r; }
+        UserRasterizer* getRasterizer() { return _rasterizer.get(); }
+
+        unsigned int getNumTested() const { return _numTested; }
+        unsigned int getNumRejected() const { return _numRejected; }
+        void resetCounters() { _numTested.exchange(0); _numRejected.exchange(0); }
+
+    protected:
+        osg::observer_ptr<UserRasterizer> _rasterizer;
+        OpenThreads::Atomic _numTested, _numRejected;
     };
 }
 
@@ -1,8 +1,89 @@
+#include <algorithm>
+#include <cstring>
 #include "nanoid/nanoid.h"
 #include "Utilities.h"
 #include "ResourceManager.h"
 using namespace osgVerse;
 
+static unsigned long long getResourceBytes(ResourceManager::Type type, osg::Object* obj)
+{
+    switch (type)
+    {
+    case ResourceManager::IMAGE:
+        return static_cast<osg::Image*>(obj)->getTotalDataSize();
+    case ResourceManager::BUFFER:
+        return static_cast<osg::BufferData*>(obj)->getTotalDataSize();
+    case ResourceManager::SHADER:
+        {
+            osg::Shader* shader = static_cast<osg::Shader*>(obj);
+            return shader->getShaderBinary() ? shader->getShaderBinary()->getSize()
+                                             : shader->getShaderSource().size();
+        }
+    default: return 0;
+    }
+}
+
+static unsigned long long computeFullHash(ResourceManager::Type type, osg::Object* obj)
+{
+    switch (type)
+    {
+    case ResourceManager::IMAGE: return Hash::getImage(*static_cast<osg::Image*>(obj));
+    case ResourceManager::BUFFER: return Hash::getBuffer(*static_cast<osg::BufferData*>(obj));
+    case ResourceManager::SHADER:
+        {
+            osg::Shader* shader = static_cast<osg::Shader*>(obj);
+            return Hash::getShader(*shader) ^ ((unsigned long long)shader->getType() * 0x9E3779B97F4A7C15ull);
+        }
+    default: return 0;
+    }
+}
+
+static unsigned long long computeFingerprint(ResourceManager::Type type, osg::Object* obj)
+{
+    // Shaders are small, so simply use the full hash
+    if (type == ResourceManager::SHADER) return computeFullHash(type, obj);
+
+    void* stream = Hash::startStream(); std::string className = obj->className();
+    Hash::addToStream(stream, className.data(), className.size());
+
+    const char* data = NULL; unsigned long long size = 0;
+    if (type == ResourceManager::IMAGE)
+    {
+        osg::Image* image = static_cast<osg::Image*>(obj);
+        int header[8] = { image->s(), image->t(), image->r(), (int)image->getPixelFormat(),
+                          (int)image->getDataType(), image->getInternalTextureFormat(),
+                          (int)image->getPacking(), (int)image->getNumMipmapLevels() };
+        Hash::addToStream(stream, (const char*)header, sizeof(header));
+        data = (const char*)image->data(); size = image->getTotalDataSize();
+    }
+    else if (type == ResourceManager::BUFFER)
+    {
+        osg::BufferData* buffer = static_cast<osg::BufferData*>(obj);
+        osg::Array* array = dynamic_cast<osg::Array*>(buffer);
+        if (array)
+        {
+            int header[3] = { (int)array->getType(), (int)array->getDataSize(), (int)array->getDataType() };
+            Hash::addToStream(stream, (const char*)header, sizeof(header));
+        }
+        data = (const char*)buffer->getDataPointer(); size = buffer->getTotalDataSize();
+    }
+
+    Hash::addToStream(stream, (const char*)&size, sizeof(size));
+    if (data != NULL && size > 0)
+    {
+        // Sample fixed blocks evenly from large data, instead of hashing every byte
+        const unsigned int blockSize = 64, numBlocks = 64;
+        if (size <= blockSize * numBlocks * 2) Hash::addToStream(stream, data, (unsigned int)size);
+        else
+        {
+            unsigned long long step = (size - blockSize) / (numBlocks - 1);
+            for (unsigned int i = 0; i < numBlocks; ++i)
+                Hash::addToStream(stream, data + i * step, blockSize);
+        }
+    }
+    return Hash::getStream(stream, true);
+}
+
 ResourceManager* ResourceManager::instance()
 {
     static osg::ref_ptr<ResourceManager> s_instance = new ResourceManager;
@@ -10,91 +91,194 @@ ResourceManager* ResourceManager::instance()
 }
 
 ResourceManager::ResourceManager()
-{ }
+:   _memoryBudget(0) {}
 
 ResourceManager::~ResourceManager()
 { }
 
 std::vector<osg::Image*> ResourceManager::getImages(const std::string& name) const
 {
-    std::vector<osg::Image*> result; TypeAndName t(IMAGE, name);
-    std::map<TypeAndName, HashSet>::const_iterator it = _nameMap.find(t);
-    if (it != _nameMap.end())
-    {
-        const HashSet& hashes = it->second;
-        for (HashSet::const_iterator it2 = hashes.begin(); it2 != hashes.end(); ++it2)
-        {
-            std::map<unsigned long long, osg::ref_ptr<osg::Image>>::const_iterator itR = _images.find(*it2);
-            if (itR != _images.end()) result.push_back(itR->second.get());
-        }
-    }
+    std::vector<osg::Object*> objects = getObjects(IMAGE, name);
+    std::vector<osg::Image*> result(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) result[i] = static_cast<osg::Image*>(objects[i]);
     return result;
 }
 
 std::vector<osg::BufferData*> ResourceManager::getBuffers(const std::string& name) const
 {
-    std::vector<osg::BufferData*> result; TypeAndName t(BUFFER, name);
-    std::map<TypeAndName, HashSet>::const_iterator it = _nameMap.find(t);
-    if (it != _nameMap.end())
-    {
-        const HashSet& hashes = it->second;
-        for (HashSet::const_iterator it2 = hashes.begin(); it2 != hashes.end(); ++it2)
-        {
-            std::map<unsigned long long, osg::ref_ptr<osg::BufferData>>::const_iterator itR = _buffers.find(*it2);
-            if (itR != _buffers.end()) result.push_back(itR->second.get());
-        }
-    }
+    std::vector<osg::Object*> objects = getObjects(BUFFER, name);
+    std::vector<osg::BufferData*> result(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) result[i] = static_cast<osg::BufferData*>(objects[i]);
     return result;
 }
 
 std::vector<osg::Shader*> ResourceManager::getShaders(const std::string& name) const
 {
-    std::vector<osg::Shader*> result; TypeAndName t(SHADER, name);
-    std::map<TypeAndName, HashSet>::const_iterator it = _nameMap.find(t);
-    if (it != _nameMap.end())
-    {
-        const HashSet& hashes = it->second;
-        for (HashSet::const_iterator it2 = hashes.begin(); it2 != hashes.end(); ++it2)
-        {
-            std::map<unsigned long long, osg::ref_ptr<osg::Shader>>::const_iterator itR = _shaders.find(*it2);
-            if (itR != _shaders.end()) result.push_back(itR->second.get());
-        }
-    }
+    std::vector<osg::Object*> objects = getObjects(SHADER, name);
+    std::vector<osg::Shader*> result(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) result[i] = static_cast<osg::Shader*>(objects[i]);
     return result;
 }
 
-osg::Image* ResourceManager::shareImage(osg::Image* image, bool addIfNotShared)
+std::vector<osg::Object*> ResourceManager::getObjects(Type type, const std::string& name) const
 {
-    if (!image) return NULL; unsigned long long hash = Hash::getImage(*image);
-    if (_images.find(hash) != _images.end()) return _images[hash].get();
-    if (addIfNotShared)
-    {
-        _nameMap[TypeAndName(IMAGE, image->getFileName())].insert(hash);
-        _images[hash] = image; return image;
-    }
-    return NULL;
+    std::lock_guard<std::mutex> lock(_nameMutex);
+    std::map<TypeAndName, std::set<osg::Object*>>::const_iterator it = _nameMap.find(TypeAndName(type, name));
+    if (it == _nameMap.end()) return std::vector<osg::Object*>();
+    return std::vector<osg::Object*>(it->second.begin(), it->second.end());
 }
 
+osg::Image* ResourceManager::shareImage(osg::Image* image, bool addIfNotShared)
+{ return image ? static_cast<osg::Image*>(share(IMAGE, image, addIfNotShared)) : NULL; }
+
 osg::BufferData* ResourceManager::shareBuffer(osg::BufferData* buffer, bool addIfNotShared)
+{ return buffer ? static_cast<osg::BufferData*>(share(BUFFER, buffer, addIfNotShared)) : NULL; }
+
+osg::Shader* ResourceManager::shareShader(osg::Shader* shader, bool addIfNotShared)
+{ return shader ? static_cast<osg::Shader*>(share(SHADER, shader, addIfNotShared)) : NULL; }
+
+osg::Object* ResourceManager::share(Type type, osg::Object* obj, bool addIfNotShared)
 {
-    if (!buffer) return NULL; unsigned long long hash = Hash::getBuffer(*buffer);
-    if (_buffers.find(hash) != _buffers.end()) return _buffers[hash].get();
-    if (addIfNotShared)
+    unsigned long long key = computeFingerprint(type, obj), bytes = getResourceBytes(type, obj);
+    unsigned long long fullHash = (type == SHADER) ? key : 0, numFullHashes = 0;
+    bool fullHashed = (type == SHADER), added = false;
+    std::string name = (type == IMAGE) ? static_cast<osg::Image*>(obj)->getFileName() : obj->getName();
+    osg::Object* found = NULL;
+
+    Shard& shard = _shards[key % NUM_SHARDS];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::vector<Entry>& bucket = shard.entries[key];
+        for (size_t i = 0; i < bucket.size(); ++i)
+        {
+            Entry& entry = bucket[i];
+            if (entry.type != type) continue;
+            if (entry.object.get() != obj)
+            {
+                // Fingerprint collides: compare full hashes, computed only now
+                if (!fullHashed)
+                { fullHash = computeFullHash(type, obj); fullHashed = true; numFullHashes++; }
+                if (!entry.fullHashed)
+                {
+                    entry.fullHash = computeFullHash(type, entry.object.get());
+                    entry.fullHashed = true; numFullHashes++;
+                }
+                if (entry.fullHash != fullHash ||
+                    strcmp(entry.object->className(), obj->className()) != 0) continue;
+            }
+            entry.lastUsed = osg::Timer::instance()->tick();
+            found = entry.object.get(); break;
+        }
+
+        if (!found && addIfNotShared)
+        {
+            Entry entry; entry.object = obj; entry.name = name; entry.type = type; entry.bytes = bytes;
+            entry.fullHash = fullHash; entry.fullHashed = fullHashed;
+            entry.lastUsed = osg::Timer::instance()->tick();
+            bucket.push_back(entry); found = obj; added = true;
+        }
+        else if (bucket.empty())
+            shard.entries.erase(key);
+    }
+
+    bool overBudget = false;
     {
-        _nameMap[TypeAndName(BUFFER, buffer->getName())].insert(hash);
-        _buffers[hash] = buffer; return buffer;
+        std::lock_guard<std::mutex> lock(_statMutex);
+        _statistics.numQueries++; _statistics.numFullHashes += numFullHashes;
+        if (found && found != obj) { _statistics.numHits++; _statistics.bytesSaved += bytes; }
+        if (added) { _statistics.bytesHeld += bytes; _statistics.numResources++; }
+        overBudget = _memoryBudget > 0 && _statistics.bytesHeld > _memoryBudget;
     }
-    return NULL;
+
+    if (added)
+    {
+        std::lock_guard<std::mutex> lock(_nameMutex);
+        _nameMap[TypeAndName(type, name)].insert(obj);
+    }
+    if (overBudget) evict(_memoryBudget * 9 / 10);
+    return found;
 }
 
-osg::Shader* ResourceManager::shareShader(osg::Shader* shader, bool addIfNotShared)
+unsigned long long ResourceManager::releaseUnusedResources()
+{ return evict(0); }
+
+unsigned long long ResourceManager::evict(unsigned long long targetBytes)
 {
-    if (!shader) return NULL; unsigned long long hash = Hash::getShader(*shader);
-    if (_shaders.find(hash) != _shaders.end()) return _shaders[hash].get();
-    if (addIfNotShared)
+    struct Candidate { osg::Timer_t lastUsed; unsigned long long key; osg::Object* object; };
+    std::lock_guard<std::mutex> evictLock(_evictMutex);
+    std::vector<Candidate> candidates;
+
+    // Find resources not referenced elsewhere. Recently shared ones are kept, as the caller
+    // may not have referenced the returned object yet
+    osg::Timer_t now = osg::Timer::instance()->tick();
+    for (int s = 0; s < NUM_SHARDS; ++s)
     {
-        _nameMap[TypeAndName(SHADER, shader->getName())].insert(hash);
-        _shaders[hash] = shader; return shader;
+        std::lock_guard<std::mutex> lock(_shards[s].mutex);
+        for (EntryMap::iterator it = _shards[s].entries.begin(); it != _shards[s].entries.end(); ++it)
+        {
+            for (size_t i = 0; i < it->second.size(); ++i)
+            {
+                const Entry& entry = it->second[i];
+                if (entry.object->referenceCount() > 1) continue;
+                if (osg::Timer::instance()->delta_s(entry.lastUsed, now) < 1.0) continue;
+                Candidate c = { entry.lastUsed, it->first, entry.object.get() };
+                candidates.push_back(c);
+            }
+        }
+    }
+    if (candidates.empty()) return 0;
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) { return a.lastUsed < b.lastUsed; });
+    unsigned long long bytesHeld = getStatistics().bytesHeld, released = 0;
+    std::vector<std::pair<TypeAndName, osg::ref_ptr<osg::Object>>> removed;
+    for (size_t c = 0; c < candidates.size() && bytesHeld > targetBytes + released; ++c)
+    {
+        Shard& shard = _shards[candidates[c].key % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        EntryMap::iterator it = shard.entries.find(candidates[c].key);
+        if (it == shard.entries.end()) continue;
+
+        std::vector<Entry>& bucket = it->second;
+        for (size_t i = 0; i < bucket.size(); ++i)
+        {
+            Entry& entry = bucket[i];
+            if (entry.object.get() != candidates[c].object || entry.object->referenceCount() > 1) continue;
+            removed.push_back(std::pair<TypeAndName, osg::ref_ptr<osg::Object>>(
+                TypeAndName(entry.type, entry.name), entry.object));
+            released += entry.bytes; bucket.erase(bucket.begin() + i); break;
+        }
+        if (bucket.empty()) shard.entries.erase(it);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_nameMutex);
+        for (size_t i = 0; i < removed.size(); ++i)
+        {
+            std::map<TypeAndName, std::set<osg::Object*>>::iterator it = _nameMap.find(removed[i].first);
+            if (it == _nameMap.end()) continue; it->second.erase(removed[i].second.get());
+            if (it->second.empty()) _nameMap.erase(it);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_statMutex);
+        _statistics.bytesHeld -= osg::minimum(released, _statistics.bytesHeld);
+        _statistics.numResources -= osg::minimum((unsigned long long)removed.size(), _statistics.numResources);
+        _statistics.numEvicted += removed.size();
     }
-    return NULL;
+    return released;  // objects in 'removed' are deleted here
+}
+
+ResourceManager::Statistics ResourceManager::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(_statMutex);
+    return _statistics;
+}
+
+void ResourceManager::resetStatistics()
+{
+    std::lock_guard<std::mutex> lock(_statMutex);
+    Statistics s; s.bytesHeld = _statistics.bytesHeld;
+    s.numResources = _statistics.numResources; _statistics = s;
 }
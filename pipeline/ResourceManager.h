@@ -4,12 +4,16 @@
 #include <osg/Image>
 #include <osg/Geometry>
 #include <osg/Program>
+#include <osg/Timer>
+#include <mutex>
 #include <set>
 
 namespace osgVerse
 {
 
-    /** Global resource data manager */
+    /** Global resource data manager, which is thread-safe so that it can be used in pager threads.
+        Resources are compared with a quick fingerprint (size/format + sampled data) first,
+        and only hashed fully if the fingerprint collides with existing ones */
     class ResourceManager : public osg::Referenced
     {
     public:
@@ -25,10 +29,6 @@ namespace osgVerse
         /** Check a new shader and return the shared one if already exists in manager */
         osg::Shader* shareShader(osg::Shader* shader, bool addIfNotShared);
 
-        std::map<unsigned long long, osg::ref_ptr<osg::Image>>& getImages() { return _images; }
-        std::map<unsigned long long, osg::ref_ptr<osg::BufferData>>& getBuffers() { return _buffers; }
-        std::map<unsigned long long, osg::ref_ptr<osg::Shader>>& getShaders() { return _shaders; }
-
         std::vector<osg::Image*> getImages(const std::string& name) const;
         std::vector<osg::BufferData*> getBuffers(const std::string& name) const;
         std::vector<osg::Shader*> getShaders(const std::string& name) const;
@@ -40,18 +40,54 @@ namespace osgVerse
         osg::Shader* getShader(const std::string& name) const
         { std::vector<osg::Shader*> v = getShaders(name); return v.empty() ? NULL : v.front(); }
 
+        /** Set memory budget of all resources (0 = unlimited, by default). When exceeded, least recently
+            shared resources that are not referenced elsewhere are released */
+        void setMemoryBudget(unsigned long long bytes) { _memoryBudget = bytes; }
+        unsigned long long getMemoryBudget() const { return _memoryBudget; }
+
+        /** Release all resources that are not referenced elsewhere, returning released bytes */
+        unsigned long long releaseUnusedResources();
+
+        struct Statistics
+        {
+            unsigned long long numQueries, numHits, numFullHashes, numEvicted;
+            unsigned long long bytesSaved, bytesHeld, numResources;
+            Statistics() : numQueries(0), numHits(0), numFullHashes(0), numEvicted(0),
+                           bytesSaved(0), bytesHeld(0), numResources(0) {}
+            double getHitRate() const { return numQueries > 0 ? (double)numHits / numQueries : 0.0; }
+        };
+
+        /** Dedup statistics: hit rate, bytes saved by sharing, bytes held by manager, etc. */
+        Statistics getStatistics() const;
+        void resetStatistics();
+
         typedef std::pair<Type, std::string> TypeAndName;
-        typedef std::set<unsigned long long> HashSet;
-        std::map<TypeAndName, HashSet>& getNameMap() { return _nameMap; }
 
     protected:
         ResourceManager();
         virtual ~ResourceManager();
 
-        std::map<unsigned long long, osg::ref_ptr<osg::Image>> _images;
-        std::map<unsigned long long, osg::ref_ptr<osg::BufferData>> _buffers;
-        std::map<unsigned long long, osg::ref_ptr<osg::Shader>> _shaders;
-        std::map<TypeAndName, HashSet> _nameMap;
+        struct Entry
+        {
+            osg::ref_ptr<osg::Object> object; std::string name;
+            unsigned long long fullHash, bytes; osg::Timer_t lastUsed;
+            Type type; bool fullHashed;
+            Entry() : fullHash(0), bytes(0), lastUsed(0), type(UNDEFINED), fullHashed(false) {}
+        };
+
+        typedef std::map<unsigned long long, std::vector<Entry>> EntryMap;
+        struct Shard { EntryMap entries; std::mutex mutex; };
+
+        osg::Object* share(Type type, osg::Object* obj, bool addIfNotShared);
+        std::vector<osg::Object*> getObjects(Type type, const std::string& name) const;
+        unsigned long long evict(unsigned long long targetBytes);
+
+        enum { NUM_SHARDS = 16 };
+        Shard _shards[NUM_SHARDS];
+        std::map<TypeAndName, std::set<osg::Object*>> _nameMap;
+        mutable std::mutex _nameMutex, _statMutex, _evictMutex;
+        Statistics _statistics;
+        unsigned long long _memoryBudget;
     };
 }
 
@@ -1,10 +1,13 @@
 #include <osg/io_utils>
 #include <osg/Version>
+#include <osg/Timer>
+#include <osg/GLExtensions>
 #include <osg/ComputeBoundsVisitor>
 #include <osgDB/ReadFile>
 #include <osgUtil/SmoothingVisitor>
 #include <iostream>
 #include "../modeling/Utilities.h"
+#include "../modeling/Profiler.h"
 #include "Utilities.h"
 #include "ShaderLibrary.h"
 #include "ShadowModule.h"
@@ -13,6 +16,27 @@
 #define GL_DEPTH_CLAMP 0x864F
 #endif
 
+namespace
+{
+    typedef void (GL_APIENTRY* CopyImageSubDataProc) (GLuint srcName, GLenum srcTarget, GLint srcLevel,
+                                                      GLint srcX, GLint srcY, GLint srcZ, GLuint dstName,
+                                                      GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY,
+                                                      GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+    CopyImageSubDataProc glCopyImageSubDataFunc = NULL;
+
+    osg::Texture2D* createShadowDepthMap(int size)
+    {
+        osg::Texture2D* tex = new osg::Texture2D;
+        tex->setTextureSize(size, size);
+        tex->setInternalFormat(GL_DEPTH_COMPONENT24);
+        tex->setSourceFormat(GL_DEPTH_COMPONENT);
+        tex->setSourceType(GL_FLOAT);
+        tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+        return tex;
+    }
+}
+
 class CreateVHACDVisitor : public osg::NodeVisitor
 {
 public:
@@ -111,9 +135,12 @@ namespace osgVerse
 {
     ShadowModule::ShadowModule(const std::string& name, Pipeline* pipeline, bool withDebugGeom)
     :   _pipeline(pipeline), _technique(PossionPCF), _shadowMaxDistance(-1.0), _shadowNumber(0),
-        _retainLightPos(false), _dirtyReference(false)
+        _referenceUpdateTime(0.0), _retainLightPos(false), _dirtyReference(false),
+        _dirtyCascades(true), _referenceBoundsDirty(true), _copyImageSupported(-1), _casterMask(0),
+        _dynamicCasterMask(0), _cacheAngle(0.5), _cacheMargin(0.2), _cachedShadows(false)
     {
-        for (int i = 0; i < MAX_SHADOWS; ++i) _shadowMaps[i] = new osg::Texture2D;
+        for (int i = 0; i < MAX_SHADOWS; ++i)
+        { _shadowMaps[i] = new osg::Texture2D; _cascadeIntervals[i] = (i > 0) ? 0 : 1; }
         _cullFace = new osg::CullFace(osg::CullFace::FRONT);
         _polygonOffset = new osg::PolygonOffset(1.1f, 4.0f);
 
@@ -172,6 +199,32 @@ namespace osgVerse
             OSG_NOTICE << "[ShadowModule] No camera found for setSmallPixelsToCull()" << std::endl;
     }
 
+    void ShadowModule::setCachedShadows(bool b, unsigned int dynamicCasterMask)
+    {
+#if defined(VERSE_EMBEDDED_GLES2)
+        if (b) OSG_NOTICE << "[ShadowModule] Cached shadows are unsupported in GLES2/WebGL1" << std::endl;
+#else
+        if (!_shadowCameras.empty())
+            OSG_NOTICE << "[ShadowModule] setCachedShadows() should be called before createStages()" << std::endl;
+        else { _cachedShadows = b; _dynamicCasterMask = dynamicCasterMask; }
+#endif
+    }
+
+    void ShadowModule::setCascadeUpdateInterval(int cascade, int frames)
+    {
+        if (cascade < 0 || cascade >= MAX_SHADOWS) return;
+        _cascadeIntervals[cascade] = osg::maximum(frames, 0); _dirtyCascades = true;
+    }
+
+    int ShadowModule::getCascadeUpdateInterval(int cascade) const
+    { return (cascade < 0 || cascade >= MAX_SHADOWS) ? 1 : _cascadeIntervals[cascade]; }
+
+    unsigned int ShadowModule::getCascadeCacheUpdates(int cascade) const
+    {
+        return (cascade < 0 || cascade >= (int)_cascadeCaches.size())
+             ? 0 : _cascadeCaches[cascade].numUpdates;
+    }
+
     void ShadowModule::setLightState(const osg::Vec3& pos, const osg::Vec3& dir0,
                                      double maxDistance, bool retainLightPos)
     {
@@ -185,7 +238,7 @@ namespace osgVerse
             pos, pos + dir * (maxDistance > 0.0 ? maxDistance : 100.0), up);
         if (m.compare(_lightInputMatrix) != 0)
         {
-            _lightInputMatrix = m; _lightMatrix = m; _dirtyReference = true;
+            _lightInputMatrix = m; _lightMatrix = m; _dirtyReference = true; _dirtyCascades = true;
             _shadowMaxDistance = maxDistance; _retainLightPos = retainLightPos;
         }
     }
@@ -201,7 +254,7 @@ namespace osgVerse
     std::vector<Pipeline::Stage*> ShadowModule::createStages(int shadowSize, int shadowNum,
                                                              osg::Shader* vs, osg::Shader* fs, unsigned int casterMask)
     {
-        _shadowCameras.clear(); _shadowNumber = osg::minimum(shadowNum, MAX_SHADOWS);
+        _shadowCameras.clear(); _shadowNumber = osg::minimum(shadowNum, MAX_SHADOWS); _dirtyCascades = true;
         _invTextureSize = new osg::Uniform("InvShadowMapSize", osg::Vec2(1.0f / shadowSize, 1.0f / shadowSize));
         for (int i = 0; i < _shadowNumber; ++i)
         {
@@ -222,6 +275,13 @@ namespace osgVerse
             _shadowMaps[i]->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER);
             _shadowMaps[i]->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_BORDER);
             _shadowMaps[i]->setBorderColor(osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f));
+
+            if (_cachedShadows)
+            {
+                _staticShadowMaps[i] = new osg::Texture2D(*_shadowMaps[i]);
+                _staticDepthMaps[i] = createShadowDepthMap(shadowSize);
+                _shadowDepthMaps[i] = createShadowDepthMap(shadowSize);
+            }
         }
 
         std::vector<Pipeline::Stage*> stages;
@@ -235,9 +295,31 @@ namespace osgVerse
             glslVer = _pipeline->getGlslTargetVersion();
         }
 
+        _casterMask = casterMask; _staticShadowCameras.clear(); _cascadeCaches.clear();
+        if (_cachedShadows)
+        {
+            if (_dynamicCasterMask & casterMask)
+            {
+                // Shared bits would exclude all casters from static maps
+                OSG_NOTICE << "[ShadowModule] Dynamic caster mask should not overlap caster mask, "
+                           << "shared bits are ignored" << std::endl;
+                _dynamicCasterMask &= ~casterMask;
+            }
+
+            // Static casters are rendered first, so cached maps are ready for per-frame cascades
+            _cascadeCaches.resize(_shadowNumber);
+            for (int i = 0; i < _shadowNumber; ++i)
+            {
+                Pipeline::Stage* stage = createShadowCaster(i, prog.get(), 0, true);
+                applyTechniqueDefines(stage->getOrCreateStateSet());
+                stages.push_back(stage); if (_pipeline.valid()) _pipeline->addStage(stage);
+            }
+        }
+
         for (int i = 0; i < _shadowNumber; ++i)
         {
-            Pipeline::Stage* stage = createShadowCaster(i, prog.get(), casterMask);
+            Pipeline::Stage* stage = createShadowCaster(
+                i, prog.get(), _cachedShadows ? (casterMask | _dynamicCasterMask) : casterMask);
             applyTechniqueDefines(stage->getOrCreateStateSet());
             stages.push_back(stage); if (_pipeline.valid()) _pipeline->addStage(stage);
         }
@@ -258,19 +340,19 @@ namespace osgVerse
 
     void ShadowModule::addReferencePoints(const std::vector<osg::Vec3d>& pt, bool toReset)
     {
-        if (toReset) _referencePoints.clear(); _dirtyReference = true;
+        if (toReset) _referencePoints.clear(); _dirtyReference = true; _dirtyCascades = true;
         _referencePoints.insert(_referencePoints.end(), pt.begin(), pt.end());
     }
 
     void ShadowModule::addReferenceBound(const osg::BoundingBoxd& bb, bool toReset)
     {
-        if (toReset) _referencePoints.clear(); _dirtyReference = true;
+        if (toReset) _referencePoints.clear(); _dirtyReference = true; _dirtyCascades = true;
         for (int i = 0; i < 8; ++i) _referencePoints.push_back(bb.corner(i));
     }
 
     void ShadowModule::addReferenceBound(const osg::BoundingBoxf& bb, bool toReset)
     {
-        if (toReset) _referencePoints.clear(); _dirtyReference = true;
+        if (toReset) _referencePoints.clear(); _dirtyReference = true; _dirtyCascades = true;
         for (int i = 0; i < 8; ++i) _referencePoints.push_back(bb.corner(i));
     }
 
@@ -289,6 +371,7 @@ namespace osgVerse
 
     void ShadowModule::updateInDraw(osg::RenderInfo& renderInfo)
     {
+        VERSE_PROFILE_ZONE_CATEGORY("ShadowModule::draw", "pipeline");
         osg::Camera* cam = _updatedCamera.get();
         osg::State* state = renderInfo.getState();
         if (!cam || !state) return;
@@ -300,6 +383,10 @@ namespace osgVerse
 
         double shadowDistance = zf - zn;
         if (shadowDistance <= 0.01) return;  // state not prepared? we have to quit then
+        else if (!_dirtyCascades && _cascadeCaches.empty() &&
+                 viewMat == _lastViewMatrix && proj == _lastProjMatrix)
+            return;  // nothing changed, keep current shadow cameras and matrices
+        _lastViewMatrix = viewMat; _lastProjMatrix = proj; _dirtyCascades = false;
         if (_dirtyReference && !_retainLightPos)
         {
             // Recalculate light-space matrix
@@ -316,12 +403,14 @@ namespace osgVerse
         double step = 0.0, zMaxTotal = 0.0;
         size_t numCameras = _shadowCameras.size();
         std::vector<osg::BoundingBoxd> shadowBBs(numCameras);
+        std::vector<double> splitDepths(numCameras + 1); splitDepths[0] = zn;
 #if false
         static const float ratios[] = { 0.0f, 0.15f, 0.35f, 0.55f, 1.0f };
         step = shadowDistance / ratios[numCameras];
         for (size_t i = 0; i < numCameras; ++i)
         {
             double zMin = zn + step * ratios[i], zMax = zn + step * ratios[i + 1];
+            splitDepths[i + 1] = zMax;
             Frustum frustum; frustum.create(viewMat, proj, zMin, zMax);
 
             // Get light-space bounding box of the splitted frustum
@@ -339,7 +428,6 @@ namespace osgVerse
                                  osg::absolute(entireShadowBB.zMax()));
 
         // CSM split: logarithmic partitioning in view-space depth
-        std::vector<double> splitDepths(numCameras + 1); splitDepths[0] = zn;
         for (size_t i = 1; i <= numCameras; ++i)
         {   // Pure logarithmic split: Ci = n * (f / n)^(i / numsplits)
             double fi = (double)i / numCameras; splitDepths[i] = zn * pow(zf / zn, fi);
@@ -354,34 +442,78 @@ namespace osgVerse
         }
 #endif
 
+        unsigned int frameNo = state->getFrameStamp() ? state->getFrameStamp()->getFrameNumber() : 0;
+        double cosThreshold = cos(osg::DegreesToRadians(_cacheAngle));
+        Frustum entireFrustum; entireFrustum.create(viewMat, proj, zn, zf);
         for (size_t i = 0; i < numCameras; ++i)
         {
             const osg::BoundingBoxd& shadowBB = shadowBBs[i];
-            const osg::Vec3 center = shadowBB.center();
-            double radius = osg::maximum(shadowBB.xMax() - shadowBB.xMin(),
-                                         shadowBB.yMax() - shadowBB.yMin()) * 0.5;
+            osg::Matrix lightMatrix = _lightMatrix;
+            double xMin = 0.0, xMax = 0.0, yMin = 0.0, yMax = 0.0, zMax = zMaxTotal;
+
+            bool cacheEnabled = i < _cascadeCaches.size() && _copyImageSupported != 0 &&
+                                _cascadeIntervals[i] != 1;
+            if (cacheEnabled)
+            {
+                // Check if the cached static shadow still covers current cascade
+                CascadeCache& cache = _cascadeCaches[i]; bool cacheUsable = cache.valid;
+                if (cacheUsable)
+                {
+                    const osg::Matrix& m0 = cache.viewMatrix; const osg::Matrix& m1 = _lightMatrix;
+                    osg::Vec3d dir0(m0(0, 2), m0(1, 2), m0(2, 2)), dir1(m1(0, 2), m1(1, 2), m1(2, 2));
+                    cacheUsable = (dir0 * dir1) >= cosThreshold;
+                }
+
+                if (cacheUsable)
+                {
+                    Frustum frustum; frustum.create(viewMat, proj, splitDepths[i], splitDepths[i + 1]);
+                    Frustum::AABB aabb = frustum.createShadowBound(_referencePoints, cache.viewMatrix);
+                    Frustum::AABB aabb2 = entireFrustum.createShadowBound(_referencePoints, cache.viewMatrix);
+                    double zNew = osg::maximum(osg::absolute(aabb2.first.z()), osg::absolute(aabb2.second.z()));
+
+                    // Also update if the cascade shrinks a lot, to retain shadow resolution
+                    const osg::BoundingBoxd& c = cache.bound;
+                    double size0 = c.xMax() - c.xMin(), size1 = osg::maximum(
+                        aabb.second.x() - aabb.first.x(), aabb.second.y() - aabb.first.y());
+                    cacheUsable = aabb.first.x() >= c.xMin() && aabb.second.x() <= c.xMax() &&
+                                  aabb.first.y() >= c.yMin() && aabb.second.y() <= c.yMax() &&
+                                  zNew <= c.zMax() && size1 > size0 * 0.5;
+                }
+
+                int interval = _cascadeIntervals[i];  // round-robin refreshing
+                if (interval > 1 && ((frameNo + i) % interval) == 0) cacheUsable = false;
+                if (cacheUsable)
+                {
+                    const osg::BoundingBoxd& c = cache.bound; lightMatrix = cache.viewMatrix;
+                    xMin = c.xMin(); xMax = c.xMax(); yMin = c.yMin(); yMax = c.yMax(); zMax = c.zMax();
+                }
+                else
+                {
+                    computeCascadeBox(shadowBB, i, 1.0 + _cacheMargin, xMin, xMax, yMin, yMax);
+                    zMax = zMaxTotal * (1.0 + _cacheMargin); cache.viewMatrix = lightMatrix;
+                    cache.bound.set(xMin, yMin, 0.0, xMax, yMax, zMax);
+                    cache.valid = true; cache.numUpdates++;
+                }
+                applyCascadeCacheState(i, true, !cacheUsable, frameNo);
+            }
+            else
+            {
+                computeCascadeBox(shadowBB, i, 1.0, xMin, xMax, yMin, yMax);
+                if (i < _cascadeCaches.size()) applyCascadeCacheState(i, false, false, frameNo);
+            }
 
-#if false
-            double xMin = center[0] - radius, xMax = center[0] + radius;
-            double yMin = center[1] - radius, yMax = center[1] + radius;
-            //xMin = shadowBB.xMin(), xMax = shadowBB.xMax();
-            //yMin = shadowBB.yMin(), yMax = shadowBB.yMax();
-#else       // Texel snap
-            double texelSize = (2.0 * radius) / _shadowMaps[i]->getTextureWidth();
-            
-            // Snap the center to texel grid and recompute keeping the radius
-            double snappedCenterX = floor(center.x() / texelSize) * texelSize;
-            double snappedCenterY = floor(center.y() / texelSize) * texelSize;
-            double xMin = snappedCenterX - radius, xMax = snappedCenterX + radius;
-            double yMin = snappedCenterY - radius, yMax = snappedCenterY + radius;
-#endif
             //std::cout << i << ": X = (" << xMin << ", " << xMax << "), Y = ("
             //          << yMin << ", " << yMax << "); Z = " << zMaxTotal << "\n";
 
             // Apply the shadow camera & uniform
             osg::Camera* shadowCam = _shadowCameras[i].get();
-            shadowCam->setViewMatrix(_lightMatrix);
-            shadowCam->setProjectionMatrixAsOrtho(xMin, xMax, yMin, yMax, 0.0, zMaxTotal);
+            shadowCam->setViewMatrix(lightMatrix);
+            shadowCam->setProjectionMatrixAsOrtho(xMin, xMax, yMin, yMax, 0.0, zMax);
+            if (i < _staticShadowCameras.size() && _staticShadowCameras[i].valid())
+            {
+                _staticShadowCameras[i]->setViewMatrix(lightMatrix);
+                _staticShadowCameras[i]->setProjectionMatrix(shadowCam->getProjectionMatrix());
+            }
             if (_technique == EyeSpaceDepthSM)
             {
                 osg::Matrix proj = shadowCam->getProjectionMatrix(), projKeepZ;
@@ -407,14 +539,35 @@ namespace osgVerse
 
     void ShadowModule::operator()(osg::Node* node, osg::NodeVisitor* nv)
     {
+        VERSE_PROFILE_ZONE_CATEGORY("ShadowModule::update", "pipeline");
         if (node->asGroup())
         {
-            osg::Group* group = node->asGroup();
-            for (size_t i = 0; i < group->getNumChildren(); ++i)
+            osg::Timer_t t0 = osg::Timer::instance()->tick();
+            osg::Group* group = node->asGroup(); size_t numChildren = group->getNumChildren();
+            bool changed = _referenceBoundsDirty || _cachedBounds.size() != numChildren;
+            _cachedBounds.resize(numChildren);
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                // Bounding sphere is cached by OSG and only recomputed when marked dirty,
+                // so use it to find out children which need new bounding boxes
+                osg::Node* child = group->getChild(i); CachedBound& cached = _cachedBounds[i];
+                const osg::BoundingSphere& bs = child->getBound();
+                if (!_referenceBoundsDirty && cached.node.get() == child &&
+                    cached.sphere.center() == bs.center() && cached.sphere.radius() == bs.radius()) continue;
+
+                osg::ComputeBoundsVisitor cbv; child->accept(cbv);
+                cached.node = child; cached.sphere = bs;
+                cached.box = cbv.getBoundingBox(); changed = true;
+            }
+
+            if (changed)
             {
-                osg::ComputeBoundsVisitor cbv; group->getChild(i)->accept(cbv);
-                addReferenceBound(cbv.getBoundingBox(), i == 0);
+                _referencePoints.clear();
+                for (size_t i = 0; i < numChildren; ++i)
+                { if (_cachedBounds[i].box.valid()) addReferenceBound(_cachedBounds[i].box, false); }
             }
+            _referenceBoundsDirty = false;
+            _referenceUpdateTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
         }
 
         osg::Camera* cameraMV = static_cast<osg::Camera*>(node);
@@ -427,7 +580,82 @@ namespace osgVerse
         traverse(node, nv);
     }
 
-    Pipeline::Stage* ShadowModule::createShadowCaster(int id, osg::Program* prog, unsigned int casterMask)
+    void ShadowModule::computeCascadeBox(const osg::BoundingBoxd& shadowBB, int id, double scale,
+                                         double& xMin, double& xMax, double& yMin, double& yMax) const
+    {
+        const osg::Vec3 center = shadowBB.center();
+        double radius = osg::maximum(shadowBB.xMax() - shadowBB.xMin(),
+                                     shadowBB.yMax() - shadowBB.yMin()) * 0.5 * scale;
+#if false
+        xMin = center[0] - radius, xMax = center[0] + radius;
+        yMin = center[1] - radius, yMax = center[1] + radius;
+        //xMin = shadowBB.xMin(), xMax = shadowBB.xMax();
+        //yMin = shadowBB.yMin(), yMax = shadowBB.yMax();
+#else   // Texel snap
+        double texelSize = (2.0 * radius) / _shadowMaps[id]->getTextureWidth();
+
+        // Snap the center to texel grid and recompute keeping the radius
+        double snappedCenterX = floor(center.x() / texelSize) * texelSize;
+        double snappedCenterY = floor(center.y() / texelSize) * texelSize;
+        xMin = snappedCenterX - radius, xMax = snappedCenterX + radius;
+        yMin = snappedCenterY - radius, yMax = snappedCenterY + radius;
+#endif
+    }
+
+    void ShadowModule::applyCascadeCacheState(int id, bool cacheEnabled, bool renderStatic, unsigned int frameNo)
+    {
+        // Without cache, or when the cached static map is re-rendered, the per-frame cascade renders
+        // all casters by itself; otherwise it draws dynamic casters over a copy of the static map
+        osg::Camera* staticCam = _staticShadowCameras[id].get();
+        osg::Camera* shadowCam = _shadowCameras[id].get();
+        bool useCopy = cacheEnabled && !renderStatic;
+        if (staticCam != NULL)
+        {
+            staticCam->setUserValue("PipelineCullMask", renderStatic ? _casterMask : 0u);
+            staticCam->setClearMask(renderStatic ? (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT) : 0);
+        }
+
+        if (shadowCam != NULL)
+        {
+            shadowCam->setUserValue("PipelineCullMask",
+                                    useCopy ? _dynamicCasterMask : (_casterMask | _dynamicCasterMask));
+            shadowCam->setClearMask(useCopy ? 0 : (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+        }
+        _cascadeCaches[id].copyRequired[(frameNo + 1) % 2] = useCopy;
+    }
+
+    void ShadowModule::copyCachedShadow(osg::RenderInfo& renderInfo, int id)
+    {
+        if (_copyImageSupported < 0)
+        {
+            osg::setGLExtensionFuncPtr(glCopyImageSubDataFunc, "glCopyImageSubData", "glCopyImageSubDataNV");
+            _copyImageSupported = (glCopyImageSubDataFunc != NULL) ? 1 : 0;
+            if (!_copyImageSupported)
+                OSG_NOTICE << "[ShadowModule] glCopyImageSubData() not found, cached shadows disabled" << std::endl;
+        }
+
+        osg::State* state = renderInfo.getState();
+        unsigned int frameNo = state->getFrameStamp() ? state->getFrameStamp()->getFrameNumber() : 0;
+        if (_copyImageSupported <= 0 || id >= (int)_cascadeCaches.size() ||
+            !_cascadeCaches[id].copyRequired[frameNo % 2]) return;
+
+        // Restore static shadow (color & depth) before drawing dynamic casters
+        unsigned int contextID = renderInfo.getContextID();
+        osg::Texture::TextureObject* srcColor = _staticShadowMaps[id]->getTextureObject(contextID);
+        osg::Texture::TextureObject* srcDepth = _staticDepthMaps[id]->getTextureObject(contextID);
+        osg::Texture::TextureObject* dstColor = _shadowMaps[id]->getTextureObject(contextID);
+        osg::Texture::TextureObject* dstDepth = _shadowDepthMaps[id]->getTextureObject(contextID);
+        if (!srcColor || !srcDepth || !dstColor || !dstDepth) return;
+
+        int w = _shadowMaps[id]->getTextureWidth(), h = _shadowMaps[id]->getTextureHeight();
+        glCopyImageSubDataFunc(srcColor->id(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                               dstColor->id(), GL_TEXTURE_2D, 0, 0, 0, 0, w, h, 1);
+        glCopyImageSubDataFunc(srcDepth->id(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                               dstDepth->id(), GL_TEXTURE_2D, 0, 0, 0, 0, w, h, 1);
+    }
+
+    Pipeline::Stage* ShadowModule::createShadowCaster(int id, osg::Program* prog, unsigned int casterMask,
+                                                      bool staticCache)
     {
         osg::ref_ptr<osg::Camera> camera = new osg::Camera;
         camera->setDrawBuffer(GL_FRONT); camera->setReadBuffer(GL_FRONT);
@@ -436,14 +664,30 @@ namespace osgVerse
         camera->setClearColor(osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f));
         camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
-        camera->setRenderOrder(osg::Camera::PRE_RENDER);
+        camera->setRenderOrder(osg::Camera::PRE_RENDER, staticCache ? -1 : 0);
 
         osg::ref_ptr<ShadowData> sData = new ShadowData; sData->index = id;
         camera->setUserData(sData.get());
 
         if (_pipeline.valid()) camera->setGraphicsContext(_pipeline->getContext());
         camera->setViewport(0, 0, _shadowMaps[id]->getTextureWidth(), _shadowMaps[id]->getTextureHeight());
-        camera->attach(osg::Camera::COLOR_BUFFER0, _shadowMaps[id].get());
+        if (staticCache)
+        {
+            // Static casters are rendered to cached maps, only when required (see updateInDraw())
+            camera->attach(osg::Camera::COLOR_BUFFER0, _staticShadowMaps[id].get());
+            camera->attach(osg::Camera::DEPTH_BUFFER, _staticDepthMaps[id].get());
+            camera->setClearMask(0);
+        }
+        else if (_cachedShadows)
+        {
+            // Depth is attached as texture for restoring from cached map
+            camera->attach(osg::Camera::COLOR_BUFFER0, _shadowMaps[id].get());
+            camera->attach(osg::Camera::DEPTH_BUFFER, _shadowDepthMaps[id].get());
+            osg::ref_ptr<ShadowCacheDrawCallback> cacheCallback = new ShadowCacheDrawCallback(this, id);
+            cacheCallback->setup(camera.get(), INITIAL_DRAW);
+        }
+        else
+            camera->attach(osg::Camera::COLOR_BUFFER0, _shadowMaps[id].get());
 #if defined(VERSE_EMBEDDED_GLES2)
         // FBO without depth attachment will not enable depth test
         // By default OSG use "ImplicitBufferAttachmentMask" to handle this (attached DEPTH_COMPONENT24 in RenderStage.cpp),
@@ -461,15 +705,19 @@ namespace osgVerse
 #if !defined(OSG_GLES2_AVAILABLE) && !defined(OSG_GLES3_AVAILABLE)
         camera->getOrCreateStateSet()->setMode(GL_DEPTH_CLAMP, value);
 #endif
-        _shadowCameras.push_back(camera.get());
+        if (staticCache) _staticShadowCameras.push_back(camera.get());
+        else _shadowCameras.push_back(camera.get());
 
         Pipeline::Stage* stage = new Pipeline::Stage;
         stage->deferred = false; stage->inputStage = true;
-        stage->name = "ShadowCaster" + std::to_string(id);
+        stage->name = (staticCache ? "ShadowCasterStatic" : "ShadowCaster") + std::to_string(id);
         stage->camera = camera; stage->camera->setName(stage->name);
         stage->camera->setUserValue("PipelineCullMask", casterMask);  // replacing setCullMask()
+        if (staticCache)  // casters with dynamic bits are never cached, even if also matching the caster mask
+            stage->camera->setUserValue("PipelineCullExcludeMask", _dynamicCasterMask);
         stage->camera->setComputeNearFarMode(osg::Camera::DO_NOT_COMPUTE_NEAR_FAR);
-        stage->outputs["ShadowOutput"] = _shadowMaps[id].get();
+        if (staticCache) stage->outputs["StaticShadowOutput"] = _staticShadowMaps[id].get();
+        else stage->outputs["ShadowOutput"] = _shadowMaps[id].get();
         stage->overridedPrograms = true;  // all child shaders must be disabled
         stage->parentModule = this; return stage;
     }
@@ -40,6 +40,32 @@ namespace osgVerse
         /** Set small-pixels-culling-feature of shadow cameras after createStages() */
         void setSmallPixelsToCull(int cameraNum, int smallPixels);
 
+        /** Enable cached static shadows, must be called before createStages() (for standard pipelines, use
+            StandardPipelineParameters::enableCachedShadows or "cached_shadows" in JSON settings instead).
+            The dynamic mask should be bits disjoint from the caster mask, e.g., DYNAMIC_CASTER_MASK.
+            Casters without it are rendered to static shadow maps which are only updated when necessary;
+            casters with it (even if also having the caster mask) are excluded from static maps and drawn
+            over a copy of them every frame. Requires GL 4.3 or ARB_copy_image */
+        void setCachedShadows(bool b, unsigned int dynamicCasterMask);
+        bool getCachedShadows() const { return _cachedShadows; }
+        unsigned int getDynamicCasterMask() const { return _dynamicCasterMask; }
+
+        /** Set update interval (in frames) of a cascade's cached static shadow: 1 means rendering every frame
+            without caching, 0 means updating only when light direction or cascade bound changes beyond the
+            thresholds, N means also updating every N frames (round-robin among cascades).
+            Default is 1 for the first cascade and 0 for others */
+        void setCascadeUpdateInterval(int cascade, int frames);
+        int getCascadeUpdateInterval(int cascade) const;
+
+        /** Get number of times the cached static shadow of a cascade is re-rendered */
+        unsigned int getCascadeCacheUpdates(int cascade) const;
+
+        /** Set light direction change (in degrees) and cascade bound margin (ratio to its size) of cached
+            static shadows. Default is (0.5, 0.2) */
+        void setCacheThresholds(double angle, double margin) { _cacheAngle = angle; _cacheMargin = margin; }
+        double getCacheAngleThreshold() const { return _cacheAngle; }
+        double getCacheMargin() const { return _cacheMargin; }
+
         /** Create simplified caster geometries to improve shadow pass effectiveness */
         void createCasterGeometries(osg::Node* scene, unsigned int casterMask, float boundRatio = 0.1f,
                                     const std::set<std::string>& whitelist = std::set<std::string>());
@@ -54,6 +80,13 @@ namespace osgVerse
         void addReferencePoints(const std::vector<osg::Vec3d>& pt, bool toReset);
         void clearReferencePoints() { _referencePoints.clear(); }
 
+        /** Force recomputing cached bounds of shadowed children, e.g., after changing vertices
+            without calling dirtyBound(). Otherwise only children with changed bounds are recomputed */
+        void dirtyReferenceBounds() { _referenceBoundsDirty = true; }
+
+        /** Get time (in milliseconds) spent on updating reference bounds in last frame */
+        double getReferenceUpdateTime() const { return _referenceUpdateTime; }
+
         int applyTextureAndUniforms(Pipeline::Stage* stage, const std::string& prefix, int startU);
         double getShadowMaxDistance() const { return _shadowMaxDistance; }
         int getShadowNumber() const { return _shadowNumber; }
@@ -68,11 +101,16 @@ namespace osgVerse
         const osg::Geode* getFrustumGeode() const { return _shadowFrustum.get(); }
 
         void updateInDraw(osg::RenderInfo& renderInfo);
+        void copyCachedShadow(osg::RenderInfo& renderInfo, int id);
         virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
     protected:
         virtual ~ShadowModule();
-        Pipeline::Stage* createShadowCaster(int id, osg::Program* prog, unsigned int casterMask);
+        Pipeline::Stage* createShadowCaster(int id, osg::Program* prog, unsigned int casterMask,
+                                            bool staticCache = false);
+        void computeCascadeBox(const osg::BoundingBoxd& shadowBB, int id, double scale,
+                               double& xMin, double& xMax, double& yMin, double& yMax) const;
+        void applyCascadeCacheState(int id, bool cacheEnabled, bool renderStatic, unsigned int frameNo);
         void updateFrustumGeometry(int id, osg::Camera* shadowCam);
         
         osg::observer_ptr<Pipeline> _pipeline;
@@ -85,11 +123,35 @@ namespace osgVerse
         osg::ref_ptr<osg::Uniform> _invTextureSize;  // vec2
         std::vector<osg::observer_ptr<osg::Camera>> _shadowCameras;
 
+        struct CascadeCache
+        {
+            osg::Matrix viewMatrix; osg::BoundingBoxd bound;  // light-space ortho box of cached map
+            bool valid, copyRequired[2];  // copying flags of next frame, decided before its culling
+            unsigned int numUpdates;
+            CascadeCache() : valid(false), numUpdates(0) { copyRequired[0] = copyRequired[1] = false; }
+        };
+        std::vector<CascadeCache> _cascadeCaches;
+        std::vector<osg::observer_ptr<osg::Camera>> _staticShadowCameras;
+        osg::ref_ptr<osg::Texture2D> _staticShadowMaps[MAX_SHADOWS];
+        osg::ref_ptr<osg::Texture2D> _staticDepthMaps[MAX_SHADOWS], _shadowDepthMaps[MAX_SHADOWS];
+        int _cascadeIntervals[MAX_SHADOWS], _copyImageSupported;
+        unsigned int _casterMask, _dynamicCasterMask;
+        double _cacheAngle, _cacheMargin; bool _cachedShadows;
+
         osg::Matrix _lightMatrix, _lightInputMatrix;
         std::vector<osg::Vec3d> _referencePoints;
+
+        struct CachedBound
+        {
+            osg::observer_ptr<osg::Node> node;
+            osg::BoundingSphere sphere; osg::BoundingBox box;
+        };
+        std::vector<CachedBound> _cachedBounds;
+        osg::Matrix _lastViewMatrix, _lastProjMatrix;
+        double _referenceUpdateTime;
         Technique _technique;
         double _shadowMaxDistance; int _shadowNumber;
-        bool _retainLightPos, _dirtyReference;
+        bool _retainLightPos, _dirtyReference, _dirtyCascades, _referenceBoundsDirty;
     };
 
     class ShadowDrawCallback : public CameraDrawCallback
@@ -105,6 +167,21 @@ namespace osgVerse
     protected:
         osg::observer_ptr<ShadowModule> _module;
     };
+
+    class ShadowCacheDrawCallback : public CameraDrawCallback
+    {
+    public:
+        ShadowCacheDrawCallback(ShadowModule* m, int id) : _module(m), _index(id) {}
+        virtual void operator()(osg::RenderInfo& renderInfo) const
+        {
+            if (_module.valid()) _module->copyCachedShadow(renderInfo, _index);
+            if (_subCallback.valid()) _subCallback.get()->run(renderInfo);
+        }
+
+    protected:
+        osg::observer_ptr<ShadowModule> _module;
+        int _index;
+    };
 }
 
 #endif
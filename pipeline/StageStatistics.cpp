@@ -0,0 +1,319 @@
+#include <osg/io_utils>
+#include <osgViewer/ViewerEventHandlers>
+#include <iostream>
+#include "StageStatistics.h"
+#include "Utilities.h"
+
+namespace osgVerse
+{
+    class StageTimingDrawCallback : public CameraDrawCallback
+    {
+    public:
+        StageTimingDrawCallback(StageStatisticsModule* m, const std::string& n, bool b)
+            : _module(m), _stageName(n), _begin(b) {}
+
+        virtual void operator()(osg::RenderInfo& renderInfo) const
+        {
+            StageStatisticsModule* module = _module.get();
+            if (module != NULL && renderInfo.getState() != NULL)
+            {
+                if (_begin) module->beginDraw(_stageName, renderInfo);
+                else module->endDraw(_stageName, renderInfo);
+            }
+            if (_subCallback.valid()) _subCallback.get()->run(renderInfo);
+        }
+
+    protected:
+        osg::observer_ptr<StageStatisticsModule> _module;
+        std::string _stageName; bool _begin;
+    };
+
+    class StageTimingCullCallback : public osg::NodeCallback
+    {
+    public:
+        StageTimingCullCallback(StageStatisticsModule* m, const std::string& n) : _module(m), _stageName(n) {}
+
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+        {
+            osg::Timer_t t0 = osg::Timer::instance()->tick(); traverse(node, nv);
+            StageStatisticsModule* module = _module.get();
+            if (module != NULL) module->recordCullTime(
+                _stageName, osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick()));
+        }
+
+    protected:
+        osg::observer_ptr<StageStatisticsModule> _module;
+        std::string _stageName;
+    };
+
+    static void averageSamples(const std::deque<double>& samples, double& result, bool validOnly)
+    {
+        double sum = 0.0; unsigned int num = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        { if (!validOnly || samples[i] >= 0.0) { sum += samples[i]; num++; } }
+        result = (num > 0) ? (sum / (double)num) : (validOnly ? -1.0 : 0.0);
+    }
+
+    static void pushSample(std::deque<double>& samples, double v, unsigned int window)
+    { samples.push_back(v); while (samples.size() > window) samples.pop_front(); }
+
+    void SsaoBudgetCallback::apply(Pipeline* pipeline, int level)
+    {
+        // Directions and steps: 8x4 (full), 4x4, 4x2
+        static const float sampleCounts[3][2] = { { 8.0f, 4.0f }, { 4.0f, 4.0f }, { 4.0f, 2.0f } };
+        Pipeline::Stage* stage = pipeline ? pipeline->getStage(_stageName) : NULL;
+        if (!stage && pipeline && _stageName == "Ssao") stage = pipeline->getStage("SSAO");  // JSON pipelines
+        if (!stage) return;
+
+        const float* counts = sampleCounts[osg::clampBetween(level, 0, 2)];
+        const char* names[2] = { "AONumDirections", "AONumSteps" };
+        for (int i = 0; i < 2; ++i)
+        {
+            osg::Uniform* u = stage->getUniform(names[i]);
+            if (u != NULL) u->set(counts[i]);
+            else stage->applyUniform(new osg::Uniform(names[i], counts[i]));
+        }
+    }
+
+    StageStatisticsModule::StageStatisticsModule(const std::string& name, Pipeline* pipeline)
+        : _pipeline(pipeline), _lastFrameTick(0), _totalGpuTime(-1.0), _averageFrameTime(0.0),
+          _frameBudget(0.0), _restoreRatio(0.8), _sampleWindow(60), _framesSinceChange(0),
+          _restoreWindows(1), _withGpuTimers(false), _lastChangeRestored(false)
+    { if (pipeline) pipeline->addModule(name, this); }
+
+    StageStatisticsModule::~StageStatisticsModule()
+    {
+        if (_pipeline.valid()) _pipeline->removeModule(this);
+    }
+
+    void StageStatisticsModule::applyStages(bool withGpuTimers)
+    {
+        if (!_pipeline)
+        {
+            OSG_WARN << "[StageStatisticsModule] Invalid pipeline" << std::endl;
+            return;
+        }
+        else if (!_records.empty())
+        {
+            OSG_WARN << "[StageStatisticsModule] Stages are already applied" << std::endl;
+            return;
+        }
+
+        _withGpuTimers = withGpuTimers;
+        for (unsigned int i = 0; i < _pipeline->getNumStages(); ++i)
+        {
+            Pipeline::Stage* s = _pipeline->getStage(i);
+            if (s->deferred) applyCallbacks(s->name, NULL, s->runner.get(), 0);
+            else applyCallbacks(s->name, s->camera.get(), NULL, INITIAL_DRAW);
+        }
+
+        // Deferred stages are run in pre-draw callback of the forward camera, so start after them
+        osg::Camera* forwardCam = _pipeline->getForwardCamera();
+        if (forwardCam != NULL) applyCallbacks("Forward", forwardCam, NULL, PRE_DRAW);
+    }
+
+    void StageStatisticsModule::applyCallbacks(const std::string& stageName, osg::Camera* camera,
+                                               DeferredRenderCallback::RttRunner* runner, int beginLevel)
+    {
+        if (!camera && !runner) return;
+        if (_records.find(stageName) != _records.end())
+        {
+            OSG_NOTICE << "[StageStatisticsModule] Duplicated stage name " << stageName
+                       << ", which will not be recorded" << std::endl;
+            return;
+        }
+
+        StageRecord& record = _records[stageName]; _stageNames.push_back(stageName);
+        if (_withGpuTimers) record.gpuTimer = new GpuTimer;
+
+        osg::ref_ptr<StageTimingDrawCallback> beginCallback = new StageTimingDrawCallback(this, stageName, true);
+        osg::ref_ptr<StageTimingDrawCallback> endCallback = new StageTimingDrawCallback(this, stageName, false);
+        if (runner != NULL)
+        { runner->preDrawCallback = beginCallback; runner->postDrawCallback = endCallback; }
+        else
+        {
+            camera->addCullCallback(new StageTimingCullCallback(this, stageName));
+            beginCallback->setup(camera, beginLevel); endCallback->setup(camera, FINAL_DRAW);
+        }
+    }
+
+    void StageStatisticsModule::recordCullTime(const std::string& stageName, double ms)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<std::string, StageRecord>::iterator itr = _records.find(stageName);
+        if (itr == _records.end()) return;
+        itr->second.lastCullTime = ms; itr->second.cullUpdated = true;
+    }
+
+    void StageStatisticsModule::beginDraw(const std::string& stageName, osg::RenderInfo& renderInfo)
+    {
+        std::map<std::string, StageRecord>::iterator itr = _records.find(stageName);
+        if (itr == _records.end()) return;
+        if (itr->second.gpuTimer.valid()) itr->second.gpuTimer->begin(*renderInfo.getState());
+        itr->second.drawStart = osg::Timer::instance()->tick();
+    }
+
+    void StageStatisticsModule::endDraw(const std::string& stageName, osg::RenderInfo& renderInfo)
+    {
+        std::map<std::string, StageRecord>::iterator itr = _records.find(stageName);
+        if (itr == _records.end()) return;
+
+        StageRecord& record = itr->second;
+        if (record.gpuTimer.valid()) record.gpuTimer->end(*renderInfo.getState());
+        double drawTime = osg::Timer::instance()->delta_m(record.drawStart, osg::Timer::instance()->tick());
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        record.lastDrawTime = drawTime; record.drawUpdated = true;
+        record.lastGpuTime = record.gpuTimer.valid() ? record.gpuTimer->getLastTime() : -1.0;
+    }
+
+    bool StageStatisticsModule::getTiming(const std::string& stageName, StageTiming& timing) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<std::string, StageRecord>::const_iterator itr = _records.find(stageName);
+        if (itr == _records.end()) return false;
+        timing = itr->second.timing; return true;
+    }
+
+    void StageStatisticsModule::getTimings(std::vector<std::pair<std::string, StageTiming>>& timings) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex); timings.clear();
+        for (size_t i = 0; i < _stageNames.size(); ++i)
+        {
+            std::map<std::string, StageRecord>::const_iterator itr = _records.find(_stageNames[i]);
+            timings.push_back(std::pair<std::string, StageTiming>(_stageNames[i], itr->second.timing));
+        }
+    }
+
+    void StageStatisticsModule::addStatsLines(osgViewer::StatsHandler* handler)
+    {
+        if (!handler) return;
+        if (_stats.valid()) _stats->collectStats("pipeline", true);
+
+        static const osg::Vec4 colors[2] = { osg::Vec4(1.0f, 1.0f, 0.5f, 1.0f), osg::Vec4(0.5f, 1.0f, 1.0f, 1.0f) };
+        for (size_t i = 0; i < _stageNames.size(); ++i)
+        {
+            const std::string& name = _stageNames[i];
+            handler->addUserStatsLine(name + (_withGpuTimers ? " GPU:" : " draw:"), colors[i % 2], colors[i % 2],
+                                      name + (_withGpuTimers ? " GPU time taken" : " draw time taken"),
+                                      1000.0f, true, false, "", "", 16.7f);
+        }
+    }
+
+    void StageStatisticsModule::addBudgetCallback(StageBudgetCallback* cb)
+    {
+        if (!cb) return; cb->apply(_pipeline.get(), 0);
+        _budgetCallbacks.push_back(BudgetCallbackPair(cb, 0));
+    }
+
+    void StageStatisticsModule::resetBudget()
+    {
+        for (size_t i = 0; i < _budgetCallbacks.size(); ++i)
+        {
+            BudgetCallbackPair& pair = _budgetCallbacks[i];
+            if (pair.second > 0) { pair.second = 0; pair.first->apply(_pipeline.get(), 0); }
+        }
+        _framesSinceChange = 0; _restoreWindows = 1; _lastChangeRestored = false;
+    }
+
+    void StageStatisticsModule::operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        osg::Timer_t tick = osg::Timer::instance()->tick();
+        if (_lastFrameTick > 0)
+        {
+            pushSample(_frameSamples, osg::Timer::instance()->delta_m(_lastFrameTick, tick), _sampleWindow);
+            averageSamples(_frameSamples, _averageFrameTime, false);
+        }
+        _lastFrameTick = tick;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            double totalGpuTime = 0.0; bool hasGpuTime = false;
+            for (std::map<std::string, StageRecord>::iterator itr = _records.begin();
+                 itr != _records.end(); ++itr)
+            {
+                StageRecord& record = itr->second;
+                if (record.cullUpdated) pushSample(record.cullSamples, record.lastCullTime, _sampleWindow);
+                if (record.drawUpdated)
+                {
+                    pushSample(record.drawSamples, record.lastDrawTime, _sampleWindow);
+                    pushSample(record.gpuSamples, record.lastGpuTime, _sampleWindow);
+                }
+                record.cullUpdated = false; record.drawUpdated = false;
+
+                StageTiming& t = record.timing; t.numSamples = record.drawSamples.size();
+                averageSamples(record.cullSamples, t.cullTime, false);
+                averageSamples(record.drawSamples, t.drawTime, false);
+                averageSamples(record.gpuSamples, t.gpuTime, true);
+                if (t.gpuTime >= 0.0) { totalGpuTime += t.gpuTime; hasGpuTime = true; }
+            }
+            _totalGpuTime = hasGpuTime ? totalGpuTime : -1.0;
+        }
+
+        const osg::FrameStamp* fs = nv ? nv->getFrameStamp() : NULL;
+        if (_stats.valid() && fs && _stats->collectStats("pipeline"))
+        {
+            std::vector<std::pair<std::string, StageTiming>> timings; getTimings(timings);
+            unsigned int frameNumber = fs->getFrameNumber();
+            for (size_t i = 0; i < timings.size(); ++i)
+            {
+                const std::string& name = timings[i].first; const StageTiming& t = timings[i].second;
+                _stats->setAttribute(frameNumber, name + " cull time taken", t.cullTime * 0.001);
+                _stats->setAttribute(frameNumber, name + " draw time taken", t.drawTime * 0.001);
+                if (t.gpuTime >= 0.0)
+                    _stats->setAttribute(frameNumber, name + " GPU time taken", t.gpuTime * 0.001);
+            }
+            if (_totalGpuTime >= 0.0)
+                _stats->setAttribute(frameNumber, "Pipeline GPU time taken", _totalGpuTime * 0.001);
+        }
+
+        checkBudget();
+        traverse(node, nv);
+    }
+
+    void StageStatisticsModule::checkBudget()
+    {
+        if (_frameBudget <= 0.0 || _budgetCallbacks.empty() || !_pipeline) return;
+        if (++_framesSinceChange < _sampleWindow) return;
+
+        double cost = (_totalGpuTime >= 0.0) ? _totalGpuTime : _averageFrameTime;
+        int changedIndex = -1; bool restored = false;
+        if (cost > _frameBudget)
+        {
+            for (size_t i = 0; i < _budgetCallbacks.size() && changedIndex < 0; ++i)
+            {
+                BudgetCallbackPair& pair = _budgetCallbacks[i];
+                if (pair.second < pair.first->getNumLevels())
+                { pair.second++; pair.first->apply(_pipeline.get(), pair.second); changedIndex = (int)i; }
+            }
+
+            // Restoring made it over budget at once: wait longer before next restoring
+            if (changedIndex >= 0 && _lastChangeRestored && _framesSinceChange <= _sampleWindow * 2)
+                _restoreWindows = osg::minimum(_restoreWindows * 2, 32u);
+        }
+        else if (cost < _frameBudget * _restoreRatio && _framesSinceChange >= _sampleWindow * _restoreWindows)
+        {
+            for (int i = (int)_budgetCallbacks.size() - 1; i >= 0 && changedIndex < 0; --i)
+            {
+                BudgetCallbackPair& pair = _budgetCallbacks[i];
+                if (pair.second > 0)
+                { pair.second--; pair.first->apply(_pipeline.get(), pair.second); changedIndex = i; }
+            }
+            restored = true;
+        }
+        if (changedIndex < 0) return;
+
+        OSG_INFO << "[StageStatisticsModule] Frame cost " << cost << "ms (budget " << _frameBudget
+                 << "ms), set budget callback " << changedIndex << " to level "
+                 << _budgetCallbacks[changedIndex].second << std::endl;
+        _framesSinceChange = 0; _lastChangeRestored = restored; _frameSamples.clear();
+
+        // Drop samples of previous quality levels
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (std::map<std::string, StageRecord>::iterator itr = _records.begin(); itr != _records.end(); ++itr)
+        {
+            StageRecord& record = itr->second; record.cullSamples.clear();
+            record.drawSamples.clear(); record.gpuSamples.clear();
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef MANA_PP_STAGE_STATISTICS_HPP
+#define MANA_PP_STAGE_STATISTICS_HPP
+
+#include <osg/Timer>
+#include <osg/Stats>
+#include <deque>
+#include <mutex>
+#include "Pipeline.h"
+
+namespace osgViewer { class StatsHandler; }
+namespace osgVerse
+{
+    class GpuTimer;
+
+    /** Averaged timings of a stage in milliseconds. GPU time is -1 if timer queries are unavailable */
+    struct StageTiming
+    {
+        double cullTime, drawTime, gpuTime;
+        unsigned int numSamples;
+        StageTiming() : cullTime(0.0), drawTime(0.0), gpuTime(-1.0), numSamples(0) {}
+    };
+
+    /** Quality levels of a pipeline feature, degraded one by one when the frame is over budget.
+        Level 0 is always the full quality */
+    class StageBudgetCallback : public osg::Referenced
+    {
+    public:
+        virtual int getNumLevels() const = 0;
+        virtual void apply(Pipeline* pipeline, int level) = 0;
+    };
+
+    /** Lower SSAO sampling directions and steps when over budget (uniforms of the "Ssao" stage,
+        or "SSAO" as named in JSON pipelines) */
+    class SsaoBudgetCallback : public StageBudgetCallback
+    {
+    public:
+        SsaoBudgetCallback(const std::string& stageName = "Ssao") : _stageName(stageName) {}
+        virtual int getNumLevels() const { return 2; }
+        virtual void apply(Pipeline* pipeline, int level);
+
+    protected:
+        std::string _stageName;
+    };
+
+    /** Pipeline module collecting per-stage timings, averaged over a sliding window:
+        - CPU cull time: camera stages only (deferred stages have nothing to cull)
+        - CPU draw time: time of submitting GL commands of the stage
+        - GPU time: timer queries of the stage, results are read a few frames later
+        The forward pass is recorded as "Forward" (excluding deferred stages run before it).
+        Averaged results are also written to osg::Stats (as seconds, like other OSG stats) with
+        attribute names like "<Stage> GPU time taken", if collectStats("pipeline") is set.
+
+        Optionally, a frame budget can be set with StageBudgetCallbacks. Total GPU time of all stages
+        (or frame interval if timer queries are unavailable) is checked each window: callbacks are
+        degraded in adding order when over budget, and restored in reverse order when under
+        (budget * restoreRatio). Restoring is delayed longer each time it causes over budget again.
+        It should be added as update callback of the main camera after all stages are created */
+    class StageStatisticsModule : public RenderingModuleBase
+    {
+    public:
+        StageStatisticsModule(const std::string& name, Pipeline* pipeline);
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        /** Apply timing callbacks to all current stages and the forward camera */
+        void applyStages(bool withGpuTimers);
+
+        /** Set number of frames to average (default: 60) */
+        void setSampleWindow(unsigned int frames) { _sampleWindow = osg::maximum(frames, 1u); }
+        unsigned int getSampleWindow() const { return _sampleWindow; }
+
+        /** Get averaged timings of a stage, or return false if not found */
+        bool getTiming(const std::string& stageName, StageTiming& timing) const;
+        void getTimings(std::vector<std::pair<std::string, StageTiming>>& timings) const;
+
+        /** Sum of averaged GPU times of all stages, or -1 if unavailable */
+        double getTotalGpuTime() const { return _totalGpuTime; }
+        double getAverageFrameTime() const { return _averageFrameTime; }
+
+        /** Stats to write to, e.g., viewer->getViewerStats() */
+        void setStats(osg::Stats* stats) { _stats = stats; }
+        osg::Stats* getStats() { return _stats.get(); }
+
+        /** Add per-stage GPU (or CPU draw if unavailable) lines to the stats handler, and enable
+            collecting "pipeline" stats. The stats should be the viewer stats to be displayed */
+        void addStatsLines(osgViewer::StatsHandler* handler);
+
+        /** Set frame budget in milliseconds (0 to disable budget checking) */
+        void setFrameBudget(double ms, double restoreRatio = 0.8)
+        { _frameBudget = ms; _restoreRatio = restoreRatio; }
+        double getFrameBudget() const { return _frameBudget; }
+
+        void addBudgetCallback(StageBudgetCallback* cb);
+        unsigned int getNumBudgetCallbacks() const { return _budgetCallbacks.size(); }
+        StageBudgetCallback* getBudgetCallback(unsigned int i) { return _budgetCallbacks[i].first.get(); }
+        int getBudgetLevel(unsigned int i) const { return _budgetCallbacks[i].second; }
+
+        /** Restore full quality of all budget callbacks */
+        void resetBudget();
+
+        /** Called by internal callbacks */
+        void recordCullTime(const std::string& stageName, double ms);
+        void beginDraw(const std::string& stageName, osg::RenderInfo& renderInfo);
+        void endDraw(const std::string& stageName, osg::RenderInfo& renderInfo);
+
+    protected:
+        virtual ~StageStatisticsModule();
+        void applyCallbacks(const std::string& stageName, osg::Camera* camera,
+                            DeferredRenderCallback::RttRunner* runner, int beginLevel);
+        void checkBudget();
+
+        struct StageRecord
+        {
+            std::deque<double> cullSamples, drawSamples, gpuSamples;
+            osg::ref_ptr<GpuTimer> gpuTimer; osg::Timer_t drawStart;
+            double lastCullTime, lastDrawTime, lastGpuTime; bool cullUpdated, drawUpdated;
+            StageTiming timing;
+            StageRecord() : drawStart(0), lastCullTime(0.0), lastDrawTime(0.0), lastGpuTime(-1.0),
+                            cullUpdated(false), drawUpdated(false) {}
+        };
+
+        typedef std::pair<osg::ref_ptr<StageBudgetCallback>, int> BudgetCallbackPair;
+        std::map<std::string, StageRecord> _records;
+        std::vector<std::string> _stageNames;
+        std::vector<BudgetCallbackPair> _budgetCallbacks;
+        std::deque<double> _frameSamples;
+        mutable std::mutex _mutex;
+
+        osg::observer_ptr<Pipeline> _pipeline;
+        osg::observer_ptr<osg::Stats> _stats;
+        osg::Timer_t _lastFrameTick;
+        double _totalGpuTime, _averageFrameTime, _frameBudget, _restoreRatio;
+        unsigned int _sampleWindow, _framesSinceChange, _restoreWindows;
+        bool _withGpuTimers, _lastChangeRestored;
+    };
+}
+
+#endif
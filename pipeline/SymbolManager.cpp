@@ -3,13 +3,105 @@
 #include <osg/ProxyNode>
 #include <osgDB/ConvertUTF>
 #include <osgDB/WriteFile>
-#include <3rdparty/dkm_parallel.hpp>
+#include <3rdparty/RTree.h>
+#include <modeling/Profiler.h>
 #include "Pipeline.h"
+#include "Utilities.h"
 #include "SymbolManager.h"
 
 #define RES 512
 using namespace osgVerse;
 
+namespace osgVerse
+{
+    struct SymbolIndex
+    {
+        typedef RTree<Symbol*, double, 3> TreeType;
+        std::map<int, osg::Vec3d> positions;  // indexed position of each symbol
+        TreeType tree;
+
+        void insert(Symbol* sym)
+        {
+            std::map<int, osg::Vec3d>::iterator itr = positions.find(sym->id);
+            if (itr != positions.end() && itr->second == sym->position) return;
+            else if (itr != positions.end()) remove(sym);
+
+            const double* pt = sym->position.ptr();
+            tree.Insert(pt, pt, sym); positions[sym->id] = sym->position;
+        }
+
+        void remove(Symbol* sym)
+        {
+            std::map<int, osg::Vec3d>::iterator itr = positions.find(sym->id);
+            if (itr == positions.end()) return;
+
+            const double* pt = itr->second.ptr();
+            tree.Remove(pt, pt, sym); positions.erase(itr);
+        }
+
+        void search(const osg::BoundingBoxd& bb, std::vector<Symbol*>& result) const
+        {
+            tree.Search(bb._min.ptr(), bb._max.ptr(),
+                        [&result](const double*, const double*, Symbol* const& sym)
+                        { result.push_back(sym); return true; });
+        }
+    };
+}
+
+static bool computePolytopeBound(const osg::Polytope& polytope, osg::BoundingBoxd& bb)
+{
+    const osg::Polytope::PlaneList& planes = polytope.getPlaneList();
+    size_t numPlanes = planes.size(); if (numPlanes < 4) return false;
+
+    std::vector<osg::Vec3d> normals(numPlanes); std::vector<double> dists(numPlanes);
+    for (size_t i = 0; i < numPlanes; ++i)
+    {
+        const osg::Plane& p = planes[i]; osg::Vec3d n(p[0], p[1], p[2]);
+        double length = n.length(); if (length <= 0.0) return false;
+        normals[i] = n / length; dists[i] = p[3] / length;
+    }
+
+    // The polytope is unbounded if any direction d matches n * d >= 0 for all plane normals;
+    // such directions can be found among cross products of normal pairs
+    bool hasDirection = false;
+    for (size_t i = 0; i < numPlanes; ++i)
+        for (size_t j = i + 1; j < numPlanes; ++j)
+        {
+            osg::Vec3d d = normals[i] ^ normals[j];
+            if (d.length2() < 1e-12) continue; else d.normalize();
+            for (int side = 0; side < 2; ++side, d = -d)
+            {
+                bool unbounded = true;
+                for (size_t k = 0; k < numPlanes && unbounded; ++k)
+                { if (normals[k] * d < -1e-9) unbounded = false; }
+                if (unbounded) return false;
+            }
+            hasDirection = true;
+        }
+    if (!hasDirection) return false;
+
+    // Compute bounding box of all vertices (intersection of 3 planes) of the polytope
+    bb.init();
+    for (size_t i = 0; i < numPlanes; ++i)
+        for (size_t j = i + 1; j < numPlanes; ++j)
+            for (size_t k = j + 1; k < numPlanes; ++k)
+            {
+                osg::Vec3d njk = normals[j] ^ normals[k]; double det = normals[i] * njk;
+                if (fabs(det) < 1e-12) continue;
+
+                osg::Vec3d pt = (njk * -dists[i] + (normals[k] ^ normals[i]) * -dists[j] +
+                                (normals[i] ^ normals[j]) * -dists[k]) / det;
+                double tolerance = 1e-6 * (1.0 + pt.length()); bool inside = true;
+                for (size_t m = 0; m < numPlanes && inside; ++m)
+                { if (normals[m] * pt + dists[m] < -tolerance) inside = false; }
+                if (inside) bb.expandBy(pt);
+            }
+    if (!bb.valid()) return false;
+
+    osg::Vec3d padding(1.0, 1.0, 1.0); padding *= 1e-6 * (1.0 + bb.radius());
+    bb._min -= padding; bb._max += padding; return true;
+}
+
 static osg::Texture2D* createParameterTable(osg::Image* image)
 {
     image->allocateImage(RES, RES, 1, GL_RGBA, GL_FLOAT);
@@ -17,6 +109,7 @@ static osg::Texture2D* createParameterTable(osg::Image* image)
     memset(image->data(), 0, image->getTotalSizeInBytes());
 
     osg::Texture2D* tex = new osg::Texture2D; tex->setImage(image);
+    tex->setSubloadCallback(new DirtyRegionSubloadCallback);
     tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
     tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
     tex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_BORDER);
@@ -24,6 +117,16 @@ static osg::Texture2D* createParameterTable(osg::Image* image)
     tex->setBorderColor(osg::Vec4(0.0f, 0.0f, 0.0f, 0.0f)); return tex;
 }
 
+static DirtyRegionSubloadCallback* getSubloader(osg::Texture2D* tex)
+{ return static_cast<DirtyRegionSubloadCallback*>(tex->getSubloadCallback()); }
+
+static inline long long getClusterKey(int x, int y)
+{ return ((long long)y << 32) | (unsigned int)x; }
+
+static inline void setParameter(osg::Vec4f* handle, int index, const osg::Vec4f& value,
+                                DirtyRegionSubloadCallback::TexelRun& run)
+{ if (handle[index] != value) { handle[index] = value; run.add(index); } }
+
 osg::Vec3 Symbol::getCorner2D(SymbolManager* mgr, int index) const
 {
     osg::Viewport* vp = mgr->getMainCamera()->getViewport();
@@ -53,14 +156,17 @@ osg::Vec3 Symbol::getCorner2D(SymbolManager* mgr, int index) const
 }
 
 SymbolManager::SymbolManager()
-    : _idCounter(0), _firstRun(true), _showIconsInMidDistance(true)
+    : _clusterCellSize(0.0f), _clusterHysteresis(0.25f), _idCounter(0),
+      _firstRun(true), _showIconsInMidDistance(true)
 {
+    _index = new SymbolIndex;
     osg::Image* posImage = new osg::Image;
     osg::Image* posImage2 = new osg::Image;
     osg::Image* dirImage = new osg::Image;
     osg::Image* dirImage2 = new osg::Image;
     osg::Image* colorImage = new osg::Image;
     osg::Image* colorImage2 = new osg::Image;
+    osg::Image* clusterImage = new osg::Image;
 
     osg::Image* emptyImage = new osg::Image;
     emptyImage->allocateImage(1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE);
@@ -72,6 +178,7 @@ SymbolManager::SymbolManager()
     _dirTexture2 = createParameterTable(dirImage2);
     _colorTexture = createParameterTable(colorImage);
     _colorTexture2 = createParameterTable(colorImage2);
+    _clusterTexture = createParameterTable(clusterImage);
 
     _iconTexture = new osg::Texture2D; _iconTexture->setResizeNonPowerOfTwoHint(false);
     _iconTexture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
@@ -93,6 +200,9 @@ SymbolManager::SymbolManager()
     _midDistanceScale = new osg::Uniform("Scale", osg::Vec3(3.0f, 1.0f, 1.0f / 10.0f));
 }
 
+SymbolManager::~SymbolManager()
+{ delete _index; }
+
 void SymbolManager::operator()(osg::Node* node, osg::NodeVisitor* nv)
 {
     osg::Group* group = node->asGroup();
@@ -112,19 +222,19 @@ void SymbolManager::operator()(osg::Node* node, osg::NodeVisitor* nv)
 
 int SymbolManager::updateSymbol(Symbol* sym)
 {
-    // TODO: add to RTree
     if (sym && sym->id < 0) sym->id = _idCounter++;
-
     if (!sym || (sym && sym->id < 0)) return -1;
-    _symbols[sym->id] = sym; return sym->id;
+
+    std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.find(sym->id);
+    if (itr != _symbols.end() && itr->second.get() != sym) _index->remove(itr->second.get());
+    _symbols[sym->id] = sym; _index->insert(sym); return sym->id;
 }
 
 bool SymbolManager::removeSymbol(Symbol* sym)
 {
-    // TODO: remove from RTree
     if (!sym || (sym && sym->id < 0)) return false;
-    if (_symbols.find(sym->id) != _symbols.end())
-        _symbols.erase(_symbols.find(sym->id));
+    std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.find(sym->id);
+    if (itr != _symbols.end()) { _index->remove(itr->second.get()); _symbols.erase(itr); }
     return true;
 }
 
@@ -142,12 +252,12 @@ const Symbol* SymbolManager::getSymbol(int id) const
 
 std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec3d& pos, double radius) const
 {
-    // TODO: use RTree query
-    std::vector<Symbol*> result;
-    for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
+    osg::Vec3d r(radius, radius, radius);
+    std::vector<Symbol*> candidates, result;
+    _index->search(osg::BoundingBoxd(pos - r, pos + r), candidates);
+    for (size_t i = 0; i < candidates.size(); ++i)
     {
-        Symbol* sym = itr->second.get();
+        Symbol* sym = candidates[i];
         double length = (sym->position - pos).length();
         if (length < radius) result.push_back(sym);
     }
@@ -156,12 +266,11 @@ std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec3d& pos, double r
 
 std::vector<Symbol*> SymbolManager::querySymbols(const osg::Polytope& polytope) const
 {
-    // TODO: use RTree query
-    std::vector<Symbol*> result;
-    for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
+    std::vector<Symbol*> candidates, result;
+    findCandidates(polytope, candidates);
+    for (size_t i = 0; i < candidates.size(); ++i)
     {
-        Symbol* sym = itr->second.get();
+        Symbol* sym = candidates[i];
         if (polytope.contains(sym->position)) result.push_back(sym);
     }
     return result;
@@ -169,7 +278,6 @@ std::vector<Symbol*> SymbolManager::querySymbols(const osg::Polytope& polytope)
 
 std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec2d& proj, double e) const
 {
-    // TODO: use RTree query
     osg::BoundingBox bb;
     bb._min.set(proj[0] - e, proj[1] - e, -1.0);
     bb._max.set(proj[0] + e, proj[1] + e, 1.0);
@@ -178,15 +286,18 @@ std::vector<Symbol*> SymbolManager::querySymbols(const osg::Vec2d& proj, double
     polytope.setToBoundingBox(bb);
     polytope.transformProvidingInverse(
         _camera->getViewMatrix() * _camera->getProjectionMatrix());
+    return querySymbols(polytope);
+}
 
-    std::vector<Symbol*> result;
+void SymbolManager::findCandidates(const osg::Polytope& polytope, std::vector<Symbol*>& result) const
+{
+    // Use spatial index if the polytope is closed, or check all symbols
+    osg::BoundingBoxd bb;
+    if (computePolytopeBound(polytope, bb)) { _index->search(bb, result); return; }
+
+    result.reserve(_symbols.size());
     for (std::map<int, osg::ref_ptr<Symbol>>::const_iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
-    {
-        Symbol* sym = itr->second.get();
-        if (polytope.contains(sym->position)) result.push_back(sym);
-    }
-    return result;
+         itr != _symbols.end(); ++itr) result.push_back(itr->second.get());
 }
 
 void SymbolManager::setShaders(osg::Shader* vs, osg::Shader* fs)
@@ -242,10 +353,12 @@ void SymbolManager::initialize(osg::Group* group)
         ss->setTextureAttributeAndModes(1, _dirTexture.get());
         ss->setTextureAttributeAndModes(2, _colorTexture.get());
         ss->setTextureAttributeAndModes(3, _iconTexture.get());
+        ss->setTextureAttributeAndModes(4, _clusterTexture.get());
         ss->addUniform(new osg::Uniform("PosTexture", (int)0));
         ss->addUniform(new osg::Uniform("DirTexture", (int)1));
         ss->addUniform(new osg::Uniform("ColorTexture", (int)2));
         ss->addUniform(new osg::Uniform("IconTexture", (int)3));
+        ss->addUniform(new osg::Uniform("ClusterTexture", (int)4));
         ss->addUniform(new osg::Uniform("InvResolution", 1.0f / (float)RES));
     }
 
@@ -316,6 +429,7 @@ void SymbolManager::initialize(osg::Group* group)
 
 void SymbolManager::update(osg::Group* group, unsigned int frameNo)
 {
+    VERSE_PROFILE_ZONE_CATEGORY("SymbolManager::update", "pipeline");
     osg::BoundingBox boundBox;
     osg::Matrix viewMatrix = _camera->getViewMatrix();
     osg::Matrix projMatrix = _camera->getProjectionMatrix();
@@ -324,12 +438,22 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
     Symbol* nearestSym = NULL; double nearest = FLT_MAX;
     int numInstances = 0, numInstances2 = 0;
 
+    // Symbols can only be shown inside the frustum and nearer than LOD0 distance
+    osg::Plane farPlane(0.0, 0.0, 1.0, _lodDistances[0]);
+    farPlane.transformProvidingInverse(viewMatrix);
+
     osg::Polytope frustum;
     frustum.setToUnitFrustum(false, false);
     frustum.transformProvidingInverse(viewMatrix * projMatrix);
+    frustum.add(farPlane);
 
-    // Use octree / RTree to query symbols and find visible ones
-    // TODO
+    // Use spatial index to find symbols which may be visible; last visible ones are reset
+    std::vector<Symbol*> candidates; findCandidates(frustum, candidates);
+    for (size_t i = 0; i < _shownSymbols.size(); ++i)
+    {
+        std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.find(_shownSymbols[i]);
+        if (itr != _symbols.end()) itr->second->state = Symbol::Hidden;
+    }
 
     // Traverse all symbols
     osg::Vec4f* posHandle = (osg::Vec4f*)_posTexture->getImage()->data();
@@ -338,19 +462,27 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
     osg::Vec4f* dirHandle2 = (osg::Vec4f*)_dirTexture2->getImage()->data();
     osg::Vec4f* colorHandle = (osg::Vec4f*)_colorTexture->getImage()->data();
     osg::Vec4f* colorHandle2 = (osg::Vec4f*)_colorTexture2->getImage()->data();
+    osg::Vec4f* clusterHandle = (osg::Vec4f*)_clusterTexture->getImage()->data();
+    DirtyRegionSubloadCallback::TexelRun posRun(getSubloader(_posTexture.get())),
+                                         posRun2(getSubloader(_posTexture2.get())),
+                                         dirRun(getSubloader(_dirTexture.get())),
+                                         dirRun2(getSubloader(_dirTexture2.get())),
+                                         colorRun(getSubloader(_colorTexture.get())),
+                                         colorRun2(getSubloader(_colorTexture2.get())),
+                                         clusterRun(getSubloader(_clusterTexture.get()));
     float lodScale0 = _lodIconScaleFactor[0] - _lodIconScaleFactor[1];
     float lodScale1 = _lodIconScaleFactor[1] - _lodIconScaleFactor[2];
 
-    std::vector<Symbol*> texts;
-    std::map<double, std::vector<std::pair<Symbol*, osg::Vec4>>> symbolsInOrder;
-    for (std::map<int, osg::ref_ptr<Symbol>>::iterator itr = _symbols.begin();
-         itr != _symbols.end(); ++itr)
+    // Update state and eye-space position of candidates in parallel
+    int numCandidates = (int)candidates.size();
+    std::vector<osg::Vec4> eyePosAndScales(numCandidates);
+    std::vector<double> distances(numCandidates);
+#pragma omp parallel for
+    for (int i = 0; i < numCandidates; ++i)
     {
-        // Update state and eye-space position
-        Symbol* sym = itr->second.get();
+        Symbol* sym = candidates[i];
         osg::Vec3f eyePos = sym->position * viewMatrix;
         double distance = -eyePos.z(), interpo = 0.0, scale = sym->scale;
-        if (distance < nearest) { nearest = distance; nearestSym = sym; }
 
         // Check distance state of each symbol
         if (distance > _lodDistances[0] || !frustum.contains(sym->position))
@@ -368,114 +500,147 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
             scale = sym->scale * (interpo * lodScale1 + _lodIconScaleFactor[2]);
         }
         else
+        {   // Near-distance models are loaded later
+            scale = sym->scale * _lodIconScaleFactor[2];
+            sym->state = Symbol::NearDistance;
+        }
+
+        distances[i] = distance; eyePosAndScales[i] = osg::Vec4(eyePos, (float)scale);
+        if (sym->state != Symbol::Hidden)
+            sym->projAndScale = osg::Vec4(eyePos * projMatrix, (float)scale);
+    }
+
+    std::vector<std::pair<double, int>> visibleSymbols; _shownSymbols.clear();
+    for (int i = 0; i < numCandidates; ++i)
+    {
+        Symbol* sym = candidates[i]; double distance = distances[i];
+        if (sym->state == Symbol::Hidden) continue; else _shownSymbols.push_back(sym->id);
+        if (distance < nearest) { nearest = distance; nearestSym = sym; }
+
+        if (sym->state == Symbol::NearDistance)
         {
             // Load or re-use symbol model
-            scale = sym->scale * _lodIconScaleFactor[2];
             sym->modelFrame0 = frameNo;
             if (!sym->fileName.empty())
-            {
-                sym->state = Symbol::NearDistance;
-                updateNearDistance(sym, group);
-            }
+            { updateNearDistance(sym, group); _modelSymbols.insert(sym->id); continue; }
             else sym->state = Symbol::MidDistance;
         }
 
-        if (sym->state != Symbol::NearDistance && sym->loadedModel.valid())
+        visibleSymbols.push_back(std::pair<double, int>(distance, i));
+    }
+
+    // If not in NearDistance mode, hide the model and see if we should delete it
+    for (std::set<int>::iterator itr = _modelSymbols.begin(); itr != _modelSymbols.end();)
+    {
+        Symbol* sym = getSymbol(*itr);
+        if (!sym || !sym->loadedModel.valid()) { itr = _modelSymbols.erase(itr); continue; }
+        if (sym->state != Symbol::NearDistance)
         {
-            // If not in NearDistance mode, hide the model and see if we should delete it
             int dt = frameNo - sym->modelFrame0;
-            if (dt > 120) group->removeChild(sym->loadedModel.get());
+            if (dt > 120)
+            { group->removeChild(sym->loadedModel.get()); itr = _modelSymbols.erase(itr); continue; }
             else sym->loadedModel->setNodeMask(0);
         }
-
-        // TODO: when convert to FarClustered?
-        if (sym->state == Symbol::Hidden || sym->state == Symbol::NearDistance) continue;
-        symbolsInOrder[distance].push_back(
-            std::pair<Symbol*, osg::Vec4>(sym, osg::Vec4(eyePos, (float)scale)));
-
-        int y = itr->first / RES, x = itr->first % RES;
-        if (y < 0 || y >(RES - 1)) { OSG_WARN << "[SymbolManager] Data overflow!" << std::endl; break; }
+        ++itr;
     }
 
-    std::vector<std::array<float, 2>> kmeansPoints;
-    std::vector<std::pair<Symbol*, osg::Vec4>> symbolsInOrder2;
-    std::map<double, std::vector<std::pair<Symbol*, osg::Vec4>>>::iterator itr;
-    for (itr = symbolsInOrder.begin(); itr != symbolsInOrder.end(); ++itr)
+    // Merge far symbols sharing the same screen-space cell into clusters
+    std::vector<std::pair<double, SymbolCluster*>> visibleClusters;
+    if (_clusterCellSize > 0.0f)
     {
-        // Save ordered points to vector and prepare for clustering
-        std::vector<std::pair<Symbol*, osg::Vec4>>& pairList = itr->second;
-        for (size_t n = 0; n < pairList.size(); ++n)
+        std::vector<Symbol*> farSymbols;
+        for (size_t n = 0; n < visibleSymbols.size(); ++n)
         {
-            std::pair<Symbol*, osg::Vec4>& pair = pairList[n];
-            osg::Vec3 proj = osg::Vec3(pair.second[0], pair.second[1],
-                                       pair.second[2]) * projMatrix;
-            std::array<float, 2> vec; vec[0] = proj[0]; vec[1] = proj[1];
-            pair.first->projAndScale = osg::Vec4(proj, pair.second[3]);
-            kmeansPoints.push_back(vec); symbolsInOrder2.push_back(pair);
+            Symbol* sym = candidates[visibleSymbols[n].second];
+            if (sym->state == Symbol::FarDistance) farSymbols.push_back(sym);
         }
-    }
+        updateClusters(farSymbols, frameNo);
 
-    if (!kmeansPoints.empty())
-    {
-#if false  // use kmean to cluster?
-        size_t numK = kmeansPoints.size() / 4; if (numK == 0) numK = 1;
-        auto result = dkm::kmeans_lloyd_parallel(kmeansPoints, numK);
-        std::vector<std::array<float, 2>> centers = std::get<0>(result);
-        std::vector<uint32_t> classIndices = std::get<1>(result);
-        std::set<uint32_t> usedIndices;
-
-        for (size_t n = 0; n < symbolsInOrder2.size(); ++n)
+        for (std::map<long long, SymbolCluster>::iterator itr = _clusters.begin();
+             itr != _clusters.end(); ++itr)
         {
-            Symbol* sym = symbolsInOrder2[n].first;
-            uint32_t classId = classIndices[n];
-            osg::Vec2 offset(kmeansPoints[n][0] - centers[classId][0],
-                             kmeansPoints[n][1] - centers[classId][1]);
-            if (offset.length() < 0.01f)
-            {
-                //if (usedIndices.find(classId) == usedIndices.end())
-                //    { usedIndices.insert(classId); }
-                //else
-                //    { continue; }
-            }
+            SymbolCluster& cluster = itr->second; if (cluster.members.size() < 2) continue;
+            for (std::set<int>::iterator it = cluster.members.begin(); it != cluster.members.end(); ++it)
+                _symbols[*it]->state = Symbol::FarClustered;
+
+            osg::Vec3d eyeCenter = cluster.centroid * viewMatrix;
+            visibleClusters.push_back(std::pair<double, SymbolCluster*>(-eyeCenter.z(), &cluster));
+        }
 
-            // Save to parameter textures
-            const osg::Vec4 posAndScale = symbolsInOrder2[n].second;
-            if (sym->state == Symbol::MidDistance)
+        if (!visibleClusters.empty())
+        {
+            size_t numLeft = 0;
+            for (size_t n = 0; n < visibleSymbols.size(); ++n)
             {
-                *(posHandle2 + numInstances2) = posAndScale;
-                *(dirHandle2 + numInstances2) = osg::Vec4(sym->tiling2, 1.0f);
-                *(colorHandle2 + numInstances) = sym->color;
-                texts.push_back(sym); numInstances2++;
-                if (!_showIconsInMidDistance) continue;
+                if (candidates[visibleSymbols[n].second]->state == Symbol::FarClustered) continue;
+                visibleSymbols[numLeft++] = visibleSymbols[n];
             }
+            visibleSymbols.resize(numLeft);
+        }
+    }
+    else if (!_clusters.empty())
+    { _clusters.clear(); _clusterMemberships.clear(); }
 
-            *(posHandle + numInstances) = posAndScale;
-            *(dirHandle + numInstances) = osg::Vec4(sym->tiling, sym->rotateAngle);
-            *(colorHandle + numInstances) = sym->color;
-            boundBox.expandBy(sym->position); numInstances++;  // FarDistance
+    // Sort visible symbols from near to far, keeping only nearest ones if there are too many
+    size_t maxInstances = RES * RES;
+    if (visibleSymbols.size() + visibleClusters.size() > maxInstances)
+    {
+        OSG_WARN << "[SymbolManager] Data overflow!" << std::endl;
+        if (visibleClusters.size() > maxInstances / 2)
+        {
+            std::nth_element(visibleClusters.begin(), visibleClusters.begin() + maxInstances / 2,
+                             visibleClusters.end());
+            visibleClusters.resize(maxInstances / 2);
         }
-#else
-        for (size_t n = 0; n < symbolsInOrder2.size(); ++n)
+
+        size_t maxSymbols = maxInstances - visibleClusters.size();
+        if (visibleSymbols.size() > maxSymbols)
         {
-            Symbol* sym = symbolsInOrder2[n].first;
-            const osg::Vec4 posAndScale = symbolsInOrder2[n].second;
+            std::nth_element(visibleSymbols.begin(), visibleSymbols.begin() + maxSymbols,
+                             visibleSymbols.end());
+            visibleSymbols.resize(maxSymbols);
+        }
+    }
+    std::sort(visibleSymbols.begin(), visibleSymbols.end());
+    std::sort(visibleClusters.begin(), visibleClusters.end());
 
-            // Save to parameter textures
-            if (sym->state == Symbol::MidDistance)
-            {
-                *(posHandle2 + numInstances2) = posAndScale;
-                *(dirHandle2 + numInstances2) = osg::Vec4(sym->tiling2, 1.0f);
-                *(colorHandle2 + numInstances) = sym->color;
-                texts.push_back(sym); numInstances2++;
-                if (!_showIconsInMidDistance) continue;
-            }
+    std::vector<Symbol*> texts;
+    for (size_t n = 0; n < visibleSymbols.size(); ++n)
+    {
+        int index = visibleSymbols[n].second; Symbol* sym = candidates[index];
+        const osg::Vec4& posAndScale = eyePosAndScales[index];
 
-            *(posHandle + numInstances) = posAndScale;
-            *(dirHandle + numInstances) = osg::Vec4(sym->tiling, sym->rotateAngle);
-            *(colorHandle + numInstances) = sym->color;
-            boundBox.expandBy(sym->position); numInstances++;  // FarDistance
+        // Save to parameter textures
+        if (sym->state == Symbol::MidDistance)
+        {
+            setParameter(posHandle2, numInstances2, posAndScale, posRun2);
+            setParameter(dirHandle2, numInstances2, osg::Vec4(sym->tiling2, 1.0f), dirRun2);
+            setParameter(colorHandle2, numInstances2, sym->color, colorRun2);
+            texts.push_back(sym); numInstances2++;
+            if (!_showIconsInMidDistance) continue;
         }
-#endif
+
+        setParameter(posHandle, numInstances, posAndScale, posRun);
+        setParameter(dirHandle, numInstances, osg::Vec4(sym->tiling, sym->rotateAngle), dirRun);
+        setParameter(colorHandle, numInstances, sym->color, colorRun);
+        setParameter(clusterHandle, numInstances, osg::Vec4(1.0f, 0.0f, 0.0f, 0.0f), clusterRun);
+        boundBox.expandBy(sym->position); numInstances++;  // FarDistance
+    }
+
+    for (size_t n = 0; n < visibleClusters.size(); ++n)
+    {
+        // Show cluster with icon of the representative symbol, slightly scaled up by its size
+        const SymbolCluster* cluster = visibleClusters[n].second;
+        Symbol* sym = _symbols[cluster->representative].get();
+        float count = (float)cluster->members.size();
+        float scale = sym->projAndScale[3] * (1.0f + 0.25f * log2(count));
+
+        setParameter(posHandle, numInstances, osg::Vec4(cluster->centroid * viewMatrix, scale), posRun);
+        setParameter(dirHandle, numInstances, osg::Vec4(sym->tiling, sym->rotateAngle), dirRun);
+        setParameter(colorHandle, numInstances, sym->color, colorRun);
+        setParameter(clusterHandle, numInstances,
+                     osg::Vec4(count, (float)cluster->radius, 0.0f, 0.0f), clusterRun);
+        boundBox.expandBy(cluster->centroid); numInstances++;  // FarClustered
     }
 
     // If only one symbol left and near enough, select it as NearDistance one
@@ -485,7 +650,7 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
         if (!nearestSym->fileName.empty())
         {
             nearestSym->state = Symbol::NearDistance;
-            updateNearDistance(nearestSym, group);
+            updateNearDistance(nearestSym, group); _modelSymbols.insert(nearestSym->id);
         }
     }
 
@@ -497,8 +662,7 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
         if (p) { p->setNumInstances(numInstances); p->dirty(); }
         _instanceGeom->setInitialBound(boundBox);
         _instanceGeom->getParent(0)->setNodeMask(0xffffffff);
-        _posTexture->getImage()->dirty(); _dirTexture->getImage()->dirty();
-        _colorTexture->getImage()->dirty();
+        posRun.flush(); dirRun.flush(); colorRun.flush(); clusterRun.flush();
     }
     else
         _instanceGeom->getParent(0)->setNodeMask(0);
@@ -511,8 +675,7 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
         if (p) { p->setNumInstances(numInstances2); p->dirty(); }
         _instanceBoard->setInitialBound(boundBox);
         _instanceBoard->getParent(0)->setNodeMask(0xffffffff);
-        _posTexture2->getImage()->dirty(); _dirTexture2->getImage()->dirty();
-        _colorTexture2->getImage()->dirty();
+        posRun2.flush(); dirRun2.flush(); colorRun2.flush();
 
         // Collect labels and recreate texture
         if (_drawGridCallback.valid())
@@ -524,6 +687,86 @@ void SymbolManager::update(osg::Group* group, unsigned int frameNo)
         _instanceBoard->getParent(0)->setNodeMask(0);
 }
 
+unsigned int SymbolManager::getBytesUploadedInLastFrame() const
+{
+    osg::Texture2D* textures[7] = { _posTexture.get(), _dirTexture.get(), _colorTexture.get(),
+                                    _posTexture2.get(), _dirTexture2.get(), _colorTexture2.get(),
+                                    _clusterTexture.get() };
+    unsigned int numBytes = 0;
+    for (int i = 0; i < 7; ++i) numBytes += getSubloader(textures[i])->getBytesUploadedInLastFrame();
+    return numBytes;
+}
+
+void SymbolManager::updateClusters(const std::vector<Symbol*>& farSymbols, unsigned int frameNo)
+{
+    double cellSize = _clusterCellSize, margin = _clusterCellSize * _clusterHysteresis;
+    for (size_t i = 0; i < farSymbols.size(); ++i)
+    {
+        Symbol* sym = farSymbols[i];
+        double x = sym->projAndScale[0], y = sym->projAndScale[1];
+        int cellX = (int)floor(x / cellSize), cellY = (int)floor(y / cellSize);
+
+        std::map<int, ClusterMembership>::iterator itr = _clusterMemberships.find(sym->id);
+        if (itr == _clusterMemberships.end())
+        {
+            ClusterMembership m; m.position = sym->position;
+            m.cellX = cellX; m.cellY = cellY; m.frame = frameNo;
+            _clusterMemberships[sym->id] = m;
+
+            SymbolCluster& cluster = _clusters[getClusterKey(cellX, cellY)];
+            cluster.members.insert(sym->id); cluster.dirty = true; continue;
+        }
+
+        // Keep current cell unless the symbol moves out of it with enough margin
+        ClusterMembership& m = itr->second; m.frame = frameNo;
+        double x0 = m.cellX * cellSize - margin, x1 = (m.cellX + 1) * cellSize + margin;
+        double y0 = m.cellY * cellSize - margin, y1 = (m.cellY + 1) * cellSize + margin;
+        if (x < x0 || x > x1 || y < y0 || y > y1)
+        {
+            SymbolCluster& cluster0 = _clusters[getClusterKey(m.cellX, m.cellY)];
+            cluster0.members.erase(sym->id); cluster0.dirty = true;
+            m.cellX = cellX; m.cellY = cellY; m.position = sym->position;
+
+            SymbolCluster& cluster1 = _clusters[getClusterKey(cellX, cellY)];
+            cluster1.members.insert(sym->id); cluster1.dirty = true;
+        }
+        else if (m.position != sym->position)
+        { m.position = sym->position; _clusters[getClusterKey(m.cellX, m.cellY)].dirty = true; }
+    }
+
+    // Remove symbols which are not in 'far' state any more
+    for (std::map<int, ClusterMembership>::iterator itr = _clusterMemberships.begin();
+         itr != _clusterMemberships.end();)
+    {
+        ClusterMembership& m = itr->second;
+        if (m.frame == frameNo) { ++itr; continue; }
+
+        SymbolCluster& cluster = _clusters[getClusterKey(m.cellX, m.cellY)];
+        cluster.members.erase(itr->first); cluster.dirty = true;
+        itr = _clusterMemberships.erase(itr);
+    }
+
+    // Only recompute clusters whose members changed
+    for (std::map<long long, SymbolCluster>::iterator itr = _clusters.begin();
+         itr != _clusters.end();)
+    {
+        SymbolCluster& cluster = itr->second;
+        if (cluster.members.empty()) { itr = _clusters.erase(itr); continue; }
+        else if (!cluster.dirty) { ++itr; continue; }
+
+        std::set<int>::iterator it; osg::Vec3d center; double radius2 = 0.0;
+        for (it = cluster.members.begin(); it != cluster.members.end(); ++it)
+            center += _clusterMemberships[*it].position;
+        center /= (double)cluster.members.size();
+
+        for (it = cluster.members.begin(); it != cluster.members.end(); ++it)
+            radius2 = osg::maximum(radius2, (_clusterMemberships[*it].position - center).length2());
+        cluster.centroid = center; cluster.radius = sqrt(radius2);
+        cluster.representative = *cluster.members.begin();
+        cluster.dirty = false; ++itr;
+    }
+}
+
 void SymbolManager::updateNearDistance(Symbol* sym, osg::Group* group)
 {
     if (!sym->loadedModel)
@@ -6,11 +6,14 @@
 #include <osg/ShapeDrawable>
 #include <osg/Texture2D>
 #include <osg/MatrixTransform>
+#include <osg/Polytope>
+#include <set>
 #include "Drawer2D.h"
 
 namespace osgVerse
 {
     class SymbolManager;
+    struct SymbolIndex;
     struct Symbol : public osg::Referenced
     {
         enum State { Hidden = 0, FarClustered, FarDistance,
@@ -36,6 +39,17 @@ namespace osgVerse
         float rotateAngle, scale;                            // Rotation and scale of the symbol
     };
 
+    /** Cluster of 'far' symbols sharing a screen-space cell */
+    struct SymbolCluster
+    {
+        SymbolCluster() : radius(0.0), representative(-1), dirty(true) {}
+        std::set<int> members;      // IDs of member symbols
+        osg::Vec3d centroid;        // (output) World-space centroid of members
+        double radius;              // (output) Max distance from a member to the centroid
+        int representative;         // (output) ID of the symbol whose icon is shown for the cluster
+        bool dirty;                 // Members changed, centroid should be recomputed
+    };
+
     /** The symbol manager. */
     class SymbolManager : public osg::NodeCallback
     {
@@ -106,10 +120,23 @@ namespace osgVerse
         void setShowIconsInMidDistance(bool b) { _showIconsInMidDistance = b; }
         bool getShowIconsInMidDistance() const { return _showIconsInMidDistance; }
 
+        // Set screen-space cell size (in NDC units, 0 to disable) for clustering 'far' symbols
+        // A symbol only leaves its cell after moving more than 'hysteresis x size' out of it,
+        // so clusters won't flicker when the view changes slightly. Default is (0, 0.25).
+        // Clusters with 2 or more members are drawn as one instance at centroid, and the
+        // 'ClusterTexture' (unit 4) of each instance contains (count, radius, 0, 0)
+        void setFarClusterCellSize(float size, float hysteresis = 0.25f)
+        { _clusterCellSize = size; _clusterHysteresis = hysteresis; }
+        float getFarClusterCellSize() const { return _clusterCellSize; }
+        float getFarClusterHysteresis() const { return _clusterHysteresis; }
+
+        /** Get clusters of 'far' symbols, which are updated incrementally while rendering */
+        const std::map<long long, SymbolCluster>& getFarClusters() const { return _clusters; }
+
         /** Set symbols rendering shaders */
         void setShaders(osg::Shader* vs, osg::Shader* fs);
 
-        /** Add or update symbol data to manager */
+        /** Add or update symbol data to manager. Call it again after changing position of the symbol */
         int updateSymbol(Symbol* sym);
 
         /** Remove symbol data from manager */
@@ -124,6 +151,8 @@ namespace osgVerse
         std::vector<Symbol*> querySymbols(const osg::Polytope& polytope) const;
         std::vector<Symbol*> querySymbols(const osg::Vec2d& proj, double eplsion) const;
 
+        /** Get all symbols. Use updateSymbol() / removeSymbol() instead of changing it directly,
+            so that the spatial index can be kept up to date */
         std::map<int, osg::ref_ptr<Symbol>>& getSymols() { return _symbols; }
         const std::map<int, osg::ref_ptr<Symbol>>& getSymols() const { return _symbols; }
 
@@ -134,11 +163,16 @@ namespace osgVerse
         };
         void setDrawTextGridCallback(DrawTextGridCallback* cb) { _drawGridCallback = cb; }
         DrawTextGridCallback* getDrawTextGridCallback() { return _drawGridCallback.get(); }
+
+        /** Get bytes of parameter tables uploaded to GPU in last frame; only changed texels are uploaded */
+        unsigned int getBytesUploadedInLastFrame() const;
     
     protected:
-        virtual ~SymbolManager() {}
+        virtual ~SymbolManager();
         void initialize(osg::Group* group);
         void update(osg::Group* group, unsigned int frameNo);
+        void findCandidates(const osg::Polytope& polytope, std::vector<Symbol*>& result) const;
+        void updateClusters(const std::vector<Symbol*>& farSymbols, unsigned int frameNo);
         virtual void updateNearDistance(Symbol* sym, osg::Group* group);
 
         osg::Image* createLabel(int w, int h, const std::string& text,
@@ -146,9 +180,16 @@ namespace osgVerse
         osg::Image* createGrid(int w, int h, int grid, const std::vector<Symbol*>& texts);
 
         std::map<int, osg::ref_ptr<Symbol>> _symbols;
+        std::vector<int> _shownSymbols;
+        std::set<int> _modelSymbols;
+        SymbolIndex* _index;
+
+        struct ClusterMembership { osg::Vec3d position; int cellX, cellY; unsigned int frame; };
+        std::map<int, ClusterMembership> _clusterMemberships;
+        std::map<long long, SymbolCluster> _clusters;
         osg::ref_ptr<osg::Geometry> _instanceGeom, _instanceBoard;
         osg::ref_ptr<osg::Texture2D> _posTexture, _dirTexture, _colorTexture;
-        osg::ref_ptr<osg::Texture2D> _posTexture2, _dirTexture2, _colorTexture2;
+        osg::ref_ptr<osg::Texture2D> _posTexture2, _dirTexture2, _colorTexture2, _clusterTexture;
         osg::ref_ptr<osg::Texture2D> _iconTexture, _bgIconTexture, _textTexture;
         osg::ref_ptr<osg::Uniform> _midDistanceOffset, _midDistanceScale;
         osg::ref_ptr<osg::Program> _farDistanceProgram, _midDistanceProgram;
@@ -156,6 +197,7 @@ namespace osgVerse
         osg::ref_ptr<Drawer2D> _drawer;
         osg::observer_ptr<osg::Camera> _camera;
         osg::Vec3 _lodIconScaleFactor;
+        float _clusterCellSize, _clusterHysteresis;
         double _lodDistances[3]; int _idCounter;
         bool _firstRun, _showIconsInMidDistance;
     };
@@ -8,6 +8,8 @@
 #include <osg/Geometry>
 #include <osg/PolygonMode>
 #include <osg/Geode>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
@@ -19,6 +21,8 @@
 #include <chrono>
 #include <codecvt>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include <array>
 #include <random>
 
@@ -337,8 +341,9 @@ static std::default_random_engine generator;
 struct MikkTSpaceHelper
 {
     std::vector<Vec3ui> _faceList;
-    osg::Vec4Array *tangents;
-    osg::Geometry* _geometry;
+    osg::ref_ptr<osg::Vec4Array> tangents;
+    osg::Vec3Array *_vArray, *_nArray;
+    osg::Vec2Array* _tArray;
 
     bool initialize(SMikkTSpaceContext* sc, osg::Geometry* g)
     {
@@ -348,21 +353,24 @@ struct MikkTSpaceHelper
         sc->m_pInterface->m_getNormal = MikkTSpaceHelper::mikk_getNormal;
         sc->m_pInterface->m_getTexCoord = MikkTSpaceHelper::mikk_getTexCoord;
         sc->m_pInterface->m_setTSpaceBasic = MikkTSpaceHelper::mikk_setTSpaceBasic;
-        sc->m_pInterface->m_setTSpace = NULL; sc->m_pUserData = this; _geometry = g;
+        sc->m_pInterface->m_setTSpace = NULL; sc->m_pUserData = this;
 
+        _vArray = dynamic_cast<osg::Vec3Array*>(g->getVertexArray());
+        _nArray = dynamic_cast<osg::Vec3Array*>(g->getNormalArray());
+        _tArray = dynamic_cast<osg::Vec2Array*>(g->getTexCoordArray(0));
         osg::Vec3Array* va = vArray(); osg::Vec3Array* na = nArray();
         osg::Vec2Array* ta = tArray();
-        if (!va || !na || !ta) return false;
+        if (!va || !na || !ta || _faceList.empty()) return false;
         if (va->size() != na->size() || va->size() != ta->size()) return false;
 
+        // Tangents are attached to the geometry later by the caller, so this is thread-safe
         tangents = new osg::Vec4Array(va->size());
-        g->setVertexAttribArray(6, tangents); g->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
         return true;
     }
 
-    osg::Vec3Array* vArray() { return static_cast<osg::Vec3Array*>(_geometry->getVertexArray()); }
-    osg::Vec3Array* nArray() { return static_cast<osg::Vec3Array*>(_geometry->getNormalArray()); }
-    osg::Vec2Array* tArray() { return static_cast<osg::Vec2Array*>(_geometry->getTexCoordArray(0)); }
+    osg::Vec3Array* vArray() { return _vArray; }
+    osg::Vec3Array* nArray() { return _nArray; }
+    osg::Vec2Array* tArray() { return _tArray; }
 
     void operator()(unsigned int i0, unsigned int i1, unsigned int i2)
     { _faceList.push_back(Vec3ui{i0, i1, i2}); }
@@ -410,6 +418,56 @@ struct MikkTSpaceHelper
     }
 };
 
+/// BC5 (RGTC2) encoder for generated normal maps
+static void compressBlockBC4(const unsigned char* values, unsigned char* block)
+{
+    unsigned char vMin = 255, vMax = 0;
+    for (int i = 0; i < 16; ++i)
+    { vMin = osg::minimum(vMin, values[i]); vMax = osg::maximum(vMax, values[i]); }
+
+    // Use the 8-value mode (red0 > red1): indices 0/1 are endpoints, 2-7 are interpolated
+    block[0] = vMax; block[1] = vMin;
+    unsigned long long bits = 0; int range = (int)vMax - (int)vMin;
+    for (int i = 0; range > 0 && i < 16; ++i)
+    {
+        int t = (((int)vMax - (int)values[i]) * 7 + range / 2) / range;
+        unsigned long long index = (t == 0) ? 0 : ((t == 7) ? 1 : (t + 1));
+        bits |= (index << (3 * i));
+    }
+    for (int i = 0; i < 6; ++i) block[2 + i] = (unsigned char)((bits >> (8 * i)) & 0xff);
+}
+
+static osg::Image* compressNormalMapBC5(osg::Image& image)
+{
+    if (image.getDataType() != GL_UNSIGNED_BYTE) return NULL;
+    int w = image.s(), h = image.t(), bw = (w + 3) / 4, bh = (h + 3) / 4;
+    int numComponents = osg::Image::computeNumComponents(image.getPixelFormat());
+    if (numComponents < 2) return NULL;
+
+    unsigned int dataSize = bw * bh * 16;
+    unsigned char* data = new unsigned char[dataSize];
+    for (int by = 0; by < bh; ++by)
+        for (int bx = 0; bx < bw; ++bx)
+        {
+            unsigned char red[16], green[16];
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                {
+                    const unsigned char* ptr = image.data(
+                        osg::minimum(bx * 4 + x, w - 1), osg::minimum(by * 4 + y, h - 1));
+                    red[y * 4 + x] = ptr[0]; green[y * 4 + x] = ptr[1];
+                }
+
+            unsigned char* block = data + (by * bw + bx) * 16;
+            compressBlockBC4(red, block); compressBlockBC4(green, block + 8);
+        }
+
+    osg::Image* result = new osg::Image;
+    result->setImage(w, h, 1, GL_COMPRESSED_RED_GREEN_RGTC2_EXT, GL_COMPRESSED_RED_GREEN_RGTC2_EXT,
+                     GL_UNSIGNED_BYTE, data, osg::Image::USE_NEW_DELETE);
+    result->setFileName(image.getFileName()); return result;
+}
+
 namespace osgVerse
 {
     std::string getNodePathID(osg::Object& obj, osg::Node* root, char sep)
@@ -1050,21 +1108,14 @@ namespace osgVerse
     }
 
     TangentSpaceVisitor::TangentSpaceVisitor(const float threshold)
-    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _angularThreshold(threshold)
-    {
-        _mikkiTSpace = new SMikkTSpaceContext;
-        _mikkiTSpace->m_pInterface = new SMikkTSpaceInterface;
-        _mikkiTSpace->m_pUserData = NULL;
-    }
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _lastComputingTime(0.0),
+        _angularThreshold(threshold), _numComputed(0), _numThreads(0) {}
 
     TangentSpaceVisitor::~TangentSpaceVisitor()
-    {
-        if (_mikkiTSpace != NULL)
-        {
-            if (_mikkiTSpace->m_pInterface) delete _mikkiTSpace->m_pInterface;
-            delete _mikkiTSpace; _mikkiTSpace = NULL;
-        }
-    }
+    { if (!_geometries.empty()) computeTangents(); }
+
+    void TangentSpaceVisitor::apply(osg::Node& node)
+    { traverse(node); finishIfRoot(); }
 
     void TangentSpaceVisitor::apply(osg::Geode& node)
     {
@@ -1075,44 +1126,98 @@ namespace osgVerse
             if (geom) apply(*geom);
         }
 #endif
-        traverse(node);
+        traverse(node); finishIfRoot();
     }
 
     void TangentSpaceVisitor::apply(osg::Geometry& geom)
     {
+        if (geom.getNormalArray() != NULL && geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX &&
+            _gathered.find(&geom) == _gathered.end() && !hasValidTangents(geom))
+        { _gathered.insert(&geom); _geometries.push_back(&geom); }
 #if OSG_VERSION_GREATER_THAN(3, 4, 1)
-        if (geom.getNormalArray() == NULL) { traverse(geom); return; }
-        if (geom.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX) { traverse(geom); return; }
+        traverse(geom); finishIfRoot();
+#endif
+    }
 
-        if (geom.getVertexAttribArray(6) != NULL &&
-            geom.getVertexAttribBinding(6) == osg::Geometry::BIND_PER_VERTEX)
-        { traverse(geom); return; }  // already set
-#else
-        if (geom.getNormalArray() == NULL) return;
-        if (geom.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX) return;
+    bool TangentSpaceVisitor::hasValidTangents(osg::Geometry& geom) const
+    {
+        osg::Array* tangents = geom.getVertexAttribArray(6);
+        if (!tangents || geom.getVertexAttribBinding(6) != osg::Geometry::BIND_PER_VERTEX) return false;
 
-        if (geom.getVertexAttribArray(6) != NULL &&
-            geom.getVertexAttribBinding(6) == osg::Geometry::BIND_PER_VERTEX) return;
-#endif
+        osg::Array* va = geom.getVertexArray();
+        return va != NULL && tangents->getNumElements() == va->getNumElements();
+    }
 
-        osg::TriangleIndexFunctor<MikkTSpaceHelper> functor;
-        geom.accept(functor);
-        if (functor.initialize(_mikkiTSpace, &geom))
-            genTangSpace(_mikkiTSpace, _angularThreshold);
-#if OSG_VERSION_GREATER_THAN(3, 4, 1)
-        traverse(geom);
-#endif
+    void TangentSpaceVisitor::computeTangents()
+    {
+        std::vector<osg::ref_ptr<osg::Geometry>> geometries; geometries.swap(_geometries);
+        _gathered.clear(); _numComputed = 0; _lastComputingTime = 0.0;
+        if (geometries.empty()) return;
+
+        // Sort by vertex count so that larger geometries start first and workers end up balanced
+        int numGeometries = (int)geometries.size();
+        std::vector<std::pair<unsigned int, int>> order(numGeometries);
+        for (int i = 0; i < numGeometries; ++i)
+        {
+            osg::Array* va = geometries[i]->getVertexArray();
+            order[i] = std::pair<unsigned int, int>(va ? va->getNumElements() : 0, i);
+        }
+        std::sort(order.begin(), order.end(), std::greater<std::pair<unsigned int, int>>());
+
+        std::vector<osg::ref_ptr<osg::Vec4Array>> results(numGeometries);
+        int numThreads = (_numThreads > 0) ? _numThreads : OpenThreads::GetNumberOfProcessors();
+        numThreads = osg::clampBetween(numThreads, 1, numGeometries);
+
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+#pragma omp parallel num_threads(numThreads)
+        {
+            SMikkTSpaceInterface mikkInterface; SMikkTSpaceContext mikkContext;
+            mikkContext.m_pInterface = &mikkInterface; mikkContext.m_pUserData = NULL;
+#pragma omp for schedule(dynamic)
+            for (int i = 0; i < numGeometries; ++i)
+            {
+                int index = order[i].second;
+                osg::TriangleIndexFunctor<MikkTSpaceHelper> functor;
+                geometries[index]->accept(functor);
+                if (!functor.initialize(&mikkContext, geometries[index].get())) continue;
+                if (genTangSpace(&mikkContext, _angularThreshold)) results[index] = functor.tangents;
+            }
+        }
+
+        // Merge results back on the calling thread
+        for (int i = 0; i < numGeometries; ++i)
+        {
+            osg::Vec4Array* tangents = results[i].get(); if (!tangents) continue;
+            geometries[i]->setVertexAttribArray(6, tangents);
+            geometries[i]->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
+            _numComputed++;
+        }
+        _lastComputingTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+        OSG_INFO << "[TangentSpaceVisitor] Computed tangents of " << _numComputed << "/" << numGeometries
+                 << " geometries in " << _lastComputingTime << "ms with " << numThreads << " threads" << std::endl;
     }
 
     NormalMapGenerator::NormalMapGenerator(double nStrength, double spScale, double spContrast, bool nInvert)
     :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
         _nStrength(nStrength), _spScale(spScale), _spContrast(spContrast),
-        _normalMapUnit(1), _specMapUnit(2), _nInvert(nInvert) {}
+        _normalMapUnit(1), _specMapUnit(2), _numThreads(0), _numWorkingTasks(0),
+        _nInvert(nInvert), _compressingNormalMap(false), _backgroundMode(false), _quitting(false) {}
+
+    NormalMapGenerator::~NormalMapGenerator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_taskMutex);
+            _quitting = true; _taskCondition.notify_all();
+        }
+
+        for (size_t i = 0; i < _workers.size(); ++i)
+        { _workers[i]->quit(); delete _workers[i]; }
+    }
 
     void NormalMapGenerator::apply(osg::Node& node)
     {
         if (node.getStateSet()) apply(*node.getStateSet());
-        traverse(node);
+        traverse(node); finishIfRoot();
     }
 
     void NormalMapGenerator::apply(osg::Geode& node)
@@ -1125,14 +1230,14 @@ namespace osgVerse
         }
 #endif
         if (node.getStateSet()) apply(*node.getStateSet());
-        traverse(node);
+        traverse(node); finishIfRoot();
     }
 
     void NormalMapGenerator::apply(osg::Drawable& drawable)
     {
         if (drawable.getStateSet()) apply(*drawable.getStateSet());
 #if OSG_VERSION_GREATER_THAN(3, 4, 1)
-        traverse(drawable);
+        traverse(drawable); finishIfRoot();
 #endif
     }
 
@@ -1151,50 +1256,165 @@ namespace osgVerse
                        << image->getFileName() << std::endl; return;
         }
 
-        double invPixel = 1.0 / 255.0;
-        std::string fileName = osgDB::getSimpleFileName(image->getFileName());
+        // Images shared by multiple state-sets are processed only once
+        osg::ref_ptr<MapTask>& task = _gatheredTasks[image];
+        if (!task) { task = new MapTask; task->image = image; }
+        task->stateSets.push_back(&ss);
+    }
+
+    std::string NormalMapGenerator::getCacheFile(osg::Image& image, unsigned long long imageHash,
+                                                 bool normalMap) const
+    {
+        if (_cacheFolder.empty()) return "";
+        int s = image.s(), t = image.t(); GLenum format = image.getPixelFormat();
+        void* stream = Hash::startStream();
+        Hash::addToStream(stream, (const char*)&imageHash, sizeof(imageHash));
+        Hash::addToStream(stream, (const char*)&s, sizeof(int));
+        Hash::addToStream(stream, (const char*)&t, sizeof(int));
+        Hash::addToStream(stream, (const char*)&format, sizeof(GLenum));
+        if (normalMap)
+        {
+            int inverted = _nInvert ? 1 : 0;
+            Hash::addToStream(stream, (const char*)&_nStrength, sizeof(double));
+            Hash::addToStream(stream, (const char*)&inverted, sizeof(int));
+        }
+        else
+        {
+            Hash::addToStream(stream, (const char*)&_spScale, sizeof(double));
+            Hash::addToStream(stream, (const char*)&_spContrast, sizeof(double));
+        }
+
+        std::stringstream ss; ss << _cacheFolder << "/" << std::hex << std::setw(16)
+                                 << std::setfill('0') << Hash::getStream(stream, true);
+        if (normalMap) ss << (_compressingNormalMap ? ".norm.dds" : ".norm.png");
+        else ss << ".spec.png"; return ss.str();
+    }
+
+    void NormalMapGenerator::processTask(MapTask* task)
+    {
+        osg::Image* image = task->image.get(); double invPixel = 1.0 / 255.0;
+        unsigned long long imageHash = _cacheFolder.empty() ? 0 : Hash::getImage(*image);
         if (_normalMapUnit > 0)
         {
             osg::ref_ptr<osg::Image> nMap;
-            std::string normFile = _cacheFolder + "/" + fileName + ".norm.png";
-            if (!_cacheFolder.empty())
-            {
-                if (osgDB::fileExists(normFile))
-                    nMap = osgDB::readImageFile(normFile);
-            }
+            std::string normFile = getCacheFile(*image, imageHash, true);
+            if (!normFile.empty() && osgDB::fileExists(normFile))
+                nMap = osgDB::readImageFile(normFile);
 
             if (!nMap)
             {
                 NormalmapGenerator ng(IntensityMap::AVERAGE, invPixel, invPixel, invPixel, invPixel);
                 nMap = ng.calculateNormalmap(image, NormalmapGenerator::PREWITT, _nStrength, _nInvert);
-                if (!_cacheFolder.empty()) osgDB::writeImageFile(*nMap, normFile);
+                if (nMap.valid() && _compressingNormalMap) nMap = compressNormalMapBC5(*nMap);
+                if (nMap.valid() && !normFile.empty()) osgDB::writeImageFile(*nMap, normFile);
             }
-
-            if (nMap.valid() && nMap->valid())
-                ss.setTextureAttributeAndModes(_normalMapUnit, createTexture2D(nMap.get()));
+            if (nMap.valid() && nMap->valid()) task->normalMap = nMap;
         }
 
         if (_specMapUnit > 0)
         {
             osg::ref_ptr<osg::Image> spMap;
-            std::string specFile = _cacheFolder + "/" + fileName + ".spec.png";
-            if (!_cacheFolder.empty())
-            {
-                if (osgDB::fileExists(specFile))
-                    spMap = osgDB::readImageFile(specFile);
-            }
+            std::string specFile = getCacheFile(*image, imageHash, false);
+            if (!specFile.empty() && osgDB::fileExists(specFile))
+                spMap = osgDB::readImageFile(specFile);
 
             if (!spMap)
             {
                 SpecularmapGenerator spg(IntensityMap::AVERAGE, invPixel, invPixel, invPixel, invPixel);
                 spMap = spg.calculateSpecmap(image, _spScale, _spContrast);
-                if (!_cacheFolder.empty()) osgDB::writeImageFile(*spMap, specFile);
+                if (spMap.valid() && !specFile.empty()) osgDB::writeImageFile(*spMap, specFile);
+            }
+            if (spMap.valid() && spMap->valid()) task->specularMap = spMap;
+        }
+    }
+
+    void NormalMapGenerator::applyTask(MapTask* task)
+    {
+        osg::ref_ptr<osg::Texture2D> nTex, spTex;
+        if (task->normalMap.valid())
+        {
+            nTex = createTexture2D(task->normalMap.get());
+            if (task->normalMap->isCompressed())
+            {
+                nTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+                nTex->setUseHardwareMipMapGeneration(false);
+            }
+        }
+        if (task->specularMap.valid()) spTex = createTexture2D(task->specularMap.get());
+
+        for (size_t i = 0; i < task->stateSets.size(); ++i)
+        {
+            osg::ref_ptr<osg::StateSet> ss;
+            if (!task->stateSets[i].lock(ss)) continue;
+            if (nTex.valid()) ss->setTextureAttributeAndModes(_normalMapUnit, nTex.get());
+            if (spTex.valid()) ss->setTextureAttributeAndModes(_specMapUnit, spTex.get());
+        }
+        OSG_INFO << "[NormalMapGenerator] Normal-map generation for "
+                 << task->image->getFileName() << " finished" << std::endl;
+    }
+
+    void NormalMapGenerator::generate()
+    {
+        std::vector<osg::ref_ptr<MapTask>> tasks;
+        for (std::map<osg::Image*, osg::ref_ptr<MapTask>>::iterator itr = _gatheredTasks.begin();
+             itr != _gatheredTasks.end(); ++itr) tasks.push_back(itr->second);
+        _gatheredTasks.clear(); if (tasks.empty()) return;
+
+        int numThreads = (_numThreads > 0) ? _numThreads : OpenThreads::GetNumberOfProcessors();
+        if (_backgroundMode)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_taskMutex);
+                _pendingTasks.insert(_pendingTasks.end(), tasks.begin(), tasks.end());
+                _taskCondition.notify_all();
             }
 
-            if (spMap.valid() && spMap->valid())
-                ss.setTextureAttributeAndModes(_specMapUnit, createTexture2D(spMap.get()));
+            for (int i = (int)_workers.size(); i < numThreads; ++i)
+            {
+                QuickThread* thread = new QuickThread;
+                thread->setProcessor([this]()
+                {
+                    osg::ref_ptr<MapTask> task;
+                    {
+                        // Block until tasks are handed in, or the generator is destroyed
+                        std::unique_lock<std::mutex> lock(_taskMutex);
+                        _taskCondition.wait(lock, [this]() { return !_pendingTasks.empty() || _quitting; });
+                        if (_pendingTasks.empty()) return;
+                        task = _pendingTasks.front(); _pendingTasks.pop_front(); _numWorkingTasks++;
+                    }
+
+                    processTask(task.get());
+                    std::lock_guard<std::mutex> lock(_taskMutex);
+                    _readyTasks.push_back(task); _numWorkingTasks--;
+                });
+                thread->start(); _workers.push_back(thread);
+            }
+            return;
+        }
+
+        int numTasks = (int)tasks.size();
+        numThreads = osg::clampBetween(numThreads, 1, numTasks);
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+        for (int i = 0; i < numTasks; ++i) processTask(tasks[i].get());
+        for (int i = 0; i < numTasks; ++i) applyTask(tasks[i].get());
+    }
+
+    unsigned int NormalMapGenerator::swapReadyTextures()
+    {
+        std::deque<osg::ref_ptr<MapTask>> readyTasks;
+        {
+            std::lock_guard<std::mutex> lock(_taskMutex);
+            readyTasks.swap(_readyTasks);
         }
-        OSG_NOTICE << "Normal-map generation for " << fileName << " finished" << std::endl;
+
+        for (size_t i = 0; i < readyTasks.size(); ++i) applyTask(readyTasks[i].get());
+        return (unsigned int)readyTasks.size();
+    }
+
+    bool NormalMapGenerator::isProcessing() const
+    {
+        std::lock_guard<std::mutex> lock(_taskMutex);
+        return !_pendingTasks.empty() || _numWorkingTasks > 0;
     }
 
     float ActiveNodeVisitor::getDistanceToEyePoint(const osg::Vec3& pos, bool useLODScale) const
@@ -19,7 +19,10 @@
 #include <osgText/Text>
 #include "Global.h"
 #include <functional>
+#include <deque>
+#include <set>
 #include <mutex>
+#include <condition_variable>
 
 struct SMikkTSpaceContext;
 struct lay_context;
@@ -156,67 +159,239 @@ namespace osgVerse
     extern osg::Image* createInterpolatedMap(const std::vector<osg::Vec2>& points, const std::vector<osg::Vec4>& values,
                                              int resX, int resY, int valueComponents, bool toInt8 = false, osg::View* viewer = NULL);
 
-    /** The screen snapshot capture */
+    class QuickThread;
+
+    /** The screen snapshot capture, with ring-buffered asynchronous readback (pixel buffers are mapped
+        a few frames later) and a background encoder pool writing images or calling the frame handler */
     class ScreenSnapshotCallback : public CameraDrawCallback
     {
     public:
-        ScreenSnapshotCallback(bool c = true, int fps = 25);
-        virtual void operator()(const osg::Camera& camera) const;
-        void flush(const std::string& prefix);
+        ScreenSnapshotCallback(bool c = true, int fps = 25, int numBuffers = 3, int numEncoders = 2);
+        virtual void operator()(osg::RenderInfo& renderInfo) const;
+        virtual void releaseGLObjects(osg::State* state = 0) const;
+
+        /** Wait until all frames handed to encoders are processed. Readbacks still in pixel buffers are
+            mapped in the draw thread: after setCapturing(false), keep the callback for following frames
+            until getNumPendingReadbacks() returns 0 (or call releaseGLObjects() with the context current) */
+        void flush();
 
         void setCapturing(bool c) { _capturing = c; if (!c) _count = 0; }
         bool getCapturing() const { return _capturing; }
 
+        /** Number of readbacks not mapped yet; they are all mapped at the next draw once capturing stops */
+        int getNumPendingReadbacks() const
+        { std::lock_guard<std::mutex> lock(_statMutex); return _numPendingReadbacks; }
+
         void setCaptureFrequency(int fps) { _interval = (fps > 0) ? (1000 / fps) : 0.0; }
         int getCaptureFrequency() const { return (int)(_interval > 0.0 ? (1000.0 / _interval) : 0); }
 
         void setFilePrefix(const std::string& f) { _filePrefix = f; }
         const std::string& getFilePrefix() const { return _filePrefix; }
 
+        /** Extension of written files, e.g., png or jpg */
+        void setFileExtension(const std::string& e) { _fileExtension = e; }
+        const std::string& getFileExtension() const { return _fileExtension; }
+
+        /** Custom handler called in encoder threads instead of writing files, e.g., to encode frames to
+            H.264 and push them as EncodedFrameObject to a stream writer. Return false if failed.
+            Use only one encoder thread if the handler requires frames to come in order */
+        typedef std::function<bool (osg::Image*, int)> FrameHandler;
+        void setFrameHandler(FrameHandler h) { _frameHandler = h; }
+
+        /** What to do if encoders fall behind: drop new frames, or block the draw thread */
+        enum OverflowPolicy { DROP_FRAMES, BLOCK_RENDERING };
+        void setOverflowPolicy(OverflowPolicy p, int maxPendingFrames = 8)
+        { _overflowPolicy = p; _maxPendingFrames = maxPendingFrames; }
+        OverflowPolicy getOverflowPolicy() const { return _overflowPolicy; }
+        int getMaxPendingFrames() const { return _maxPendingFrames; }
+
+        /** Statistics: latency (ms) from readback request to encoded, and dropped / encoded frames */
+        double getLastCaptureLatency() const
+        { std::lock_guard<std::mutex> lock(_statMutex); return _lastLatency; }
+        double getAverageCaptureLatency() const
+        {
+            std::lock_guard<std::mutex> lock(_statMutex);
+            return _numEncodedFrames > 0 ? (_totalLatency / _numEncodedFrames) : 0.0;
+        }
+
+        unsigned int getNumDroppedFrames() const
+        { std::lock_guard<std::mutex> lock(_statMutex); return _numDroppedFrames; }
+        unsigned int getNumEncodedFrames() const
+        { std::lock_guard<std::mutex> lock(_statMutex); return _numEncodedFrames; }
+
+        /** Last frame that was read back */
         osg::Image* getImage() { return _image.get(); }
         const osg::Image* getImage() const { return _image.get(); }
 
     protected:
-        std::map<std::string, osg::ref_ptr<osg::Image>> _outputList;
+        virtual ~ScreenSnapshotCallback();
+        void capture(osg::RenderInfo& renderInfo);
+        void retrievePixelBuffers(osg::State& state, int numForced);
+        void submitFrame(osg::Image* image, int frameIndex, osg::Timer_t requestTime);
+        bool encodeNextFrame();
+
+        struct PixelBuffer
+        {
+            unsigned int pbo; void* fence;
+            int width, height, frameIndex, requestFrame;
+            osg::Timer_t requestTime; bool pending;
+            PixelBuffer() : pbo(0), fence(NULL), width(0), height(0), frameIndex(0),
+                            requestFrame(0), requestTime(0), pending(false) {}
+        };
+
+        struct CapturedFrame
+        {
+            osg::ref_ptr<osg::Image> image;
+            int frameIndex; osg::Timer_t requestTime;
+        };
+
+        std::vector<PixelBuffer> _pixelBuffers;
+        std::deque<CapturedFrame> _frameQueue;
+        std::vector<QuickThread*> _encoders;
+        std::condition_variable _queueCondition;  // queue changed, or encoders quitting
+        std::mutex _queueMutex; mutable std::mutex _statMutex;
         osg::ref_ptr<osg::Image> _image;
-        std::string _filePrefix;
-        mutable osg::Timer_t _lastTime; mutable int _count;
-        double _interval; bool _capturing;
+        std::string _filePrefix, _fileExtension;
+        FrameHandler _frameHandler;
+        OverflowPolicy _overflowPolicy;
+        osg::Timer_t _lastTime; int _count, _maxPendingFrames, _numEncoders;
+        int _numWorkingFrames, _numPendingReadbacks, _drawNumber;
+        double _interval, _lastLatency, _totalLatency;
+        unsigned int _numDroppedFrames, _numEncodedFrames;
+        bool _capturing, _pboSupported, _quitting;
     };
 
-    /** The tangent/binormal computing visitor */
+    /** Asynchronous GPU timer with GL timestamp queries (ARB_timer_query). Call begin() and end() in the
+        draw thread of the same graphics context; results are read back a few frames later, so that the
+        draw thread is never stalled. getLastTime() returns -1 if timer queries are not supported */
+    class GpuTimer : public osg::Referenced
+    {
+    public:
+        GpuTimer(int latency = 4);
+
+        void begin(osg::State& state);
+        void end(osg::State& state);
+
+        /** GPU time (in ms) between begin() and end() of the latest finished frame */
+        double getLastTime() const { return _lastTime; }
+
+        /** Return false if timer queries are known to be unavailable in current context */
+        bool isSupported() const { return _supported != 0; }
+
+        void releaseGLObjects(osg::State* state);
+
+    protected:
+        virtual ~GpuTimer() {}
+        void retrieveResults(osg::State& state);
+
+        struct QueryPair
+        {
+            unsigned int queries[2]; int frameIndex; bool pending;
+            QueryPair() : frameIndex(0), pending(false) { queries[0] = queries[1] = 0; }
+        };
+
+        std::vector<QueryPair> _queryPairs;
+        int _current, _drawNumber, _lastFrameIndex, _supported;
+        double _lastTime;
+    };
+
+    /** The tangent/binormal computing visitor. Geometries are gathered while traversing, and their
+        tangents are computed on a worker pool (one MikkTSpace context per thread) when the traversal
+        of the root node finishes. Geometries that already have valid tangents are skipped.
+        If apply(Geometry&) is called outside a traversal, call computeTangents() manually */
     class TangentSpaceVisitor : public osg::NodeVisitor
     {
     public:
         TangentSpaceVisitor(const float angularThreshold = 180.0f);
         virtual ~TangentSpaceVisitor();
+        virtual void apply(osg::Node& node);
         virtual void apply(osg::Geode& node);
         virtual void apply(osg::Geometry& geometry);
 
+        /** Set number of worker threads, 0 to use all processors and 1 to compute sequentially */
+        void setNumThreads(int n) { _numThreads = osg::maximum(n, 0); }
+        int getNumThreads() const { return _numThreads; }
+
+        /** Compute tangents of all gathered geometries and attach them as vertex attribute 6 */
+        void computeTangents();
+
+        /** Number of geometries computed by last computeTangents() call, and time spent (in ms) */
+        unsigned int getNumComputedGeometries() const { return _numComputed; }
+        double getLastComputingTime() const { return _lastComputingTime; }
+
     protected:
-        SMikkTSpaceContext* _mikkiTSpace;
+        bool hasValidTangents(osg::Geometry& geom) const;
+        void finishIfRoot() { if (_nodePath.size() <= 1) computeTangents(); }
+
+        std::vector<osg::ref_ptr<osg::Geometry>> _geometries;
+        std::set<osg::Geometry*> _gathered;
+        double _lastComputingTime;
         float _angularThreshold;
+        unsigned int _numComputed;
+        int _numThreads;
     };
 
-    /** The normal-map & specular-map generator */
+    /** The normal-map & specular-map generator. Textures are gathered while traversing and processed
+        on a worker pool when traversal of the root node finishes. Results are cached in the cache folder
+        by content hash and generating parameters. In background mode the generator must be kept alive
+        (e.g., in a ref_ptr), and swapReadyTextures() should be called in update traversal */
     class NormalMapGenerator : public osg::NodeVisitor
     {
     public:
         NormalMapGenerator(double nStrength = 2.0, double spScale = 0.2,
                            double spContrast = 1.0, bool nInvert = false);
+        virtual ~NormalMapGenerator();
         void setTextureUnits(int n, int sp) { _normalMapUnit = n; _specMapUnit = sp; }
         void setCacheFolder(const std::string& folder) { _cacheFolder = folder; }
 
+        /** Set number of worker threads, 0 to use all processors */
+        void setNumThreads(int n) { _numThreads = osg::maximum(n, 0); }
+        int getNumThreads() const { return _numThreads; }
+
+        /** Compress normal maps to BC5 (RG channels only; standard shaders reconstruct Z as blue reads 0).
+            Compressed maps are cached as DDS files */
+        void setCompressingNormalMap(bool b) { _compressingNormalMap = b; }
+        bool getCompressingNormalMap() const { return _compressingNormalMap; }
+
+        /** Process textures in background threads and swap them in when ready */
+        void setBackgroundMode(bool b) { _backgroundMode = b; }
+        bool getBackgroundMode() const { return _backgroundMode; }
+
+        /** Process all gathered textures, or hand them to background workers */
+        void generate();
+
+        /** Apply finished maps to their state-sets in background mode, returns number of textures */
+        unsigned int swapReadyTextures();
+
+        /** Check if there are still textures being processed in background */
+        bool isProcessing() const;
+
         virtual void apply(osg::Node& node);
         virtual void apply(osg::Geode& node);
         virtual void apply(osg::Drawable& geometry);
         void apply(osg::StateSet& ss);
 
     protected:
+        struct MapTask : public osg::Referenced
+        {
+            std::vector<osg::observer_ptr<osg::StateSet>> stateSets;
+            osg::ref_ptr<osg::Image> image, normalMap, specularMap;
+        };
+
+        void processTask(MapTask* task);
+        void applyTask(MapTask* task);
+        std::string getCacheFile(osg::Image& image, unsigned long long imageHash, bool normalMap) const;
+        void finishIfRoot() { if (_nodePath.size() <= 1) generate(); }
+
+        std::map<osg::Image*, osg::ref_ptr<MapTask>> _gatheredTasks;
+        std::deque<osg::ref_ptr<MapTask>> _pendingTasks, _readyTasks;
+        std::vector<QuickThread*> _workers;
+        std::condition_variable _taskCondition;  // new pending tasks, or workers quitting
+        mutable std::mutex _taskMutex;
         std::string _cacheFolder;
         double _nStrength, _spScale, _spContrast;
-        int _normalMapUnit, _specMapUnit;
-        bool _nInvert;
+        int _normalMapUnit, _specMapUnit, _numThreads, _numWorkingTasks;
+        bool _nInvert, _compressingNormalMap, _backgroundMode, _quitting;
     };
 
     /** The node visitor needs view/projection matrix inputs and can traverse only active nodes */
@@ -490,6 +665,56 @@ namespace osgVerse
         mutable bool _initialized;
     };
 
+    /** Texture subload callback which only uploads modified texels of the texture image.
+        Texels are indexed row by row; call dirtyTexels() instead of image->dirty() after changing them */
+    class DirtyRegionSubloadCallback : public osg::Texture2D::SubloadCallback
+    {
+    public:
+        DirtyRegionSubloadCallback()
+        :   _bytesInFrame(0), _bytesLastFrame(0), _frameNumber(0), _totalBytes(0) {}
+
+        /** Mark texels [first, first + count) to upload in next frame */
+        void dirtyTexels(unsigned int first, unsigned int count);
+        void dirtyAll();
+
+        /** Merge continuous texel indices before calling dirtyTexels() */
+        struct TexelRun
+        {
+            TexelRun(DirtyRegionSubloadCallback* cb) : callback(cb), first(0), count(0) {}
+            ~TexelRun() { flush(); }
+
+            void add(unsigned int i)
+            { if (count > 0 && first + count == i) count++; else { flush(); first = i; count = 1; } }
+            void flush() { if (count > 0 && callback) callback->dirtyTexels(first, count); count = 0; }
+
+            DirtyRegionSubloadCallback* callback;
+            unsigned int first, count;
+        };
+
+        /** Uploading statistics (of all graphics contexts) */
+        unsigned int getBytesUploadedInLastFrame() const { return _bytesLastFrame; }
+        unsigned long long getTotalBytesUploaded() const { return _totalBytes; }
+
+        virtual void load(const osg::Texture2D& texture, osg::State& state) const;
+        virtual void subload(const osg::Texture2D& texture, osg::State& state) const;
+
+    protected:
+        virtual ~DirtyRegionSubloadCallback() {}
+        void addUploadedBytes(unsigned int bytes, osg::State& state) const;
+
+        typedef std::vector<std::pair<unsigned int, unsigned int>> TexelRanges;  // [first, end)
+        struct ContextData
+        {
+            TexelRanges pending; int width, height; bool all;
+            ContextData() : width(0), height(0), all(false) {}
+        };
+
+        mutable std::map<unsigned int, ContextData> _contexts;
+        mutable std::mutex _mutex;
+        mutable unsigned int _bytesInFrame, _bytesLastFrame, _frameNumber;
+        mutable unsigned long long _totalBytes;
+    };
+
     /** Compute SSIM (structural similarity index measure) of two input image list */
     struct SSIM
     {
@@ -20,6 +20,7 @@
 #include <codecvt>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <array>
 #include <random>
 
@@ -36,24 +37,88 @@
 using namespace osgVerse;
 
 /************** ScreenSnapshotCallback **************/
-ScreenSnapshotCallback::ScreenSnapshotCallback(bool c, int fps)
-: _lastTime(0), _count(0), _capturing(c) { _image = new osg::Image; setCaptureFrequency(fps); }
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#   define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#   define GL_ALREADY_SIGNALED 0x911A
+#   define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+typedef osg::GLExtensions SnapshotExtensions;
+static SnapshotExtensions* getSnapshotExtensions(osg::State& state)
+{ return state.get<osg::GLExtensions>(); }
+#else
+typedef osg::GLBufferObject::Extensions SnapshotExtensions;
+static SnapshotExtensions* getSnapshotExtensions(osg::State& state)
+{ return osg::GLBufferObject::getExtensions(state.getContextID(), true); }
+#endif
 
-void ScreenSnapshotCallback::flush(const std::string& prefix)
+ScreenSnapshotCallback::ScreenSnapshotCallback(bool c, int fps, int numBuffers, int numEncoders)
+:   _fileExtension("png"), _overflowPolicy(DROP_FRAMES), _lastTime(0), _count(0), _maxPendingFrames(8),
+    _numEncoders(osg::maximum(numEncoders, 1)), _numWorkingFrames(0), _numPendingReadbacks(0), _drawNumber(0),
+    _lastLatency(0.0), _totalLatency(0.0), _numDroppedFrames(0), _numEncodedFrames(0), _capturing(c),
+    _pboSupported(true), _quitting(false)
 {
-    for (std::map<std::string, osg::ref_ptr<osg::Image>>::iterator it = _outputList.begin();
-         it != _outputList.end(); ++it)
-    { osgDB::writeImageFile(*(it->second), prefix + it->first); }
-    _outputList.clear();
+    _image = new osg::Image; setCaptureFrequency(fps);
+    _pixelBuffers.resize(osg::maximum(numBuffers, 1));
+#if defined(OSG_GLES1_AVAILABLE) || defined(OSG_GLES2_AVAILABLE) || defined(OSG_GLES3_AVAILABLE)
+    _pboSupported = false;  // use synchronous reading instead
+#endif
 }
 
-void ScreenSnapshotCallback::operator()(const osg::Camera & camera) const
+ScreenSnapshotCallback::~ScreenSnapshotCallback()
 {
-    int width = 800, height = 600; if (!_capturing) return;
-#if !defined(OSG_GLES1_AVAILABLE) && !defined(OSG_GLES2_AVAILABLE)
-    glReadBuffer(GL_BACK);  // read from back buffer (gc must be double-buffered)
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(_queueMutex);
+        _quitting = true; _queueCondition.notify_all();
+    }
+
+    for (size_t i = 0; i < _encoders.size(); ++i)
+    { _encoders[i]->quit(); delete _encoders[i]; }
+}
+
+void ScreenSnapshotCallback::flush()
+{
+    std::unique_lock<std::mutex> lock(_queueMutex);
+    _queueCondition.wait(lock, [this]() { return _frameQueue.empty() && _numWorkingFrames == 0; });
+}
+
+void ScreenSnapshotCallback::releaseGLObjects(osg::State* state) const
+{
+    CameraDrawCallback::releaseGLObjects(state);
+    ScreenSnapshotCallback* nonconst = const_cast<ScreenSnapshotCallback*>(this);
+    SnapshotExtensions* ext = state ? getSnapshotExtensions(*state) : NULL;
+    if (ext) nonconst->retrievePixelBuffers(*state, -1);  // hand remaining readbacks to encoders
+    for (size_t i = 0; i < nonconst->_pixelBuffers.size(); ++i)
+    {
+        PixelBuffer& pb = nonconst->_pixelBuffers[i];
+        if (ext && pb.pbo) ext->glDeleteBuffers(1, &pb.pbo);
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+        if (ext && pb.fence) ext->glDeleteSync((GLsync)pb.fence);
 #endif
-    const osg::GraphicsContext* gc = camera.getGraphicsContext();
+        pb = PixelBuffer();
+    }
+
+    std::lock_guard<std::mutex> lock(nonconst->_statMutex);
+    nonconst->_numPendingReadbacks = 0;
+}
+
+void ScreenSnapshotCallback::operator()(osg::RenderInfo& renderInfo) const
+{
+    if (renderInfo.getCurrentCamera() && renderInfo.getState())
+        const_cast<ScreenSnapshotCallback*>(this)->capture(renderInfo);
+    if (_subCallback.valid()) _subCallback.get()->run(renderInfo);
+}
+
+void ScreenSnapshotCallback::capture(osg::RenderInfo& renderInfo)
+{
+    osg::State& state = *renderInfo.getState(); _drawNumber++;
+    if (_pboSupported) retrievePixelBuffers(state, _capturing ? 0 : -1);
+    if (!_capturing) return;
+
+    int width = 800, height = 600;
+    const osg::GraphicsContext* gc = renderInfo.getCurrentCamera()->getGraphicsContext();
     if (gc && gc->getTraits())
     {
         width = gc->getTraits()->width;
@@ -61,20 +126,240 @@ void ScreenSnapshotCallback::operator()(const osg::Camera & camera) const
     }
 
     osg::Timer_t t0 = osg::Timer::instance()->tick();
-    if (_interval <= osg::Timer::instance()->delta_m(_lastTime, t0))
+    if (_interval > osg::Timer::instance()->delta_m(_lastTime, t0)) return;
+    _lastTime = t0;
+#if !defined(OSG_GLES1_AVAILABLE) && !defined(OSG_GLES2_AVAILABLE)
+    glReadBuffer(GL_BACK);  // read from back buffer (gc must be double-buffered)
+#endif
+
+    SnapshotExtensions* ext = getSnapshotExtensions(state);
+    if (!_pboSupported || !ext)
+    {
+        osg::ref_ptr<osg::Image> image = new osg::Image;
+        image->readPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+        _image = image; submitFrame(image.get(), _count++, t0); return;
+    }
+
+    // Find a free pixel buffer, or map the oldest one at once if all are in use
+    PixelBuffer* buffer = NULL;
+    for (int tries = 0; tries < 2 && !buffer; ++tries)
+    {
+        for (size_t i = 0; i < _pixelBuffers.size(); ++i)
+        { if (!_pixelBuffers[i].pending) { buffer = &_pixelBuffers[i]; break; } }
+        if (!buffer) retrievePixelBuffers(state, 1);
+    }
+    if (!buffer) return;
+
+    if (buffer->pbo == 0) ext->glGenBuffers(1, &buffer->pbo);
+    ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, buffer->pbo);
+    if (buffer->width != width || buffer->height != height)
+        ext->glBufferData(GL_PIXEL_PACK_BUFFER_ARB, width * height * 4, NULL, GL_STREAM_READ_ARB);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+    if (ext->glFenceSync) buffer->fence = ext->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#endif
+
+    buffer->width = width; buffer->height = height; buffer->frameIndex = _count++;
+    buffer->requestFrame = _drawNumber; buffer->requestTime = t0; buffer->pending = true;
+    std::lock_guard<std::mutex> lock(_statMutex); _numPendingReadbacks++;
+}
+
+void ScreenSnapshotCallback::retrievePixelBuffers(osg::State& state, int numForced)
+{
+    std::vector<PixelBuffer*> pendingBuffers;
+    for (size_t i = 0; i < _pixelBuffers.size(); ++i)
+    { if (_pixelBuffers[i].pending) pendingBuffers.push_back(&_pixelBuffers[i]); }
+    if (pendingBuffers.empty()) return;
+
+    SnapshotExtensions* ext = getSnapshotExtensions(state); if (!ext) return;
+    std::sort(pendingBuffers.begin(), pendingBuffers.end(),
+              [](PixelBuffer* a, PixelBuffer* b) { return a->frameIndex < b->frameIndex; });
+    for (size_t i = 0; i < pendingBuffers.size(); ++i)
     {
-        _image->readPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
-        if (!_filePrefix.empty())
+        // Map buffers in capture order, only if the GPU has finished them (or a few frames passed)
+        PixelBuffer& pb = *pendingBuffers[i];
+        bool forced = (numForced < 0) || ((int)i < numForced);
+        bool ready = forced || (_drawNumber - pb.requestFrame) >= (int)_pixelBuffers.size();
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+        if (!ready && pb.fence)
         {
-            ScreenSnapshotCallback* nonconst = const_cast<ScreenSnapshotCallback*>(this);
-            std::stringstream oss; oss << "_" << std::setw(4) << std::setfill('0') << _count;
-            nonconst->_outputList[_filePrefix + oss.str() + ".png"] =
-                static_cast<osg::Image*>(_image->clone(osg::CopyOp::DEEP_COPY_ALL));  // FIXME: write out in thread
+            GLenum result = ext->glClientWaitSync((GLsync)pb.fence, 0, 0);
+            ready = (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED);
         }
-        _lastTime = t0; _count++;
+#endif
+        if (!ready) break;
+
+        ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, pb.pbo);
+        unsigned char* src = (unsigned char*)ext->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+        if (src)
+        {
+            osg::ref_ptr<osg::Image> image = new osg::Image;
+            image->allocateImage(pb.width, pb.height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+            memcpy(image->data(), src, image->getTotalSizeInBytes());
+            ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+            _image = image; submitFrame(image.get(), pb.frameIndex, pb.requestTime);
+        }
+        else
+        {
+            OSG_WARN << "[ScreenSnapshotCallback] Failed to map pixel buffer of frame "
+                     << pb.frameIndex << std::endl;
+            std::lock_guard<std::mutex> lock(_statMutex); _numDroppedFrames++;
+        }
+        ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+        if (pb.fence) ext->glDeleteSync((GLsync)pb.fence);
+#endif
+        pb.fence = NULL; pb.pending = false;
+        std::lock_guard<std::mutex> lock(_statMutex); _numPendingReadbacks--;
     }
 }
 
+void ScreenSnapshotCallback::submitFrame(osg::Image* image, int frameIndex, osg::Timer_t requestTime)
+{
+    if (_filePrefix.empty() && !_frameHandler) return;  // only kept as the last image
+    if (_encoders.empty())
+    {
+        for (int i = 0; i < _numEncoders; ++i)
+        {
+            QuickThread* thread = new QuickThread;
+            thread->setProcessor([this]() { encodeNextFrame(); });
+            thread->start(); _encoders.push_back(thread);
+        }
+    }
+
+    CapturedFrame frame; frame.image = image;
+    frame.frameIndex = frameIndex; frame.requestTime = requestTime;
+    {
+        std::unique_lock<std::mutex> lock(_queueMutex);
+        if (_maxPendingFrames > 0 && _overflowPolicy == BLOCK_RENDERING)  // wait for encoders
+            _queueCondition.wait(lock, [this]() { return (int)_frameQueue.size() < _maxPendingFrames; });
+        if (_maxPendingFrames <= 0 || (int)_frameQueue.size() < _maxPendingFrames)
+        { _frameQueue.push_back(frame); _queueCondition.notify_all(); return; }
+    }
+
+    std::lock_guard<std::mutex> lock(_statMutex); _numDroppedFrames++;
+    OSG_INFO << "[ScreenSnapshotCallback] Encoders fall behind, frame "
+             << frameIndex << " is dropped" << std::endl;
+}
+
+bool ScreenSnapshotCallback::encodeNextFrame()
+{
+    CapturedFrame frame;
+    {
+        // Block until a frame is submitted, or the callback is destroyed
+        std::unique_lock<std::mutex> lock(_queueMutex);
+        _queueCondition.wait(lock, [this]() { return !_frameQueue.empty() || _quitting; });
+        if (_frameQueue.empty()) return false;
+        frame = _frameQueue.front(); _frameQueue.pop_front(); _numWorkingFrames++;
+        _queueCondition.notify_all();  // a slot is free for BLOCK_RENDERING
+    }
+
+    bool ok = false;
+    if (_frameHandler) ok = _frameHandler(frame.image.get(), frame.frameIndex);
+    else
+    {
+        std::stringstream oss; oss << _filePrefix << "_" << std::setw(4) << std::setfill('0')
+                                   << frame.frameIndex << "." << _fileExtension;
+        ok = osgDB::writeImageFile(*frame.image, oss.str());
+    }
+
+    double latency = osg::Timer::instance()->delta_m(frame.requestTime, osg::Timer::instance()->tick());
+    {
+        std::lock_guard<std::mutex> lock(_statMutex);
+        if (ok) { _lastLatency = latency; _totalLatency += latency; _numEncodedFrames++; }
+        else _numDroppedFrames++;
+    }
+
+    std::lock_guard<std::mutex> lock(_queueMutex);
+    _numWorkingFrames--; _queueCondition.notify_all(); return true;
+}
+
+/************** GpuTimer **************/
+#ifndef GL_TIMESTAMP
+#   define GL_TIMESTAMP 0x8E28
+#endif
+
+#ifndef GL_QUERY_RESULT
+#   define GL_QUERY_RESULT 0x8866
+#   define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+GpuTimer::GpuTimer(int latency)
+:   _current(-1), _drawNumber(0), _lastFrameIndex(-1), _supported(-1), _lastTime(-1.0)
+{ _queryPairs.resize(osg::maximum(latency, 2)); }
+
+void GpuTimer::begin(osg::State& state)
+{
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+    osg::GLExtensions* ext = state.get<osg::GLExtensions>();
+    if (_supported < 0)
+    {
+        _supported = (ext && ext->isARBTimerQuerySupported && ext->glQueryCounter &&
+                      state.getTimestampBits() > 0) ? 1 : 0;
+        if (!_supported) OSG_INFO << "[GpuTimer] Timer query not supported" << std::endl;
+    }
+    if (!_supported) return; else retrieveResults(state);
+
+    // Skip this frame if all query pairs are still waiting for results
+    _current = -1; _drawNumber++;
+    for (size_t i = 0; i < _queryPairs.size() && _current < 0; ++i)
+    { if (!_queryPairs[i].pending) _current = (int)i; }
+    if (_current < 0) return;
+
+    QueryPair& qp = _queryPairs[_current];
+    if (!qp.queries[0]) ext->glGenQueries(2, qp.queries);
+    ext->glQueryCounter(qp.queries[0], GL_TIMESTAMP);
+    qp.frameIndex = _drawNumber;
+#else
+    _supported = 0;
+#endif
+}
+
+void GpuTimer::end(osg::State& state)
+{
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+    if (_current < 0 || _supported <= 0) return;
+    osg::GLExtensions* ext = state.get<osg::GLExtensions>();
+    QueryPair& qp = _queryPairs[_current];
+    ext->glQueryCounter(qp.queries[1], GL_TIMESTAMP);
+    qp.pending = true; _current = -1;
+#endif
+}
+
+void GpuTimer::retrieveResults(osg::State& state)
+{
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+    osg::GLExtensions* ext = state.get<osg::GLExtensions>();
+    for (size_t i = 0; i < _queryPairs.size(); ++i)
+    {
+        QueryPair& qp = _queryPairs[i]; if (!qp.pending) continue;
+        GLint available = 0; ext->glGetQueryObjectiv(qp.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 t0 = 0, t1 = 0; qp.pending = false;
+        ext->glGetQueryObjectui64v(qp.queries[0], GL_QUERY_RESULT, &t0);
+        ext->glGetQueryObjectui64v(qp.queries[1], GL_QUERY_RESULT, &t1);
+        if (qp.frameIndex > _lastFrameIndex && t1 >= t0)
+        { _lastTime = double(t1 - t0) * 1e-6; _lastFrameIndex = qp.frameIndex; }
+    }
+#endif
+}
+
+void GpuTimer::releaseGLObjects(osg::State* state)
+{
+#if OSG_VERSION_GREATER_THAN(3, 3, 2)
+    osg::GLExtensions* ext = state ? state->get<osg::GLExtensions>() : NULL;
+    for (size_t i = 0; i < _queryPairs.size(); ++i)
+    {
+        QueryPair& qp = _queryPairs[i];
+        if (ext && qp.queries[0]) ext->glDeleteQueries(2, qp.queries);
+        qp = QueryPair();
+    }
+#endif
+    _current = -1;
+}
+
 /************** Hash **************/
 static XXH64_hash_t g_hashSeed = XXH64("osgVerse", 8, 0);
 
@@ -970,3 +1255,107 @@ bool TextureCopier::operator()(unsigned int srcTexture, unsigned int srcFBO, int
     }
     return (state && !state->checkGLErrors("TextureCopier"));
 }
+
+/************** DirtyRegionSubloadCallback **************/
+void DirtyRegionSubloadCallback::dirtyTexels(unsigned int first, unsigned int count)
+{
+    if (count == 0) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (std::map<unsigned int, ContextData>::iterator itr = _contexts.begin();
+         itr != _contexts.end(); ++itr)
+    {
+        TexelRanges& ranges = itr->second.pending; if (itr->second.all) continue;
+        if (!ranges.empty() && ranges.back().first <= first && first <= ranges.back().second)
+            ranges.back().second = osg::maximum(ranges.back().second, first + count);
+        else
+            ranges.push_back(TexelRanges::value_type(first, first + count));
+    }
+}
+
+void DirtyRegionSubloadCallback::dirtyAll()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (std::map<unsigned int, ContextData>::iterator itr = _contexts.begin();
+         itr != _contexts.end(); ++itr) { itr->second.pending.clear(); itr->second.all = true; }
+}
+
+void DirtyRegionSubloadCallback::load(const osg::Texture2D& texture, osg::State& state) const
+{
+    const osg::Image* image = texture.getImage();
+    if (!image || !image->data()) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ContextData& cd = _contexts[state.getContextID()];
+        cd.pending.clear(); cd.all = false; cd.width = image->s(); cd.height = image->t();
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, image->getPacking());
+    glTexImage2D(GL_TEXTURE_2D, 0, image->getInternalTextureFormat(), image->s(), image->t(), 0,
+                 image->getPixelFormat(), image->getDataType(), image->data());
+    addUploadedBytes(image->getTotalSizeInBytes(), state);
+}
+
+void DirtyRegionSubloadCallback::subload(const osg::Texture2D& texture, osg::State& state) const
+{
+    const osg::Image* image = texture.getImage();
+    if (!image || !image->data()) { addUploadedBytes(0, state); return; }
+
+    TexelRanges ranges; bool uploadAll = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ContextData& cd = _contexts[state.getContextID()];
+        uploadAll = cd.all || cd.width != image->s() || cd.height != image->t();
+        if (!uploadAll) ranges.swap(cd.pending);
+    }
+    if (uploadAll) { load(texture, state); return; }
+    else if (ranges.empty()) { addUploadedBytes(0, state); return; }
+
+    // Merge overlapped ranges; upload the partial head/tail rows and full rows between them
+    std::sort(ranges.begin(), ranges.end());
+    unsigned int w = image->s(), numTexels = w * image->t(), numBytes = 0, end = 0;
+    unsigned int pixelBytes = image->getPixelSizeInBits() / 8;
+    GLenum format = image->getPixelFormat(), type = image->getDataType();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, image->getPacking());
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        unsigned int first = ranges[i].first; end = ranges[i].second;
+        while (i + 1 < ranges.size() && ranges[i + 1].first <= end)
+            end = osg::maximum(ranges[++i].second, end);
+        end = osg::minimum(end, numTexels); if (first >= end) continue;
+
+        unsigned int y0 = first / w, y1 = (end - 1) / w, x0 = first % w, x1 = (end - 1) % w;
+        if (y0 == y1)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0 + 1, 1, format, type, image->data(x0, y0));
+            numBytes += (x1 - x0 + 1) * pixelBytes; continue;
+        }
+
+        if (x0 > 0)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, w - x0, 1, format, type, image->data(x0, y0));
+            numBytes += (w - x0) * pixelBytes; y0++;
+        }
+
+        if (x1 < w - 1)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y1, x1 + 1, 1, format, type, image->data(0, y1));
+            numBytes += (x1 + 1) * pixelBytes; y1--;
+        }
+
+        if (y0 <= y1)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, w, y1 - y0 + 1, format, type, image->data(0, y0));
+            numBytes += w * (y1 - y0 + 1) * pixelBytes;
+        }
+    }
+    addUploadedBytes(numBytes, state);
+}
+
+void DirtyRegionSubloadCallback::addUploadedBytes(unsigned int bytes, osg::State& state) const
+{
+    const osg::FrameStamp* fs = state.getFrameStamp();
+    unsigned int frameNo = fs ? fs->getFrameNumber() : 0;
+    if (frameNo != _frameNumber)
+    { _bytesLastFrame = _bytesInFrame; _bytesInFrame = 0; _frameNumber = frameNo; }
+    _bytesInFrame += bytes; _totalBytes += bytes;
+}
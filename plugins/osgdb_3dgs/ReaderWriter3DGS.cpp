@@ -7,8 +7,11 @@
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
 #include <osgUtil/Tessellator>
+#include <algorithm>
 #include "modeling/GaussianGeometry.h"
 #include "modeling/Utilities.h"
+#include "modeling/Profiler.h"
+#include "SplatSelection.h"
 
 #include "gf/core/gauss_ir.h"
 #include "gf/io/registry.h"
@@ -17,13 +20,38 @@
 #include "spz/load-spz.h"
 
 // Ref: https://github.com/playcanvas/splat-transform/blob/main/src/readers/
-osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string& path,
+osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string& path, bool paging,
                                             osgVerse::GaussianGeometry::RenderMethod method);
+osg::ref_ptr<osg::Node> loadSubSplatFromXGrids(const std::string& in, const osgDB::Options* opt);
 osg::ref_ptr<osg::Node> loadSplatFromXGrids2(std::istream& in, const std::string& path,
                                              osgVerse::GaussianGeometry::RenderMethod method);
 osg::ref_ptr<osg::Node> loadSubSplatFromXGrids2(const std::string& in, const osgDB::Options* opt);
 osg::ref_ptr<osg::Node> loadSplatFromSOG(std::istream& in, const std::string& path, const std::string& ext,
-                                         int vOffset, int vCount, osgVerse::GaussianGeometry::RenderMethod method);
+                                         int vOffset, int vCount, bool byImportance,
+                                         osgVerse::GaussianGeometry::RenderMethod method);
+
+void splat::selectSplatIndices(std::vector<int>& indices, const std::vector<float>& importance,
+                               int numSplats, int vOffset, int vCount)
+{
+    if (vOffset < 0) vOffset = 0; else if (vOffset > numSplats) vOffset = numSplats;
+    if (vCount <= 0 || vOffset + vCount > numSplats) vCount = numSplats - vOffset;
+
+    std::vector<int> order(numSplats);
+    for (int i = 0; i < numSplats; ++i) order[i] = i;
+    if ((int)importance.size() == numSplats && vCount < numSplats)
+    {
+        // Strict order (ties resolved by index) so progressive requests never overlap
+        auto compare = [&importance](int a, int b)
+        { return importance[a] > importance[b] || (importance[a] == importance[b] && a < b); };
+        if (vOffset > 0) std::nth_element(order.begin(), order.begin() + vOffset, order.end(), compare);
+        if (vOffset + vCount < numSplats)
+            std::nth_element(order.begin() + vOffset, order.begin() + vOffset + vCount, order.end(), compare);
+        indices.assign(order.begin() + vOffset, order.begin() + vOffset + vCount);
+        std::sort(indices.begin(), indices.end());
+    }
+    else
+        indices.assign(order.begin() + vOffset, order.begin() + vOffset + vCount);
+}
 
 namespace
 {
@@ -61,6 +89,7 @@ public:
         supportsExtension("ksplat", "Mark Kellogg's splat file");
         supportsExtension("spz", "Niantic Labs' splat file");
         supportsExtension("lcc", "XGrids' gaussian splatting file");
+        supportsExtension("lcc_node", "Helper extension to load LCC sub-level");
         supportsExtension("lcc2", "XGrids' gaussian splatting file, version 2");
         supportsExtension("lcc2_node", "Helper extension to load LCC2 sub-graph");
         supportsExtension("json", "PlayCanvas SOG's meta.json file");
@@ -72,6 +101,10 @@ public:
                        "<GS> render with geometry shader.");
         supportsOption("LoadVertexOffset", "Vertex offset while loading ply/splat/sog/spz formats. Default: 0");
         supportsOption("LoadVertexCount", "Vertex count while loading ply/splat/sog/spz formats. Default: 0 for all");
+        supportsOption("LoadByImportance", "Apply LoadVertexOffset/Count to splats sorted by importance "
+                       "(opacity x size), for progressive loading of sog/spz/ply formats. Default: 0");
+        supportsOption("LccPaging", "Load only the coarsest level of each LCC chunk and page finer levels "
+                       "on demand from the shared data mapping. Set to 0 to decode all levels at once. Default: 1");
     }
 
     virtual const char* className() const
@@ -83,6 +116,7 @@ public:
     {
         std::string ext; std::string fileName = getRealFileName(path, ext);
         if (ext == "lcc2_node") return loadSubSplatFromXGrids2(fileName, options);
+        else if (ext == "lcc_node") return loadSubSplatFromXGrids(fileName, options);
 
         std::ifstream in(fileName, std::ios::in | std::ios::binary);
         if (!in) return ReadResult::FILE_NOT_FOUND;
@@ -98,6 +132,7 @@ public:
 
     virtual ReadResult readNode(std::istream& fin, const Options* options) const
     {
+        VERSE_PROFILE_ZONE_CATEGORY("ReaderWriter3DGS::readNode", "loader");
         osg::ref_ptr<osg::Geode> geode = new osg::Geode;
         spz::UnpackOptions unpackOpt;  // TODO: convert coordinates
         if (options)
@@ -106,6 +141,9 @@ public:
             std::string vOffsetHint = options->getPluginStringData("LoadVertexOffset");
             std::string vCountHint = options->getPluginStringData("LoadVertexCount");
             int vOffset = atoi(vOffsetHint.c_str()), vCount = atoi(vCountHint.c_str());
+            bool byImportance = atoi(options->getPluginStringData("LoadByImportance").c_str()) > 0;
+            std::string pagingHint = options->getPluginStringData("LccPaging");
+            bool lccPaging = pagingHint.empty() || atoi(pagingHint.c_str()) > 0;
 
             osgVerse::GaussianGeometry::RenderMethod method = osgVerse::GaussianGeometry::INSTANCING;
 #if defined(OSG_GLES2_AVAILABLE) || defined(OSG_GLES3_AVAILABLE)
@@ -126,12 +164,12 @@ public:
             }
             else if (ext == "lcc")
             {
-                osg::ref_ptr<osg::Node> node = loadSplatFromXGrids(fin, prefix, method);
+                osg::ref_ptr<osg::Node> node = loadSplatFromXGrids(fin, prefix, lccPaging, method);
                 if (node.valid()) return node.get();
             }
             else if (ext == "json" || ext == "sog")
             {
-                osg::ref_ptr<osg::Node> node = loadSplatFromSOG(fin, prefix, ext, vOffset, vCount, method);
+                osg::ref_ptr<osg::Node> node = loadSplatFromSOG(fin, prefix, ext, vOffset, vCount, byImportance, method);
                 if (node.valid()) return node.get();
             }
 
@@ -146,7 +184,11 @@ public:
             gf::ReadOptions read_opt;
             gf::Expected<gf::GaussianCloudIR> ir = reader->Read(
                 (const uint8_t*)buffer.data(), buffer.size(), read_opt);
-            if (ir.ok()) geode->addDrawable(fromGF(ir.value(), vOffset, vCount, method));
+            if (ir.ok())
+            {
+                osgVerse::GaussianGeometry* geom = fromGF(ir.value(), vOffset, vCount, byImportance, method);
+                if (geom) geode->addDrawable(geom);
+            }
 #else
             spz::GaussianCloud cloud;
             if (ext == "ply")
@@ -237,78 +279,90 @@ protected:
     }
 
 #if true
-    osgVerse::GaussianGeometry* fromGF(gf::GaussianCloudIR& c, int vOffset, int vCount,
+    osgVerse::GaussianGeometry* fromGF(gf::GaussianCloudIR& c, int vOffset, int vCount, bool byImportance,
                                        osgVerse::GaussianGeometry::RenderMethod m) const
     {
-        osg::ref_ptr<osg::Vec3Array> pos = new osg::Vec3Array, scale = new osg::Vec3Array;
-        for (size_t i = 0; i < c.positions.size(); i += 3)
-            pos->push_back(osg::Vec3(c.positions[i], c.positions[i + 1], c.positions[i + 2]));
-        for (size_t i = 0; i < c.scales.size(); i += 3)
+        int numPoints = (int)c.numPoints; if (numPoints < 1) return NULL;
+        std::vector<float> importance; std::vector<int> indices;
+        if (byImportance && (int)c.alphas.size() >= numPoints && (int)c.scales.size() >= numPoints * 3)
         {
-            // scale is stored in logarithmic scale in GaussForge
-            scale->push_back(osg::Vec3(expf(c.scales[i]), expf(c.scales[i + 1]), expf(c.scales[i + 2])));
-        }
-
-        osg::ref_ptr<osg::Vec4Array> rot = new osg::Vec4Array;
-        for (size_t i = 0; i < c.rotations.size(); i += 4)
-            rot->push_back(osg::Vec4(c.rotations[i + 1], c.rotations[i + 2], c.rotations[i + 3], c.rotations[i]));
-
-        osg::ref_ptr<osg::FloatArray> alpha = new osg::FloatArray;
-        for (size_t i = 0; i < c.alphas.size(); i++) { float op = c.alphas[i]; alpha->push_back(1.0f / (1.0f + expf(-op))); }
-
-        osg::ref_ptr<osg::Vec4Array> rD0 = new osg::Vec4Array, gD0 = new osg::Vec4Array, bD0 = new osg::Vec4Array;
-        osg::ref_ptr<osg::Vec4Array> rD1 = new osg::Vec4Array, gD1 = new osg::Vec4Array, bD1 = new osg::Vec4Array;
-        osg::ref_ptr<osg::Vec4Array> rD2 = new osg::Vec4Array, gD2 = new osg::Vec4Array, bD2 = new osg::Vec4Array;
-        osg::ref_ptr<osg::Vec4Array> rD3 = new osg::Vec4Array, gD3 = new osg::Vec4Array, bD3 = new osg::Vec4Array;
-        size_t numShCoff = c.sh.size() / c.numPoints, shDegree = 0, shIndex = 0;
-        for (size_t i = 0; i < c.colors.size(); i += 3, shIndex += numShCoff)
-        {
-            rD0->push_back(osg::Vec4(c.colors[i + 0], 0.0f, 0.0f, 0.0f));
-            gD0->push_back(osg::Vec4(c.colors[i + 1], 0.0f, 0.0f, 0.0f));
-            bD0->push_back(osg::Vec4(c.colors[i + 2], 0.0f, 0.0f, 0.0f));
-            if (numShCoff >= 9)  // Degree 1
+            importance.resize(numPoints);
+#pragma omp parallel for
+            for (int i = 0; i < numPoints; ++i)
             {
-                rD0->back().set(rD0->back()[0], c.sh[shIndex + 0], c.sh[shIndex + 3], c.sh[shIndex + 6]);
-                gD0->back().set(gD0->back()[0], c.sh[shIndex + 1], c.sh[shIndex + 4], c.sh[shIndex + 7]);
-                bD0->back().set(bD0->back()[0], c.sh[shIndex + 2], c.sh[shIndex + 5], c.sh[shIndex + 8]);
-                shDegree = 1;
-            }
-
-            if (numShCoff >= 24)  // Degree 2
-            {
-                rD1->push_back(osg::Vec4(c.sh[shIndex + 9], c.sh[shIndex + 12], c.sh[shIndex + 15], c.sh[shIndex + 18]));
-                gD1->push_back(osg::Vec4(c.sh[shIndex + 10], c.sh[shIndex + 13], c.sh[shIndex + 16], c.sh[shIndex + 19]));
-                bD1->push_back(osg::Vec4(c.sh[shIndex + 11], c.sh[shIndex + 14], c.sh[shIndex + 17], c.sh[shIndex + 20]));
-                rD2->push_back(osg::Vec4(c.sh[shIndex + 21], 0.0f, 0.0f, 0.0f));
-                gD2->push_back(osg::Vec4(c.sh[shIndex + 22], 0.0f, 0.0f, 0.0f));
-                bD2->push_back(osg::Vec4(c.sh[shIndex + 23], 0.0f, 0.0f, 0.0f));
-                shDegree = 2;
+                float logScale = c.scales[i * 3] + c.scales[i * 3 + 1] + c.scales[i * 3 + 2];
+                importance[i] = expf(logScale / 3.0f) / (1.0f + expf(-c.alphas[i]));  // opacity x average radius
             }
+        }
+        splat::selectSplatIndices(indices, importance, numPoints, vOffset, vCount);
+
+        // Unpack selected splats in parallel, directly into the final arrays
+        int count = (int)indices.size(); if (!count) return NULL;
+        int numShCoff = (int)(c.sh.size() / numPoints), shDegree = 0;
+        if (numShCoff >= 45) shDegree = 3; else if (numShCoff >= 24) shDegree = 2; else if (numShCoff >= 9) shDegree = 1;
+
+        osg::ref_ptr<osg::Vec3Array> pos = new osg::Vec3Array(count), scale = new osg::Vec3Array(count);
+        osg::ref_ptr<osg::Vec4Array> rot = new osg::Vec4Array(count);
+        osg::ref_ptr<osg::FloatArray> alpha = new osg::FloatArray(count);
+        osg::ref_ptr<osg::Vec4Array> rD0 = new osg::Vec4Array(count), gD0 = new osg::Vec4Array(count), bD0 = new osg::Vec4Array(count);
+        osg::ref_ptr<osg::Vec4Array> rD1, gD1, bD1, rD2, gD2, bD2, rD3, gD3, bD3;
+        if (shDegree >= 2)
+        {
+            rD1 = new osg::Vec4Array(count); gD1 = new osg::Vec4Array(count); bD1 = new osg::Vec4Array(count);
+            rD2 = new osg::Vec4Array(count); gD2 = new osg::Vec4Array(count); bD2 = new osg::Vec4Array(count);
+        }
+        if (shDegree >= 3)
+            { rD3 = new osg::Vec4Array(count); gD3 = new osg::Vec4Array(count); bD3 = new osg::Vec4Array(count); }
 
-            if (numShCoff >= 45)  // Degree 3
-            {
-                rD2->back().set(rD2->back()[0], c.sh[shIndex + 24], c.sh[shIndex + 27], c.sh[shIndex + 30]);
-                gD2->back().set(gD2->back()[0], c.sh[shIndex + 25], c.sh[shIndex + 28], c.sh[shIndex + 31]);
-                bD2->back().set(bD2->back()[0], c.sh[shIndex + 26], c.sh[shIndex + 29], c.sh[shIndex + 32]);
-                rD3->push_back(osg::Vec4(c.sh[shIndex + 33], c.sh[shIndex + 36], c.sh[shIndex + 39], c.sh[shIndex + 42]));
-                gD3->push_back(osg::Vec4(c.sh[shIndex + 34], c.sh[shIndex + 37], c.sh[shIndex + 40], c.sh[shIndex + 43]));
-                bD3->push_back(osg::Vec4(c.sh[shIndex + 35], c.sh[shIndex + 38], c.sh[shIndex + 41], c.sh[shIndex + 44]));
-                shDegree = 3;
-            }
+#pragma omp parallel for
+        for (int j = 0; j < count; ++j)
+        {
+            const int i = indices[j];
+            const float* p = &c.positions[i * 3]; const float* s = &c.scales[i * 3];
+            const float* q = &c.rotations[i * 4]; const float* col = &c.colors[i * 3];
+            (*pos)[j].set(p[0], p[1], p[2]);
+            (*scale)[j].set(expf(s[0]), expf(s[1]), expf(s[2]));  // scale is stored in logarithmic scale in GaussForge
+            (*rot)[j].set(q[1], q[2], q[3], q[0]);
+            (*alpha)[j] = 1.0f / (1.0f + expf(-c.alphas[i]));
+            (*rD0)[j].set(col[0], 0.0f, 0.0f, 0.0f);
+            (*gD0)[j].set(col[1], 0.0f, 0.0f, 0.0f);
+            (*bD0)[j].set(col[2], 0.0f, 0.0f, 0.0f);
+            if (shDegree < 1) continue;
+
+            const float* sh = &c.sh[(size_t)i * numShCoff];
+            (*rD0)[j].set(col[0], sh[0], sh[3], sh[6]);
+            (*gD0)[j].set(col[1], sh[1], sh[4], sh[7]);
+            (*bD0)[j].set(col[2], sh[2], sh[5], sh[8]);
+            if (shDegree < 2) continue;
+
+            (*rD1)[j].set(sh[9], sh[12], sh[15], sh[18]);
+            (*gD1)[j].set(sh[10], sh[13], sh[16], sh[19]);
+            (*bD1)[j].set(sh[11], sh[14], sh[17], sh[20]);
+            (*rD2)[j].set(sh[21], 0.0f, 0.0f, 0.0f);
+            (*gD2)[j].set(sh[22], 0.0f, 0.0f, 0.0f);
+            (*bD2)[j].set(sh[23], 0.0f, 0.0f, 0.0f);
+            if (shDegree < 3) continue;
+
+            (*rD2)[j].set(sh[21], sh[24], sh[27], sh[30]);
+            (*gD2)[j].set(sh[22], sh[25], sh[28], sh[31]);
+            (*bD2)[j].set(sh[23], sh[26], sh[29], sh[32]);
+            (*rD3)[j].set(sh[33], sh[36], sh[39], sh[42]);
+            (*gD3)[j].set(sh[34], sh[37], sh[40], sh[43]);
+            (*bD3)[j].set(sh[35], sh[38], sh[41], sh[44]);
         }
 
         osg::ref_ptr<osgVerse::GaussianGeometry> geom = new osgVerse::GaussianGeometry(m);
         geom->setShDegrees(shDegree); geom->setPosition(pos.get());
         geom->setScaleAndRotation(scale.get(), rot.get(), alpha.get());
         geom->setShRed(0, rD0.get()); geom->setShGreen(0, gD0.get()); geom->setShBlue(0, bD0.get());
-        if (numShCoff >= 24)
+        if (shDegree >= 2)
         {
             geom->setShRed(1, rD1.get()); geom->setShGreen(1, gD1.get()); geom->setShBlue(1, bD1.get());
             geom->setShRed(2, rD2.get()); geom->setShGreen(2, gD2.get()); geom->setShBlue(2, bD2.get());
-            if (numShCoff >= 45)
+            if (shDegree >= 3)
                 { geom->setShRed(3, rD3.get()); geom->setShGreen(3, gD3.get()); geom->setShBlue(3, bD3.get()); }
         }
-        geom->finalize(vOffset, vCount); return geom.release();
+        geom->finalize(); return geom.release();  // range already applied while unpacking
     }
 
     gf::GaussianCloudIR sceneToGF(const osg::Node& node) const
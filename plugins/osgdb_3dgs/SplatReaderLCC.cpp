@@ -13,14 +13,100 @@
 #include "readerwriter/Utilities.h"
 #include "3rdparty/picojson.h"
 #include "3rdparty/mio.hpp"
+#include <osg/observer_ptr>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Mutex>
 
 namespace
 {
+    /** Memory-mapped data.bin / shcoef.bin, shared by all paged level requests of the same scene */
+    class XGridsMappedFiles : public osg::Referenced
+    {
+    public:
+        mio::mmap_source data, shcoef;
+
+        static osg::ref_ptr<XGridsMappedFiles> get(const std::string& dataFile, const std::string& shFile)
+        {
+            typedef std::map<std::string, osg::observer_ptr<XGridsMappedFiles>> MappedFileMap;
+            static MappedFileMap s_mappedFiles;
+            static OpenThreads::Mutex s_mutex;
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex);
+
+            // Remove entries whose mappings are already released by all scenes
+            for (MappedFileMap::iterator itr = s_mappedFiles.begin(); itr != s_mappedFiles.end();)
+            { if (!itr->second.valid()) s_mappedFiles.erase(itr++); else ++itr; }
+
+            osg::ref_ptr<XGridsMappedFiles> files; std::string key = dataFile + "|" + shFile;
+            MappedFileMap::iterator itr = s_mappedFiles.find(key);
+            if (itr != s_mappedFiles.end() && itr->second.lock(files)) return files;
+
+            std::error_code error; files = new XGridsMappedFiles;
+            files->data.map(dataFile, error);
+            if (error)
+            {
+                OSG_WARN << "[ReaderWriter3DGS] Failed to map XGrids' data.bin: "
+                         << error << std::endl; return NULL;
+            }
+
+            if (!shFile.empty())
+            {
+                files->shcoef.map(shFile, error);
+                if (error)
+                {
+                    OSG_WARN << "[ReaderWriter3DGS] Failed to map XGrids' shcoef.bin: "
+                             << error << std::endl; files->shcoef.unmap();
+                }
+            }
+            s_mappedFiles[key] = files.get();
+            return files;
+        }
+
+    protected:
+        virtual ~XGridsMappedFiles() { data.unmap(); shcoef.unmap(); }
+    };
+
+    struct XGridsLevelParameters
+    {
+        osg::Vec3 scaleRange[2], shRange[2]; int degrees; float distance;
+        osgVerse::GaussianGeometry::RenderMethod method;
+
+        std::string serialize() const
+        {
+            std::stringstream ss; ss << degrees << " " << distance << " " << (int)method;
+            for (int i = 0; i < 2; ++i) ss << " " << scaleRange[i][0] << " " << scaleRange[i][1] << " " << scaleRange[i][2];
+            for (int i = 0; i < 2; ++i) ss << " " << shRange[i][0] << " " << shRange[i][1] << " " << shRange[i][2];
+            return ss.str();
+        }
+
+        void deserialize(const std::string& str)
+        {
+            std::stringstream ss(str); int m = 0; ss >> degrees >> distance >> m;
+            for (int i = 0; i < 2; ++i) ss >> scaleRange[i][0] >> scaleRange[i][1] >> scaleRange[i][2];
+            for (int i = 0; i < 2; ++i) ss >> shRange[i][0] >> shRange[i][1] >> shRange[i][2];
+            method = (osgVerse::GaussianGeometry::RenderMethod)m;
+        }
+    };
+
     struct XGridsNodeChunk
     {
         uint16_t col = 0, row = 0;
         std::vector<uint32_t> numSplats, byteSizes;
         std::vector<uint64_t> offsets;
+
+        std::string serialize() const
+        {
+            std::stringstream ss; ss << col << " " << row << " " << offsets.size();
+            for (size_t i = 0; i < offsets.size(); ++i)
+                ss << " " << numSplats[i] << " " << offsets[i] << " " << byteSizes[i];
+            return ss.str();
+        }
+
+        void deserialize(const std::string& str)
+        {
+            std::stringstream ss(str); size_t num = 0; ss >> col >> row >> num;
+            numSplats.resize(num); offsets.resize(num); byteSizes.resize(num);
+            for (size_t i = 0; i < num; ++i) ss >> numSplats[i] >> offsets[i] >> byteSizes[i];
+        }
     };
 
     static osg::Vec3 parseScale(const osg::Vec3& s0, const osg::Vec3& sMin, const osg::Vec3& sMax)
@@ -51,25 +137,24 @@ namespace
                          float((enc >> 21) & 2047) / 2047.0f);
     }
 
-    std::vector<osg::Vec3> parseShcoef(const std::vector<unsigned int>& raw, const osg::Vec3& sMin, const osg::Vec3& sMax)
+    void parseShcoef(const unsigned int* raw, size_t num, const osg::Vec3& sMin, const osg::Vec3& sMax,
+                     osg::Vec3* result)
     {
-        std::vector<osg::Vec3> result(raw.size());
-        for (size_t i = 0; i < raw.size(); ++i)
+        for (size_t i = 0; i < num; ++i)
         {
             osg::Vec3 ratio = parsePacked11(raw[i]);
             result[i] = osg::Vec3(sMin[0] * (1.0f - ratio[0]) + sMax[0] * ratio[0],
                                   sMin[1] * (1.0f - ratio[1]) + sMax[1] * ratio[1],
                                   sMin[2] * (1.0f - ratio[2]) + sMax[2] * ratio[2]);
         }
-        return result;
     }
 }
 
-void applyShcoefFromXGrids(osg::Geometry* geomInput, const std::vector<unsigned char>& data, uint32_t numSplats,
+void applyShcoefFromXGrids(osg::Geometry* geomInput, const unsigned char* data, uint32_t numSplats,
                            const osg::Vec3& sMin, const osg::Vec3& sMax)
 {
     osgVerse::GaussianGeometry* geom = dynamic_cast<osgVerse::GaussianGeometry*>(geomInput);
-    size_t fixedSize = sizeof(int) * 16; if (!geom || !numSplats) return;
+    const size_t numCoefs = 16, fixedSize = sizeof(int) * numCoefs; if (!geom || !numSplats) return;
 
     osg::ref_ptr<osg::Vec4Array> rD0 = geom->getShRed(0), gD0 = geom->getShGreen(0), bD0 = geom->getShBlue(0);
     osg::ref_ptr<osg::Vec4Array> rD1 = new osg::Vec4Array(numSplats), gD1 = new osg::Vec4Array(numSplats),
@@ -77,13 +162,12 @@ void applyShcoefFromXGrids(osg::Geometry* geomInput, const std::vector<unsigned
                                  gD2 = new osg::Vec4Array(numSplats), bD2 = new osg::Vec4Array(numSplats),
                                  rD3 = new osg::Vec4Array(numSplats), gD3 = new osg::Vec4Array(numSplats),
                                  bD3 = new osg::Vec4Array(numSplats);
-    for (uint32_t i = 0; i < numSplats; ++i)
+#pragma omp parallel for
+    for (int i = 0; i < (int)numSplats; ++i)
     {
-        std::vector<unsigned int> rawData(16);
-        memcpy(&rawData[0], &data[i * fixedSize], fixedSize);
-
-        std::vector<osg::Vec3> result = parseShcoef(rawData, sMin, sMax);
-        if (result.size() < 15) continue;
+        unsigned int rawData[numCoefs]; osg::Vec3 result[numCoefs];  // per-splat, on stack
+        memcpy(rawData, data + i * fixedSize, fixedSize);
+        parseShcoef(rawData, numCoefs, sMin, sMax, result);
         (*rD0)[i].y() = result[0].x(); (*gD0)[i].y() = result[0].x(); (*bD0)[i].y() = result[0].x();
         (*rD0)[i].z() = result[1].y(); (*gD0)[i].z() = result[1].y(); (*bD0)[i].z() = result[1].y();
         (*rD0)[i].w() = result[2].z(); (*gD0)[i].w() = result[2].z(); (*bD0)[i].w() = result[2].z();
@@ -100,7 +184,7 @@ void applyShcoefFromXGrids(osg::Geometry* geomInput, const std::vector<unsigned
     geom->setShRed(3, rD3.get()); geom->setShGreen(3, gD3.get()); geom->setShBlue(3, bD3.get());
 }
 
-osg::Geometry* loadGeometryFromXGrids(const std::vector<unsigned char>& data, uint32_t numSplats,
+osg::Geometry* loadGeometryFromXGrids(const unsigned char* data, uint32_t numSplats,
                                       int degrees, const osg::Vec3& sMin, const osg::Vec3& sMax,
                                       osgVerse::GaussianGeometry::RenderMethod rm)
 {
@@ -111,9 +195,10 @@ osg::Geometry* loadGeometryFromXGrids(const std::vector<unsigned char>& data, ui
     osg::ref_ptr<osg::FloatArray> alpha = new osg::FloatArray(numSplats);
 
     const static float kSH_C0 = 0.28209479177387814;
-    for (uint32_t i = 0; i < numSplats; ++i)
+#pragma omp parallel for
+    for (int i = 0; i < (int)numSplats; ++i)
     {
-        float valueF[3]; uint16_t valueS[3]; uint8_t valueB[4]; uint32_t valueI = 0, index = i * 32;
+        float valueF[3]; uint16_t valueS[3]; uint8_t valueB[4]; uint32_t valueI = 0; size_t index = (size_t)i * 32;
         for (uint32_t n = 0; n < 3; ++n) memcpy(&valueF[n], &data[index + n * 4], sizeof(float));
         (*pos)[i].set(valueF[0], valueF[1], valueF[2]);
         for (uint32_t n = 0; n < 4; ++n) memcpy(&valueB[n], &data[index + 12 + n], sizeof(uint8_t));
@@ -135,6 +220,84 @@ osg::Geometry* loadGeometryFromXGrids(const std::vector<unsigned char>& data, ui
     return geom.release();
 }
 
+/** Decode one LOD level of a chunk directly from the shared mapping */
+osg::Geode* loadLevelFromXGrids(XGridsMappedFiles* files, const XGridsNodeChunk& chunk, int level,
+                                const XGridsLevelParameters& params, const std::string& name)
+{
+    uint64_t start = chunk.offsets[level], end = start + chunk.byteSizes[level];
+    uint64_t totalSize = files->data.size(); if (end > totalSize) end = totalSize;
+    uint32_t numSplats = osg::minimum(chunk.numSplats[level], (uint32_t)((end - start) / 32));
+    if (end <= start || numSplats == 0) return NULL;
+
+    osg::ref_ptr<osg::Geometry> geom = loadGeometryFromXGrids(
+        (const unsigned char*)files->data.data() + start, numSplats, params.degrees,
+        params.scaleRange[0], params.scaleRange[1], params.method);
+    if (!geom) return NULL; else geom->setName(name + "_LOD" + std::to_string(level));
+
+    if (params.degrees > 0 && files->shcoef.is_mapped())
+    {
+        start = chunk.offsets[level] * 2; end = chunk.byteSizes[level] * 2 + start;
+        if (end <= files->shcoef.size())
+        {
+            applyShcoefFromXGrids(geom.get(), (const unsigned char*)files->shcoef.data() + start,
+                                  numSplats, params.shRange[0], params.shRange[1]);
+        }
+    }
+    static_cast<osgVerse::GaussianGeometry*>(geom.get())->finalize();
+
+    osg::Geode* geode = new osg::Geode; geode->addDrawable(geom.get());
+    return geode;
+}
+
+/** Create level node: it shows current level at distance and requests the next finer level via the pager */
+osg::Node* createLevelNodeFromXGrids(XGridsMappedFiles* files, const XGridsNodeChunk& chunk, int level,
+                                     const XGridsLevelParameters& params, const std::string& name,
+                                     const osg::BoundingSphere& bs, const osgDB::Options* opt)
+{
+    osg::ref_ptr<osg::Geode> geode = loadLevelFromXGrids(files, chunk, level, params, name);
+    int finer = level - 1; while (finer >= 0 && chunk.numSplats[finer] == 0) finer--;
+    if (finer < 0) return geode.release();
+
+    osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+    plod->setName(name + "_LOD" + std::to_string(level));
+    plod->setRangeMode(osg::LOD::DISTANCE_FROM_EYE_POINT);
+    plod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+    plod->setCenter(bs.center()); plod->setRadius(bs.radius());
+
+    float distance = params.distance * pow(1.2f, (float)level);
+    plod->addChild(geode.valid() ? geode.get() : new osg::Node, distance, FLT_MAX);
+    plod->setFileName(1, name + "_LOD" + std::to_string(finer) + ".lcc_node.verse_3dgs");
+    plod->setRange(1, 0.0f, distance);
+
+    osg::ref_ptr<osgDB::Options> levelOpt = opt ? opt->cloneOptions() : new osgDB::Options;
+    levelOpt->setPluginStringData("LccChunk", chunk.serialize());
+    levelOpt->setPluginStringData("LccLevel", std::to_string(finer));
+    plod->setDatabaseOptions(levelOpt.get());
+    return plod.release();
+}
+
+osg::ref_ptr<osg::Node> loadSubSplatFromXGrids(const std::string& file, const osgDB::Options* opt)
+{
+    std::string chunkData = opt ? opt->getPluginStringData("LccChunk") : "";
+    std::string paramData = opt ? opt->getPluginStringData("LccParameters") : "";
+    if (chunkData.empty() || paramData.empty())
+    { OSG_WARN << "[ReaderWriter3DGS] Invalid LCC level: " << file << std::endl; return NULL; }
+
+    XGridsNodeChunk chunk; chunk.deserialize(chunkData);
+    XGridsLevelParameters params; params.deserialize(paramData);
+    int level = atoi(opt->getPluginStringData("LccLevel").c_str());
+    if (level < 0 || level >= (int)chunk.offsets.size()) return NULL;
+
+    osg::ref_ptr<XGridsMappedFiles> files = XGridsMappedFiles::get(
+        opt->getPluginStringData("LccDataFile"), opt->getPluginStringData("LccShcoefFile"));
+    if (!files) return NULL;
+
+    osg::BoundingSphere bs; std::stringstream ss(opt->getPluginStringData("LccChunkBound"));
+    ss >> bs.center()[0] >> bs.center()[1] >> bs.center()[2] >> bs.radius();
+    std::string name = std::to_string(chunk.col) + "_" + std::to_string(chunk.row);
+    return createLevelNodeFromXGrids(files.get(), chunk, level, params, name, bs, opt);
+}
+
 osg::Node* loadCollisionFromXGrids(std::istream& in)
 {
     unsigned int magic = 0, rev = 0; in.read((char*)&magic, sizeof(unsigned int));
@@ -175,7 +338,7 @@ osg::Node* loadCollisionFromXGrids(std::istream& in)
     return geode.release();
 }
 
-osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string& path,
+osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string& path, bool paging,
                                             osgVerse::GaussianGeometry::RenderMethod rm)
 {
     std::string reserved0, reserved1, err;
@@ -275,7 +438,7 @@ osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string&
     }
 
     // Load data.bin to obtain main point cloud data
-    int deg = (fileType == "Portable") ? 0 : 3; std::error_code error;
+    int deg = (fileType == "Portable") ? 0 : 3;
     std::string dataBinPath = path + "/data.bin", shBinPath = path + "/shcoef.bin";
     if (!osgDB::fileExists(dataBinPath)) dataBinPath = path + "/Data.bin";
     if (!osgDB::fileExists(shBinPath)) shBinPath = path + "/Shcoef.bin";
@@ -285,65 +448,57 @@ osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string&
                  << path << std::endl; return root;
     }
 
-    mio::mmap_source ro_mmap, ro_mmap2; ro_mmap.map(dataBinPath, error);
-    if (error)
-    {
-        OSG_WARN << "[ReaderWriter3DGS] Failed to map XGrids' data.bin: "
-                 << error << std::endl; return root;
-    }
+    if (deg == 0 || !osgDB::fileExists(shBinPath)) shBinPath.clear();
+    osg::ref_ptr<XGridsMappedFiles> files = XGridsMappedFiles::get(dataBinPath, shBinPath);
+    if (!files) return root; else if (!files->shcoef.is_mapped()) deg = 0;
+    root->setUserData(files.get());  // keep the mapping while paged levels may still be requested
 
-    if (deg > 0 && osgDB::fileExists(shBinPath))
-    {
-        ro_mmap2.map(shBinPath, error);
-        if (error)
-        {
-            OSG_WARN << "[ReaderWriter3DGS] Failed to map XGrids' shcoef.bin: "
-                     << error << std::endl; deg = 0;
-        }
-    }
+    XGridsLevelParameters params; params.degrees = deg; params.method = rm; params.distance = 0.0f;
+    params.scaleRange[0] = scaleRange[0]; params.scaleRange[1] = scaleRange[1];
+    params.shRange[0] = shRange[0]; params.shRange[1] = shRange[1];
+
+    osg::ref_ptr<osgDB::Options> levelOpt = new osgDB::Options;
+    levelOpt->setPluginStringData("LccDataFile", dataBinPath);
+    levelOpt->setPluginStringData("LccShcoefFile", shBinPath);
 
     // Create LODS and read from data.bin & shcoef.bin
-    uint64_t totalSize = ro_mmap.size(), totalSize2 = (deg > 0) ? ro_mmap2.size() : 0;
     for (size_t k = 0; k < dataChunks.size(); ++k)
     {
         XGridsNodeChunk& chunk = dataChunks[k];
-        osg::ref_ptr<osg::LOD> lod = new osg::LOD;
-        lod->setName(std::to_string(chunk.col) + "_" + std::to_string(chunk.row));
-        lod->setRangeMode(osg::LOD::DISTANCE_FROM_EYE_POINT);
-        lod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
-
+        std::string chunkName = std::to_string(chunk.col) + "_" + std::to_string(chunk.row);
         osg::BoundingBox localBox;
         localBox._min = worldBox._min + osg::Vec3(cellLengthX * chunk.col, cellLengthY * chunk.row, 0.0f);
         localBox._max = localBox._min + osg::Vec3(cellLengthX, cellLengthY, worldBox.zMax() - worldBox.zMin());
-        lod->setCenter(localBox.center()); lod->setRadius(localBox.radius());
 
-        std::vector<unsigned char> data; float d = localBox.radius() * 0.4f;
+        float d = localBox.radius() * 0.4f; params.distance = d;
+        if (paging)
+        {   // Coarsest level is decoded now, finer ones are requested by the pager when getting closer
+            int coarsest = (int)chunk.offsets.size() - 1;
+            while (coarsest >= 0 && chunk.numSplats[coarsest] == 0) coarsest--;
+            if (coarsest < 0) continue;
+
+            osg::BoundingSphere bs(localBox); std::stringstream ss;
+            ss << bs.center()[0] << " " << bs.center()[1] << " " << bs.center()[2] << " " << bs.radius();
+            osg::ref_ptr<osgDB::Options> chunkOpt = levelOpt->cloneOptions();
+            chunkOpt->setPluginStringData("LccParameters", params.serialize());
+            chunkOpt->setPluginStringData("LccChunkBound", ss.str());
+
+            osg::ref_ptr<osg::Node> node = createLevelNodeFromXGrids(
+                files.get(), chunk, coarsest, params, chunkName, bs, chunkOpt.get());
+            if (node.valid()) root->addChild(node.get());
+            continue;
+        }
+
+        osg::ref_ptr<osg::LOD> lod = new osg::LOD; lod->setName(chunkName);
+        lod->setRangeMode(osg::LOD::DISTANCE_FROM_EYE_POINT);
+        lod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+        lod->setCenter(localBox.center()); lod->setRadius(localBox.radius());
         for (int i = (int)chunk.offsets.size() - 1; i >= 0; --i)
         {
-            uint64_t start = chunk.offsets[i], end = chunk.byteSizes[i]; end += start;
-            if (end <= start || chunk.numSplats[i] == 0) continue;
-            else if (totalSize <= end) data.assign(ro_mmap.begin() + start, ro_mmap.end());
-            else data.assign(ro_mmap.begin() + start, ro_mmap.begin() + end);
-            
-            osg::ref_ptr<osg::Geometry> geom = loadGeometryFromXGrids(
-                data, chunk.numSplats[i], deg, scaleRange[0], scaleRange[1], rm);
-            if (geom.valid())
-            {
-                osg::ref_ptr<osg::Geode> child = new osg::Geode; child->addDrawable(geom.get());
-                geom->setName(lod->getName() + "_LOD" + std::to_string(i));
-
-                if (deg > 0)
-                {
-                    std::vector<unsigned char> data2;
-                    start = chunk.offsets[i] * 2, end = chunk.byteSizes[i] * 2 + start;
-                    if (totalSize2 <= end) data2.assign(ro_mmap2.begin() + start, ro_mmap2.end());
-                    else data2.assign(ro_mmap2.begin() + start, ro_mmap2.begin() + end);
-                    applyShcoefFromXGrids(geom.get(), data2, chunk.numSplats[i], shRange[0], shRange[1]);
-                }
-                static_cast<osgVerse::GaussianGeometry*>(geom.get())->finalize();
-                lod->addChild(child.get(), d * pow(1.2f, i), d * pow(1.2f, i + 1));
-            }
+            osg::ref_ptr<osg::Geode> child = loadLevelFromXGrids(files.get(), chunk, i, params, chunkName);
+            if (child.valid()) lod->addChild(child.get(), d * pow(1.2f, i), d * pow(1.2f, i + 1));
         }
+        if (lod->getNumChildren() == 0) continue;
 
         const osg::LOD::RangeList& ranges = lod->getRangeList();
         lod->setRange(0, ranges[0].first, FLT_MAX);
@@ -358,8 +513,6 @@ osg::ref_ptr<osg::Node> loadSplatFromXGrids(std::istream& in, const std::string&
         }
 #endif
     }
-    ro_mmap.unmap();
-    if (deg > 0) ro_mmap2.unmap();
 
     // Load collision.lci
     std::string collisionPath = path + "/collision.lci";
@@ -12,6 +12,7 @@
 #include "modeling/Utilities.h"
 #include "readerwriter/Utilities.h"
 #include "3rdparty/picojson.h"
+#include "SplatSelection.h"
 
 // https://developer.playcanvas.com/user-manual/gaussian-splatting/formats/sog/
 namespace
@@ -19,6 +20,7 @@ namespace
     struct SogData
     {
         std::map<std::string, osg::ref_ptr<osg::Image>> images;
+        std::map<std::string, std::string> imageFiles;
         std::vector<float> scaleCode, sh0Code, shNCode;
         osg::Vec3 meansMin, meansMax;
         osg::Vec3 scalesMin, scalesMax;      // V1 only
@@ -35,13 +37,12 @@ namespace
     static float unlog(float x) { return signum(x) * (exp(abs(x)) - 1.0f); }
     static float sigmoidInv(float x) { float e = osg::minimum(1.0 - 1e-6, osg::maximum(1e-6, (double)x)); return (float)log(e / (1.0 - e)); };
 
-    static osg::Image* readDataImage(const std::string& path, const std::string& file, osg::Referenced* zip)
+    static osg::Image* readDataImage(const std::string& path, const std::string& file,
+                                     const std::vector<unsigned char>& data, bool fromZip)
     {
-        if (zip != NULL)
+        if (fromZip)
         {
-            std::vector<unsigned char> data = osgVerse::CompressAuxiliary::extract(zip, file);
             if (data.empty()) return NULL;
-
             std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary); ss.write((char*)data.data(), data.size());
             osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getFileExtension(file));
             if (!rw) rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_webp");
@@ -54,7 +55,26 @@ namespace
         }
     }
 
-    static bool parseSogMetaData(SogData& sogData, picojson::value& document, const std::string& path, osg::Referenced* zip)
+    static void readDataImages(SogData& sogData, const std::string& path, osg::Referenced* zip)
+    {
+        // Extract serially as the zip handle is not thread-safe, then decode webp planes in parallel
+        std::vector<std::string> keys, files;
+        for (std::map<std::string, std::string>::iterator itr = sogData.imageFiles.begin();
+             itr != sogData.imageFiles.end(); ++itr) { keys.push_back(itr->first); files.push_back(itr->second); }
+
+        int numImages = (int)keys.size();
+        std::vector<std::vector<unsigned char>> dataList(numImages);
+        if (zip != NULL)
+        { for (int i = 0; i < numImages; ++i) dataList[i] = osgVerse::CompressAuxiliary::extract(zip, files[i]); }
+
+        std::vector<osg::ref_ptr<osg::Image>> images(numImages);
+#pragma omp parallel for
+        for (int i = 0; i < numImages; ++i)
+        { images[i] = readDataImage(path, files[i], dataList[i], zip != NULL); std::vector<unsigned char>().swap(dataList[i]); }
+        for (int i = 0; i < numImages; ++i) sogData.images[keys[i]] = images[i];
+    }
+
+    static bool parseSogMetaData(SogData& sogData, picojson::value& document, osg::Referenced* zip)
     {
         if (zip != NULL)
         {
@@ -95,14 +115,14 @@ namespace
 
                 picojson::array files = meansObj.get("files").get<picojson::array>();
                 for (size_t i = 0; i < files.size(); ++i)
-                    sogData.images["means_" + std::to_string(i)] = readDataImage(path, files[i].get<std::string>(), zip);
+                    sogData.imageFiles["means_" + std::to_string(i)] = files[i].get<std::string>();
             }
 
             if (quatsObj.is<picojson::object>())
             {
                 picojson::array files = quatsObj.get("files").get<picojson::array>();
                 for (size_t i = 0; i < files.size(); ++i)
-                    sogData.images["quats_" + std::to_string(i)] = readDataImage(path, files[i].get<std::string>(), zip);
+                    sogData.imageFiles["quats_" + std::to_string(i)] = files[i].get<std::string>();
             }
 
             if (scalesObj.is<picojson::object>())
@@ -125,7 +145,7 @@ namespace
 
                 picojson::array files = scalesObj.get("files").get<picojson::array>();
                 for (size_t i = 0; i < files.size(); ++i)
-                    sogData.images["scales_" + std::to_string(i)] = readDataImage(path, files[i].get<std::string>(), zip);
+                    sogData.imageFiles["scales_" + std::to_string(i)] = files[i].get<std::string>();
             }
 
             if (sh0Obj.is<picojson::object>())
@@ -148,7 +168,7 @@ namespace
 
                 picojson::array files = sh0Obj.get("files").get<picojson::array>();
                 for (size_t i = 0; i < files.size(); ++i)
-                    sogData.images["sh0_" + std::to_string(i)] = readDataImage(path, files[i].get<std::string>(), zip);
+                    sogData.imageFiles["sh0_" + std::to_string(i)] = files[i].get<std::string>();
             }
 
             if (shNObj.is<picojson::object>())
@@ -180,7 +200,7 @@ namespace
 
                 picojson::array files = shNObj.get("files").get<picojson::array>();
                 for (size_t i = 0; i < files.size(); ++i)
-                    sogData.images["shN_" + std::to_string(i)] = readDataImage(path, files[i].get<std::string>(), zip);
+                    sogData.imageFiles["shN_" + std::to_string(i)] = files[i].get<std::string>();
             }
             return true;
         }
@@ -188,8 +208,39 @@ namespace
         { OSG_WARN << "[ReaderWriter3DGS] Invalid SOG meta file: " << e.what() << std::endl; return false; }
     }
 
+    static void computeSogImportance(std::vector<float>& importance, osg::Image* scales, osg::Image* sh0,
+                                     const SogData& sogData)
+    {
+        if (!scales || !sh0) return;
+        if (scales->getDataType() != GL_UNSIGNED_BYTE || scales->getPixelFormat() != GL_RGBA ||
+            sh0->getDataType() != GL_UNSIGNED_BYTE || sh0->getPixelFormat() != GL_RGBA) return;
+
+        std::vector<float> codes = sogData.scaleCode; codes.resize(256);
+        osg::Vec4ub *ptrS = (osg::Vec4ub*)scales->data(), *ptrA = (osg::Vec4ub*)sh0->data();
+        const osg::Vec3 &mins = sogData.scalesMin, &maxs = sogData.scalesMax;
+        int count = (int)importance.size();
+#pragma omp parallel for
+        for (int i = 0; i < count; ++i)
+        {
+            osg::Vec4ub valueS = *(ptrS + i), valueA = *(ptrA + i); float logScale = 0.0f, alpha = 0.0f;
+            if (sogData.hasCodebook)
+            {   // V2
+                logScale = codes[valueS.r()] + codes[valueS.g()] + codes[valueS.b()];
+                alpha = valueA.a() / 255.0f;
+            }
+            else
+            {   // V1
+                for (int k = 0; k < 3; ++k)
+                    logScale += mins[k] + (maxs[k] - mins[k]) * (valueS[k] / 255.0f);
+                float a = sogData.sh0Min[3] + (sogData.sh0Max[3] - sogData.sh0Min[3]) * (valueA.a() / 255.0f);
+                alpha = 1.0f / (1.0f + exp(-a));
+            }
+            importance[i] = alpha * exp(logScale / 3.0f);  // opacity x average radius
+        }
+    }
+
     static void createSogPositions(osg::Vec3Array& va, osg::Image* means_l, osg::Image* means_u,
-                                   const osg::Vec3& mins, const osg::Vec3& maxs)
+                                   const std::vector<int>& indices, const osg::Vec3& mins, const osg::Vec3& maxs)
     {
         if (!means_l || !means_u) { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'means' image missing\n"; return; }
         if (means_l->getDataType() != GL_UNSIGNED_BYTE || means_l->getPixelFormat() != GL_RGBA ||
@@ -197,9 +248,11 @@ namespace
         { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'means' image format mismatch\n"; return; }
         
         osg::Vec4ub *ptrL = (osg::Vec4ub*)means_l->data(), *ptrU = (osg::Vec4ub*)means_u->data();
-        for (size_t i = 0; i < va.size(); ++i)
+        int count = (int)va.size();
+#pragma omp parallel for
+        for (int i = 0; i < count; ++i)
         {
-            osg::Vec4ub valueL = *(ptrL + i), valueU = *(ptrU + i);
+            osg::Vec4ub valueL = *(ptrL + indices[i]), valueU = *(ptrU + indices[i]);
             float qx = ((unsigned short)(valueU.r() << 8) | valueL.r()) / 65535.0f;
             float qy = ((unsigned short)(valueU.g() << 8) | valueL.g()) / 65535.0f;
             float qz = ((unsigned short)(valueU.b() << 8) | valueL.b()) / 65535.0f;
@@ -210,28 +263,31 @@ namespace
         }
     }
 
-    static void createSogScales(osg::Vec3Array& sa, osg::Image* scales, std::vector<float>& codes,
-                                const osg::Vec3& mins, const osg::Vec3& maxs)
+    static void createSogScales(osg::Vec3Array& sa, osg::Image* scales, const std::vector<int>& indices,
+                                std::vector<float>& codes, const osg::Vec3& mins, const osg::Vec3& maxs)
     {
         if (!scales) { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'scales' image missing\n"; return; }
         if (scales->getDataType() != GL_UNSIGNED_BYTE || scales->getPixelFormat() != GL_RGBA)
         { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'scales' image format mismatch\n"; return; }
 
         osg::Vec4ub* ptr = (osg::Vec4ub*)scales->data();
+        int count = (int)sa.size();
         if (!codes.empty())
         {   // V2
             codes.resize(256);
-            for (size_t i = 0; i < sa.size(); ++i)
+#pragma omp parallel for
+            for (int i = 0; i < count; ++i)
             {
-                osg::Vec4ub value = *(ptr + i);
+                osg::Vec4ub value = *(ptr + indices[i]);
                 sa[i] = osg::Vec3(exp(codes[value.r()]), exp(codes[value.g()]), exp(codes[value.b()]));
             }
         }
         else
         {   // V1
-            for (size_t i = 0; i < sa.size(); ++i)
+#pragma omp parallel for
+            for (int i = 0; i < count; ++i)
             {
-                osg::Vec4ub value = *(ptr + i);
+                osg::Vec4ub value = *(ptr + indices[i]);
                 float sx = mins[0] + (maxs[0] - mins[0]) * (value.r() / 255.0f);
                 float sy = mins[1] + (maxs[1] - mins[1]) * (value.g() / 255.0f);
                 float sz = mins[2] + (maxs[2] - mins[2]) * (value.b() / 255.0f);
@@ -240,16 +296,18 @@ namespace
         }
     }
 
-    static void createSogRotations(osg::Vec4Array& qa, osg::Image* quats)
+    static void createSogRotations(osg::Vec4Array& qa, osg::Image* quats, const std::vector<int>& indices)
     {
         if (!quats) { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'quats' image missing\n"; return; }
         if (quats->getDataType() != GL_UNSIGNED_BYTE || quats->getPixelFormat() != GL_RGBA)
         { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'quats' image format mismatch\n"; return; }
 
         osg::Vec4ub* ptr = (osg::Vec4ub*)quats->data();
-        for (size_t i = 0; i < qa.size(); ++i)
+        int count = (int)qa.size();
+#pragma omp parallel for
+        for (int i = 0; i < count; ++i)
         {
-            osg::Vec4ub value = *(ptr + i);
+            osg::Vec4ub value = *(ptr + indices[i]);
             float a = (value.r() / 255.0f - 0.5f) * 2.0f / sqrt(2.0f);
             float b = (value.g() / 255.0f - 0.5f) * 2.0f / sqrt(2.0f);
             float c = (value.b() / 255.0f - 0.5f) * 2.0f / sqrt(2.0f);
@@ -268,7 +326,8 @@ namespace
     }
 
     static void createSogColors0(osg::Vec4Array& r0, osg::Vec4Array& g0, osg::Vec4Array& b0, osg::FloatArray& a,
-                                 osg::Image* sh0, std::vector<float>& codes, const osg::Vec4& mins, const osg::Vec4& maxs)
+                                 osg::Image* sh0, const std::vector<int>& indices, std::vector<float>& codes,
+                                 const osg::Vec4& mins, const osg::Vec4& maxs)
     {
         if (!sh0) { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'sh0' image missing\n"; return; }
         if (sh0->getDataType() != GL_UNSIGNED_BYTE || sh0->getPixelFormat() != GL_RGBA)
@@ -276,12 +335,14 @@ namespace
 
         //const static double SH_C0 = 0.28209479177387814;
         osg::Vec4ub* ptr = (osg::Vec4ub*)sh0->data();
+        int count = (int)a.size();
         if (!codes.empty())
         {   // V2
             codes.resize(256);
-            for (size_t i = 0; i < a.size(); ++i)
+#pragma omp parallel for
+            for (int i = 0; i < count; ++i)
             {
-                osg::Vec4ub value = *(ptr + i); a[i] = value.a() / 255.0f;
+                osg::Vec4ub value = *(ptr + indices[i]); a[i] = value.a() / 255.0f;
                 r0[i] = osg::Vec4(codes[value.r()], 0.0f, 0.0f, 0.0f);
                 g0[i] = osg::Vec4(codes[value.g()], 0.0f, 0.0f, 0.0f);
                 b0[i] = osg::Vec4(codes[value.b()], 0.0f, 0.0f, 0.0f);
@@ -289,9 +350,10 @@ namespace
         }
         else
         {   // V1
-            for (size_t i = 0; i < a.size(); ++i)
+#pragma omp parallel for
+            for (int i = 0; i < count; ++i)
             {
-                osg::Vec4ub value = *(ptr + i);
+                osg::Vec4ub value = *(ptr + indices[i]);
                 float r = mins[0] + (maxs[0] - mins[0]) * (value.r() / 255.0f);
                 float g = mins[1] + (maxs[1] - mins[1]) * (value.g() / 255.0f);
                 float b = mins[2] + (maxs[2] - mins[2]) * (value.b() / 255.0f);
@@ -308,8 +370,9 @@ namespace
                                  osg::Vec4Array& r1, osg::Vec4Array& g1, osg::Vec4Array& b1,
                                  osg::Vec4Array& r2, osg::Vec4Array& g2, osg::Vec4Array& b2,
                                  osg::Vec4Array& r3, osg::Vec4Array& g3, osg::Vec4Array& b3,
-                                 osg::Image* centroids, osg::Image* labels, std::vector<float>& codes,
-                                 float shNMin, float shNMax, size_t numDegrees, size_t numEntries)
+                                 osg::Image* centroids, osg::Image* labels, const std::vector<int>& indices,
+                                 std::vector<float>& codes, float shNMin, float shNMax, size_t numDegrees,
+                                 size_t numEntries)
     {
         if (!centroids) { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'shN_centroids' image missing\n"; return; }
         if (!labels) { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'shN_labels' image missing\n"; return; }
@@ -318,20 +381,23 @@ namespace
         { OSG_NOTICE << "[ReaderWriter3DGS] SOG 'shN' image format mismatch\n"; return; }
 
         const static std::vector<int> coeffs = { 0, 3, 8, 15 };
-        int coeff = coeffs[numDegrees]; std::vector<float> R(coeff), G(coeff), B(coeff);
+        int coeff = coeffs[numDegrees];
         if (centroids->getOrigin() == osg::Image::BOTTOM_LEFT) centroids->flipVertical();
 
         osg::Vec4ub* ptrC = (osg::Vec4ub*)centroids->data();
         osg::Vec4ub* ptrL = (osg::Vec4ub*)labels->data();
         bool isVersion2 = (!codes.empty()); codes.resize(256);
-        for (size_t i = 0; i < r0.size(); ++i)
+        int count = (int)r0.size(), centroidWidth = centroids->s();
+#pragma omp parallel for
+        for (int i = 0; i < count; ++i)
         {
-            osg::Vec4ub value = *(ptrL + i);
+            float R[15], G[15], B[15];
+            osg::Vec4ub value = *(ptrL + indices[i]);
             unsigned short q = (unsigned short)(value.g() << 8) | value.r();
             for (int j = 0; j < coeff; ++j)
             {
                 const int cx = (int)(q % 64) * coeff + j, cy = (int)floor(q / 64);
-                osg::Vec4ub center = *(ptrC + cy * centroids->s() + cx);
+                osg::Vec4ub center = *(ptrC + cy * centroidWidth + cx);
                 if (isVersion2)
                     { R[j] = codes[center.r()]; G[j] = codes[center.g()]; B[j] = codes[center.b()]; }
                 else
@@ -356,7 +422,8 @@ namespace
 }
 
 osg::ref_ptr<osg::Node> loadSplatFromSOG(std::istream& in, const std::string& path, const std::string& ext,
-                                         int vOffset, int vCount, osgVerse::GaussianGeometry::RenderMethod rm)
+                                         int vOffset, int vCount, bool byImportance,
+                                         osgVerse::GaussianGeometry::RenderMethod rm)
 {
     SogData sogData; picojson::value document;
     if (ext == "json")
@@ -367,24 +434,38 @@ osg::ref_ptr<osg::Node> loadSplatFromSOG(std::istream& in, const std::string& pa
             OSG_WARN << "[ReaderWriter3DGS] Failed to parse PlayCanvas' SOG data: " << err << std::endl;
             return NULL;
         }
-        if (!parseSogMetaData(sogData, document, path, NULL)) return NULL;
+        if (!parseSogMetaData(sogData, document, NULL)) return NULL;
+        readDataImages(sogData, path, NULL);
     }
     else if (ext == "sog")
     {
         osg::ref_ptr<osg::Referenced> zip = osgVerse::CompressAuxiliary::createHandle(osgVerse::CompressAuxiliary::ZIP, in);
-        bool done = parseSogMetaData(sogData, document, path, zip);
+        bool done = parseSogMetaData(sogData, document, zip);
+        if (done) readDataImages(sogData, path, zip);
         osgVerse::CompressAuxiliary::destroyHandle(zip); if (!done) return NULL;
     }
 
+    // Select splats to decode: a sub-range, optionally ordered by importance for progressive loading
+    size_t numSplats = sogData.count; if (!numSplats) return NULL;
+    std::vector<float> importance; std::vector<int> indices;
+    if (byImportance)
+    {
+        importance.resize(numSplats);
+        computeSogImportance(importance, sogData.images["scales_0"].get(), sogData.images["sh0_0"].get(), sogData);
+    }
+    splat::selectSplatIndices(indices, importance, (int)numSplats, vOffset, vCount);
+
     // Create data arrays from loaded images
-    size_t count = sogData.count; if (!count) return NULL;
+    size_t count = indices.size(); if (!count) return NULL;
     osg::ref_ptr<osg::Vec3Array> pos = new osg::Vec3Array(count), scale = new osg::Vec3Array(count);
     osg::ref_ptr<osg::Vec4Array> rot = new osg::Vec4Array(count); osg::ref_ptr<osg::FloatArray> alpha = new osg::FloatArray(count);
     osg::ref_ptr<osg::Vec4Array> rD0 = new osg::Vec4Array(count), gD0 = new osg::Vec4Array(count), bD0 = new osg::Vec4Array(count);
-    createSogPositions(*pos, sogData.images["means_0"].get(), sogData.images["means_1"].get(), sogData.meansMin, sogData.meansMax);
-    createSogScales(*scale, sogData.images["scales_0"].get(), sogData.scaleCode, sogData.scalesMin, sogData.scalesMax);
-    createSogRotations(*rot, sogData.images["quats_0"].get());
-    createSogColors0(*rD0, *gD0, *bD0, *alpha, sogData.images["sh0_0"].get(), sogData.sh0Code, sogData.sh0Min, sogData.sh0Max);
+    createSogPositions(*pos, sogData.images["means_0"].get(), sogData.images["means_1"].get(), indices,
+                       sogData.meansMin, sogData.meansMax);
+    createSogScales(*scale, sogData.images["scales_0"].get(), indices, sogData.scaleCode, sogData.scalesMin, sogData.scalesMax);
+    createSogRotations(*rot, sogData.images["quats_0"].get(), indices);
+    createSogColors0(*rD0, *gD0, *bD0, *alpha, sogData.images["sh0_0"].get(), indices,
+                     sogData.sh0Code, sogData.sh0Min, sogData.sh0Max);
 
 #if true
     osg::ref_ptr<osgVerse::GaussianGeometry> geom = new osgVerse::GaussianGeometry(rm);
@@ -398,13 +479,13 @@ osg::ref_ptr<osg::Node> loadSplatFromSOG(std::istream& in, const std::string& pa
                                      rD2 = new osg::Vec4Array(count), gD2 = new osg::Vec4Array(count), bD2 = new osg::Vec4Array(count),
                                      rD3 = new osg::Vec4Array(count), gD3 = new osg::Vec4Array(count), bD3 = new osg::Vec4Array(count);
         createSogColorsN(*rD0, *gD0, *bD0, *rD1, *gD1, *bD1, *rD2, *gD2, *bD2, *rD3, *gD3, *bD3,
-                         sogData.images["shN_0"].get(), sogData.images["shN_1"].get(), sogData.shNCode,
+                         sogData.images["shN_0"].get(), sogData.images["shN_1"].get(), indices, sogData.shNCode,
                          sogData.shNMin, sogData.shNMax, sogData.numDegrees, sogData.numEntries);
         geom->setShRed(1, rD1.get()); geom->setShGreen(1, gD1.get()); geom->setShBlue(1, bD1.get());
         geom->setShRed(2, rD2.get()); geom->setShGreen(2, gD2.get()); geom->setShBlue(2, bD2.get());
         geom->setShRed(3, rD3.get()); geom->setShGreen(3, gD3.get()); geom->setShBlue(3, bD3.get());
     }
-    geom->finalize(vOffset, vCount);
+    geom->finalize();  // range already applied while decoding
 #else
     osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
     geom->setVertexArray(pos.get());
@@ -0,0 +1,11 @@
+#pragma once
+#include <vector>
+
+namespace splat
+{
+    /** Select splats in [vOffset, vOffset + vCount) for decoding. If importance values are provided, the range
+        is taken from splats sorted by importance (descending), so that offset 0 with count N returns the N most
+        visible splats and offset N with count 0 returns the rest; selected indices are kept in file order */
+    void selectSplatIndices(std::vector<int>& indices, const std::vector<float>& importance,
+                            int numSplats, int vOffset, int vCount);
+}
@@ -14,6 +14,7 @@
 #include "3rdparty/picojson.h"
 #include "pipeline/Global.h"
 #include "readerwriter/Utilities.h"
+#include "modeling/Profiler.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -100,6 +101,7 @@ public:
 
     virtual ReadResult readNode(std::istream& fin, const osgDB::Options* options) const
     {
+        VERSE_PROFILE_ZONE_CATEGORY("ReaderWriter3dTiles::readNode", "loader");
         std::string ext = options ? options->getPluginStringData("extension") : "";
         std::string prefix = options ? options->getPluginStringData("prefix") : "";
         if (ext == "xml")
@@ -9,6 +9,7 @@
 
 #include "readerwriter/LoadSceneGLTF.h"
 #include "readerwriter/SaveSceneGLTF.h"
+#include "modeling/Profiler.h"
 #include "3rdparty/picojson.h"
 
 class ReaderWriterGLTF : public osgDB::ReaderWriter
@@ -28,6 +29,8 @@ public:
         supportsOption("DisabledPBR", "Use PBR materials or not");
         supportsOption("ForcedPBR", "Force using PBR materials or not");
         supportsOption("UpAxis", "Set up axis to Y (0) or Z (1) (default = 0)");
+        supportsOption("ParallelLoading", "Decode images and build mesh primitives concurrently, "
+                       "and report per-phase timings (default = 0)");
         supportsOption("WriteImageHint=<hint>", "Export option: Hint of writing image to stream: "
                        "<IncludeData> writes Image::data() directly; "
                        "<IncludeFile> writes the image file itself to stream; "
@@ -46,6 +49,7 @@ public:
         int noPBR = options ? atoi(options->getPluginStringData("DisabledPBR").c_str()) : 0;
         int forcedPBR = options ? atoi(options->getPluginStringData("ForcedPBR").c_str()) : 0;
         int yUp = options ? atoi(options->getPluginStringData("UpAxis").c_str()) : 0;
+        bool parallel = options ? atoi(options->getPluginStringData("ParallelLoading").c_str()) > 0 : false;
         
         osg::ref_ptr<osg::Node> group;
         if (ext == "cmpt")
@@ -59,16 +63,19 @@ public:
             group = readCesiumFormatPnts(fin, osgDB::getFilePath(fileName));
         }
         else if (ext == "glb" || ext == "b3dm" || ext == "i3dm")
-            group = osgVerse::loadGltf(fileName, true, (noPBR == 1) ? 0 : (forcedPBR == 0 ? 1 : 2), yUp == 0).get();
+            group = osgVerse::loadGltf(fileName, true, (noPBR == 1) ? 0 : (forcedPBR == 0 ? 1 : 2),
+                                       yUp == 0, parallel).get();
         else
-            group = osgVerse::loadGltf(fileName, false, (noPBR == 1) ? 0 : (forcedPBR == 0 ? 1 : 2), yUp == 0).get();
+            group = osgVerse::loadGltf(fileName, false, (noPBR == 1) ? 0 : (forcedPBR == 0 ? 1 : 2),
+                                       yUp == 0, parallel).get();
         if (!group) OSG_WARN << "[ReaderWriterGLTF] Failed to load " << fileName << std::endl;
         return group.get();
     }
 
     virtual ReadResult readNode(std::istream& fin, const osgDB::Options* options) const
     {
-        std::string dir = "", mode; bool isBinary = false, yUp = true; int pbrMode = 1;
+        VERSE_PROFILE_ZONE_CATEGORY("ReaderWriterGLTF::readNode", "loader");
+        std::string dir = "", mode; bool isBinary = false, yUp = true, parallel = false; int pbrMode = 1;
         if (options)
         {
             std::string fileName = options->getPluginStringData("filename");
@@ -90,6 +97,7 @@ public:
             int noPBR = atoi(options->getPluginStringData("DisabledPBR").c_str());
             int forcedPBR = atoi(options->getPluginStringData("ForcedPBR").c_str());
             pbrMode = (noPBR == 1) ? 0 : (forcedPBR == 0 ? 1 : 2);
+            parallel = atoi(options->getPluginStringData("ParallelLoading").c_str()) > 0;
             mode = options->getPluginStringData("Mode");
             std::transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
             if (mode == "binary") isBinary = true;
@@ -97,7 +105,7 @@ public:
 
         if (dir.empty() && options && !options->getDatabasePathList().empty())
             dir = options->getDatabasePathList().front();
-        return osgVerse::loadGltf2(fin, dir, isBinary, pbrMode, yUp).get();
+        return osgVerse::loadGltf2(fin, dir, isBinary, pbrMode, yUp, parallel).get();
     }
 
     virtual WriteResult writeNode(const osg::Node& node, const std::string& path, const osgDB::Options* options) const
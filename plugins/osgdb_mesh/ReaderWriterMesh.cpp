@@ -14,6 +14,7 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "3rdparty/tiny_obj_loader.h"
 #include "modeling/Utilities.h"
+#include "modeling/Profiler.h"
 #include <unordered_map>
 
 extern osg::Node* readMeshScenePLY(std::istream& fin, const std::string& dir, const osgDB::Options* options);
@@ -56,6 +57,7 @@ public:
 
     virtual ReadResult readNode(std::istream& fin, const Options* options) const
     {
+        VERSE_PROFILE_ZONE_CATEGORY("ReaderWriterMesh::readNode", "loader");
         std::string filename, dir("."), ext("obj");
         if (options)
         {
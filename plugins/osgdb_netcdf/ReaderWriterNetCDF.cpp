@@ -2,12 +2,16 @@
 #include <osg/Geometry>
 #include <osg/ImageSequence>
 #include <osg/PagedLOD>
+#include <osg/ValueObject>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
 
 #include "animation/ParticleEngine.h"
+#include "readerwriter/Utilities.h"
 #include <limits.h>
+#include <float.h>
+#include <sstream>
 #include <netcdf.h>
 #include <netcdf_mem.h>
 
@@ -50,11 +54,18 @@ public:
         supportsExtension("nc4", "CDF4 data file");
         supportsExtension("hdf5", "HDF5 data file");
         supportsExtension("h5", "HDF5 data file");
+        supportsExtension("netcdf_brick", "Helper extension to load a volume brick on demand");
 
         supportsOption("DimResolutionY", "Save image Y data index: default=0");
         supportsOption("DimResolutionX", "Save image X data index: default=1");
         supportsOption("DimComponents", "Save image component data index: default=2");
         supportsOption("Normalized", "Save image data and normalize every value to 0-255: default=false");
+        supportsOption("Variable", "Read only the variable of given name: default=all (image), first 3D one (bricks)");
+        supportsOption("TimeStep", "Time step index of time / unlimited dimension to read: default=0");
+        supportsOption("Level", "Fix the vertical dimension (level/depth/height) at given index: default=-1 (unused)");
+        supportsOption("BrickSize", "Read node as paged octree of 3D bricks with given size: default=0 (disabled)");
+        supportsOption("BrickRangeFactor", "Distance to switch to child bricks, multiplied with radius: default=4");
+        supportsOption("BrickSampleStep", "Voxel step to compute brick value ranges, only 1 skips empty bricks: default=1");
     }
 
     virtual const char* className() const
@@ -67,9 +78,26 @@ public:
         if (!in) return ReadResult::FILE_NOT_HANDLED; return readObject(in, options);
     }
 
+    virtual ReadResult readNode(const std::string& path, const Options* options) const
+    {
+        std::string fileName, ext; fileName = getRealFileName(path, ext);
+        if (fileName.empty()) return ReadResult::FILE_NOT_HANDLED;
+        if (ext == "netcdf_brick") return loadBrick(fileName, options);
+
+        int brickSize = options ? atoi(options->getPluginStringData("BrickSize").c_str()) : 0;
+        if (brickSize > 0) return createBrickHierarchy(fileName, brickSize, options);
+        return ReadResult::FILE_NOT_HANDLED;
+    }
+
     virtual ReadResult readImage(const std::string& path, const Options* options) const
     {
         std::string fileName, ext; fileName = getRealFileName(path, ext);
+        if (options && (!options->getPluginStringData("Variable").empty() ||
+            !options->getPluginStringData("TimeStep").empty() || !options->getPluginStringData("Level").empty()))
+        {   // Read selected slice directly from file, without loading the whole file into memory
+            return loadSelectedImage(fileName, options);
+        }
+
         std::ifstream in(fileName, std::ios::in | std::ios::binary);
         if (!in) return ReadResult::FILE_NOT_HANDLED; return readImage(in, options);
     }
@@ -105,6 +133,260 @@ protected:
         return fileName;
     }
 
+    /** Hyperslab of a variable: X/Y/Z dimensions and fixed indices of the others (time, level, ...) */
+    struct VolumeSelection
+    {
+        std::vector<size_t> start, count, dimLength;
+        std::vector<ptrdiff_t> stride;
+        int varId, axis[3];  // dimension indices of X, Y, Z (-1 if not exists)
+        VolumeSelection() : varId(-1) { axis[0] = axis[1] = axis[2] = -1; }
+
+        size_t size(int a) const { return axis[a] < 0 ? 1 : dimLength[axis[a]]; }
+        void setRange(int a, size_t s, size_t c, ptrdiff_t st = 1)
+        { if (axis[a] >= 0) { start[axis[a]] = s; count[axis[a]] = c; stride[axis[a]] = st; } }
+    };
+
+    static bool isTimeDimension(const std::string& name, bool unlimited)
+    {
+        std::string n(name); std::transform(n.begin(), n.end(), n.begin(), tolower);
+        return unlimited || n == "time" || n == "t" || n == "times";
+    }
+
+    static bool isLevelDimension(const std::string& name)
+    {
+        std::string n(name); std::transform(n.begin(), n.end(), n.begin(), tolower);
+        return n == "level" || n == "lev" || n == "plev" || n == "depth" || n == "height" || n == "z";
+    }
+
+    /** Select the named variable (at least 2D), or the first variable with at least 3 dimensions if
+        no name is given. In the latter case, a variable with level dimension is required if Level is set,
+        so that 2D coordinate variables like lat/lon bounds are never picked */
+    bool selectVolume(int ncid, const std::string& varName, int timeStep, int level,
+                      VolumeSelection& sel) const
+    {
+        int nvars = 0, unlimdimid = -1; nc_inq_nvars(ncid, &nvars); nc_inq_unlimdim(ncid, &unlimdimid);
+        for (int i = 0; i < nvars; i++)
+        {
+            char name[NC_MAX_NAME + 1]; int varndims = 0, vardimids[NC_MAX_VAR_DIMS];
+            if (nc_inq_var(ncid, i, name, NULL, &varndims, vardimids, NULL) != 0) continue;
+            if (!varName.empty() && varName != name) continue;
+            if (varndims < (varName.empty() ? 3 : 2)) continue;
+
+            sel = VolumeSelection(); sel.varId = i; bool hasLevel = false;
+            sel.start.resize(varndims, 0); sel.count.resize(varndims, 1);
+            sel.stride.resize(varndims, 1); sel.dimLength.resize(varndims, 1);
+            for (int j = varndims - 1, a = 0; j >= 0; --j)
+            {
+                char dimName[NC_MAX_NAME + 1]; nc_inq_dim(ncid, vardimids[j], dimName, &sel.dimLength[j]);
+                if (isTimeDimension(dimName, vardimids[j] == unlimdimid))
+                    sel.start[j] = osg::minimum((size_t)osg::maximum(timeStep, 0), sel.dimLength[j] - 1);
+                else if (level >= 0 && isLevelDimension(dimName))
+                    { sel.start[j] = osg::minimum((size_t)level, sel.dimLength[j] - 1); hasLevel = true; }
+                else if (a < 3)
+                    { sel.axis[a++] = j; sel.count[j] = sel.dimLength[j]; }
+            }
+            if (varName.empty() && level >= 0 && !hasLevel) continue;
+            if (sel.axis[1] >= 0) return true;  // at least 2D
+        }
+        return false;
+    }
+
+    static void getSelectionOptions(const Options* options, std::string& varName, int& timeStep, int& level)
+    {
+        varName = options ? options->getPluginStringData("Variable") : "";
+        std::string t = options ? options->getPluginStringData("TimeStep") : "";
+        std::string l = options ? options->getPluginStringData("Level") : "";
+        timeStep = t.empty() ? 0 : atoi(t.c_str()); level = l.empty() ? -1 : atoi(l.c_str());
+    }
+
+    static float getFillValue(int ncid, int varId)
+    {
+        float fillValue = NC_FILL_FLOAT;
+        if (nc_get_att_float(ncid, varId, "_FillValue", &fillValue) != 0)
+            nc_get_att_float(ncid, varId, "missing_value", &fillValue);
+        return fillValue;
+    }
+
+    ReadResult loadSelectedImage(const std::string& fileName, const Options* options) const
+    {
+        std::string varName; int timeStep = 0, level = -1, ncid = 0;
+        getSelectionOptions(options, varName, timeStep, level);
+        int status = nc_open(fileName.c_str(), NC_NOWRITE, &ncid);
+        if (status != 0)
+        {
+            OSG_WARN << "[ReaderWriterNetCDF] Failed to open: " << nc_strerror(status)
+                     << std::endl; return ReadResult::FILE_NOT_FOUND;
+        }
+
+        VolumeSelection sel; osg::ref_ptr<osg::Image> image;
+        if (selectVolume(ncid, varName, timeStep, level, sel))
+        {
+            char name[NC_MAX_NAME + 1]; nc_inq_varname(ncid, sel.varId, name);
+            image = new osg::Image; image->setName(name);
+            image->allocateImage(sel.size(0), sel.size(1), sel.size(2), GL_LUMINANCE, GL_FLOAT);
+            image->setInternalTextureFormat(GL_LUMINANCE32F_ARB);
+            status = nc_get_vara_float(ncid, sel.varId, sel.start.data(), sel.count.data(), (float*)image->data());
+            if (status != 0)
+            {
+                OSG_WARN << "[ReaderWriterNetCDF] Failed to load data: "
+                         << nc_strerror(status) << std::endl; image = NULL;
+            }
+        }
+        else
+            OSG_WARN << "[ReaderWriterNetCDF] Variable not found or less than 2D: "
+                     << (varName.empty() ? "<first 3D variable>" : varName) << std::endl;
+        nc_close(ncid);
+        return image.valid() ? ReadResult(image.get()) : ReadResult::ERROR_IN_READING_FILE;
+    }
+
+    /** Read one brick hyperslab (with 1 voxel border on the max side for seamless sampling).
+        Coarse bricks of upper levels read every (stride)th voxel on each axis */
+    osg::Image* readBrickImage(int ncid, VolumeSelection& sel, const osg::Vec3i& origin,
+                               const osg::Vec3i& dim, int stride) const
+    {
+        for (int a = 0; a < 3; ++a) sel.setRange(a, origin[a], dim[a], stride);
+        osg::ref_ptr<osg::Image> image = new osg::Image;
+        image->allocateImage(dim[0], dim[1], dim[2], GL_LUMINANCE, GL_FLOAT);
+        image->setInternalTextureFormat(GL_LUMINANCE32F_ARB);
+
+        float* ptr = (float*)image->data();
+        int status = nc_get_vars_float(ncid, sel.varId, sel.start.data(), sel.count.data(),
+                                       sel.stride.data(), ptr);
+        for (int a = 0; a < 3; ++a) sel.setRange(a, origin[a], dim[a]);
+        if (status != 0)
+        {
+            OSG_WARN << "[ReaderWriterNetCDF] Failed to load brick: "
+                     << nc_strerror(status) << std::endl; return NULL;
+        }
+        return image.release();
+    }
+
+    /** Compute value range of a brick (with its border) from every (step)th voxel on each axis, without
+        keeping the data. It is exact only if step is 1, otherwise only an estimate */
+    bool sampleBrickRange(int ncid, VolumeSelection& sel, const size_t origin[3], const size_t dim[3], int step,
+                          float fillValue, float& minValue, float& maxValue, std::vector<float>& buffer) const
+    {
+        size_t sampleDim[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            sampleDim[a] = (dim[a] + step - 1) / step;
+            sel.setRange(a, origin[a], sampleDim[a], step);
+        }
+
+        buffer.resize(sampleDim[0] * sampleDim[1] * sampleDim[2]);
+        int status = nc_get_vars_float(ncid, sel.varId, sel.start.data(), sel.count.data(),
+                                       sel.stride.data(), buffer.data());
+        for (int a = 0; a < 3; ++a) sel.setRange(a, origin[a], dim[a]);
+        if (status != 0)
+        {
+            OSG_WARN << "[ReaderWriterNetCDF] Failed to sample brick: "
+                     << nc_strerror(status) << std::endl; return false;
+        }
+        computeRange(buffer.data(), buffer.size(), fillValue, minValue, maxValue);
+        return true;
+    }
+
+    static void computeRange(const float* ptr, size_t numVoxels, float fillValue, float& minValue, float& maxValue)
+    {
+        minValue = FLT_MAX; maxValue = -FLT_MAX;
+        for (size_t i = 0; i < numVoxels; ++i)
+        {
+            float v = ptr[i]; if (v != v || v == fillValue) continue;
+            if (v < minValue) minValue = v; if (v > maxValue) maxValue = v;
+        }
+    }
+
+    /** Create an octree of paged bricks of selected variable, upper levels being downsampled bricks.
+        Value range of each brick is computed from its voxels (with border) read every BrickSampleStep.
+        Only an exact scan (step = 1) may skip empty bricks; a sampled range is an estimate and never
+        used to discard a brick */
+    ReadResult createBrickHierarchy(const std::string& fileName, int brickSize, const Options* options) const
+    {
+        std::string varName; int timeStep = 0, level = -1, ncid = 0;
+        getSelectionOptions(options, varName, timeStep, level);
+        std::string rangeStr = options->getPluginStringData("BrickRangeFactor");
+        float rangeFactor = rangeStr.empty() ? 4.0f : (float)atof(rangeStr.c_str());
+        std::string stepStr = options->getPluginStringData("BrickSampleStep");
+        int sampleStep = osg::clampBetween(stepStr.empty() ? 1 : atoi(stepStr.c_str()), 1, brickSize);
+
+        int status = nc_open(fileName.c_str(), NC_NOWRITE, &ncid);
+        if (status != 0)
+        {
+            OSG_WARN << "[ReaderWriterNetCDF] Failed to open: " << nc_strerror(status)
+                     << std::endl; return ReadResult::FILE_NOT_FOUND;
+        }
+
+        VolumeSelection sel;
+        if (!selectVolume(ncid, varName, timeStep, level, sel))
+        {
+            OSG_WARN << "[ReaderWriterNetCDF] No volume variable found: " << varName << std::endl;
+            nc_close(ncid); return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        char name[NC_MAX_NAME + 1]; nc_inq_varname(ncid, sel.varId, name); varName = name;
+        float fillValue = getFillValue(ncid, sel.varId);
+        size_t total[3] = { sel.size(0), sel.size(1), sel.size(2) }, numEmpty = 0;
+        std::vector<float> sampleBuffer;
+
+        osg::ref_ptr<osgVerse::VolumeBrickIndex> index = new osgVerse::VolumeBrickIndex(
+            osg::Vec3i(total[0], total[1], total[2]), brickSize, rangeFactor);
+        for (size_t z = 0; z < total[2]; z += brickSize)
+            for (size_t y = 0; y < total[1]; y += brickSize)
+                for (size_t x = 0; x < total[0]; x += brickSize)
+                {
+                    size_t origin[3] = { x, y, z }, dim[3];
+                    for (int a = 0; a < 3; ++a) dim[a] = osg::minimum((size_t)brickSize + 1, total[a] - origin[a]);
+
+                    float minV = 0.0f, maxV = 0.0f;
+                    if (!sampleBrickRange(ncid, sel, origin, dim, sampleStep, fillValue, minV, maxV, sampleBuffer))
+                        { nc_close(ncid); return ReadResult::ERROR_IN_READING_FILE; }
+                    if (minV > maxV && sampleStep == 1) { numEmpty++; continue; }  // empty-space skipping
+                    index->addBrick(osg::Vec3i(x / brickSize, y / brickSize, z / brickSize), minV, maxV);
+                }
+        nc_close(ncid);
+
+        std::stringstream ss; ss << osgDB::getSimpleFileName(fileName) << "_" << varName << "_t"
+                                 << timeStep << "_l" << level;
+        index->buildLevels(); index->setFileNames(ss.str(), "netcdf_brick");
+        osg::ref_ptr<osgDB::Options> brickOpt = options->cloneOptions();
+        brickOpt->setPluginStringData("BrickSource", fileName);
+        brickOpt->setPluginStringData("Variable", varName);
+
+        osg::ref_ptr<osg::Group> root = index->createRootNode(brickOpt.get()); root->setName(varName);
+        OSG_NOTICE << "[ReaderWriterNetCDF] " << varName << ": " << total[0] << "x" << total[1] << "x"
+                   << total[2] << ", " << index->getNumBricks(0) << " bricks in " << index->getNumLevels()
+                   << " levels created, " << numEmpty << " empty bricks skipped" << std::endl;
+        return root.get();
+    }
+
+    ReadResult loadBrick(const std::string& brickName, const Options* options) const
+    {
+        osg::Vec4i key; osgVerse::VolumeBrickIndex* index = osgVerse::VolumeBrickIndex::getFromOptions(options, key);
+        std::string fileName = options ? options->getPluginStringData("BrickSource") : "";
+        if (!index || fileName.empty())
+        { OSG_WARN << "[ReaderWriterNetCDF] Invalid brick: " << brickName << std::endl; return ReadResult::FILE_NOT_HANDLED; }
+        if (osgVerse::VolumeBrickIndex::isChildrenFile(brickName)) return index->createChildNodes(key, options);
+
+        std::string varName; int timeStep = 0, level = -1, ncid = 0, stride = 1;
+        getSelectionOptions(options, varName, timeStep, level);
+        osg::Vec3i v0, v1, dim = index->getBrickImageSize(key); index->getBrickExtent(key, v0, v1, stride);
+
+        int status = nc_open(fileName.c_str(), NC_NOWRITE, &ncid);
+        if (status != 0)
+        {
+            OSG_WARN << "[ReaderWriterNetCDF] Failed to open: " << nc_strerror(status)
+                     << std::endl; return ReadResult::FILE_NOT_FOUND;
+        }
+
+        VolumeSelection sel; osg::ref_ptr<osg::Image> image; float fillValue = 0.0f;
+        if (selectVolume(ncid, varName, timeStep, level, sel))
+        { image = readBrickImage(ncid, sel, v0, dim, stride); fillValue = getFillValue(ncid, sel.varId); }
+        nc_close(ncid); if (!image) return ReadResult::ERROR_IN_READING_FILE;
+
+        image->setName(brickName);
+        return index->createBrickGeode(key, image.get(), fillValue);
+    }
+
     ReadResult loadFromStream(const std::string& buffer, const Options* options, int type) const
     {
         int idX = 1, idY = 0, idComp = 2; bool normalized = false;
@@ -5,7 +5,11 @@
 #include <osg/Geometry>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
 #include <osgDB/Registry>
+#include <osg/PagedLOD>
+#include <osg/Timer>
 #include <osgUtil/Tessellator>
 
 #include <pipeline/Drawer2D.h>
@@ -17,7 +21,27 @@
 #include <osmium/osm/relation.hpp>
 #include <osmium/memory/buffer.hpp>
 #include <osmium/index/map/flex_mem.hpp>
+#include <osmium/index/map/sparse_mem_array.hpp>
+#include <osmium/index/map/dense_file_array.hpp>
+#include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/thread/pool.hpp>
+#include <fcntl.h>
+#include <fstream>
 #include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <map>
+#include <set>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#ifdef _WIN32
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
 
 class ReaderWriterOSM : public osgDB::ReaderWriter
 {
@@ -38,6 +62,15 @@ public:
         supportsOption("ImageHeight", "Image resolution. Default: 512");
         supportsOption("FilterKey", "Filter objects by key");
         supportsOption("FilterValue", "Filter objects by value (used with FilterKey)");
+        supportsOption("StreamingZoom", "Enable streaming mode and write web-mercator tiles at this zoom level (1-22). "
+                                        "Only ways are written, relations are counted but ignored. Default: 0");
+        supportsOption("StreamingMinZoom", "Lowest level of the tile pyramid with simplified features. Default: StreamingZoom - 6");
+        supportsOption("StreamingOutput", "Output directory of streaming tiles. Default: <file>_tiles");
+        supportsOption("StreamingIndexFile", "On-disk node location index (dense). Default: <output>/nodes.idx for "
+                                             "inputs larger than 256MB, otherwise in-memory sparse index");
+        supportsOption("StreamingThreads", "Number of decoding threads of the osmium reader. Default: all cores but one");
+        supportsOption("StreamingBufferMB", "Max buffered tile data before flushing to disk. Default: 256");
+        supportsOption("StreamingTileRange", "Paged range of each tile, multiplied with its radius. Default: 6");
     }
 
     virtual const char* className() const
@@ -67,6 +100,17 @@ public:
         std::string ext; std::string fileName = getRealFileName(path, ext);
         if (fileName.empty()) return ReadResult::FILE_NOT_HANDLED;
 
+        int streamingZoom = options ? atoi(options->getPluginStringData("StreamingZoom").c_str()) : 0;
+        if (streamingZoom > 0)
+        {
+            try { return streamOSMDataToTiles(fileName, osg::clampBetween(streamingZoom, 1, 22), options); }
+            catch (const std::exception& e)
+            {
+                OSG_WARN << "[ReaderWriterOSM] Error streaming OSM data to tiles: " << e.what() << std::endl;
+                return ReadResult::ERROR_IN_READING_FILE;
+            }
+        }
+
         try
         {
             osg::ref_ptr<osgVerse::FeatureCollection> fc = parseOSMData(fileName, options);
@@ -139,6 +183,25 @@ public:
     }
 
 protected:
+    static std::string getGeometryType(const osmium::Way& way)
+    {
+        const osmium::TagList& tags = way.tags();
+
+        // Check for area/polygon indicators
+        if (const char* area = tags["area"])
+        { if (std::string(area) == "yes") return "polygon"; }
+
+        // Check for common polygon tags
+        static const char* polygonTags[] = {
+            "building", "landuse", "natural", "waterway", "amenity",
+            "leisure", "tourism", "shop", "office", "craft",
+            "historic", "military", "aeroway", "boundary", "place"
+        };
+
+        for (const char* tag : polygonTags) { if (tags[tag]) return "polygon"; }
+        return "line";
+    }
+
     /** OSM data handler using libosmium */
     class OSMDataHandler : public osmium::handler::Handler
     {
@@ -226,34 +289,398 @@ protected:
             }
         }
 
-        std::string getGeometryType(const osmium::Way& way) const
+        using IndexType = osmium::index::map::FlexMem<osmium::unsigned_object_id_type, osmium::Location>;
+        IndexType _locations;
+
+        osgVerse::FeatureCollection* _fc;
+        //osg::ref_ptr<osgVerse::Feature> _points;
+        std::string _filterKey;
+        std::string _filterValue;
+    };
+
+    /** Streaming handler: writes ways into per-tile bucket files with bounded memory.
+        Node locations are filled by NodeLocationsForWays before way() is called */
+    class OSMTileBucketHandler : public osmium::handler::Handler
+    {
+    public:
+        OSMTileBucketHandler(const std::string& outDir, int zoom, size_t maxBufferBytes,
+                             const std::string& filterKey, const std::string& filterValue)
+        :   _outDir(outDir), _filterKey(filterKey), _filterValue(filterValue),
+            _maxBufferBytes(maxBufferBytes), _bufferedBytes(0), _zoom(zoom),
+            _numNodes(0), _numWays(0), _numRelations(0), _numDropped(0) {}
+
+        void node(const osmium::Node&) { _numNodes++; }
+        void relation(const osmium::Relation&) { _numRelations++; }
+
+        void way(const osmium::Way& way)
         {
+            _numWays++; if (!passesFilter(way)) return;
+            std::vector<osg::Vec3> points; osg::BoundingBox bb;
+            for (const auto& nodeRef : way.nodes())
+            {
+                const osmium::Location& loc = nodeRef.location();
+                if (!loc.valid()) continue;
+                points.push_back(osg::Vec3(loc.lat(), loc.lon(), 0.0f));
+                bb.expandBy(points.back());
+            }
+            if (points.empty()) { _numDropped++; return; }
+
+            // Encode once, then copy into every tile the way overlaps, so that features crossing
+            // tile borders are complete in all neighbouring tiles
+            std::string data; GLenum type = (getGeometryType(way) == "polygon") ? GL_POLYGON : GL_LINE_STRIP;
+            writeFeatureHead(data, type, way.id(), points);
+
             const osmium::TagList& tags = way.tags();
+            writeValue(data, (unsigned int)tags.size());
+            for (const auto& tag : tags) { writeString(data, tag.key()); writeString(data, tag.value()); }
+
+            int x0 = 0, y0 = 0, x1 = 0, y1 = 0; getTileRange(bb, _zoom, x0, y0, x1, y1);
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                { _buckets[std::pair<int, int>(x, y)].append(data); _bufferedBytes += data.size(); }
+            if (_bufferedBytes > _maxBufferBytes) flush();
+        }
 
-            // Check for area/polygon indicators
-            if (const char* area = tags["area"])
-            { if (std::string(area) == "yes") return "polygon"; }
+        /** Append all buffered data to bucket files and release memory. Bucket files left by
+            previous runs are truncated at the first write */
+        void flush()
+        {
+            for (std::map<std::pair<int, int>, std::string>::iterator itr = _buckets.begin();
+                 itr != _buckets.end(); ++itr)
+            {
+                if (itr->second.empty()) continue;
+                bool appending = _writtenTiles.find(itr->first) != _writtenTiles.end();
+                std::ofstream out(getBucketFile(_zoom, itr->first.first, itr->first.second).c_str(),
+                                  std::ios::out | std::ios::binary | (appending ? std::ios::app : std::ios::trunc));
+                out.write(itr->second.data(), itr->second.size());
+                _writtenTiles.insert(itr->first); std::string().swap(itr->second);
+            }
+            _buckets.clear(); _bufferedBytes = 0;
+        }
 
-            // Check for common polygon tags
-            static const char* polygonTags[] = {
-                "building", "landuse", "natural", "waterway", "amenity",
-                "leisure", "tourism", "shop", "office", "craft",
-                "historic", "military", "aeroway", "boundary", "place"
-            };
+        /** Read a bucket file back as feature collection */
+        static osgVerse::FeatureCollection* readBucket(const std::string& bucketFile)
+        {
+            std::ifstream in(bucketFile.c_str(), std::ios::in | std::ios::binary);
+            if (!in) return NULL;
 
-            for (const char* tag : polygonTags) { if (tags[tag]) return "polygon"; }
-            return "line";
+            osg::ref_ptr<osgVerse::FeatureCollection> fc = new osgVerse::FeatureCollection;
+            unsigned int type = 0, numPoints = 0, numTags = 0; osmium::object_id_type id = 0;
+            while (in.read((char*)&type, sizeof(unsigned int)))
+            {
+                in.read((char*)&id, sizeof(osmium::object_id_type));
+                in.read((char*)&numPoints, sizeof(unsigned int));
+                if (!in || !numPoints) break;
+                osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(numPoints);
+                in.read((char*)&(*va)[0], numPoints * sizeof(osg::Vec3));
+
+                // "osm_id" keeps the type of the non-streaming reader, "osm_id64" is the full ID
+                osg::ref_ptr<osgVerse::Feature> feature = new osgVerse::Feature((GLenum)type);
+                feature->addPoints(va.get()); feature->setUserValue("osm_id", (unsigned int)id);
+                feature->setUserValue("osm_id64", std::to_string((long long)id));
+                in.read((char*)&numTags, sizeof(unsigned int));
+                for (unsigned int i = 0; i < numTags; ++i)
+                {
+                    std::string key = readString(in), value = readString(in);
+                    feature->setUserValue(std::string("tag_") + key, value);
+                }
+                if (!in) break; fc->push_back(feature.get());
+            }
+            return fc.release();
         }
 
-        using IndexType = osmium::index::map::FlexMem<osmium::unsigned_object_id_type, osmium::Location>;
-        IndexType _locations;
+        std::string getBucketFile(int z, int x, int y) const
+        {
+            std::stringstream ss; ss << _outDir << "/" << z << "_" << x << "_" << y << ".bucket";
+            return ss.str();
+        }
 
-        osgVerse::FeatureCollection* _fc;
-        //osg::ref_ptr<osgVerse::Feature> _points;
-        std::string _filterKey;
-        std::string _filterValue;
+        /** Append a simplified copy of the feature (without tags) to the buffer, for the level
+            whose pixel size (in degrees) is given. Return false if it is too small to be seen */
+        static bool writeReducedFeature(std::string& buffer, const osgVerse::Feature& f, double pixelSize)
+        {
+            const osg::BoundingBox& bb = f.getBound(); const osg::Vec3Array* va = f.getPoints(0);
+            if (!va || va->empty() || osg::maximum(bb.xMax() - bb.xMin(), bb.yMax() - bb.yMin()) < pixelSize)
+                return false;
+
+            std::vector<osg::Vec3> points(1, va->front()); double pixelSize2 = pixelSize * pixelSize;
+            for (size_t i = 1; i < va->size() - 1; ++i)
+            { if (((*va)[i] - points.back()).length2() >= pixelSize2) points.push_back((*va)[i]); }
+            if (va->size() > 1) points.push_back(va->back());
+            if (points.size() < (f.getType() == GL_POLYGON ? 3u : 2u)) return false;
+
+            long long id = 0; std::string idString;
+            if (f.getUserValue("osm_id64", idString)) id = atoll(idString.c_str());
+            writeFeatureHead(buffer, f.getType(), (osmium::object_id_type)id, points);
+            writeValue(buffer, (unsigned int)0); return true;
+        }
+
+        static void latLonToTile(double lat, double lon, int zoom, int& x, int& y)
+        {
+            double n = (double)(1 << zoom), latR = osg::DegreesToRadians(osg::clampBetween(lat, -85.0511, 85.0511));
+            x = osg::clampBetween((int)floor((lon + 180.0) / 360.0 * n), 0, (int)n - 1);
+            y = osg::clampBetween((int)floor((1.0 - asinh(tan(latR)) / osg::PI) * 0.5 * n), 0, (int)n - 1);
+        }
+
+        /** Tiles overlapped by a (lat, lon) bounding box, y of tiles grows southwards */
+        static void getTileRange(const osg::BoundingBox& bb, int zoom, int& x0, int& y0, int& x1, int& y1)
+        {
+            latLonToTile(bb.xMax(), bb.yMin(), zoom, x0, y0);
+            latLonToTile(bb.xMin(), bb.yMax(), zoom, x1, y1);
+        }
+
+        const std::set<std::pair<int, int>>& getWrittenTiles() const { return _writtenTiles; }
+        size_t numNodes() const { return _numNodes; }
+        size_t numWays() const { return _numWays; }
+        size_t numRelations() const { return _numRelations; }
+        size_t numDropped() const { return _numDropped; }
+
+    protected:
+        template <typename T> bool passesFilter(const T& obj) const
+        {
+            if (_filterKey.empty()) return true;
+            const char* value = obj.tags()[_filterKey.c_str()];
+            if (!value) return false;
+            return _filterValue.empty() || _filterValue == value;
+        }
+
+        template <typename T> static void writeValue(std::string& buffer, T v)
+        { buffer.append((const char*)&v, sizeof(T)); }
+
+        static void writeFeatureHead(std::string& buffer, GLenum type, osmium::object_id_type id,
+                                     const std::vector<osg::Vec3>& points)
+        {
+            writeValue(buffer, (unsigned int)type); writeValue(buffer, id);
+            writeValue(buffer, (unsigned int)points.size());
+            buffer.append((const char*)&points[0], points.size() * sizeof(osg::Vec3));
+        }
+
+        static void writeString(std::string& buffer, const char* str)
+        {
+            unsigned int length = (unsigned int)strlen(str);
+            writeValue(buffer, length); buffer.append(str, length);
+        }
+
+        static std::string readString(std::istream& in)
+        {
+            unsigned int length = 0; in.read((char*)&length, sizeof(unsigned int));
+            std::string str(length, '\0'); if (length > 0) in.read(&str[0], length);
+            return str;
+        }
+
+        std::map<std::pair<int, int>, std::string> _buckets;
+        std::set<std::pair<int, int>> _writtenTiles;
+        std::string _outDir, _filterKey, _filterValue;
+        size_t _maxBufferBytes, _bufferedBytes; int _zoom;
+        size_t _numNodes, _numWays, _numRelations, _numDropped;
     };
 
+    struct TileInfo { std::string fileName; osg::BoundingSphere bound; };
+    typedef std::map<std::pair<int, int>, TileInfo> TileInfoMap;
+
+    static osg::PagedLOD* createPagedTile(const std::string& outDir, const TileInfo& info, float range)
+    {
+        osg::PagedLOD* plod = new osg::PagedLOD;
+        plod->setDatabasePath(outDir + "/");
+        plod->setFileName(0, info.fileName);
+        plod->setRange(0, 0.0f, range);
+        plod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+        plod->setCenter(info.bound.center()); plod->setRadius(info.bound.radius());
+        return plod;
+    }
+
+    typedef osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> LocationIndex;
+    osg::Node* streamOSMDataToTiles(const std::string& fileName, int zoom,
+                                    const osgDB::ReaderWriter::Options* options) const
+    {
+        std::string filterKey = options->getPluginStringData("FilterKey"),
+                    filterValue = options->getPluginStringData("FilterValue"),
+                    outDir = options->getPluginStringData("StreamingOutput"),
+                    indexFile = options->getPluginStringData("StreamingIndexFile");
+        int numThreads = atoi(options->getPluginStringData("StreamingThreads").c_str());
+        int bufferMB = atoi(options->getPluginStringData("StreamingBufferMB").c_str());
+        double tileRange = atof(options->getPluginStringData("StreamingTileRange").c_str());
+        std::string minZoomString = options->getPluginStringData("StreamingMinZoom");
+        int minZoom = minZoomString.empty() ? (zoom - 6) : atoi(minZoomString.c_str());
+        minZoom = osg::clampBetween(minZoom, 0, zoom);
+        if (outDir.empty()) outDir = osgDB::getNameLessAllExtensions(fileName) + "_tiles";
+        if (bufferMB < 1) bufferMB = 256; if (tileRange <= 0.0) tileRange = 6.0;
+        if (numThreads < 1) numThreads = osg::maximum((int)std::thread::hardware_concurrency() - 1, 1);
+        osgDB::makeDirectory(outDir);
+
+        // Node locations: dense on-disk index for planet/country files, or compact sparse array. The
+        // sparse array holds all node locations in memory, so it is used only for small inputs
+        bool autoIndexFile = false;
+        if (indexFile.empty())
+        {
+            std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+            if (in && (long long)in.tellg() > 256ll * 1024 * 1024)
+            {
+                indexFile = outDir + "/nodes.idx"; autoIndexFile = true;
+                OSG_NOTICE << "[ReaderWriterOSM] Large input " << fileName << ", using on-disk node index "
+                           << indexFile << " (set StreamingIndexFile to change it)" << std::endl;
+            }
+        }
+
+        std::unique_ptr<LocationIndex> index; int indexFd = -1;
+        if (!indexFile.empty())
+        {
+#ifdef _WIN32
+            indexFd = _open(indexFile.c_str(), _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+            indexFd = ::open(indexFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+            if (indexFd < 0)
+                OSG_WARN << "[ReaderWriterOSM] Failed to create index file " << indexFile
+                         << ", falling back to memory index" << std::endl;
+            else
+                index.reset(new osmium::index::map::DenseFileArray<
+                    osmium::unsigned_object_id_type, osmium::Location>(indexFd));
+        }
+        if (!index) index.reset(new osmium::index::map::SparseMemArray<
+            osmium::unsigned_object_id_type, osmium::Location>());
+
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        OSMTileBucketHandler tileHandler(outDir, zoom, (size_t)bufferMB * 1024 * 1024, filterKey, filterValue);
+        {
+            osmium::handler::NodeLocationsForWays<LocationIndex> locationHandler(*index);
+            locationHandler.ignore_errors();
+
+            osmium::thread::Pool pool(numThreads);
+            osmium::io::File inputFile(fileName);
+            osmium::io::Reader reader(inputFile, pool, osmium::osm_entity_bits::node |
+                                      osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation);
+            osmium::apply(reader, locationHandler, tileHandler);
+            reader.close(); tileHandler.flush();
+        }
+        index.reset(); if (indexFd >= 0)
+        {
+#ifdef _WIN32
+            _close(indexFd);
+#else
+            ::close(indexFd);
+#endif
+            if (autoIndexFile) std::remove(indexFile.c_str());
+        }
+
+        // Convert buckets to paged tiles level by level from the finest one, so only one tile is in
+        // memory. Each tile also appends its simplified features to the parent bucket, and upper
+        // level tiles switch between their own features and paged children by distance
+        osg::Timer_t t1 = osg::Timer::instance()->tick();
+        std::set<std::pair<int, int>> levelTiles = tileHandler.getWrittenTiles();
+        TileInfoMap childTiles; size_t numTiles = 0;
+        for (int z = zoom; z >= minZoom; --z)
+        {
+            std::set<std::pair<int, int>> tileKeys = levelTiles, parentBuckets;
+            for (TileInfoMap::iterator itr = childTiles.begin(); itr != childTiles.end(); ++itr)
+                tileKeys.insert(std::pair<int, int>(itr->first.first >> 1, itr->first.second >> 1));
+
+            TileInfoMap currentTiles;
+            double parentPixelSize = 360.0 / (double)(1 << osg::maximum(z - 1, 0)) / 256.0;
+            for (std::set<std::pair<int, int>>::iterator itr = tileKeys.begin(); itr != tileKeys.end(); ++itr)
+            {
+                int x = itr->first, y = itr->second; osg::BoundingSphere bs;
+                std::string bucketFile = tileHandler.getBucketFile(z, x, y);
+                osg::ref_ptr<osgVerse::FeatureCollection> fc = OSMTileBucketHandler::readBucket(bucketFile);
+                std::remove(bucketFile.c_str());
+
+                osg::ref_ptr<osg::Geode> geode;
+                if (fc.valid() && !fc->features.empty())
+                {
+                    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+                    geom->setUseDisplayList(false);
+                    geom->setUseVertexBufferObjects(true);
+                    for (size_t i = 0; i < fc->features.size(); ++i)
+                        osgVerse::addFeatureToGeometry(*(fc->features[i]), geom.get(), true);
+                    geode = new osg::Geode; geode->addDrawable(geom.get());
+                    bs.expandBy(osg::BoundingSphere(fc->bound));
+
+                    if (z > minZoom)
+                    {
+                        // Features are copied in all tiles they overlap: only the tile containing the
+                        // center passes them up, to all parent tiles they overlap
+                        std::map<std::pair<int, int>, std::string> reducedBuckets;
+                        for (size_t i = 0; i < fc->features.size(); ++i)
+                        {
+                            const osgVerse::Feature& f = *(fc->features[i]);
+                            const osg::BoundingBox& fb = f.getBound(); int cx = 0, cy = 0;
+                            OSMTileBucketHandler::latLonToTile(fb.center()[0], fb.center()[1], z, cx, cy);
+                            if (cx != x || cy != y) continue;
+
+                            std::string reduced;
+                            if (!OSMTileBucketHandler::writeReducedFeature(reduced, f, parentPixelSize)) continue;
+                            int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+                            OSMTileBucketHandler::getTileRange(fb, z - 1, x0, y0, x1, y1);
+                            for (int py = y0; py <= y1; ++py)
+                                for (int px = x0; px <= x1; ++px)
+                                    reducedBuckets[std::pair<int, int>(px, py)].append(reduced);
+                        }
+
+                        for (std::map<std::pair<int, int>, std::string>::iterator ri = reducedBuckets.begin();
+                             ri != reducedBuckets.end(); ++ri)
+                        {
+                            const std::pair<int, int>& parent = ri->first;
+                            bool appending = parentBuckets.find(parent) != parentBuckets.end();
+                            std::ofstream out(tileHandler.getBucketFile(z - 1, parent.first, parent.second).c_str(),
+                                std::ios::out | std::ios::binary | (appending ? std::ios::app : std::ios::trunc));
+                            out.write(ri->second.data(), ri->second.size()); parentBuckets.insert(parent);
+                        }
+                    }
+                }
+
+                osg::ref_ptr<osg::Group> children = new osg::Group;
+                for (int c = 0; c < 4; ++c)
+                {
+                    TileInfoMap::iterator ci = childTiles.find(std::pair<int, int>(x * 2 + (c & 1), y * 2 + (c >> 1)));
+                    if (ci == childTiles.end()) continue;
+                    children->addChild(createPagedTile(outDir, ci->second, FLT_MAX));
+                    bs.expandBy(ci->second.bound);
+                }
+
+                osg::ref_ptr<osg::Node> tileNode;
+                if (children->getNumChildren() == 0) tileNode = geode.get();
+                else if (!geode) tileNode = children.get();
+                else
+                {
+                    float splitRange = bs.radius() * tileRange * 0.5f;
+                    osg::ref_ptr<osg::LOD> lod = new osg::LOD;
+                    lod->addChild(geode.get(), splitRange, FLT_MAX);
+                    lod->addChild(children.get(), 0.0f, splitRange);
+                    lod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+                    lod->setCenter(bs.center()); lod->setRadius(bs.radius());
+                    tileNode = lod.get();
+                }
+                if (!tileNode) continue;
+
+                std::stringstream ss; ss << z << "_" << x << "_" << y << ".osgb";
+                if (osgDB::writeNodeFile(*tileNode, outDir + "/" + ss.str()))
+                { TileInfo& info = currentTiles[*itr]; info.fileName = ss.str(); info.bound = bs; numTiles++; }
+            }
+            childTiles.swap(currentTiles); levelTiles.swap(parentBuckets);
+        }
+
+        osg::ref_ptr<osg::Group> root = new osg::Group;
+        for (TileInfoMap::iterator itr = childTiles.begin(); itr != childTiles.end(); ++itr)
+            root->addChild(createPagedTile(outDir, itr->second, itr->second.bound.radius() * tileRange));
+
+        // Throughput report
+        osg::Timer_t t2 = osg::Timer::instance()->tick();
+        double readTime = osg::Timer::instance()->delta_s(t0, t1), tileTime = osg::Timer::instance()->delta_s(t1, t2);
+        double invRead = readTime > 0.0 ? 1.0 / readTime : 0.0;
+        OSG_NOTICE << "[ReaderWriterOSM] Streamed " << fileName << " in " << readTime << "s: "
+                   << tileHandler.numNodes() << " nodes (" << tileHandler.numNodes() * invRead << "/s), "
+                   << tileHandler.numWays() << " ways (" << tileHandler.numWays() * invRead << "/s), "
+                   << tileHandler.numRelations() << " relations (" << tileHandler.numRelations() * invRead
+                   << "/s), " << tileHandler.numDropped() << " ways dropped; " << numTiles << " tiles at zoom "
+                   << minZoom << "-" << zoom << " written in " << tileTime << "s" << std::endl;
+        root->setUserValue("osm_nodes", (double)tileHandler.numNodes());
+        root->setUserValue("osm_ways", (double)tileHandler.numWays());
+        root->setUserValue("osm_relations", (double)tileHandler.numRelations());
+        root->setUserValue("osm_read_seconds", readTime);
+        root->setUserValue("osm_tile_seconds", tileTime);
+        return root.release();
+    }
+
     osgVerse::FeatureCollection* parseOSMData(const std::string& fileName,
                                               const osgDB::ReaderWriter::Options* options) const
     {
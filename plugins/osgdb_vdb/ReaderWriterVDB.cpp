@@ -4,17 +4,22 @@
 #include <osg/ImageSequence>
 #include <osg/Geometry>
 #include <osg/Geode>
+#include <osg/PagedLOD>
+#include <osg/ValueObject>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <sstream>
 
 #include <animation/ParticleEngine.h>
 #include <pipeline/Global.h>
+#include <readerwriter/Utilities.h>
 #include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for.h>
 #include <openvdb/openvdb.h>
 #include <openvdb/io/Stream.h>
+#include <openvdb/io/File.h>
 #include <openvdb/tools/VolumeToMesh.h>
 #include <openvdb/tools/MeshToVolume.h>
 #include <openvdb/tools/Interpolation.h>
@@ -26,11 +31,15 @@ public:
     {
         supportsExtension("verse_vdb", "osgVerse pseudo-loader");
         supportsExtension("vdb", "VDB point cloud and texture file");
+        supportsExtension("vdb_brick", "Helper extension to load a volume brick on demand");
         supportsOption("ReadDataType=<hint>", "Read option: <Mesh/Points>");
         supportsOption("DimensionScale=<hint>", "Read option: volume image size scale, default is 1.0");
         supportsOption("ResolutionX=<hint>", "Write option: output image resolution X, default = 256");
         supportsOption("ResolutionY=<hint>", "Write option: output image resolution Y, default = 256");
         supportsOption("ResolutionZ=<hint>", "Write option: output image resolution Z, default = 256");
+        supportsOption("GridName=<hint>", "Read option: only read the grid of given name, default = first one");
+        supportsOption("BrickSize=<hint>", "Read option: read node as paged octree of 3D bricks, default = 0 (disabled)");
+        supportsOption("BrickRangeFactor=<hint>", "Read option: distance to switch to child bricks / radius, default = 4");
         openvdb::initialize();
     }
 
@@ -52,6 +61,11 @@ public:
             ext = osgDB::getFileExtension(fileName);
         }
 
+        if (ext == "vdb_brick") return loadBrick(fileName, options);
+
+        int brickSize = options ? atoi(options->getPluginStringData("BrickSize").c_str()) : 0;
+        if (brickSize > 0) return createBrickHierarchy(fileName, brickSize, options);
+
         std::ifstream ifile(fileName, std::ios_base::in | std::ios_base::binary);
         if (!ifile) return ReadResult::FILE_NOT_FOUND;
         return readNode(ifile, options);
@@ -432,6 +446,201 @@ protected:
         return fileName;
     }
 
+    static std::string findGridName(openvdb::io::File& file, const std::string& gridName)
+    {
+        if (!gridName.empty()) return file.hasGrid(gridName) ? gridName : "";
+        openvdb::io::File::NameIterator itr = file.beginName();
+        return (itr != file.endName()) ? itr.gridName() : "";
+    }
+
+    /** Merge value ranges of leaf nodes and active tiles of a grid region into the brick index.
+        Bricks without any active value are not recorded, which gives empty-space skipping */
+    template<typename GridType>
+    void collectBrickRanges(const GridType& grid, const openvdb::CoordBBox& region, const openvdb::Coord& origin,
+                            osgVerse::VolumeBrickIndex& index) const
+    {
+        // Leaf nodes: one range per leaf, added to the bricks its active voxels overlap
+        for (typename GridType::TreeType::LeafCIter leaf = grid.tree().cbeginLeaf(); leaf; ++leaf)
+        {
+            float minV = FLT_MAX, maxV = -FLT_MAX; openvdb::CoordBBox bbox;
+            for (typename GridType::TreeType::LeafNodeType::ValueOnCIter v = leaf->cbeginValueOn(); v; ++v)
+            { float value = (float)*v; minV = osg::minimum(minV, value); maxV = osg::maximum(maxV, value); }
+            if (minV > maxV) continue; leaf->evalActiveBoundingBox(bbox, false);
+            addBrickRange(bbox, region, origin, minV, maxV, index);
+        }
+
+        // Active tiles of internal nodes, without visiting voxels of leaf nodes again
+        typename GridType::ValueOnCIter iter = grid.cbeginValueOn();
+        iter.setMaxDepth(GridType::ValueOnCIter::LEAF_DEPTH - 1);
+        for (; iter; ++iter)
+        {
+            float v = (float)iter.getValue(); openvdb::CoordBBox bbox;
+            iter.getBoundingBox(bbox); addBrickRange(bbox, region, origin, v, v, index);
+        }
+    }
+
+    static void addBrickRange(openvdb::CoordBBox bbox, const openvdb::CoordBBox& region, const openvdb::Coord& origin,
+                              float minV, float maxV, osgVerse::VolumeBrickIndex& index)
+    {
+        bbox.intersect(region); if (bbox.empty()) return;
+        openvdb::Coord b0 = bbox.min() - origin, b1 = bbox.max() - origin;
+        index.addVoxelRange(osg::Vec3i(b0.x(), b0.y(), b0.z()), osg::Vec3i(b1.x(), b1.y(), b1.z()), minV, maxV);
+    }
+
+    /** Fill texels [o0, o1] of the brick image: texel o is the average of voxels from (start + o * stride),
+        clipped by the last voxel of the volume */
+    template<typename GridType>
+    void sampleBrick(const GridType& grid, const openvdb::Coord& start, const openvdb::Coord& last, int stride,
+                     const openvdb::Coord& o0, const openvdb::Coord& o1, osg::Image* image) const
+    {
+        float* ptr = (float*)image->data(); int s = image->s(), t = image->t();
+        tbb::parallel_for(tbb::blocked_range<int>(o0.z(), o1.z() + 1),
+            [&grid, &start, &last, &o0, &o1, stride, s, t, ptr](const tbb::blocked_range<int>& range)
+        {
+            typename GridType::ConstAccessor accessor = grid.getConstAccessor();
+            for (int z = range.begin(); z < range.end(); ++z)
+                for (int y = o0.y(); y <= o1.y(); ++y)
+                    for (int x = o0.x(); x <= o1.x(); ++x)
+                    {
+                        openvdb::Coord c0 = start + openvdb::Coord(x, y, z) * stride;
+                        openvdb::Coord c1 = openvdb::Coord::minComponent(c0 + openvdb::Coord(stride - 1), last);
+                        double sum = 0.0; int num = 0; openvdb::Coord c;
+                        for (c.z() = c0.z(); c.z() <= c1.z(); ++c.z())
+                            for (c.y() = c0.y(); c.y() <= c1.y(); ++c.y())
+                                for (c.x() = c0.x(); c.x() <= c1.x(); ++c.x())
+                                { sum += (double)accessor.getValue(c); num++; }
+                        *(ptr + ((size_t)z * t + y) * s + x) = num > 0 ? (float)(sum / num) : 0.0f;
+                    }
+        });
+    }
+
+    /** Create an octree of paged bricks of selected grid. The file is opened with delayed loading, and the
+        brick index is built region by region, each reading only the grid part clipped by its bounding box.
+        Upper levels are downsampled bricks, so far views only load a few coarse bricks */
+    ReadResult createBrickHierarchy(const std::string& fileName, int brickSize, const Options* options) const
+    {
+        std::string gridName = options->getPluginStringData("GridName");
+        std::string rangeStr = options->getPluginStringData("BrickRangeFactor");
+        float rangeFactor = rangeStr.empty() ? 4.0f : (float)atof(rangeStr.c_str());
+
+        osg::ref_ptr<osgVerse::VolumeBrickIndex> index; openvdb::CoordBBox indexBox;
+        try
+        {
+            openvdb::io::File file(fileName); file.open(true);
+            gridName = findGridName(file, gridName);
+            if (gridName.empty()) { file.close(); return ReadResult::ERROR_IN_READING_FILE; }
+
+            openvdb::GridBase::Ptr meta = file.readGridMetadata(gridName);
+            indexBox = getIndexSpaceBoundingBox(*meta);
+            if (indexBox.empty())
+            {
+                OSG_NOTICE << "[ReaderWriterVDB] No bounding box in metadata of " << gridName
+                           << ", reading the whole grid once to compute it" << std::endl;
+                indexBox = file.readGrid(gridName)->evalActiveVoxelBoundingBox();
+            }
+            if (indexBox.empty()) { file.close(); return ReadResult::ERROR_IN_READING_FILE; }
+
+            openvdb::Coord dim = indexBox.dim();
+            index = new osgVerse::VolumeBrickIndex(osg::Vec3i(dim.x(), dim.y(), dim.z()), brickSize, rangeFactor);
+
+            int regionSize = osg::maximum(256 / brickSize, 1) * brickSize;
+            for (int z = 0; z < dim.z(); z += regionSize)
+                for (int y = 0; y < dim.y(); y += regionSize)
+                    for (int x = 0; x < dim.x(); x += regionSize)
+                    {
+                        openvdb::Coord r0 = indexBox.min() + openvdb::Coord(x, y, z);
+                        openvdb::CoordBBox region(r0, r0 + openvdb::Coord(regionSize - 1)); region.intersect(indexBox);
+                        openvdb::GridBase::Ptr grid = file.readGrid(gridName, meta->transform().indexToWorld(region));
+                        if (openvdb::FloatGrid::Ptr g0 = openvdb::gridPtrCast<openvdb::FloatGrid>(grid))
+                            collectBrickRanges(*g0, region, indexBox.min(), *index);
+                        else if (openvdb::Int32Grid::Ptr g1 = openvdb::gridPtrCast<openvdb::Int32Grid>(grid))
+                            collectBrickRanges(*g1, region, indexBox.min(), *index);
+                        else if (openvdb::DoubleGrid::Ptr g2 = openvdb::gridPtrCast<openvdb::DoubleGrid>(grid))
+                            collectBrickRanges(*g2, region, indexBox.min(), *index);
+                        else
+                        {
+                            OSG_WARN << "[ReaderWriterVDB] Unsupported grid type for bricking: "
+                                     << grid->valueType() << std::endl;
+                            file.close(); return ReadResult::ERROR_IN_READING_FILE;
+                        }
+                    }
+            file.close();
+        }
+        catch (openvdb::Exception& e)
+        {
+            OSG_WARN << "[ReaderWriterVDB] Failed to read " << fileName << ": " << e.what() << std::endl;
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+
+        openvdb::Coord b0 = indexBox.min(), dim = indexBox.dim(); index->buildLevels();
+        index->setFileNames(osgDB::getSimpleFileName(fileName) + "_" + gridName, "vdb_brick");
+        osg::ref_ptr<osgDB::Options> brickOpt = options->cloneOptions();
+        brickOpt->setPluginStringData("BrickSource", fileName);
+        brickOpt->setPluginStringData("GridName", gridName);
+        brickOpt->setPluginStringData("VolumeOrigin", std::to_string(b0.x()) + " " + std::to_string(b0.y())
+                                                      + " " + std::to_string(b0.z()));
+
+        osg::ref_ptr<osg::Group> root = index->createRootNode(brickOpt.get()); root->setName(gridName);
+        OSG_NOTICE << "[ReaderWriterVDB] " << gridName << ": " << dim.x() << "x" << dim.y() << "x" << dim.z()
+                   << ", " << index->getNumBricks(0) << " non-empty bricks in " << index->getNumLevels()
+                   << " levels created" << std::endl;
+        return root.get();
+    }
+
+    ReadResult loadBrick(const std::string& brickName, const Options* options) const
+    {
+        osg::Vec4i key; osgVerse::VolumeBrickIndex* index = osgVerse::VolumeBrickIndex::getFromOptions(options, key);
+        std::string fileName = options ? options->getPluginStringData("BrickSource") : "";
+        if (!index || fileName.empty())
+        { OSG_WARN << "[ReaderWriterVDB] Invalid brick: " << brickName << std::endl; return ReadResult::FILE_NOT_HANDLED; }
+        if (osgVerse::VolumeBrickIndex::isChildrenFile(brickName)) return index->createChildNodes(key, options);
+
+        openvdb::Coord origin; std::string gridName = options->getPluginStringData("GridName");
+        std::stringstream ss0(options->getPluginStringData("VolumeOrigin")); ss0 >> origin.x() >> origin.y() >> origin.z();
+        osg::Vec3i v0, v1, dim = index->getBrickImageSize(key), size = index->getVolumeSize(); int stride = 1;
+        index->getBrickExtent(key, v0, v1, stride);
+
+        osg::ref_ptr<osg::Image> image = new osg::Image; image->setName(brickName);
+        image->allocateImage(dim.x(), dim.y(), dim.z(), GL_LUMINANCE, GL_FLOAT);
+        image->setInternalTextureFormat(GL_LUMINANCE32F_ARB);
+        memset(image->data(), 0, image->getTotalSizeInBytes());
+
+        // Read the brick chunk by chunk, so coarse bricks never keep a large part of the grid in memory
+        openvdb::Coord start = origin + openvdb::Coord(v0.x(), v0.y(), v0.z());
+        openvdb::Coord last = origin + openvdb::Coord(size.x() - 1, size.y() - 1, size.z() - 1);
+        int chunk = osg::maximum(256 / stride, 1);
+        try
+        {
+            openvdb::io::File file(fileName); file.open(true);
+            openvdb::GridBase::Ptr meta = file.readGridMetadata(gridName);
+            for (int z = 0; z < dim.z(); z += chunk)
+                for (int y = 0; y < dim.y(); y += chunk)
+                    for (int x = 0; x < dim.x(); x += chunk)
+                    {
+                        openvdb::Coord o0(x, y, z), o1 = openvdb::Coord::minComponent(
+                            o0 + openvdb::Coord(chunk - 1), openvdb::Coord(dim.x() - 1, dim.y() - 1, dim.z() - 1));
+                        openvdb::CoordBBox bbox(start + o0 * stride, openvdb::Coord::minComponent(
+                            start + o1 * stride + openvdb::Coord(stride - 1), last));
+                        openvdb::GridBase::Ptr grid = file.readGrid(gridName, meta->transform().indexToWorld(bbox));
+
+                        if (openvdb::FloatGrid::Ptr g0 = openvdb::gridPtrCast<openvdb::FloatGrid>(grid))
+                            sampleBrick(*g0, start, last, stride, o0, o1, image.get());
+                        else if (openvdb::Int32Grid::Ptr g1 = openvdb::gridPtrCast<openvdb::Int32Grid>(grid))
+                            sampleBrick(*g1, start, last, stride, o0, o1, image.get());
+                        else if (openvdb::DoubleGrid::Ptr g2 = openvdb::gridPtrCast<openvdb::DoubleGrid>(grid))
+                            sampleBrick(*g2, start, last, stride, o0, o1, image.get());
+                        else { file.close(); return ReadResult::ERROR_IN_READING_FILE; }
+                    }
+            file.close();
+        }
+        catch (openvdb::Exception& e)
+        {
+            OSG_WARN << "[ReaderWriterVDB] Failed to read brick " << brickName << ": " << e.what() << std::endl;
+            return ReadResult::ERROR_IN_READING_FILE;
+        }
+        return index->createBrickGeode(key, image.get(), -FLT_MAX);
+    }
+
     template<typename T> struct ValueRange
     {
         ValueRange() : _min(std::numeric_limits<T>::max()), _max(std::numeric_limits<T>::min()) {}
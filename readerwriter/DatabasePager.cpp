@@ -1,6 +1,7 @@
 #include <osg/Version>
 #include <osg/PagedLOD>
 #include <modeling/Utilities.h>
+#include <modeling/Profiler.h>
 #include "Utilities.h"
 #include "DatabasePager.h"
 using namespace osgVerse;
@@ -63,6 +64,7 @@ void DatabasePager::createBoundingBox(osg::Node* node)
 
 void DatabasePager::addLoadedDataToSceneGraph_Verse(const osg::FrameStamp& frameStamp)
 {
+    VERSE_PROFILE_ZONE_CATEGORY("DatabasePager::merge", "pager");
     double timeStamp = frameStamp.getReferenceTime();
     unsigned int frameNumber = frameStamp.getFrameNumber();
     std::string maxFileName;
@@ -163,6 +165,7 @@ void DatabasePager::addLoadedDataToSceneGraph_Verse(const osg::FrameStamp& frame
 
 void DatabasePager::removeExpiredSubgraphs(const osg::FrameStamp& frameStamp)
 {
+    VERSE_PROFILE_ZONE_CATEGORY("DatabasePager::prune", "pager");
     // No need to remove anything on first frame.
     if (frameStamp.getFrameNumber() == 0) return;
 
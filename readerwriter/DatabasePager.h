@@ -5,6 +5,7 @@
 #include <osg/PagedLOD>
 #include <osgDB/Registry>
 #include <osgDB/DatabasePager>
+#include <modeling/Profiler.h>
 #include "Export.h"
 
 namespace osgVerse
@@ -42,6 +43,7 @@ namespace osgVerse
 
         virtual void updateSceneGraph(const osg::FrameStamp& fs)
         {
+            VERSE_PROFILE_FRAME(fs.getFrameNumber());
             removeExpiredSubgraphs(fs);
             addLoadedDataToSceneGraph_Verse(fs);
         }
@@ -2,12 +2,14 @@
 #include <osg/Version>
 #include <osg/ValueObject>
 #include <osg/AnimationPath>
+#include <osg/Timer>
 #include <osg/Texture2D>
 #include <osg/Geometry>
 #include <osgDB/ConvertUTF>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <OpenThreads/ScopedLock>
 
 #include "modeling/Utilities.h"
 #include "modeling/GaussianGeometry.h"
@@ -19,6 +21,7 @@
 #include <libhv/all/client/requests.h>
 #include <picojson.h>
 #include <regex>
+#include <sstream>
 #define DISABLE_SKINNING_DATA 0
 
 #define TINYGLTF_IMPLEMENTATION
@@ -342,9 +345,42 @@ namespace osgVerse
         stbi_image_free(data); return true;
     }
 
-    LoaderGLTF::LoaderGLTF(std::istream& in, const std::string& d, bool isBinary,
-                           int pbr, bool yUp) : _usingMaterialPBR(pbr), _3dtilesFormat(false)
+    bool LoaderGLTF::deferImageData(tinygltf::Image* image, const int image_idx, std::string* err,
+                                    std::string* warn, int req_width, int req_height,
+                                    const unsigned char* bytes, int size, void* user_data)
     {
+        // Only keep encoded bytes while parsing; they will be decoded concurrently afterwards
+        LoaderGLTF* loader = (LoaderGLTF*)user_data;
+        if (!loader || !bytes || size <= 0) return false;
+        image->image.assign(bytes, bytes + size);
+        loader->_deferredImages.insert(image_idx); return true;
+    }
+
+    void LoaderGLTF::decodeDeferredImages()
+    {
+        std::vector<int> imageIDs(_deferredImages.begin(), _deferredImages.end());
+        std::vector<std::string> errors(imageIDs.size());
+        tinygltf::LoadImageDataOption option; option.preserve_channels = true;
+
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)imageIDs.size(); ++i)
+        {
+            if (imageIDs[i] < 0 || imageIDs[i] >= (int)_modelDef.images.size()) continue;
+            tinygltf::Image& image = _modelDef.images[imageIDs[i]];
+            std::vector<unsigned char> bytes; bytes.swap(image.image); std::string warn;
+            if (!LoadImageDataEx(&image, imageIDs[i], &errors[i], &warn, 0, 0,
+                                 bytes.data(), (int)bytes.size(), &option)) image.image.clear();
+        }
+        _deferredImages.clear();
+
+        for (size_t i = 0; i < errors.size(); ++i)
+        { if (!errors[i].empty()) OSG_WARN << "[LoaderGLTF] " << errors[i]; }
+    }
+
+    LoaderGLTF::LoaderGLTF(std::istream& in, const std::string& d, bool isBinary, int pbr,
+                           bool yUp, bool parallel) : _usingMaterialPBR(pbr), _3dtilesFormat(false), _parallel(parallel)
+    {
+        osg::Timer_t t0 = osg::Timer::instance()->tick(), t1 = t0;
         std::string protocol = osgDB::getServerProtocol(d);
         osgDB::ReaderWriter* rwWeb = (protocol.empty()) ? NULL
                                    : osgDB::Registry::instance()->getReaderWriterForExtension("verse_web");
@@ -352,7 +388,7 @@ namespace osgVerse
             &osgVerse::FileExists, &tinygltf::ExpandFilePath,
             &osgVerse::ReadWholeFile, &tinygltf::WriteWholeFile,
             &osgVerse::GetFileSizeInBytes, rwWeb };
-        _materialsMap.clear();
+        _materialsMap.clear(); _materialHashMap.clear();
 
         std::string err, warn; bool loaded = false;
         std::istreambuf_iterator<char> eos; osg::Vec3d rtcCenter;
@@ -362,7 +398,8 @@ namespace osgVerse
         tinygltf::TinyGLTF loader;
         loader.SetParseStrictness(tinygltf::Permissive);
         loader.SetStoreOriginalJSONForExtrasAndExtensions(true);
-        loader.SetImageLoader(&LoadImageDataEx, this);
+        if (_parallel) loader.SetImageLoader(&LoaderGLTF::deferImageData, this);
+        else loader.SetImageLoader(&LoadImageDataEx, this);
         loader.SetFsCallbacks(fs, &err);
         if (!err.empty()) OSG_WARN << "[LoaderGLTF] SetFsCallbacks: " << err << std::endl;
 
@@ -431,6 +468,14 @@ namespace osgVerse
         if (!warn.empty()) OSG_WARN << "[LoaderGLTF] Warnings found: " << warn << std::endl;
         if (!loaded) { OSG_WARN << "[LoaderGLTF] Unable to load GLTF scene" << std::endl; return; }
 
+        double parsingTime = 0.0, imageTime = 0.0, materialTime = 0.0, meshTime = 0.0;
+        t1 = osg::Timer::instance()->tick(); parsingTime = osg::Timer::instance()->delta_m(t0, t1);
+        if (_parallel && !_deferredImages.empty())
+        {
+            decodeDeferredImages(); t0 = t1; t1 = osg::Timer::instance()->tick();
+            imageTime = osg::Timer::instance()->delta_m(t0, t1);
+        }
+
         // Preload skin data
         for (size_t i = 0; i < _modelDef.skins.size(); ++i)
         {
@@ -457,10 +502,26 @@ namespace osgVerse
         }
 
         // Load geometries to geodes (after all nodes have registered with an ID)
-        for (size_t i = 0; i < _deferredMeshList.size(); ++i)
+        if (_parallel)
         {
-            DeferredMeshData& mData = _deferredMeshList[i];
-            createMesh(mData.meshRoot.get(), mData.mesh, mData.skinIndex);
+            // Materials and textures are shared, so create them first; meshes only read them later
+            t0 = osg::Timer::instance()->tick();
+            for (size_t i = 0; i < _modelDef.materials.size(); ++i) getOrCreateMaterial(i);
+            t1 = osg::Timer::instance()->tick(); materialTime = osg::Timer::instance()->delta_m(t0, t1);
+
+#pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < (int)_deferredMeshList.size(); ++i)
+                createMesh(_deferredMeshList[i]);
+
+            // Shared state-sets and parent lists are not thread-safe, so attach results serially
+            for (size_t i = 0; i < _deferredMeshList.size(); ++i)
+                attachMesh(_deferredMeshList[i]);
+            t0 = t1; t1 = osg::Timer::instance()->tick(); meshTime = osg::Timer::instance()->delta_m(t0, t1);
+        }
+        else
+        {
+            for (size_t i = 0; i < _deferredMeshList.size(); ++i)
+            { createMesh(_deferredMeshList[i]); attachMesh(_deferredMeshList[i]); }
         }
 
         // Configure skinning data and player objects
@@ -586,6 +647,15 @@ namespace osgVerse
                     animName, boneList, skeletonAnimMap);
             }
         }  // end of for (animations)
+
+        if (_parallel)
+        {
+            t0 = t1; t1 = osg::Timer::instance()->tick();
+            OSG_NOTICE << "[LoaderGLTF] Parallel loading timings: Parsing = " << parsingTime
+                       << "ms, Images = " << imageTime << "ms, Materials = " << materialTime
+                       << "ms, Meshes = " << meshTime << "ms, Skinning & animations = "
+                       << osg::Timer::instance()->delta_m(t0, t1) << "ms" << std::endl;
+        }
     }
 
     osg::Node* LoaderGLTF::createNode(int id, tinygltf::Node& node)
@@ -631,17 +701,34 @@ namespace osgVerse
         group->setMatrix(matrix); return group.release();
     }
 
-    bool LoaderGLTF::createMesh(osg::Geode* geode, tinygltf::Mesh& mesh, int skinIndex)
+    void LoaderGLTF::attachMesh(DeferredMeshData& mData)
     {
-        SkinningData* sd = (skinIndex < 0) ? NULL : &_skinningDataList[skinIndex];
+        osg::Geode* geode = mData.meshRoot.get(); tinygltf::Mesh& mesh = mData.mesh;
 #if !DISABLE_SKINNING_DATA
-        if (sd != NULL)
+        if (mData.skinIndex >= 0)
         {
             geode->setNodeMask(0);  // FIXME: ugly to hide original meshes
             geode->setUserValue("OriginalPlayerMesh", true);
         }
 #endif
 
+        for (size_t i = 0; i < mData.geometries.size(); ++i)
+        {
+            DeferredMeshData::GeometryAndState& gs = mData.geometries[i];
+            if (gs.second.valid()) gs.first->setStateSet(gs.second.get());
+            geode->addDrawable(gs.first.get());
+        }
+        mData.geometries.clear();
+
+        bool withNames = mesh.extras.Has("targetNames");
+        if (!mesh.weights.empty()) applyBlendshapeWeights(geode, mesh.weights,
+            withNames ? mesh.extras.Get("targetNames") : tinygltf::Value());
+    }
+
+    bool LoaderGLTF::createMesh(DeferredMeshData& mData)
+    {
+        tinygltf::Mesh& mesh = mData.mesh;
+        SkinningData* sd = (mData.skinIndex < 0) ? NULL : &_skinningDataList[mData.skinIndex];
         for (size_t i = 0; i < mesh.primitives.size(); ++i)
         {
             GaussianPreparedData gsData;
@@ -679,25 +766,16 @@ namespace osgVerse
             if (gsData.enabled) static_cast<GaussianGeometry*>(geom.get())->setShDegrees(gsData.shDegrees);
             geom->setUseDisplayList(false); geom->setUseVertexBufferObjects(true);
             geom->setName(mesh.name + "_" + std::to_string(i));
-            if (primitive.material >= 0)
-            {
-                auto findIter = _materialsMap.find(primitive.material);
-                if (findIter != _materialsMap.end())
-                    geom->setStateSet(findIter->second);
-                else
-                {
-                    tinygltf::Material& material = _modelDef.materials[primitive.material];
-                    createMaterial(geom->getOrCreateStateSet(), material);  // add material
-                    _materialsMap[primitive.material] = geom->getStateSet();
-                }
-            }
+
+            // In parallel mode all materials are created beforehand, so this only reads the map
+            osg::StateSet* stateset = (primitive.material < 0) ? NULL : getOrCreateMaterial(primitive.material);
 
             if (gsData.enabled && extBufferViews.find("KHR_gaussian_splatting_compression_spz_2") != extBufferViews.end())
             {
                 osg::ref_ptr<osg::Geometry> geom2 =
                     createFromExtGaussianSplattingSPZ2(mesh.name, extBufferViews["KHR_gaussian_splatting_compression_spz_2"]);
                 if (geom2.valid()) { geom2->setName(geom->getName()); geom = geom2; }
-                geode->addDrawable(geom.get()); continue;
+                mData.geometries.push_back(DeferredMeshData::GeometryAndState(geom, stateset)); continue;
             }
 
             for (std::map<std::string, int>::iterator attrib = primitive.attributes.begin();
@@ -953,11 +1031,12 @@ namespace osgVerse
             // Apply to geode and create material
             if (!gsData.enabled) geom->addPrimitiveSet(p.get());
             else static_cast<GaussianGeometry*>(geom.get())->finalize();
-            geode->addDrawable(geom.get());
+            mData.geometries.push_back(DeferredMeshData::GeometryAndState(geom, stateset));
 
             // Handle skinning data
             if (sd != NULL && !skData.weightList.empty())
             {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_skinningMutex);
                 typedef std::pair<osg::Transform*, float> JointWeightPair;
                 PlayerAnimation::GeometryJointData gjData;
                 for (size_t w = 0; w < skData.weightList.size(); w += 4)
@@ -984,7 +1063,7 @@ namespace osgVerse
                     gjData._weightList.push_back(jwMap);
                 }
 
-                gjData._stateset = geom->getStateSet();
+                gjData._stateset = stateset;
                 sd->jointData[geom.get()] = gjData;
                 sd->meshList.push_back(geom.get());
             }
@@ -993,10 +1072,6 @@ namespace osgVerse
             for (size_t j = 0; j < primitive.targets.size(); ++j)
                 createBlendshapeData(geom.get(), primitive.targets[j]);
         }  // for (size_t i = 0; i < mesh.primitives.size(); ++i)
-
-        bool withNames = mesh.extras.Has("targetNames");
-        if (!mesh.weights.empty()) applyBlendshapeWeights(geode, mesh.weights,
-            withNames ? mesh.extras.Get("targetNames") : tinygltf::Value());
         return true;
     }
 
@@ -1027,7 +1102,7 @@ namespace osgVerse
         int occlusionID = material.occlusionTexture.index;
 
         if (baseID >= 0 && baseID < _modelDef.textures.size())
-            ss->setTextureAttributeAndModes(0, createTexture(uniformNames[0], _modelDef.textures[baseID]));
+            ss->setTextureAttributeAndModes(0, getOrCreateTexture(uniformNames[0], baseID));
         else
         {
             osg::Vec4 baseColor(linearToSRGB(material.pbrMetallicRoughness.baseColorFactor[0]),
@@ -1039,7 +1114,7 @@ namespace osgVerse
         }
 
         if (normalID >= 0)
-            ss->setTextureAttributeAndModes(1, createTexture(uniformNames[1], _modelDef.textures[normalID]));
+            ss->setTextureAttributeAndModes(1, getOrCreateTexture(uniformNames[1], normalID));
         if (_usingMaterialPBR > 1 || (normalID >= 0 && _usingMaterialPBR > 0))
         {
             // Load or create Occlusion-Roughnes-Metallic texture
@@ -1063,7 +1138,7 @@ namespace osgVerse
                 // Load occlusion texture and combine ORM
                 osg::ref_ptr<osg::Texture> ormNewInput; bool compressed = false;
                 if (occlusionID >= 0)
-                    ormNewInput = createTexture(uniformNames[4], _modelDef.textures[occlusionID]);
+                    ormNewInput = getOrCreateTexture(uniformNames[4], occlusionID);
                 if (ormNewInput.valid())
                 {
                     // https://github.com/KhronosGroup/glTF/blob/main/specification/2.0/schema/material.occlusionTextureInfo.schema.json
@@ -1077,7 +1152,7 @@ namespace osgVerse
 
                 // Load metallic-roughness texture and combine ORM
                 if (roughnessID >= 0 && roughnessID < _modelDef.textures.size())
-                    ormNewInput = createTexture(uniformNames[3], _modelDef.textures[roughnessID]);
+                    ormNewInput = getOrCreateTexture(uniformNames[3], roughnessID);
                 else
                     ormNewInput = createDefaultTextureForColor(osg::Vec4(
                         1.0f, material.pbrMetallicRoughness.roughnessFactor, material.pbrMetallicRoughness.metallicFactor, 1.0f));
@@ -1110,7 +1185,7 @@ namespace osgVerse
 
             // Load emission texture
             if (emissiveID >= 0)
-                ss->setTextureAttributeAndModes(5, createTexture(uniformNames[5], _modelDef.textures[emissiveID]));
+                ss->setTextureAttributeAndModes(5, getOrCreateTexture(uniformNames[5], emissiveID));
             else
             {
                 osg::Vec3 emission(material.emissiveFactor[0], material.emissiveFactor[1], material.emissiveFactor[2]);
@@ -1140,6 +1215,60 @@ namespace osgVerse
 #endif
     }
 
+    /** Hash of material values compared by tinygltf::Material::operator== (name excluded) */
+    static size_t hashMaterial(const tinygltf::Material& m)
+    {
+        const tinygltf::PbrMetallicRoughness& pbr = m.pbrMetallicRoughness;
+        std::stringstream ss; ss << m.alphaMode << "|" << m.alphaCutoff << "|" << m.doubleSided << "|";
+        for (size_t i = 0; i < pbr.baseColorFactor.size(); ++i) ss << pbr.baseColorFactor[i] << ",";
+        for (size_t i = 0; i < m.emissiveFactor.size(); ++i) ss << m.emissiveFactor[i] << ",";
+        ss << pbr.metallicFactor << "|" << pbr.roughnessFactor << "|"
+           << pbr.baseColorTexture.index << "," << pbr.baseColorTexture.texCoord << "|"
+           << pbr.metallicRoughnessTexture.index << "," << pbr.metallicRoughnessTexture.texCoord << "|"
+           << m.normalTexture.index << "," << m.normalTexture.scale << "|"
+           << m.occlusionTexture.index << "," << m.occlusionTexture.strength << "|"
+           << m.emissiveTexture.index << "|";
+        for (tinygltf::ExtensionMap::const_iterator itr = m.extensions.begin(); itr != m.extensions.end(); ++itr)
+            ss << itr->first << ";";
+        return std::hash<std::string>()(ss.str());
+    }
+
+    osg::StateSet* LoaderGLTF::getOrCreateMaterial(int id)
+    {
+        auto findIter = _materialsMap.find(id);
+        if (findIter != _materialsMap.end()) return findIter->second.get();
+        if (id < 0 || id >= (int)_modelDef.materials.size()) return NULL;
+
+        // Share the state-set with an identical material which only differs in name:
+        // only materials with the same hash are compared
+        tinygltf::Material material = _modelDef.materials[id];
+        std::vector<int>& candidates = _materialHashMap[hashMaterial(material)];
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            tinygltf::Material other = _modelDef.materials[candidates[i]];
+            other.name = material.name;
+            if (other == material)
+            {
+                osg::StateSet* ss = _materialsMap[candidates[i]].get();
+                _materialsMap[id] = ss; return ss;
+            }
+        }
+
+        osg::ref_ptr<osg::StateSet> ss = new osg::StateSet;
+        createMaterial(ss.get(), material);  // add material
+        _materialsMap[id] = ss; candidates.push_back(id); return ss.get();
+    }
+
+    osg::Texture* LoaderGLTF::getOrCreateTexture(const std::string& name, int id)
+    {
+        if (id < 0 || id >= (int)_modelDef.textures.size()) return NULL;
+        auto findIter = _texturesMap.find(id);
+        if (findIter != _texturesMap.end()) return findIter->second.get();
+
+        osg::ref_ptr<osg::Texture> tex = createTexture(name, _modelDef.textures[id]);
+        _texturesMap[id] = tex; return tex.get();
+    }
+
     osg::Texture* LoaderGLTF::createTexture(const std::string& name, tinygltf::Texture& tex)
     {
         if (tex.source < 0 || tex.source >= _modelDef.images.size())
@@ -1424,9 +1553,17 @@ namespace osgVerse
 
     osg::ref_ptr<osg::Geometry> LoaderGLTF::createFromExtGaussianSplattingSPZ2(const std::string& name, int bufferViewID)
     {
-        std::vector<unsigned char> bufferData;
+        const unsigned char* bufferData = NULL; size_t bufferSize = 0;
         const tinygltf::BufferView& extView = _modelDef.bufferViews[bufferViewID];
-        if (extView.buffer >= 0) { bufferData = _modelDef.buffers[extView.buffer].data; }
+        if (extView.buffer >= 0)
+        {
+            const std::vector<unsigned char>& data = _modelDef.buffers[extView.buffer].data;
+            if (extView.byteOffset < data.size())
+            {
+                bufferData = data.data() + extView.byteOffset;
+                bufferSize = osg::minimum(extView.byteLength, data.size() - extView.byteOffset);
+            }
+        }
 
         osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("verse_3dgs");
         if (!rw)
@@ -1434,7 +1571,7 @@ namespace osgVerse
         else
         {
             std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
-            ss.write((char*)bufferData.data(), bufferData.size());
+            if (bufferData) ss.write((const char*)bufferData, bufferSize);
 
             osg::ref_ptr<osgDB::Options> opt = new osgDB::Options("extension=spz");
             osg::ref_ptr<osg::Node> spzNode = rw->readNode(ss, opt.get()).getNode();
@@ -1449,7 +1586,7 @@ namespace osgVerse
         return NULL;
     }
 
-    osg::ref_ptr<osg::Group> loadGltf(const std::string& file, bool isBinary, int usingPBR, bool yUp)
+    osg::ref_ptr<osg::Group> loadGltf(const std::string& file, bool isBinary, int usingPBR, bool yUp, bool parallel)
     {
         std::string workDir = osgDB::getFilePath(file), http = osgDB::getServerProtocol(file);
         if (!http.empty() && http.find("file") == std::string::npos) return NULL;
@@ -1461,15 +1598,15 @@ namespace osgVerse
             return NULL;
         }
 
-        osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(in, workDir, isBinary, usingPBR, yUp);
+        osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(in, workDir, isBinary, usingPBR, yUp, parallel);
         if (loader->getRoot()) loader->getRoot()->setName(file);
         return loader->getRoot();
     }
 
     osg::ref_ptr<osg::Group> loadGltf2(std::istream& in, const std::string& dir,
-                                       bool isBinary, int usingPBR, bool yUp)
+                                       bool isBinary, int usingPBR, bool yUp, bool parallel)
     {
-        osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(in, dir, isBinary, usingPBR, yUp);
+        osg::ref_ptr<LoaderGLTF> loader = new LoaderGLTF(in, dir, isBinary, usingPBR, yUp, parallel);
         return loader->getRoot();
     }
 }
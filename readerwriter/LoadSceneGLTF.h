@@ -4,7 +4,9 @@
 #include <osg/Texture2D>
 #include <osg/Geode>
 #include <osg/MatrixTransform>
+#include <OpenThreads/Mutex>
 #include <iterator>
+#include <set>
 #include <fstream>
 #include <iostream>
 
@@ -19,7 +21,9 @@ namespace osgVerse
     {
     public:
         // usingPBR: 0 - disabled, 1: enabled, 2: forced
-        LoaderGLTF(std::istream& in, const std::string& d, bool isBinary, int usingPBR, bool yUp = true);
+        // parallel: decode images and build mesh primitives concurrently (OpenMP)
+        LoaderGLTF(std::istream& in, const std::string& d, bool isBinary, int usingPBR,
+                   bool yUp = true, bool parallel = false);
 
         osg::Group* getRoot() { return _root.get(); }
         tinygltf::Model& getModelData() { return _modelDef; }
@@ -27,6 +31,8 @@ namespace osgVerse
     protected:
         struct DeferredMeshData
         {
+            typedef std::pair<osg::ref_ptr<osg::Geometry>, osg::ref_ptr<osg::StateSet>> GeometryAndState;
+            std::vector<GeometryAndState> geometries;  // created by createMesh(), added by attachMesh()
             osg::ref_ptr<osg::Geode> meshRoot;
             tinygltf::Mesh mesh; int skinIndex;
             DeferredMeshData() : skinIndex(-1) {}
@@ -48,9 +54,19 @@ namespace osgVerse
         virtual ~LoaderGLTF() {}
         osg::Node* createNode(int id, tinygltf::Node& node);
         osg::Texture* createTexture(const std::string& name, tinygltf::Texture& tex);
+        osg::Texture* getOrCreateTexture(const std::string& name, int id);
+        osg::StateSet* getOrCreateMaterial(int id);
+        void decodeDeferredImages();
+
+        static bool deferImageData(tinygltf::Image* image, const int image_idx, std::string* err,
+                                   std::string* warn, int req_width, int req_height,
+                                   const unsigned char* bytes, int size, void* user_data);
         osg::ref_ptr<osg::Geometry> createFromExtGaussianSplattingSPZ2(const std::string& name, int bufferViewID);
 
-        bool createMesh(osg::Geode* geode, tinygltf::Mesh& mesh, int skinIndex);
+        /** Build geometries of a mesh without touching the scene graph or shared state-sets,
+            so it can run concurrently; attachMesh() then adds them to the geode serially */
+        bool createMesh(DeferredMeshData& mData);
+        void attachMesh(DeferredMeshData& mData);
         void createMaterial(osg::StateSet* ss, tinygltf::Material mat);
         void createInvBindMatrices(SkinningData& sd, const std::vector<osg::Transform*>& bones,
                                    tinygltf::Accessor& accessor, const osg::Matrix& invParent);
@@ -77,18 +93,23 @@ namespace osgVerse
         std::map<int, osg::observer_ptr<osg::Image>> _imageMap;
         std::map<int, osg::Node*> _nodeCreationMap;
         std::map<int, osg::ref_ptr<osg::StateSet>> _materialsMap;
+        std::map<size_t, std::vector<int>> _materialHashMap;
+        std::map<int, osg::ref_ptr<osg::Texture>> _texturesMap;
+        std::set<int> _deferredImages;
+        OpenThreads::Mutex _skinningMutex;
         std::vector<DeferredMeshData> _deferredMeshList;
         std::vector<SkinningData> _skinningDataList;
         osg::ref_ptr<osg::MatrixTransform> _root;
         tinygltf::Model _modelDef;
         std::string _workingDir;
-        int _usingMaterialPBR; bool _3dtilesFormat;
+        int _usingMaterialPBR; bool _3dtilesFormat, _parallel;
     };
 
     OSGVERSE_RW_EXPORT osg::ref_ptr<osg::Group> loadGltf(
-        const std::string& file, bool isBinary, int usingPBR, bool yUp = true);
+        const std::string& file, bool isBinary, int usingPBR, bool yUp = true, bool parallel = false);
     OSGVERSE_RW_EXPORT osg::ref_ptr<osg::Group> loadGltf2(
-        std::istream& in, const std::string& dir, bool isBinary, int usingPBR, bool yUp = true);
+        std::istream& in, const std::string& dir, bool isBinary, int usingPBR,
+        bool yUp = true, bool parallel = false);
 }
 
 #endif
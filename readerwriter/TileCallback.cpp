@@ -8,6 +8,7 @@
 #include <osgUtil/SmoothingVisitor>
 
 #include <modeling/Math.h>
+#include <modeling/Profiler.h>
 #include <pipeline/Utilities.h>
 #include "Utilities.h"
 #include "TileCallback.h"
@@ -571,6 +572,7 @@ bool TileCallback::updateLayerData(osg::NodeVisitor* nv, osg::Node* node, LayerT
 
 void TileCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
 {
+    VERSE_PROFILE_ZONE_CATEGORY("TileCallback", "terrain");
     if (!_layersDone)
     {
         // Check if current layer paths are all usable and loaded
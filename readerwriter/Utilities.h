@@ -3,7 +3,9 @@
 
 #include <osg/Transform>
 #include <osg/Geometry>
+#include <osg/Geode>
 #include <osg/Camera>
+#include <osg/PagedLOD>
 #include <osgDB/ReaderWriter>
 #ifdef __EMSCRIPTEN__
 #   include <emscripten/fetch.h>
@@ -13,6 +15,7 @@ extern void emscripten_advance();
 #include "Export.h"
 #include <functional>
 #include <queue>
+#include <map>
 #include <mutex>
 
 #ifndef GL_ARB_texture_rg
@@ -210,6 +213,68 @@ namespace osgVerse
     enum YUVFormat { YU12 = 0/*IYUV*/, YV12, NV12, NV21 };
     OSGVERSE_RW_EXPORT std::vector<std::vector<unsigned char>> convertRGBtoYUV(osg::Image* image, YUVFormat f = YV12);
 
+    /** Create a box of a volume brick with its 3D texture, and uniforms read by fast_volume.frag:
+        BoundingMin/BoundingMax (the box, in voxels) and ValueRange (min, max - min, invalid value).
+        Value range should be the one of the whole volume, so all bricks are normalized the same way.
+        The texture may have 1 more texel than the box on max sides, to be seamless with next bricks */
+    OSGVERSE_RW_EXPORT osg::Geode* createVolumeBrick(osg::Image* image, const osg::Vec3& origin,
+                                                     const osg::Vec3& size, const osg::Vec3& valueRange);
+
+    /** Octree index of a bricked volume, used by paged volume readers (VDB, NetCDF). Level 0 bricks have
+        (brickSize + 1)^3 voxels including a 1-voxel border on max sides; each upper level doubles the
+        voxel stride, until one brick covers the whole volume. Only non-empty bricks are recorded.
+        Each brick is a PagedLOD showing its own (downsampled) texture when far away, and loading paged
+        children bricks when near. The index is kept as user data of the database options, so readers
+        can find the brick key and create child bricks when loading "<name>.children.<ext>" files */
+    class OSGVERSE_RW_EXPORT VolumeBrickIndex : public osg::Referenced
+    {
+    public:
+        VolumeBrickIndex(const osg::Vec3i& volumeSize, int brickSize, float rangeFactor);
+
+        /** Merge value range of voxels [v0, v1] to all level 0 bricks reading them (incl. borders) */
+        void addVoxelRange(const osg::Vec3i& v0, const osg::Vec3i& v1, float minV, float maxV);
+
+        /** Record a level 0 brick. Range may be invalid (min > max) if it is not known but non-empty */
+        void addBrick(const osg::Vec3i& brick, float minV, float maxV);
+
+        /** Build upper levels from recorded level 0 bricks */
+        void buildLevels();
+
+        /** First and last voxels (inclusive, on the border) and stride of the brick (x, y, z, level) */
+        void getBrickExtent(const osg::Vec4i& key, osg::Vec3i& v0, osg::Vec3i& v1, int& stride) const;
+        osg::Vec3i getBrickImageSize(const osg::Vec4i& key) const;
+
+        bool getBrickRange(const osg::Vec4i& key, osg::Vec2& range) const;
+        const osg::Vec2& getValueRange() const { return _valueRange; }
+        const osg::Vec3i& getVolumeSize() const { return _volumeSize; }
+        unsigned int getNumBricks(int level) const;
+        int getNumLevels() const { return _numLevels; }
+
+        /** Set brick file names: <prefix>_<level>_<x>_<y>_<z>.<ext> */
+        void setFileNames(const std::string& prefix, const std::string& ext) { _prefix = prefix; _extension = ext; }
+
+        /** Create root of the hierarchy. Options should contain reader-specific data to load bricks */
+        osg::Group* createRootNode(const osgDB::Options* options);
+
+        /** Create child bricks of the brick, for loading "<name>.children.<ext>" */
+        osg::Group* createChildNodes(const osg::Vec4i& key, const osgDB::Options* options);
+
+        /** Create box of the loaded brick image, with the value range of whole volume */
+        osg::Geode* createBrickGeode(const osg::Vec4i& key, osg::Image* image, float invalidValue) const;
+
+        /** Get the index and brick key from database options of a paged brick */
+        static VolumeBrickIndex* getFromOptions(const osgDB::Options* options, osg::Vec4i& key);
+        static bool isChildrenFile(const std::string& name);
+
+    protected:
+        osg::PagedLOD* createBrickNode(const osg::Vec4i& key, const osgDB::Options* options);
+
+        std::map<osg::Vec4i, osg::Vec2> _bricks;
+        osg::Vec3i _volumeSize; osg::Vec2 _valueRange;
+        std::string _prefix, _extension;
+        float _rangeFactor; int _brickSize, _numLevels;
+    };
+
     /** Some web-related helper functions and algorithms */
     struct OSGVERSE_RW_EXPORT WebAuxiliary
     {
@@ -8,6 +8,8 @@
 #include <osg/Depth>
 #include <osg/Texture1D>
 #include <osg/Texture2D>
+#include <osg/Texture3D>
+#include <osg/ShapeDrawable>
 #include <osg/Multisample>
 #include <osg/Material>
 #include <osg/PolygonOffset>
@@ -18,6 +20,7 @@
 #include <sstream>
 #include <iomanip>
 #include <cctype>
+#include <cfloat>
 
 #include "pipeline/Global.h"
 #include "pipeline/Utilities.h"
@@ -491,6 +494,186 @@ namespace osgVerse
         return yuvData;
     }
 
+    osg::Geode* createVolumeBrick(osg::Image* image, const osg::Vec3& origin, const osg::Vec3& size,
+                                  const osg::Vec3& valueRange)
+    {
+        osg::ref_ptr<osg::Texture3D> tex3D = new osg::Texture3D;
+        tex3D->setFilter(osg::Texture3D::MIN_FILTER, osg::Texture3D::LINEAR);
+        tex3D->setFilter(osg::Texture3D::MAG_FILTER, osg::Texture3D::LINEAR);
+        tex3D->setWrap(osg::Texture3D::WRAP_S, osg::Texture3D::CLAMP_TO_EDGE);
+        tex3D->setWrap(osg::Texture3D::WRAP_T, osg::Texture3D::CLAMP_TO_EDGE);
+        tex3D->setWrap(osg::Texture3D::WRAP_R, osg::Texture3D::CLAMP_TO_EDGE);
+        tex3D->setResizeNonPowerOfTwoHint(false); tex3D->setImage(image);
+
+        osg::Geode* geode = new osg::Geode;
+        geode->addDrawable(new osg::ShapeDrawable(new osg::Box(origin + size * 0.5f, size[0], size[1], size[2])));
+        osg::StateSet* ss = geode->getOrCreateStateSet();
+        ss->setTextureAttributeAndModes(0, tex3D.get());
+        ss->addUniform(new osg::Uniform("VolumeTexture", (int)0));
+        ss->addUniform(new osg::Uniform("BoundingMin", origin));
+        ss->addUniform(new osg::Uniform("BoundingMax", origin + size));
+        ss->addUniform(new osg::Uniform("ValueRange", valueRange));
+        geode->setInitialBound(osg::BoundingSphere(osg::BoundingBox(origin, origin + size)));
+        return geode;
+    }
+
+    VolumeBrickIndex::VolumeBrickIndex(const osg::Vec3i& volumeSize, int brickSize, float rangeFactor)
+    :   _volumeSize(volumeSize), _valueRange(FLT_MAX, -FLT_MAX), _extension("brick"),
+        _rangeFactor(rangeFactor), _brickSize(osg::maximum(brickSize, 2)), _numLevels(1)
+    {
+        int maxSize = osg::maximum(volumeSize[0], osg::maximum(volumeSize[1], volumeSize[2]));
+        while ((_brickSize << (_numLevels - 1)) < maxSize) _numLevels++;
+    }
+
+    void VolumeBrickIndex::addVoxelRange(const osg::Vec3i& v0, const osg::Vec3i& v1, float minV, float maxV)
+    {
+        // Voxel v is read by brick (v / size), and also by the previous brick as its border if on boundary
+        osg::Vec3i b0, b1;
+        for (int a = 0; a < 3; ++a)
+        {
+            b0[a] = osg::maximum(v0[a] - 1, 0) / _brickSize;
+            b1[a] = osg::minimum(v1[a], _volumeSize[a] - 1) / _brickSize;
+        }
+
+        for (int z = b0.z(); z <= b1.z(); ++z)
+            for (int y = b0.y(); y <= b1.y(); ++y)
+                for (int x = b0.x(); x <= b1.x(); ++x) addBrick(osg::Vec3i(x, y, z), minV, maxV);
+    }
+
+    void VolumeBrickIndex::addBrick(const osg::Vec3i& brick, float minV, float maxV)
+    {
+        osg::Vec4i key(brick.x(), brick.y(), brick.z(), 0);
+        std::map<osg::Vec4i, osg::Vec2>::iterator itr = _bricks.find(key);
+        if (itr == _bricks.end()) _bricks[key] = osg::Vec2(minV, maxV);
+        else itr->second.set(osg::minimum(itr->second[0], minV), osg::maximum(itr->second[1], maxV));
+        _valueRange.set(osg::minimum(_valueRange[0], minV), osg::maximum(_valueRange[1], maxV));
+    }
+
+    void VolumeBrickIndex::buildLevels()
+    {
+        for (int level = 1; level < _numLevels; ++level)
+        {
+            std::map<osg::Vec4i, osg::Vec2> parents;
+            for (std::map<osg::Vec4i, osg::Vec2>::iterator itr = _bricks.begin(); itr != _bricks.end(); ++itr)
+            {
+                const osg::Vec4i& k = itr->first; if (k.w() != level - 1) continue;
+                osg::Vec4i parent(k.x() >> 1, k.y() >> 1, k.z() >> 1, level);
+                std::map<osg::Vec4i, osg::Vec2>::iterator pi = parents.find(parent);
+                if (pi == parents.end()) parents[parent] = itr->second;
+                else pi->second.set(osg::minimum(pi->second[0], itr->second[0]),
+                                    osg::maximum(pi->second[1], itr->second[1]));
+            }
+            _bricks.insert(parents.begin(), parents.end());
+        }
+    }
+
+    void VolumeBrickIndex::getBrickExtent(const osg::Vec4i& key, osg::Vec3i& v0, osg::Vec3i& v1, int& stride) const
+    {
+        stride = 1 << key.w(); int extent = _brickSize * stride;
+        for (int a = 0; a < 3; ++a)
+        { v0[a] = key[a] * extent; v1[a] = osg::minimum(v0[a] + extent, _volumeSize[a] - 1); }
+    }
+
+    osg::Vec3i VolumeBrickIndex::getBrickImageSize(const osg::Vec4i& key) const
+    {
+        osg::Vec3i v0, v1, dim; int stride = 1; getBrickExtent(key, v0, v1, stride);
+        for (int a = 0; a < 3; ++a) dim[a] = (v1[a] - v0[a]) / stride + 1;
+        return dim;
+    }
+
+    bool VolumeBrickIndex::getBrickRange(const osg::Vec4i& key, osg::Vec2& range) const
+    {
+        std::map<osg::Vec4i, osg::Vec2>::const_iterator itr = _bricks.find(key);
+        if (itr == _bricks.end()) return false; range = itr->second; return true;
+    }
+
+    unsigned int VolumeBrickIndex::getNumBricks(int level) const
+    {
+        unsigned int num = 0;
+        for (std::map<osg::Vec4i, osg::Vec2>::const_iterator itr = _bricks.begin(); itr != _bricks.end(); ++itr)
+        { if (itr->first.w() == level) num++; }
+        return num;
+    }
+
+    osg::Group* VolumeBrickIndex::createRootNode(const osgDB::Options* options)
+    {
+        osg::Group* root = new osg::Group;
+        for (std::map<osg::Vec4i, osg::Vec2>::iterator itr = _bricks.begin(); itr != _bricks.end(); ++itr)
+        { if (itr->first.w() == _numLevels - 1) root->addChild(createBrickNode(itr->first, options)); }
+        root->setUserValue("VolumeSize", osg::Vec3(_volumeSize[0], _volumeSize[1], _volumeSize[2]));
+        root->setUserValue("VolumeMinValue", _valueRange[0]);
+        root->setUserValue("VolumeMaxValue", _valueRange[1]);
+        return root;
+    }
+
+    osg::Group* VolumeBrickIndex::createChildNodes(const osg::Vec4i& key, const osgDB::Options* options)
+    {
+        osg::Group* group = new osg::Group; if (key.w() < 1) return group;
+        for (int c = 0; c < 8; ++c)
+        {
+            osg::Vec4i child(key.x() * 2 + (c & 1), key.y() * 2 + ((c >> 1) & 1),
+                             key.z() * 2 + (c >> 2), key.w() - 1);
+            if (_bricks.find(child) != _bricks.end()) group->addChild(createBrickNode(child, options));
+        }
+        return group;
+    }
+
+    osg::PagedLOD* VolumeBrickIndex::createBrickNode(const osg::Vec4i& key, const osgDB::Options* options)
+    {
+        osg::Vec3i v0, v1; int stride = 1; getBrickExtent(key, v0, v1, stride);
+        osg::BoundingBox bb(osg::Vec3(v0[0], v0[1], v0[2]), osg::Vec3(v1[0] + 1, v1[1] + 1, v1[2] + 1));
+        std::stringstream ss; ss << _prefix << "_" << key.w() << "_" << key.x() << "_" << key.y() << "_" << key.z();
+
+        osg::ref_ptr<osgDB::Options> brickOpt = options ? options->cloneOptions() : new osgDB::Options;
+        brickOpt->setUserData(this);
+        brickOpt->setPluginStringData("BrickKey", std::to_string(key.x()) + " " + std::to_string(key.y()) + " "
+                                      + std::to_string(key.z()) + " " + std::to_string(key.w()));
+
+        osg::PagedLOD* plod = new osg::PagedLOD; osg::Vec2 range; getBrickRange(key, range);
+        plod->setName(ss.str()); plod->setDatabaseOptions(brickOpt.get());
+        plod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+        plod->setCenter(bb.center()); plod->setRadius(bb.radius());
+        plod->setUserValue("BrickMinValue", range[0]); plod->setUserValue("BrickMaxValue", range[1]);
+        if (key.w() > 0)
+        {
+            float splitRange = bb.radius() * _rangeFactor;
+            plod->setFileName(0, ss.str() + "." + _extension); plod->setRange(0, splitRange, FLT_MAX);
+            plod->setFileName(1, ss.str() + ".children." + _extension); plod->setRange(1, 0.0f, splitRange);
+        }
+        else
+        { plod->setFileName(0, ss.str() + "." + _extension); plod->setRange(0, 0.0f, FLT_MAX); }
+        return plod;
+    }
+
+    osg::Geode* VolumeBrickIndex::createBrickGeode(const osg::Vec4i& key, osg::Image* image, float invalidValue) const
+    {
+        // The box covers voxels of the brick without the border (which belongs to next bricks)
+        osg::Vec3i v0, v1; int stride = 1; getBrickExtent(key, v0, v1, stride);
+        osg::Vec3 origin(v0[0], v0[1], v0[2]), size;
+        for (int a = 0; a < 3; ++a) size[a] = osg::minimum(_brickSize * stride, v1[a] - v0[a] + 1);
+
+        osg::Vec2 range = _valueRange; if (!(range[0] < range[1])) range.set(0.0f, 1.0f);
+        osg::Geode* geode = createVolumeBrick(image, origin, size, osg::Vec3(range[0], range[1] - range[0], invalidValue));
+        std::map<osg::Vec4i, osg::Vec2>::const_iterator itr = _bricks.find(key);
+        if (itr != _bricks.end())
+        {
+            geode->setUserValue("BrickMinValue", itr->second[0]);
+            geode->setUserValue("BrickMaxValue", itr->second[1]);
+        }
+        return geode;
+    }
+
+    VolumeBrickIndex* VolumeBrickIndex::getFromOptions(const osgDB::Options* options, osg::Vec4i& key)
+    {
+        if (!options) return NULL;
+        VolumeBrickIndex* index = dynamic_cast<VolumeBrickIndex*>(const_cast<osg::Referenced*>(options->getUserData()));
+        std::stringstream ss(options->getPluginStringData("BrickKey"));
+        if (!(ss >> key[0] >> key[1] >> key[2] >> key[3])) return NULL; return index;
+    }
+
+    bool VolumeBrickIndex::isChildrenFile(const std::string& name)
+    { return osgDB::getLowerCaseFileExtension(osgDB::getNameLessExtension(name)) == "children"; }
+
     std::vector<unsigned char> loadFileData(const std::string& url, std::string& mimeType, std::string& encodingType,
                                             const std::vector<std::string>& reqHeaders)
     {
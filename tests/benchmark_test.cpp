@@ -0,0 +1,492 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geometry>
+#include <osg/Geode>
+#include <osg/PagedLOD>
+#include <osg/MatrixTransform>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+
+#include <VerseCommon.h>
+#include <modeling/Utilities.h>
+#include <pipeline/Rasterizer.h>
+#include <readerwriter/Utilities.h>
+#include <readerwriter/TileCallback.h>
+#include <readerwriter/DatabasePager.h>
+#include <parallel_radix_sort.h>
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+USE_VERSE_PLUGINS()
+#endif
+
+#ifndef _DEBUG
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+#endif
+
+/* Headless benchmark suite of core CPU paths. No window or graphics context is created, and synthetic
+   workloads use fixed random seeds so that results are repeatable between runs and builds.
+   Examples:
+     osgVerse_Test_Benchmark --csv baseline.csv
+     osgVerse_Test_Benchmark --baseline baseline.csv --tolerance 0.1 --json results.json
+     osgVerse_Test_Benchmark --run ply_parse,glb_parse --ply bunny.ply --glb scene.glb */
+
+struct Workload : public osg::Referenced
+{
+    /** Prepare data, return false to skip the workload (e.g., required file not provided) */
+    virtual bool setup() = 0;
+
+    /** Called before each iteration and not timed, to restore input data */
+    virtual void reset() {}
+
+    /** The timed workload */
+    virtual void run() = 0;
+
+    std::string name, description;
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    std::vector<double> samples;  // in milliseconds, sorted
+
+    double percentile(double p) const
+    {
+        if (samples.empty()) return 0.0;
+        double pos = p * (samples.size() - 1); size_t i0 = (size_t)floor(pos);
+        size_t i1 = osg::minimum(i0 + 1, samples.size() - 1); double r = pos - (double)i0;
+        return samples[i0] * (1.0 - r) + samples[i1] * r;
+    }
+
+    double mean() const
+    {
+        double sum = 0.0; if (samples.empty()) return 0.0;
+        for (size_t i = 0; i < samples.size(); ++i) sum += samples[i];
+        return sum / samples.size();
+    }
+};
+
+static osg::Geometry* createGridMesh(const osg::Vec3& origin, int numX, int numY, bool duplicated)
+{
+    // A wavy height-field; duplicated mode writes 6 separated vertices per cell (welding input)
+    std::mt19937 rng(numX * 1000 + numY); std::uniform_real_distribution<float> noise(0.0f, 0.2f);
+    std::vector<osg::Vec3> grid((numX + 1) * (numY + 1));
+    for (int y = 0; y <= numY; ++y)
+        for (int x = 0; x <= numX; ++x)
+            grid[y * (numX + 1) + x] = origin + osg::Vec3(x, y, sinf(x * 0.1f) * cosf(y * 0.1f) + noise(rng));
+
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> na = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> ta = new osg::Vec2Array;
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    if (!duplicated)
+    {
+        va->assign(grid.begin(), grid.end()); na->assign(grid.size(), osg::Z_AXIS);
+        for (size_t i = 0; i < grid.size(); ++i)
+            ta->push_back(osg::Vec2((i % (numX + 1)) / (float)numX, (i / (numX + 1)) / (float)numY));
+    }
+
+    for (int y = 0; y < numY; ++y)
+        for (int x = 0; x < numX; ++x)
+        {
+            int i0 = y * (numX + 1) + x, i1 = i0 + 1, i2 = i0 + numX + 1, i3 = i2 + 1;
+            int quad[6] = { i0, i1, i3, i0, i3, i2 };
+            for (int k = 0; k < 6; ++k)
+            {
+                if (!duplicated) { de->push_back(quad[k]); continue; }
+                va->push_back(grid[quad[k]]); na->push_back(osg::Z_AXIS);
+                ta->push_back(osg::Vec2((quad[k] % (numX + 1)) / (float)numX, (quad[k] / (numX + 1)) / (float)numY));
+                de->push_back(va->size() - 1);
+            }
+        }
+
+    osg::Geometry* geom = new osg::Geometry;
+    geom->setVertexArray(va.get()); geom->setTexCoordArray(0, ta.get());
+    geom->setNormalArray(na.get()); geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    geom->addPrimitiveSet(de.get()); return geom;
+}
+
+static osg::Node* createGridScene(int numMeshes, int cellsPerMesh, bool duplicated)
+{
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    for (int i = 0; i < numMeshes; ++i)
+    {
+        osg::Vec3 origin((i % 8) * cellsPerMesh, (i / 8) * cellsPerMesh, 0.0f);
+        geode->addDrawable(createGridMesh(origin, cellsPerMesh, cellsPerMesh, duplicated));
+    }
+    return geode.release();
+}
+
+/// Same depth-key computing and radix sorting as GaussianSortThread
+struct GaussianSortWorkload : public Workload
+{
+    std::vector<osg::Vec3> positions; std::vector<GLuint> indices, keys;
+    int numSplats, frame;
+    GaussianSortWorkload(int n) : numSplats(n), frame(0) {}
+
+    virtual bool setup()
+    {
+        std::mt19937 rng(1024); std::normal_distribution<float> dist(0.0f, 50.0f);
+        positions.resize(numSplats); indices.resize(numSplats); keys.resize(numSplats);
+        for (int i = 0; i < numSplats; ++i) positions[i].set(dist(rng), dist(rng), dist(rng) * 0.2f);
+        return true;
+    }
+
+    virtual void reset()
+    { for (int i = 0; i < numSplats; ++i) indices[i] = i; frame++; }
+
+    virtual void run()
+    {
+        double angle = frame * 0.1; osg::Vec3 eye(cos(angle) * 300.0, sin(angle) * 300.0, 50.0);
+        osg::Matrix localToEye = osg::Matrix::lookAt(eye, osg::Vec3(), osg::Z_AXIS);
+        for (size_t i = 0; i < indices.size(); ++i)
+        {   // comparing floating-point numbers as integers
+            float d = (positions[indices[i]] * localToEye).z();
+            union { float f; uint32_t u; } un = { (d > 0.0f ? 0.0f : (-d)) };
+            keys[i] = (GLuint)un.u;
+        }
+        parallel_radix_sort::SortPairs(&keys[0], &indices[0], keys.size());
+    }
+};
+
+struct OcclusionRasterWorkload : public Workload
+{
+    osg::ref_ptr<osgVerse::UserRasterizer> rasterizer;
+    std::vector<osg::BoundingBoxf> queryBoxes;
+    std::vector<float> depthData; std::vector<unsigned short> hizData;
+    std::vector<unsigned char> queryResults;
+    int numBuildings, numThreads, frame; float radius;
+    OcclusionRasterWorkload(int n, int t) : numBuildings(n), numThreads(t), frame(0), radius(0.0f) {}
+
+    virtual bool setup()
+    {
+        rasterizer = new osgVerse::UserRasterizer(1280, 720);
+        rasterizer->setNumThreads(numThreads);
+        int gridSize = (int)ceil(sqrt((double)numBuildings)); std::mt19937 rng(1024);
+        for (int i = 0; i < numBuildings; ++i)
+        {
+            osg::Vec3 c((i % gridSize - gridSize * 0.5f) * 40.0f, (i / gridSize - gridSize * 0.5f) * 40.0f, 0.0f);
+            osg::Vec3 h(5.0f + rng() % 10, 5.0f + rng() % 10, 10.0f + rng() % 120);
+            std::vector<osg::Vec3> vertices = {
+                c + osg::Vec3(-h[0], -h[1], 0.0f), c + osg::Vec3(h[0], -h[1], 0.0f),
+                c + osg::Vec3(h[0], h[1], 0.0f), c + osg::Vec3(-h[0], h[1], 0.0f),
+                c + osg::Vec3(-h[0], -h[1], h[2]), c + osg::Vec3(h[0], -h[1], h[2]),
+                c + osg::Vec3(h[0], h[1], h[2]), c + osg::Vec3(-h[0], h[1], h[2]) };
+            std::vector<unsigned int> indices = {
+                0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+                1, 2, 6, 1, 6, 5,  2, 3, 7, 2, 7, 6,  3, 0, 4, 3, 4, 7 };
+            rasterizer->addOccluder(new osgVerse::UserOccluder("Building" + std::to_string(i), vertices, indices));
+            queryBoxes.push_back(osg::BoundingBoxf(c - osg::Vec3(4.0f, 4.0f, 0.0f), c + osg::Vec3(4.0f, 4.0f, 8.0f)));
+        }
+        radius = gridSize * 10.0f; return true;
+    }
+
+    virtual void run()
+    {
+        double angle = osg::PI * 2.0 * (frame++ % 100) / 100.0;
+        osg::Vec3 eye(cos(angle) * radius, sin(angle) * radius, 30.0f);
+        rasterizer->setModelViewProjection(osg::Matrix::lookAt(eye, osg::Vec3(0.0f, 0.0f, 20.0f), osg::Z_AXIS),
+                                           osg::Matrix::perspective(60.0, 1280.0 / 720.0, 1.0, 10000.0));
+        rasterizer->render(eye, &depthData, &hizData);
+        rasterizer->queryVisibility(queryBoxes, queryResults);
+    }
+};
+
+struct TextureCompressWorkload : public Workload
+{
+    osg::ref_ptr<osg::Image> image; int size;
+    TextureCompressWorkload(int s) : size(s) {}
+
+    virtual bool setup()
+    {
+        image = new osg::Image; image->allocateImage(size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        std::mt19937 rng(1024); unsigned char* ptr = image->data();
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x, ptr += 4)
+            {   // gradients with some noise, closer to real textures than pure noise
+                ptr[0] = (unsigned char)((x * 255) / size); ptr[1] = (unsigned char)((y * 255) / size);
+                ptr[2] = (unsigned char)(rng() % 64 + 96); ptr[3] = (unsigned char)(((x / 16 + y / 16) % 2) * 255);
+            }
+        return true;
+    }
+
+    virtual void run()
+    { osg::ref_ptr<osg::Image> result = osgVerse::compressImage(*image); }
+};
+
+struct TileGeometryWorkload : public Workload
+{
+    osg::ref_ptr<osg::Texture2D> elevation; int numTiles;
+    TileGeometryWorkload(int n) : numTiles(n) {}
+
+    virtual bool setup()
+    {
+        osg::ref_ptr<osg::Image> image = new osg::Image;
+        image->allocateImage(256, 256, 1, GL_LUMINANCE, GL_FLOAT);
+        float* ptr = (float*)image->data();
+        for (int y = 0; y < 256; ++y)
+            for (int x = 0; x < 256; ++x) *(ptr++) = 500.0f * sinf(x * 0.05f) * cosf(y * 0.07f);
+        elevation = new osg::Texture2D(image.get()); return true;
+    }
+
+    virtual void run()
+    {
+        for (int i = 0; i < numTiles; ++i)
+        {
+            osg::ref_ptr<osgVerse::TileCallback> tileCB = new osgVerse::TileCallback;
+            tileCB->setFlatten(false); tileCB->setTileNumber(3200 + i % 8, 1600 + i / 8, 12);
+
+            osg::Vec3d tileMin, tileMax; double tileW = 0.0, tileH = 0.0; osg::Matrix matrix;
+            tileCB->computeTileExtent(tileMin, tileMax, tileW, tileH);
+            osg::ref_ptr<osg::Geometry> geom = tileCB->createTileGeometry(
+                matrix, elevation.get(), tileMin, tileMax, tileW, tileH);
+        }
+    }
+};
+
+struct FileParseWorkload : public Workload
+{
+    std::string fileName, pseudoExtension;
+    osg::ref_ptr<osgDB::Options> options;
+    std::function<osg::Node* ()> creator;
+
+    virtual bool setup()
+    {
+        options = new osgDB::Options; options->setObjectCacheHint(osgDB::Options::CACHE_NONE);
+        if (!osgDB::fileExists(fileName))
+        {
+            if (!creator) return false;  // file-based only
+            osg::ref_ptr<osg::Node> node = creator();
+            if (!node || !osgDB::writeNodeFile(*node, fileName + pseudoExtension)) return false;
+        }
+        description = fileName; return true;
+    }
+
+    virtual void run()
+    { osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(fileName + pseudoExtension, options.get()); }
+};
+
+struct MeshWeldWorkload : public Workload
+{
+    osg::ref_ptr<osg::Node> scene; int numMeshes, cellsPerMesh;
+    MeshWeldWorkload(int n, int c) : numMeshes(n), cellsPerMesh(c) {}
+
+    virtual bool setup()
+    { scene = createGridScene(numMeshes, cellsPerMesh, true); return scene.valid(); }
+
+    virtual void run()
+    {
+        osgVerse::MeshCollector collector;
+        collector.setWeldingVertices(true);
+        scene->accept(collector);
+    }
+};
+
+/// Pager exposing merging of synthetic requests without running loader threads
+class BenchmarkPager : public osgVerse::DatabasePager
+{
+public:
+    void addLoadedRequest(osg::PagedLOD* parent, osg::Node* loaded, const std::string& fileName)
+    {
+        osg::ref_ptr<DatabaseRequest> request = new DatabaseRequest;
+        request->_valid = true; request->_fileName = fileName;
+        request->_group = parent; request->_loadedModel = loaded;
+        _dataToMergeList->add(request.get());
+    }
+};
+
+struct PagerMergeWorkload : public Workload
+{
+    osg::ref_ptr<BenchmarkPager> pager; osg::ref_ptr<osg::FrameStamp> frameStamp;
+    osg::ref_ptr<osg::Group> root; osg::ref_ptr<osg::Geometry> sharedGeometry;
+    int numRequests;
+    PagerMergeWorkload(int n) : numRequests(n) {}
+
+    virtual bool setup()
+    {
+        pager = new BenchmarkPager; frameStamp = new osg::FrameStamp;
+        sharedGeometry = createGridMesh(osg::Vec3(), 16, 16, false); return true;
+    }
+
+    virtual void reset()
+    {
+        root = new osg::Group; frameStamp->setFrameNumber(frameStamp->getFrameNumber() + 1);
+        frameStamp->setReferenceTime(frameStamp->getReferenceTime() + 0.016);
+        for (int i = 0; i < numRequests; ++i)
+        {
+            osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+            osg::ref_ptr<osg::Geode> coarse = new osg::Geode; coarse->addDrawable(sharedGeometry.get());
+            plod->addChild(coarse.get(), 100.0f, FLT_MAX);
+            plod->setFileName(1, "tile_" + std::to_string(i) + ".osgb"); plod->setRange(1, 0.0f, 100.0f);
+            root->addChild(plod.get());
+
+            // Loaded tile contains further paged children, to exercise PagedLOD registering as well
+            osg::ref_ptr<osg::Group> loaded = new osg::Group;
+            for (int j = 0; j < 4; ++j)
+            {
+                osg::ref_ptr<osg::PagedLOD> child = new osg::PagedLOD;
+                osg::ref_ptr<osg::Geode> geode = new osg::Geode; geode->addDrawable(sharedGeometry.get());
+                child->addChild(geode.get(), 50.0f, FLT_MAX);
+                child->setFileName(1, "tile_" + std::to_string(i) + "_" + std::to_string(j) + ".osgb");
+                child->setRange(1, 0.0f, 50.0f); loaded->addChild(child.get());
+            }
+            pager->addLoadedRequest(plod.get(), loaded.get(), plod->getFileName(1));
+        }
+    }
+
+    virtual void run()
+    { pager->addLoadedDataToSceneGraph_Verse(*frameStamp); }
+};
+
+static bool readBaseline(const std::string& file, std::map<std::string, double>& medians)
+{
+    std::ifstream in(file.c_str()); std::string line;
+    if (!in) return false; std::getline(in, line);  // header
+    while (std::getline(in, line))
+    {
+        std::vector<std::string> values; osgDB::split(line, values, ',');
+        if (values.size() > 4) medians[values[0]] = atof(values[4].c_str());
+    }
+    return !medians.empty();
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments = osgVerse::globalInitialize(argc, argv, osgVerse::defaultInitParameters());
+    osgVerse::updateOsgBinaryWrappers();
+
+    int numIterations = 20, numWarmups = 2, numThreads = (int)OpenThreads::GetNumberOfProcessors();
+    std::string runList, jsonFile, csvFile, baselineFile, plyFile, glbFile, tilesetFile;
+    std::string tempDir = osgDB::getCurrentWorkingDirectory(); double tolerance = 0.1;
+    arguments.read("--iterations", numIterations); arguments.read("--warmups", numWarmups);
+    arguments.read("--threads", numThreads); arguments.read("--run", runList);
+    arguments.read("--json", jsonFile); arguments.read("--csv", csvFile);
+    arguments.read("--baseline", baselineFile); arguments.read("--tolerance", tolerance);
+    arguments.read("--temp", tempDir); arguments.read("--ply", plyFile);
+    arguments.read("--glb", glbFile); arguments.read("--tileset", tilesetFile);
+    numIterations = osg::maximum(numIterations, 1); numWarmups = osg::maximum(numWarmups, 0);
+
+    std::vector<osg::ref_ptr<Workload>> workloads;
+    workloads.push_back(new GaussianSortWorkload(1000000));
+    workloads.back()->name = "gaussian_sort"; workloads.back()->description = "1M splats";
+    workloads.push_back(new OcclusionRasterWorkload(4000, numThreads));
+    workloads.back()->name = "occlusion_raster"; workloads.back()->description = "4000 occluders, 1280x720";
+    workloads.push_back(new TextureCompressWorkload(2048));
+    workloads.back()->name = "bc_compress"; workloads.back()->description = "2048x2048 RGBA to BC3";
+    workloads.push_back(new TileGeometryWorkload(16));
+    workloads.back()->name = "tile_geometry"; workloads.back()->description = "16 globe tiles";
+    workloads.push_back(new MeshWeldWorkload(16, 128));
+    workloads.back()->name = "mesh_weld"; workloads.back()->description = "16 grids of 128x128 cells";
+    workloads.push_back(new PagerMergeWorkload(500));
+    workloads.back()->name = "pager_merge"; workloads.back()->description = "500 requests";
+
+    osg::ref_ptr<FileParseWorkload> plyParse = new FileParseWorkload;
+    plyParse->name = "ply_parse"; plyParse->pseudoExtension = ".verse_mesh";
+    plyParse->fileName = plyFile.empty() ? (tempDir + "/verse_benchmark.ply") : plyFile;
+    if (plyFile.empty()) plyParse->creator = []() { return createGridScene(1, 512, false); };
+    workloads.push_back(plyParse.get());
+
+    osg::ref_ptr<FileParseWorkload> glbParse = new FileParseWorkload;
+    glbParse->name = "glb_parse"; glbParse->pseudoExtension = ".verse_gltf";
+    glbParse->fileName = glbFile.empty() ? (tempDir + "/verse_benchmark.glb") : glbFile;
+    if (glbFile.empty()) glbParse->creator = []() { return createGridScene(16, 128, false); };
+    workloads.push_back(glbParse.get());
+
+    osg::ref_ptr<FileParseWorkload> tilesParse = new FileParseWorkload;
+    tilesParse->name = "3dtiles_parse"; tilesParse->pseudoExtension = ".verse_tiles";
+    tilesParse->fileName = tilesetFile;  // no synthetic data: skipped if not provided
+    workloads.push_back(tilesParse.get());
+
+    std::vector<std::string> selected;
+    if (!runList.empty()) osgDB::split(runList, selected, ',');
+
+    std::vector<BenchmarkResult> results;
+    for (size_t w = 0; w < workloads.size(); ++w)
+    {
+        Workload* workload = workloads[w].get();
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), workload->name) == selected.end())
+            continue;
+        if (!workload->setup())
+        { std::cout << "[Benchmark] " << workload->name << ": skipped (no input data)\n"; continue; }
+
+        BenchmarkResult result; result.name = workload->name;
+        for (int i = 0; i < numWarmups + numIterations; ++i)
+        {
+            workload->reset();
+            osg::Timer_t t0 = osg::Timer::instance()->tick(); workload->run();
+            double t = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+            if (i >= numWarmups) result.samples.push_back(t);
+        }
+        std::sort(result.samples.begin(), result.samples.end());
+        results.push_back(result);
+
+        std::cout << "[Benchmark] " << std::left << std::setw(18) << result.name << std::right << std::fixed
+                  << std::setprecision(3) << " min = " << result.samples.front() << "ms, p50 = "
+                  << result.percentile(0.5) << "ms, p90 = " << result.percentile(0.9) << "ms, p99 = "
+                  << result.percentile(0.99) << "ms (" << workload->description << ")" << std::endl;
+    }
+
+    if (!csvFile.empty())
+    {
+        std::ofstream out(csvFile.c_str());
+        out << "name,iterations,min,mean,p50,p90,p99,max\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const BenchmarkResult& r = results[i];
+            out << r.name << "," << r.samples.size() << "," << r.samples.front() << "," << r.mean() << ","
+                << r.percentile(0.5) << "," << r.percentile(0.9) << "," << r.percentile(0.99) << ","
+                << r.samples.back() << "\n";
+        }
+    }
+
+    if (!jsonFile.empty())
+    {
+        std::ofstream out(jsonFile.c_str());
+        out << "{\n  \"iterations\": " << numIterations << ",\n  \"threads\": " << numThreads
+            << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const BenchmarkResult& r = results[i];
+            out << "    { \"name\": \"" << r.name << "\", \"min\": " << r.samples.front() << ", \"mean\": "
+                << r.mean() << ", \"p50\": " << r.percentile(0.5) << ", \"p90\": " << r.percentile(0.9)
+                << ", \"p99\": " << r.percentile(0.99) << ", \"max\": " << r.samples.back() << " }"
+                << (i < results.size() - 1 ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+
+    // Compare medians with a saved baseline (CSV written by --csv), failing on regressions
+    int numRegressions = 0;
+    if (!baselineFile.empty())
+    {
+        std::map<std::string, double> baseline;
+        if (!readBaseline(baselineFile, baseline))
+        { std::cout << "[Benchmark] Failed to read baseline " << baselineFile << std::endl; return 1; }
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            std::map<std::string, double>::iterator itr = baseline.find(results[i].name);
+            if (itr == baseline.end() || itr->second <= 0.0) continue;
+
+            double ratio = results[i].percentile(0.5) / itr->second;
+            bool regressed = ratio > (1.0 + tolerance); if (regressed) numRegressions++;
+            std::cout << "[Benchmark] " << std::left << std::setw(18) << results[i].name << std::right
+                      << " p50 " << itr->second << "ms -> " << results[i].percentile(0.5) << "ms ("
+                      << std::showpos << (ratio - 1.0) * 100.0 << std::noshowpos << "%)"
+                      << (regressed ? " REGRESSION" : "") << std::endl;
+        }
+    }
+    return numRegressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#include <osg/io_utils>
+#include <osg/ArgumentParser>
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+
+#include <pipeline/DynamicResolution.h>
+#ifndef _DEBUG
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+#endif
+
+/** Synthetic GPU cost: resolution-dependent part scales with pixel count, plus a fixed part */
+struct CostModel
+{
+    double base, fixed, noise;
+    CostModel(double b, double f, double n = 0.05) : base(b), fixed(f), noise(n) {}
+
+    double compute(float scale) const
+    {
+        double r = (double)rand() / (double)RAND_MAX;
+        return (base * scale * scale + fixed) * (1.0 + noise * (2.0 * r - 1.0));
+    }
+};
+
+/** Without GPU timings, frame intervals are fed, optionally snapped to multiples of VSync interval */
+static unsigned int runFrames(osgVerse::DynamicResolutionController* controller, const CostModel& gpu,
+                              double cpuTime, bool gpuAvailable, int numFrames, double vsync = 0.0)
+{
+    unsigned int numChanges = 0;
+    for (int i = 0; i < numFrames; ++i)
+    {
+        double gpuTime = gpu.compute(controller->getScale()), interval = gpuTime + cpuTime;
+        if (vsync > 0.0) interval = ceil(interval / vsync) * vsync;
+        bool changed = gpuAvailable ? controller->update(cpuTime, gpuTime)
+                                    : controller->update(cpuTime, -1.0, interval);
+        if (changed) numChanges++;
+    }
+    return numChanges;
+}
+
+static void printState(const std::string& name, osgVerse::DynamicResolutionController* controller)
+{
+    std::cout << "[DynamicResolution] " << name << ": scale = " << controller->getScale()
+              << ", averaged frame time = " << controller->getAverageFrameTime() << "ms" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    double targetFrameTime = 1000.0 / 60.0; int numFrames = 600;
+    arguments.read("--target", targetFrameTime); arguments.read("--frames", numFrames);
+    srand(1234); bool passed = true;
+
+    osg::ref_ptr<osgVerse::DynamicResolutionController> controller =
+        new osgVerse::DynamicResolutionController;
+    controller->setTargetFrameTime(targetFrameTime);
+    double lower = targetFrameTime * controller->getLowerThreshold();
+    double upper = targetFrameTime * controller->getUpperThreshold();
+
+    // Heavy scene: should scale down into the hysteresis band
+    CostModel heavy(targetFrameTime * 1.8, 1.0);
+    runFrames(controller.get(), heavy, 4.0, true, numFrames);
+    float settledScale = controller->getScale();
+    printState("Converge", controller.get());
+    passed &= controller->isUsingGpuTiming() && settledScale < 1.0f &&
+              controller->getAverageFrameTime() <= upper;
+
+    // Same load: should not oscillate after settling
+    unsigned int numChanges = runFrames(controller.get(), heavy, 4.0, true, numFrames);
+    printState("Stable", controller.get());
+    passed &= numChanges == 0 && controller->getScale() == settledScale;
+
+    // Light scene: should recover to full resolution
+    CostModel light(targetFrameTime * 0.5, 1.0);
+    runFrames(controller.get(), light, 4.0, true, numFrames);
+    printState("Recover", controller.get());
+    passed &= controller->getScale() == controller->getMaxScale();
+
+    // CPU-bound: GPU in budget, so resolution should not be reduced
+    controller->reset();
+    runFrames(controller.get(), light, targetFrameTime * 1.5, true, numFrames);
+    printState("CPU-bound", controller.get());
+    passed &= controller->isCpuBound() && controller->getScale() == controller->getMaxScale();
+
+    // No timer queries: fall back to frame times
+    controller->reset();
+    runFrames(controller.get(), heavy, 0.0, false, numFrames);
+    printState("CPU fallback", controller.get());
+    passed &= !controller->isUsingGpuTiming() && controller->getScale() < 1.0f &&
+              controller->getAverageFrameTime() <= upper;
+
+    // No timer queries with VSync: intervals never drop below target, but scale should still recover
+    double vsync = 1000.0 / 60.0; controller->reset();
+    runFrames(controller.get(), heavy, 2.0, false, numFrames, vsync);
+    printState("VSync heavy", controller.get());
+    passed &= controller->getScale() < 1.0f;
+
+    // Failed probes should back off: less than one change per 4 sample windows
+    numChanges = runFrames(controller.get(), heavy, 2.0, false, numFrames * 4, vsync);
+    std::cout << "[DynamicResolution] VSync probing: " << numChanges << " changes in "
+              << numFrames * 4 << " frames" << std::endl;
+    passed &= numChanges * controller->getSampleWindow() < (unsigned int)numFrames;
+
+    // Recovering may wait for the backoff of last failed probes first
+    runFrames(controller.get(), light, 2.0, false, numFrames * 2, vsync);
+    printState("VSync recover", controller.get());
+    passed &= controller->getScale() == controller->getMaxScale();
+
+    std::cout << "[DynamicResolution] Hysteresis band: " << lower << "ms - " << upper << "ms" << std::endl;
+    if (!passed) std::cout << "[DynamicResolution] Scale does not follow the frame time" << std::endl;
+    return passed ? 0 : 1;
+}
@@ -136,11 +136,7 @@ osg::StateSet* createPbrStateSet(osgVerse::Pipeline* pipeline)
 
     osgVerse::LightModule* lm = static_cast<osgVerse::LightModule*>(pipeline->getModule("Light"));
     if (forwardSS.valid() && lm)
-    {
-        forwardSS->setTextureAttributeAndModes(7, lm->getParameterTable());
-        forwardSS->addUniform(new osg::Uniform("LightParameterMap", 7));
-        forwardSS->addUniform(lm->getLightNumber());
-    }
+        lm->applyTextureAndUniforms(forwardSS.get(), "LightParameterMap", 7);
     return forwardSS.release();
 }
 
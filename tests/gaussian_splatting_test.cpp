@@ -46,7 +46,8 @@ class QwertyManipulator : public osgGA::FirstPersonManipulator
 {
 public:
     QwertyManipulator(const osg::Vec3d& e)
-    :   osgGA::FirstPersonManipulator(), _presetEye(e), _animKeyTime(0.0), _animPlayTime(-1.0)
+    :   osgGA::FirstPersonManipulator(), _presetEye(e), _animKeyTime(0.0), _animPlayTime(-1.0),
+        _stoppingCapture(false)
     {
         setAllowThrow(false); setVerticalAxisFixed(true); setWheelMovement(0.05f, true);
         _outputCallback = new osgVerse::ScreenSnapshotCallback(false, 25);
@@ -126,17 +127,23 @@ protected:
 
             if (tEnd < t)
             {
-                osg::View* view = dynamic_cast<osg::View*>(&us);
-                view->getCamera()->setFinalDrawCallback(NULL);
-                _outputCallback->setCapturing(false); _animPlayTime = -1.0;
+                _outputCallback->setCapturing(false);
+                _animPlayTime = -1.0; _stoppingCapture = true;
             }
         }
+        else if (_stoppingCapture && _outputCallback->getNumPendingReadbacks() == 0)
+        {   // Remaining readbacks are mapped at the draw after capturing stops, then wait for encoders
+            osg::View* view = dynamic_cast<osg::View*>(&us);
+            view->getCamera()->setFinalDrawCallback(NULL);
+            _outputCallback->flush(); _stoppingCapture = false;
+        }
         return false;
     }
 
     osg::ref_ptr<osgVerse::ScreenSnapshotCallback> _outputCallback;
     osg::ref_ptr<osg::AnimationPath> _path; osg::Vec3d _presetEye;
     double _animKeyTime, _animPlayTime;
+    bool _stoppingCapture;
 };
 
 class GaussianStateVisitor : public osg::NodeVisitor
@@ -0,0 +1,142 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/Geometry>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
+#include <osg/ArgumentParser>
+#include <osgUtil/LineSegmentIntersector>
+#include <iostream>
+#include <random>
+
+#include <pipeline/IntersectionManager.h>
+#ifndef _DEBUG
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+#endif
+
+/** Wavy height-field of (num x num) cells, i.e., (2 * num * num) triangles */
+static osg::Geometry* createHeightField(int num)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    for (int y = 0; y <= num; ++y)
+        for (int x = 0; x <= num; ++x)
+            va->push_back(osg::Vec3(x, y, sinf(x * 0.1f) * cosf(y * 0.13f) * 5.0f));
+
+    for (int y = 0; y < num; ++y)
+        for (int x = 0; x < num; ++x)
+        {
+            int i0 = y * (num + 1) + x, i1 = i0 + 1, i2 = i0 + num + 1, i3 = i2 + 1;
+            de->push_back(i0); de->push_back(i1); de->push_back(i3);
+            de->push_back(i0); de->push_back(i3); de->push_back(i2);
+        }
+
+    osg::Geometry* geom = new osg::Geometry;
+    geom->setVertexArray(va.get()); geom->addPrimitiveSet(de.get());
+    return geom;
+}
+
+/** Reference results of osgUtil::LineSegmentIntersector without any BVH */
+static bool findReference(osg::Node* root, const osg::Vec3d& s, const osg::Vec3d& e,
+                          osgUtil::Intersector::IntersectionLimit limit,
+                          osgUtil::LineSegmentIntersector::Intersections& results)
+{
+    osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector =
+        new osgUtil::LineSegmentIntersector(osgUtil::Intersector::MODEL, s, e);
+    intersector->setIntersectionLimit(limit);
+    osgUtil::IntersectionVisitor iv(intersector.get()); root->accept(iv);
+    results = intersector->getIntersections();
+    return !results.empty();
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    int numCells = 200, numSegments = 2000; double tolerance = 1e-3;
+    arguments.read("--cells", numCells); arguments.read("--segments", numSegments);
+    arguments.read("--tolerance", tolerance);
+
+    // Two height-fields, the second one rotated and translated to check matrices
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(createHeightField(numCells));
+    osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform;
+    mt->setMatrix(osg::Matrix::rotate(0.3, osg::Z_AXIS) * osg::Matrix::translate(10.0, 5.0, 20.0));
+    mt->addChild(geode.get());
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    root->addChild(geode.get()); root->addChild(mt.get());
+
+    // Slanted segments from above to below, all starting inside the height-fields
+    std::mt19937 rng(1234); std::uniform_real_distribution<double> pos(5.0, numCells - 5.0), slant(-3.0, 3.0);
+    std::vector<std::pair<osg::Vec3d, osg::Vec3d>> segments(numSegments);
+    for (int i = 0; i < numSegments; ++i)
+    {
+        osg::Vec3d s(pos(rng), pos(rng), 50.0);
+        segments[i] = std::pair<osg::Vec3d, osg::Vec3d>(s, s + osg::Vec3d(slant(rng), slant(rng), -100.0));
+    }
+
+    // Reference first, then build BVHs at once so that all queries below use them
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    std::vector<osgUtil::LineSegmentIntersector::Intersections> nearest(numSegments), all(numSegments);
+    for (int i = 0; i < numSegments; ++i)
+        findReference(root.get(), segments[i].first, segments[i].second,
+                      osgUtil::Intersector::LIMIT_NEAREST, nearest[i]);
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    for (int i = 0; i < numSegments; ++i)
+        findReference(root.get(), segments[i].first, segments[i].second, osgUtil::Intersector::NO_LIMIT, all[i]);
+
+    osgVerse::setIntersectionBVHEnabled(true, 1000);
+    unsigned int numBVH = osgVerse::prepareIntersectionBVH(root.get());
+    bool passed = numBVH > 0;
+    std::cout << "[IntersectionBVH] Prepare: " << numBVH << " BVHs ready" << std::endl;
+
+    // Nearest hits: same drawable and world point
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+    std::vector<osgVerse::IntersectionResult> results(numSegments);
+    for (int i = 0; i < numSegments; ++i)
+        results[i] = osgVerse::findNearestIntersection(root.get(), segments[i].first, segments[i].second);
+    osg::Timer_t t3 = osg::Timer::instance()->tick();
+
+    unsigned int mismatches = 0;
+    for (int i = 0; i < numSegments; ++i)
+    {
+        const osgVerse::IntersectionResult& r = results[i];
+        if (nearest[i].empty() || r.intersectPoints.empty())
+        { if (nearest[i].empty() != r.intersectPoints.empty()) mismatches++; continue; }
+
+        const osgUtil::LineSegmentIntersector::Intersection& ref = *nearest[i].begin();
+        if (ref.drawable != r.drawable ||
+            (ref.getWorldIntersectPoint() - r.getWorldIntersectPoint()).length() > tolerance) mismatches++;
+    }
+    std::cout << "[IntersectionBVH] Nearest: " << mismatches << " mismatches" << std::endl;
+    passed &= (mismatches == 0);
+
+    // Batch query should return the same results in the same order
+    std::vector<osgVerse::IntersectionResult> batch = osgVerse::findNearestIntersections(root.get(), segments);
+    mismatches = 0;
+    for (int i = 0; i < numSegments; ++i)
+    {
+        if (batch[i].intersectPoints.size() != results[i].intersectPoints.size()) { mismatches++; continue; }
+        if (!batch[i].intersectPoints.empty() && (batch[i].getWorldIntersectPoint() -
+            results[i].getWorldIntersectPoint()).length() > tolerance) mismatches++;
+    }
+    std::cout << "[IntersectionBVH] Batch: " << mismatches << " mismatches" << std::endl;
+    passed &= (mismatches == 0);
+
+    // All hits: same number of intersections (both height-fields may be crossed)
+    mismatches = 0;
+    for (int i = 0; i < numSegments; ++i)
+    {
+        std::vector<osgVerse::IntersectionResult> hits =
+            osgVerse::findAllIntersections(root.get(), segments[i].first, segments[i].second);
+        if (hits.size() != all[i].size()) mismatches++;
+    }
+    std::cout << "[IntersectionBVH] All: " << mismatches << " mismatches" << std::endl;
+    passed &= (mismatches == 0);
+
+    std::cout << "[IntersectionBVH] " << numSegments << " nearest queries: osgUtil = "
+              << osg::Timer::instance()->delta_m(t0, t1) << "ms, BVH = "
+              << osg::Timer::instance()->delta_m(t2, t3) << "ms" << std::endl;
+    if (!passed) std::cout << "[IntersectionBVH] Results differ from osgUtil" << std::endl;
+    return passed ? 0 : 1;
+}
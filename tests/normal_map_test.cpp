@@ -0,0 +1,163 @@
+#include <osg/Timer>
+#include <osg/Texture2D>
+#include <osg/Geode>
+#include <osg/ArgumentParser>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <OpenThreads/Thread>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include <pipeline/Utilities.h>
+#ifndef _DEBUG
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+#endif
+
+#ifdef OSG_LIBRARY_STATIC
+USE_OSG_PLUGINS()
+#endif
+
+/** Random bumpy RGB image; all images use the same file name to check cache key collisions */
+static osg::Image* createDiffuseImage(int size, unsigned int seed)
+{
+    std::mt19937 rng(seed); std::uniform_int_distribution<int> noise(0, 255);
+    osg::Image* image = new osg::Image;
+    image->allocateImage(size, size, 1, GL_RGB, GL_UNSIGNED_BYTE);
+    for (int i = 0; i < size * size * 3; ++i) image->data()[i] = (unsigned char)noise(rng);
+    image->setFileName("diffuse.png"); return image;
+}
+
+static osg::Node* createScene(const std::vector<osg::ref_ptr<osg::Image>>& images, int stateSetsPerImage)
+{
+    osg::Geode* geode = new osg::Geode;
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        osg::ref_ptr<osg::Texture2D> tex = new osg::Texture2D(images[i].get());
+        for (int j = 0; j < stateSetsPerImage; ++j)
+        {
+            osg::Geometry* geom = new osg::Geometry;
+            geom->getOrCreateStateSet()->setTextureAttributeAndModes(0, tex.get());
+            geode->addDrawable(geom);
+        }
+    }
+    return geode;
+}
+
+static osg::Image* getMap(osg::Node* scene, unsigned int drawable, int unit)
+{
+    osg::StateSet* ss = scene->asGeode()->getDrawable(drawable)->getStateSet();
+    osg::Texture2D* tex = dynamic_cast<osg::Texture2D*>(ss->getTextureAttribute(unit, osg::StateAttribute::TEXTURE));
+    return tex ? tex->getImage() : NULL;
+}
+
+static bool sameImage(const osg::Image* a, const osg::Image* b)
+{
+    if (!a || !b || a->getTotalSizeInBytes() != b->getTotalSizeInBytes()) return false;
+    return memcmp(a->data(), b->data(), a->getTotalSizeInBytes()) == 0;
+}
+
+static unsigned int countCacheFiles(const std::string& folder)
+{
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(folder); unsigned int num = 0;
+    for (size_t i = 0; i < contents.size(); ++i) { if (contents[i][0] != '.') num++; }
+    return num;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    int numImages = 8, imageSize = 128; std::string cacheFolder = "normal_map_cache";
+    arguments.read("--images", numImages); arguments.read("--size", imageSize);
+    arguments.read("--cache", cacheFolder); double timeout = 60.0; arguments.read("--timeout", timeout);
+
+    osgDB::makeDirectory(cacheFolder);
+    osgDB::DirectoryContents oldFiles = osgDB::getDirectoryContents(cacheFolder);
+    for (size_t i = 0; i < oldFiles.size(); ++i)
+    { if (oldFiles[i][0] != '.') remove((cacheFolder + "/" + oldFiles[i]).c_str()); }
+
+    std::vector<osg::ref_ptr<osg::Image>> images;
+    for (int i = 0; i < numImages; ++i) images.push_back(createDiffuseImage(imageSize, 1000 + i));
+
+    // Serial reference, without cache
+    osg::ref_ptr<osg::Node> serialScene = createScene(images, 2);
+    {
+        osgVerse::NormalMapGenerator nmg; nmg.setNumThreads(1);
+        serialScene->accept(nmg);
+    }
+
+    // Parallel: same results, and each shared image processed once
+    osg::ref_ptr<osg::Node> parallelScene = createScene(images, 2);
+    {
+        osgVerse::NormalMapGenerator nmg; nmg.setNumThreads(4); nmg.setCacheFolder(cacheFolder);
+        parallelScene->accept(nmg);
+    }
+
+    bool passed = true, sameResults = true, sharedOnce = true;
+    for (int i = 0; i < numImages; ++i)
+    {
+        sameResults &= sameImage(getMap(serialScene.get(), i * 2, 1), getMap(parallelScene.get(), i * 2, 1));
+        sameResults &= sameImage(getMap(serialScene.get(), i * 2, 2), getMap(parallelScene.get(), i * 2, 2));
+        sharedOnce &= getMap(parallelScene.get(), i * 2, 1) == getMap(parallelScene.get(), i * 2 + 1, 1);
+    }
+    std::cout << "[NormalMap] Parallel: same as serial results = " << sameResults
+              << ", shared by state-sets of the same image = " << sharedOnce << std::endl;
+    passed &= sameResults && sharedOnce;
+
+    // Cache keys: images with the same file name must not collide
+    unsigned int numFiles = countCacheFiles(cacheFolder);
+    std::cout << "[NormalMap] Cache keys: " << numFiles << " files for " << numImages << " images" << std::endl;
+    passed &= numFiles == (unsigned int)numImages * 2;
+
+    // Cached results are read back in background mode
+    osg::ref_ptr<osg::Node> cachedScene = createScene(images, 1);
+    {
+        osgVerse::NormalMapGenerator nmg; nmg.setCacheFolder(cacheFolder); nmg.setBackgroundMode(true);
+        cachedScene->accept(nmg); unsigned int numSwapped = 0;
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        while (nmg.isProcessing() || numSwapped < (unsigned int)numImages)
+        {
+            numSwapped += nmg.swapReadyTextures();
+            if (osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) > timeout)
+            {
+                std::cout << "[NormalMap] Background: timed out with " << numSwapped << " of "
+                          << numImages << " maps ready" << std::endl; passed = false; break;
+            }
+            if (numSwapped < (unsigned int)numImages) OpenThreads::Thread::microSleep(1000);
+        }
+    }
+
+    bool sameCached = countCacheFiles(cacheFolder) == numFiles;
+    for (int i = 0; i < numImages; ++i)
+        sameCached &= sameImage(getMap(serialScene.get(), i * 2, 1), getMap(cachedScene.get(), i, 1));
+    std::cout << "[NormalMap] Cache reuse: background results read from cache = " << sameCached << std::endl;
+    passed &= sameCached;
+
+    // Different parameters must not reuse cached maps
+    osg::ref_ptr<osg::Node> strongScene = createScene(images, 1);
+    {
+        osgVerse::NormalMapGenerator nmg(4.0); nmg.setCacheFolder(cacheFolder);
+        strongScene->accept(nmg);
+    }
+    numFiles = countCacheFiles(cacheFolder);
+    std::cout << "[NormalMap] Parameter keys: " << numFiles << " files after changing strength" << std::endl;
+    passed &= numFiles == (unsigned int)numImages * 3 &&
+              !sameImage(getMap(serialScene.get(), 0, 1), getMap(strongScene.get(), 0, 1));
+
+    // BC5 compression: two-channel RGTC maps
+    osg::ref_ptr<osg::Node> bc5Scene = createScene(images, 1);
+    {
+        osgVerse::NormalMapGenerator nmg; nmg.setCompressingNormalMap(true);
+        bc5Scene->accept(nmg);
+    }
+    osg::Image* bc5 = getMap(bc5Scene.get(), 0, 1);
+    bool compressed = bc5 && bc5->getPixelFormat() == GL_COMPRESSED_RED_GREEN_RGTC2_EXT &&
+                      bc5->getTotalSizeInBytes() == (unsigned int)(imageSize * imageSize);
+    std::cout << "[NormalMap] BC5: normal map compressed to RGTC2 = " << compressed << std::endl;
+    passed &= compressed;
+
+    if (!passed) std::cout << "[NormalMap] Generated maps are not as expected" << std::endl;
+    return passed ? 0 : 1;
+}
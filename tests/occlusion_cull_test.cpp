@@ -8,6 +8,7 @@
 #include <osgUtil/CullVisitor>
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
+#include <OpenThreads/Thread>
 #include <iostream>
 #include <sstream>
 
@@ -21,10 +22,114 @@
 namespace backward { backward::SignalHandling sh; }
 #endif
 
+static osgVerse::UserOccluder* createBuildingOccluder(const osg::Vec3& center, const osg::Vec3& size, int index)
+{
+    osg::Vec3 h = size * 0.5f;
+    std::vector<osg::Vec3> vertices = {
+        center + osg::Vec3(-h[0], -h[1], 0.0f), center + osg::Vec3(h[0], -h[1], 0.0f),
+        center + osg::Vec3(h[0], h[1], 0.0f), center + osg::Vec3(-h[0], h[1], 0.0f),
+        center + osg::Vec3(-h[0], -h[1], size[2]), center + osg::Vec3(h[0], -h[1], size[2]),
+        center + osg::Vec3(h[0], h[1], size[2]), center + osg::Vec3(-h[0], h[1], size[2]) };
+    std::vector<unsigned int> indices = {
+        0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+        1, 2, 6, 1, 6, 5,  2, 3, 7, 2, 7, 6,  3, 0, 4, 3, 4, 7 };
+    return new osgVerse::UserOccluder("Building" + std::to_string(index), vertices, indices);
+}
+
+static int runBenchmark(osg::ArgumentParser& arguments)
+{
+    int numBuildings = 4000, numFrames = 100, numThreads = (int)OpenThreads::GetNumberOfProcessors();
+    arguments.read("--occluders", numBuildings); arguments.read("--frames", numFrames);
+    arguments.read("--threads", numThreads);
+
+    // Generate a city-like grid of box buildings as occluders
+    osg::ref_ptr<osgVerse::UserRasterizer> rasterizer = new osgVerse::UserRasterizer(1280, 720);
+    int gridSize = (int)ceil(sqrt((double)numBuildings)); srand(1024);
+    for (int i = 0; i < numBuildings; ++i)
+    {
+        osg::Vec3 center((i % gridSize - gridSize * 0.5f) * 40.0f, (i / gridSize - gridSize * 0.5f) * 40.0f, 0.0f);
+        osg::Vec3 size(10.0f + rand() % 20, 10.0f + rand() % 20, 10.0f + rand() % 120);
+        rasterizer->addOccluder(createBuildingOccluder(center, size, i));
+    }
+
+    std::vector<osg::BoundingBoxf> queryBoxes;
+    for (int i = 0; i < numBuildings; ++i)
+    {
+        osg::Vec3 center((i % gridSize - gridSize * 0.5f) * 40.0f, (i / gridSize - gridSize * 0.5f) * 40.0f, 0.0f);
+        queryBoxes.push_back(osg::BoundingBoxf(center - osg::Vec3(4.0f, 4.0f, 0.0f), center + osg::Vec3(4.0f, 4.0f, 8.0f)));
+    }
+
+    std::vector<float> depthData; std::vector<unsigned short> hizData;
+    std::vector<unsigned char> queryResults;
+    float radius = gridSize * 10.0f, tolerance = 1e-5f;
+    osg::Matrix proj = osg::Matrix::perspective(60.0, 1280.0 / 720.0, 1.0, 10000.0);
+    arguments.read("--tolerance", tolerance);
+
+    // Tiled rendering must produce the same depths as serial rendering
+    std::vector<float> serialDepth; size_t numMismatched = 0; float maxDifference = 0.0f;
+    for (int f = 0; f < numFrames; f += osg::maximum(numFrames / 10, 1))
+    {
+        double angle = osg::PI * 2.0 * f / numFrames;
+        osg::Vec3 eye(cos(angle) * radius, sin(angle) * radius, 30.0f);
+        rasterizer->setModelViewProjection(
+            osg::Matrix::lookAt(eye, osg::Vec3(0.0f, 0.0f, 20.0f), osg::Z_AXIS), proj);
+        rasterizer->setNumThreads(0); rasterizer->render(eye, &serialDepth, NULL);
+        rasterizer->setNumThreads(numThreads); rasterizer->render(eye, &depthData, NULL);
+        if (serialDepth.size() != depthData.size())
+        { std::cout << "Depth buffer size mismatched at frame " << f << std::endl; return 1; }
+
+        for (size_t i = 0; i < depthData.size(); ++i)
+        {
+            float diff = fabs(depthData[i] - serialDepth[i]);
+            if (diff > tolerance) numMismatched++; maxDifference = osg::maximum(maxDifference, diff);
+        }
+    }
+
+    std::cout << "Tiled vs serial depth: " << numMismatched << " mismatched pixels, max difference = "
+              << maxDifference << " (tolerance = " << tolerance << ")" << std::endl;
+    if (numMismatched > 0) return 1;
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        osgVerse::UserRasterizer::Statistics total;
+        double queryTime = 0.0; unsigned int numRejected = 0;
+        rasterizer->setNumThreads(mode == 0 ? 0 : numThreads);
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        for (int f = 0; f < numFrames; ++f)
+        {
+            double angle = osg::PI * 2.0 * f / numFrames;
+            osg::Vec3 eye(cos(angle) * radius, sin(angle) * radius, 30.0f);
+            rasterizer->setModelViewProjection(
+                osg::Matrix::lookAt(eye, osg::Vec3(0.0f, 0.0f, 20.0f), osg::Z_AXIS), proj);
+            rasterizer->render(eye, &depthData, &hizData);
+
+            osg::Timer_t q0 = osg::Timer::instance()->tick();
+            numRejected += rasterizer->queryVisibility(queryBoxes, queryResults);
+            queryTime += osg::Timer::instance()->delta_m(q0, osg::Timer::instance()->tick());
+
+            const osgVerse::UserRasterizer::Statistics& st = rasterizer->getStatistics();
+            total.sortTime += st.sortTime; total.binTime += st.binTime;
+            total.rasterTime += st.rasterTime; total.resolveTime += st.resolveTime;
+            total.numRasterized += st.numRasterized; total.numTiles = st.numTiles;
+        }
+
+        double frameTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick()) / numFrames;
+        std::cout << (mode == 0 ? "Serial" : "Tiled") << " (threads = " << rasterizer->getNumThreads()
+                  << ", tiles = " << total.numTiles << "): " << frameTime << "ms / frame; Sort = "
+                  << total.sortTime / numFrames << "ms, Bin = " << total.binTime / numFrames
+                  << "ms, Raster = " << total.rasterTime / numFrames << "ms, Resolve = "
+                  << total.resolveTime / numFrames << "ms, Rasterized = "
+                  << total.numRasterized / numFrames << " / " << rasterizer->getStatistics().numOccluders
+                  << "; Box queries = " << queryTime / numFrames << "ms, Rejected = "
+                  << numRejected / numFrames << " / " << queryBoxes.size() << std::endl;
+    }
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     osg::ArgumentParser arguments = osgVerse::globalInitialize(argc, argv, osgVerse::defaultInitParameters());
     osgVerse::updateOsgBinaryWrappers();
+    if (arguments.read("--benchmark")) return runBenchmark(arguments);
 
 #if true
     osg::ref_ptr<osg::Node> terrain = osgDB::readNodeFile("lz.osg");
@@ -47,6 +152,13 @@ int main(int argc, char** argv)
     osg::ref_ptr<osgVerse::UserRasterizer> rasterizer = new osgVerse::UserRasterizer(1280, 720);
     rasterizer->addOccluder(occ1.get()); rasterizer->addOccluder(occ2.get());
 
+    int numThreads = 0; arguments.read("--threads", numThreads);
+    rasterizer->setNumThreads(numThreads);
+
+    // Cull cessna with software depth of previous frame
+    osg::ref_ptr<osgVerse::OcclusionCullCallback> occlusionCull = new osgVerse::OcclusionCullCallback(rasterizer.get());
+    cessna->addCullCallback(occlusionCull.get());
+
     std::vector<float> depthData; std::vector<unsigned short> hizData;
     while (!viewer.done())
     {
@@ -56,8 +168,9 @@ int main(int argc, char** argv)
         rasterizer->render(cameraPos, &depthData, &hizData);
 
         float vis = rasterizer->queryVisibility(occ2.get());
-        std::cout << "Cessna Visibility: " << vis << "\n";
-        viewer.frame();
+        std::cout << "Cessna Visibility: " << vis << "; Culled: " << occlusionCull->getNumRejected()
+                  << " / " << occlusionCull->getNumTested() << "\n";
+        occlusionCull->resetCounters(); viewer.frame();
     }
 #else
     // test with original https://github.com/rawrunprotected/rasterizer
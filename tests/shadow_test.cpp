@@ -63,6 +63,22 @@ int main(int argc, char** argv)
     root->addChild(sceneRoot.get());
     root->addChild(postCamera.get());
 
+    // Moving caster for cached shadows: it has both the caster bit and the dynamic bit,
+    // so it must be drawn every frame but never baked into static shadow maps
+    bool useCachedShadow = arguments.read("--cached");
+    osg::ref_ptr<osg::MatrixTransform> movingCaster = new osg::MatrixTransform;
+    const osg::BoundingSphere& sceneBound = sceneRoot->getBound();
+    if (useCachedShadow)
+    {
+        osg::ref_ptr<osg::Geode> boxGeode = new osg::Geode;
+        boxGeode->addDrawable(new osg::ShapeDrawable(
+            new osg::Box(osg::Vec3(), sceneBound.radius() * 0.1f)));
+        movingCaster->addChild(boxGeode.get());
+        osgVerse::Pipeline::setPipelineMask(
+            *movingCaster, DEFERRED_SCENE_MASK | SHADOW_CASTER_MASK | DYNAMIC_CASTER_MASK);
+        root->addChild(movingCaster.get());
+    }
+
     // Start the viewer
     osg::ref_ptr<osgViewer::Viewer> viewer;
     bool useForwardShadow = arguments.read("--forward");
@@ -88,6 +104,7 @@ int main(int argc, char** argv)
             plViewer->getParameters().shadowTechnique |= osgVerse::ShadowModule::BandPCF;
         if (arguments.read("--no-pcf"))
             plViewer->getParameters().shadowTechnique &= ~osgVerse::ShadowModule::PossionPCF;
+        plViewer->getParameters().enableCachedShadows = useCachedShadow;
         viewer = plViewer;
     }
 
@@ -176,9 +193,17 @@ int main(int argc, char** argv)
     }
 
     float lightX = 0.02f; bool lightD = true, animated = arguments.read("--animated");
+    unsigned int numFrames = 0;
     std::cout << "Shadow testing started..." << std::endl;
     while (!viewer->done())
     {
+        if (useCachedShadow)
+        {
+            double t = viewer->getFrameStamp()->getSimulationTime();
+            movingCaster->setMatrix(osg::Matrix::translate(sceneBound.center() + osg::Vec3(
+                cos(t) * sceneBound.radius() * 0.3f, sin(t) * sceneBound.radius() * 0.3f, 0.0f)));
+        }
+
         if (animated)
         {
             if (lightD) { if (lightX > 0.8f) lightD = false; else lightX += 0.001f; }
@@ -188,6 +213,15 @@ int main(int argc, char** argv)
         if (light0.valid()) light0->setDirection(osg::Vec3(lightX, 0.1f, -1.0f));
         else if (shadow.valid()) shadow->setLightState(osg::Vec3(0.0f, 0.0f, 1.0f), osg::Vec3(lightX, 0.1f, -1.0f));
         viewer->frame(); MicroProfileFlip(NULL);  // see localhost:1338
+        numFrames++;
+    }
+
+    if (useCachedShadow && shadow.valid())
+    {
+        // Moving caster alone should not refresh static maps (the first cascade is not cached by default)
+        for (int i = 0; i < shadow->getShadowNumber(); ++i)
+            std::cout << "Cascade " << i << ": static shadow updated " << shadow->getCascadeCacheUpdates(i)
+                      << " times in " << numFrames << " frames" << std::endl;
     }
     return 0;
 }
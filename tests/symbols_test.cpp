@@ -160,6 +160,7 @@ int main(int argc, char** argv)
         symManager->setLodDistance(osgVerse::SymbolManager::LOD0, 10000.0);
         symManager->setLodDistance(osgVerse::SymbolManager::LOD1, 0.0);
         symManager->setLodDistance(osgVerse::SymbolManager::LOD2, 0.0);
+        if (arguments.read("--cluster")) symManager->setFarClusterCellSize(0.05f);
 
         for (int y = 0; y < 100; ++y)
             for (int x = 0; x < 100; ++x)
@@ -0,0 +1,119 @@
+#include <osg/Timer>
+#include <osg/Geometry>
+#include <osg/Geode>
+#include <OpenThreads/Thread>
+#include <iostream>
+
+#include <pipeline/Utilities.h>
+#ifndef _DEBUG
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+#endif
+
+static osg::Geometry* createSphereMesh(const osg::Vec3& center, float radius, int numRings, int numSegments)
+{
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> na = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> ta = new osg::Vec2Array;
+    for (int r = 0; r <= numRings; ++r)
+    {
+        float phi = osg::PI * (float)r / (float)numRings;
+        for (int s = 0; s <= numSegments; ++s)
+        {
+            float theta = 2.0f * osg::PI * (float)s / (float)numSegments;
+            osg::Vec3 N(sinf(phi) * cosf(theta), sinf(phi) * sinf(theta), cosf(phi));
+            va->push_back(center + N * radius); na->push_back(N);
+            ta->push_back(osg::Vec2((float)s / numSegments, (float)r / numRings));
+        }
+    }
+
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+    for (int r = 0; r < numRings; ++r)
+    {
+        for (int s = 0; s < numSegments; ++s)
+        {
+            unsigned int i0 = r * (numSegments + 1) + s, i1 = i0 + numSegments + 1;
+            de->push_back(i0); de->push_back(i1); de->push_back(i0 + 1);
+            de->push_back(i0 + 1); de->push_back(i1); de->push_back(i1 + 1);
+        }
+    }
+
+    osg::Geometry* geom = new osg::Geometry;
+    geom->setVertexArray(va.get()); geom->setTexCoordArray(0, ta.get());
+    geom->setNormalArray(na.get()); geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    geom->addPrimitiveSet(de.get()); return geom;
+}
+
+static osg::Node* createMeshSet(int numMeshes, int numRings, int numSegments)
+{
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    int numPerRow = (int)ceil(sqrt((double)numMeshes));
+    for (int i = 0; i < numMeshes; ++i)
+    {
+        // Vary mesh sizes to make the workload unbalanced, like a real scene
+        int rings = numRings + (i % 4) * numRings / 2, segments = numSegments + (i % 3) * numSegments / 2;
+        osg::Vec3 center((float)(i % numPerRow) * 3.0f, (float)(i / numPerRow) * 3.0f, 0.0f);
+
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        geode->addDrawable(createSphereMesh(center, 1.0f, rings, segments));
+        root->addChild(geode.get());
+    }
+    return root.release();
+}
+
+static double computeTangents(osg::Node* node, int numThreads, unsigned int& numComputed)
+{
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    osgVerse::TangentSpaceVisitor tsv; tsv.setNumThreads(numThreads);
+    node->accept(tsv); numComputed = tsv.getNumComputedGeometries();
+    return osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+}
+
+static bool compareTangents(osg::Node* node0, osg::Node* node1)
+{
+    osg::Group *g0 = node0->asGroup(), *g1 = node1->asGroup();
+    if (!g0 || !g1 || g0->getNumChildren() != g1->getNumChildren()) return false;
+    for (unsigned int i = 0; i < g0->getNumChildren(); ++i)
+    {
+        osg::Geode *geode0 = g0->getChild(i)->asGeode(), *geode1 = g1->getChild(i)->asGeode();
+        osg::Vec4Array* ta0 = dynamic_cast<osg::Vec4Array*>(
+            geode0->getDrawable(0)->asGeometry()->getVertexAttribArray(6));
+        osg::Vec4Array* ta1 = dynamic_cast<osg::Vec4Array*>(
+            geode1->getDrawable(0)->asGeometry()->getVertexAttribArray(6));
+        if (!ta0 || !ta1 || ta0->size() != ta1->size()) return false;
+        for (size_t j = 0; j < ta0->size(); ++j)
+        { if (((*ta0)[j] - (*ta1)[j]).length2() > 1e-8f) return false; }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+    int numMeshes = 256, numRings = 64, numSegments = 128, numThreads = 0;
+    arguments.read("--meshes", numMeshes); arguments.read("--threads", numThreads);
+    arguments.read("--rings", numRings); arguments.read("--segments", numSegments);
+    if (numThreads <= 0) numThreads = OpenThreads::GetNumberOfProcessors();
+
+    osg::ref_ptr<osg::Node> sceneST = createMeshSet(numMeshes, numRings, numSegments);
+    osg::ref_ptr<osg::Node> sceneMT = createMeshSet(numMeshes, numRings, numSegments);
+    std::cout << "Computing tangents of " << numMeshes << " meshes ("
+              << numRings << " rings, " << numSegments << " segments at least)" << std::endl;
+
+    unsigned int numComputedST = 0, numComputedMT = 0;
+    double timeST = computeTangents(sceneST.get(), 1, numComputedST);
+    double timeMT = computeTangents(sceneMT.get(), numThreads, numComputedMT);
+    std::cout << "Single-threaded: " << timeST << "ms, " << numComputedST << " geometries" << std::endl;
+    std::cout << "Multi-threaded (" << numThreads << "): " << timeMT << "ms, "
+              << numComputedMT << " geometries" << std::endl;
+    if (timeMT > 0.0) std::cout << "Speed-up: " << (timeST / timeMT) << "x" << std::endl;
+
+    // Geometries with valid tangents should be skipped when visiting again
+    unsigned int numComputedAgain = 0;
+    double timeAgain = computeTangents(sceneMT.get(), numThreads, numComputedAgain);
+    std::cout << "Re-visiting: " << timeAgain << "ms, " << numComputedAgain << " geometries" << std::endl;
+
+    bool matched = compareTangents(sceneST.get(), sceneMT.get());
+    std::cout << "Results " << (matched ? "matched" : "MISMATCHED") << std::endl;
+    return (matched && numComputedST == numComputedMT && numComputedAgain == 0) ? 0 : 1;
+}